@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+struct AliasTable
+{
+	float prob;         // The i's column's event i's prob
+	int   alias;        // The i's column's another event's idx
+	float ori_prob;
+	float alias_ori_prob;
+};
+
+// Worklists of a build, kept by callers that rebuild tables every frame
+struct AliasTableScratch
+{
+	std::vector<double>   scaled;
+	std::vector<uint32_t> worklist;
+};
+
+// O(n) Vose build into table[0, count), weights are non-negative and need not be normalized
+// All zero weights give a uniform table
+void build_alias_table(const float *weights, uint32_t count, AliasTable *table, AliasTableScratch &scratch);
+
+void build_alias_table(const float *weights, uint32_t count, AliasTable *table);
+
+std::vector<AliasTable> build_alias_table(const std::vector<float> &weights);
@@ -15,6 +15,7 @@
 #include "pipeline/tonemap.hpp"
 #include "pipeline/ui.hpp"
 #include "scene.hpp"
+#include "work_stealing.hpp"
 
 class Application
 {
@@ -31,6 +32,7 @@ class Application
 	void update_view();
 	void update(CommandBufferRecorder &recorder);
 	void render(CommandBufferRecorder &recorder);
+	void render_async(CommandBufferRecorder &recorder);
 	void update_ui();
 
   private:
@@ -38,6 +40,21 @@ class Application
 	Scene   m_scene;
 
 	std::vector<CommandBufferRecorder> m_recorders;
+	std::vector<CommandBufferRecorder> m_compute_recorders;
+
+	// Per frame, per job command pools and secondary command buffers for parallel pass recording
+	std::array<std::vector<VkCommandPool>, 3>         m_job_cmd_pools;
+	std::array<std::vector<CommandBufferRecorder>, 3> m_job_recorders;
+
+	// Passes recorded this frame, plain functions of the application so queuing one never allocates
+	using FrameJob = void (*)(Application &app, CommandBufferRecorder &recorder);
+	std::vector<FrameJob> m_jobs;
+
+	// Transient per-frame data, reset once the frame fence is signaled
+	LinearAllocator m_frame_arena{1 << 16};
+
+	uint64_t m_frame_allocations      = 0;
+	uint64_t m_peak_frame_allocations = 0;        // Since the last allocation report
 
 	uint32_t m_current_frame = 0;
 	uint32_t m_num_frames    = 0;
@@ -47,15 +64,22 @@ class Application
 
 	std::vector<VkFence> m_fences;
 
+	// Async compute hand-off, compute -> graphics within a frame, graphics -> compute across frames
+	std::vector<VkSemaphore> m_compute_complete;
+	std::vector<VkSemaphore> m_graphics_complete;
+
+	VkSemaphore m_pending_graphics_complete = VK_NULL_HANDLE;
+
 	std::vector<glm::vec2> m_jitter_samples;
 
 	glm::vec2 m_current_jitter = glm::vec2(0.f);
 	glm::vec2 m_prev_jitter    = glm::vec2(0.f);
 
-	bool m_update     = true;
 	bool m_enable_ui  = true;
 	bool m_resize     = false;
 
+	int32_t m_reference_frames = 64;
+
 	struct
 	{
 		glm::vec3 position = glm::vec3(0.f);
@@ -99,4 +123,7 @@ class Application
 		PathTracing,
 		Hybrid,
 	} m_render_mode = RenderMode::Hybrid;
+
+	// Applied at the start of the next frame, so async compute is either recorded and submitted for a whole frame or not at all
+	RenderMode m_next_render_mode = RenderMode::Hybrid;
 };
\ No newline at end of file
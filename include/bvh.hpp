@@ -0,0 +1,50 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <vector>
+
+struct Vertex;
+struct Instance;
+
+// 32 byte node, interior nodes keep their left child right after themselves
+struct BVHNode
+{
+	glm::vec3 bbox_min = glm::vec3(0.f);
+	uint32_t  index    = 0;        // Right child of an interior node, first entry of a leaf in BVH::primitives
+	glm::vec3 bbox_max = glm::vec3(0.f);
+	uint32_t  count    = 0;        // Primitives of a leaf, 0 for an interior node
+};
+
+struct BVH
+{
+	std::vector<BVHNode>  nodes;             // Root first
+	std::vector<uint32_t> primitives;        // Primitive ids referenced by the leaves
+};
+
+// Two levels mirroring the BLAS/TLAS, bottom levels over the object space triangles of each distinct geometry and a top level over the instances
+struct SceneBVH
+{
+	std::vector<BVH>        blas;
+	std::vector<glm::uvec3> geometries;           // Bottom level id - vertices offset, indices offset, indices count
+	std::vector<uint32_t>   instance_blas;        // Instance id - bottom level id
+	BVH                     tlas;                 // Leaves reference instance ids
+};
+
+// Binned SAH build over primitive bounds, large nodes are binned in parallel and split into parallel tasks
+BVH build_bvh(const std::vector<std::array<glm::vec3, 2>> &bounds, uint32_t max_leaf_size = 4);
+
+// Refits the bounds of a tree built over the same primitives after they moved
+void refit_bvh(BVH &bvh, const std::vector<std::array<glm::vec3, 2>> &bounds);
+
+// Expected cost of a random ray hitting the root, unit traversal and intersection costs
+float sah_cost(const BVH &bvh);
+
+SceneBVH build_scene_bvh(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, const std::vector<Instance> &instances);
+
+// Refits the bottom level an instance references, used for skinned instances
+void refit_scene_blas(SceneBVH &bvh, uint32_t instance_id, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices);
+
+// Rebuilds the top level after instances moved
+void rebuild_scene_tlas(SceneBVH &bvh, const std::vector<Instance> &instances);
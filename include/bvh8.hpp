@@ -0,0 +1,109 @@
+#pragma once
+
+#include "bvh.hpp"
+
+#include <limits>
+
+// Eight children of a node collapsed from the binary BVH, bounds are stored as SoA to test a ray against all of them at once
+struct alignas(32) BVH8Node
+{
+	float    bbox_min_x[8];
+	float    bbox_min_y[8];
+	float    bbox_min_z[8];
+	float    bbox_max_x[8];
+	float    bbox_max_y[8];
+	float    bbox_max_z[8];
+	int32_t  child[8];              // Interior child node, ~first entry in BVH8::primitives for a leaf child
+	uint8_t  count[8];              // Primitives of a leaf child, 0 for an interior child
+	uint8_t  valid = 0;             // Bit mask of the occupied child slots
+};
+
+struct BVH8
+{
+	std::vector<BVH8Node> nodes;             // Root first
+	std::vector<uint32_t> primitives;        // Primitive ids referenced by the leaves
+};
+
+// Object space triangle of a bottom level in leaf order
+struct BVH8Triangle
+{
+	glm::vec3 p0;
+	uint32_t  primitive;        // Triangle index within the geometry
+	glm::vec3 p1;
+	uint32_t  padding0;
+	glm::vec3 p2;
+	uint32_t  padding1;
+};
+
+// Alpha of a material for the CPU alpha test, mirrors hit_test() in raytrace.slangh
+struct BVH8Material
+{
+	uint32_t alpha_mode = 0;         // 0 - opaque, 1 - mask, 2 - blend, materials forced opaque on the GPU are 0
+	float    cutoff     = 0.f;
+	float    base_alpha = 1.f;
+	int32_t  texture    = -1;        // Alpha texture, -1 without base color texture
+};
+
+// Alpha channel of the finest base color level, sampled bilinearly with repeat like the linear sampler
+struct BVH8AlphaTexture
+{
+	uint32_t             width  = 0;
+	uint32_t             height = 0;
+	std::vector<uint8_t> alpha;
+};
+
+struct SceneBVH8
+{
+	std::vector<BVH8>                                  blas;
+	std::vector<std::vector<BVH8Triangle>>             triangles;                // Bottom level id - triangles in leaf order
+	std::vector<std::vector<std::array<glm::vec2, 3>>> texcoords;                // Bottom level id - triangle texcoords in leaf order, only for bottom levels of alpha tested instances
+	BVH8                                               tlas;                     // Leaves reference instance ids
+	std::vector<glm::mat4>                             world_to_object;          // Instance id - transform_inv
+	std::vector<uint32_t>                              instance_blas;            // Instance id - bottom level id
+	std::vector<uint32_t>                              instance_material;        // Instance id - material id
+	std::vector<BVH8Material>                          materials;
+	std::vector<BVH8AlphaTexture>                      alpha_textures;
+};
+
+struct Ray
+{
+	glm::vec3 origin    = glm::vec3(0.f);
+	float     t_min     = 0.001f;
+	glm::vec3 direction = glm::vec3(0.f, 0.f, 1.f);
+	float     t_max     = std::numeric_limits<float>::infinity();
+};
+
+// Committed hit, mirrors RtPayload
+struct RayHit
+{
+	float     t            = std::numeric_limits<float>::infinity();
+	uint32_t  primitive_id = 0;
+	uint32_t  instance_id  = 0;
+	glm::vec2 bary         = glm::vec2(0.f);
+};
+
+// Collapses a binary BVH into eight wide nodes, opening the largest interior child until a node is full
+BVH8 collapse_bvh(const BVH &bvh);
+
+SceneBVH8 build_scene_bvh8(const SceneBVH &bvh, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, const std::vector<Instance> &instances, std::vector<BVH8Material> &&materials, std::vector<BVH8AlphaTexture> &&alpha_textures);
+
+// Recollapses the bottom level an instance references after refit_scene_blas()
+void refit_scene_bvh8_blas(SceneBVH8 &bvh8, const SceneBVH &bvh, uint32_t instance_id, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices);
+
+// Recollapses the top level after rebuild_scene_tlas()
+void rebuild_scene_bvh8_tlas(SceneBVH8 &bvh8, const SceneBVH &bvh, const std::vector<Instance> &instances);
+
+// Shadow ray of any_hit() in raytrace.slangh
+Ray shadow_ray(const glm::vec3 &origin, const glm::vec3 &direction, float max_dist);
+
+// Same semantics as closest_hit() and any_hit() in raytrace.slangh, seed drives the stochastic test of blended materials
+bool closest_hit(const SceneBVH8 &bvh8, const Ray &ray, bool force_opaque, uint32_t &seed, RayHit &hit);
+bool any_hit(const SceneBVH8 &bvh8, const Ray &ray, uint32_t &seed);
+
+// Up to 8 coherent rays traversed together, returns the bit mask of rays that hit
+uint32_t closest_hit_packet(const SceneBVH8 &bvh8, const Ray *rays, uint32_t count, bool force_opaque, uint32_t *seeds, RayHit *hits);
+uint32_t any_hit_packet(const SceneBVH8 &bvh8, const Ray *rays, uint32_t count, uint32_t *seeds);
+
+// Rays are sorted into coherent packets by direction octant and origin, packets are traced in parallel
+void closest_hit_stream(const SceneBVH8 &bvh8, const std::vector<Ray> &rays, bool force_opaque, std::vector<uint32_t> &seeds, std::vector<RayHit> &hits);
+void any_hit_stream(const SceneBVH8 &bvh8, const std::vector<Ray> &rays, std::vector<uint32_t> &seeds, std::vector<uint8_t> &occluded);
@@ -7,15 +7,23 @@
 #include <glm/glm.hpp>
 
 #include <array>
+#include <atomic>
 #include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <span>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 struct GLFWwindow;
 struct Context;
 struct CommandBufferRecorder;
+struct ThreadCommandPools;
 
 enum class RayTracedScale
 {
@@ -47,11 +55,51 @@ struct AccelerationStructure
 	VkDeviceAddress device_address = 0;
 };
 
+// Handle to an in-flight one-shot submission, see Context::wait(SubmitTicket)
+struct SubmitTicket
+{
+	uint64_t id = 0;
+};
+
+// Bump allocator for transient per-frame data, reset at frame start
+struct LinearAllocator
+{
+	explicit LinearAllocator(size_t capacity);
+
+	void *allocate(size_t size, size_t alignment);
+
+	template <typename T>
+	std::span<T> allocate(size_t count)
+	{
+		static_assert(std::is_trivially_destructible_v<T>);
+		T *data = static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+		std::uninitialized_value_construct_n(data, count);
+		return std::span<T>(data, count);
+	}
+
+	void reset();
+
+	size_t size() const;
+
+  private:
+	std::unique_ptr<uint8_t[]> m_data;
+	size_t                     m_capacity = 0;
+	std::atomic<size_t>        m_offset   = 0;
+
+	// Fallback blocks when the arena runs out, released on reset
+	std::mutex                              m_overflow_mutex;
+	std::vector<std::unique_ptr<uint8_t[]>> m_overflow;
+};
+
 struct BarrierBuilder
 {
-	CommandBufferRecorder             &recorder;
-	std::vector<VkImageMemoryBarrier>  image_barriers;
-	std::vector<VkBufferMemoryBarrier> buffer_barriers;
+	static constexpr uint32_t MAX_BARRIER_COUNT = 32;
+
+	CommandBufferRecorder                               &recorder;
+	std::array<VkImageMemoryBarrier, MAX_BARRIER_COUNT>  image_barriers;
+	std::array<VkBufferMemoryBarrier, MAX_BARRIER_COUNT> buffer_barriers;
+	uint32_t                                             image_barrier_count  = 0;
+	uint32_t                                             buffer_barrier_count = 0;
 
 	BarrierBuilder(CommandBufferRecorder &recorder);
 
@@ -76,26 +124,88 @@ struct BarrierBuilder
 	    size_t        size   = VK_WHOLE_SIZE,
 	    size_t        offset = 0);
 
+	// Queue family ownership transfer, release half recorded on the source queue
+	BarrierBuilder &add_image_release(
+	    VkImage                        image,
+	    VkAccessFlags                  src_mask,
+	    VkAccessFlags                  dst_mask,
+	    VkImageLayout                  old_layout,
+	    VkImageLayout                  new_layout,
+	    uint32_t                       dst_family,
+	    const VkImageSubresourceRange &range = {
+	        .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	        .baseMipLevel   = 0,
+	        .levelCount     = 1,
+	        .baseArrayLayer = 0,
+	        .layerCount     = 1,
+	    });
+
+	// Queue family ownership transfer, acquire half recorded on the destination queue
+	BarrierBuilder &add_image_acquire(
+	    VkImage                        image,
+	    VkAccessFlags                  src_mask,
+	    VkAccessFlags                  dst_mask,
+	    VkImageLayout                  old_layout,
+	    VkImageLayout                  new_layout,
+	    uint32_t                       src_family,
+	    const VkImageSubresourceRange &range = {
+	        .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	        .baseMipLevel   = 0,
+	        .levelCount     = 1,
+	        .baseArrayLayer = 0,
+	        .layerCount     = 1,
+	    });
+
+	BarrierBuilder &add_buffer_release(
+	    VkBuffer      buffer,
+	    VkAccessFlags src_mask,
+	    VkAccessFlags dst_mask,
+	    uint32_t      dst_family,
+	    size_t        size   = VK_WHOLE_SIZE,
+	    size_t        offset = 0);
+
+	BarrierBuilder &add_buffer_acquire(
+	    VkBuffer      buffer,
+	    VkAccessFlags src_mask,
+	    VkAccessFlags dst_mask,
+	    uint32_t      src_family,
+	    size_t        size   = VK_WHOLE_SIZE,
+	    size_t        offset = 0);
+
 	CommandBufferRecorder &insert(VkPipelineStageFlags src_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VkPipelineStageFlags dst_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+
+  private:
+	VkImageMemoryBarrier &push_image_barrier();
+
+	VkBufferMemoryBarrier &push_buffer_barrier();
 };
 
 struct CommandBufferRecorder
 {
-	VkCommandBuffer cmd_buffer;
-	const Context  *context;
+	VkCommandBuffer      cmd_buffer;
+	VkCommandPool        cmd_pool;
+	VkCommandBufferLevel level;
+	const Context       *context;
 
 	bool compute;
 
-	std::vector<VkRenderingAttachmentInfo>   color_attachments;
+	std::array<VkRenderingAttachmentInfo, 8> color_attachments;
+	uint32_t                                 color_attachment_count = 0;
 	std::optional<VkRenderingAttachmentInfo> depth_stencil_attachment;
 
 	explicit CommandBufferRecorder(const Context &context, bool compute);
 
+	CommandBufferRecorder(const Context &context, VkCommandPool cmd_pool, VkCommandBufferLevel level, bool compute);
+
+	CommandBufferRecorder(const Context &context, VkCommandPool cmd_pool, VkCommandBuffer cmd_buffer, bool compute);
+
+	uint32_t queue_family() const;
+
 	CommandBufferRecorder &begin();
 
 	CommandBufferRecorder &end();
 
-	CommandBufferRecorder &begin_marker(const std::string &name);
+	CommandBufferRecorder &begin_marker(const char *name);
 
 	CommandBufferRecorder &end_marker();
 
@@ -139,6 +249,13 @@ struct CommandBufferRecorder
 	    void              *data,
 	    uint32_t           size);
 
+	CommandBufferRecorder &copy_buffer(
+	    VkBuffer src_buffer,
+	    VkBuffer dst_buffer,
+	    size_t   size,
+	    size_t   src_offset = 0,
+	    size_t   dst_offset = 0);
+
 	CommandBufferRecorder &copy_buffer_to_image(
 	    VkBuffer                        buffer,
 	    VkImage                         image,
@@ -184,15 +301,22 @@ struct CommandBufferRecorder
 	    });
 
 	CommandBufferRecorder &bind_descriptor_set(
-	    VkPipelineBindPoint                 bind_point,
-	    VkPipelineLayout                    pipeline_layout,
-	    const std::vector<VkDescriptorSet> &descriptor_sets);
+	    VkPipelineBindPoint              bind_point,
+	    VkPipelineLayout                 pipeline_layout,
+	    std::span<const VkDescriptorSet> descriptor_sets);
+
+	CommandBufferRecorder &bind_descriptor_set(
+	    VkPipelineBindPoint                    bind_point,
+	    VkPipelineLayout                       pipeline_layout,
+	    std::initializer_list<VkDescriptorSet> descriptor_sets);
 
 	CommandBufferRecorder &bind_pipeline(
 	    VkPipelineBindPoint bind_point,
 	    VkPipeline          pipeline);
 
-	CommandBufferRecorder &bind_vertex_buffers(const std::vector<VkBuffer> &vertex_buffers);
+	CommandBufferRecorder &bind_vertex_buffers(std::span<const VkBuffer> vertex_buffers);
+
+	CommandBufferRecorder &bind_vertex_buffers(std::initializer_list<VkBuffer> vertex_buffers);
 
 	CommandBufferRecorder &bind_index_buffer(
 	    VkBuffer    index_buffer,
@@ -251,11 +375,29 @@ struct CommandBufferRecorder
 	    const VkAccelerationStructureBuildGeometryInfoKHR &geometry_info,
 	    const VkAccelerationStructureBuildRangeInfoKHR    *range_info);
 
-	CommandBufferRecorder &execute(std::function<void(void)> &&func);
+	CommandBufferRecorder &build_acceleration_structure(
+	    std::span<const VkAccelerationStructureBuildGeometryInfoKHR>     geometry_infos,
+	    std::span<const VkAccelerationStructureBuildRangeInfoKHR *const> range_infos);
 
-	CommandBufferRecorder &execute(std::function<void(VkCommandBuffer)> &&func);
+	template <typename Func>
+	CommandBufferRecorder &execute(Func &&func)
+	{
+		if constexpr (std::is_invocable_v<Func, CommandBufferRecorder &>)
+		{
+			func(*this);
+		}
+		else if constexpr (std::is_invocable_v<Func, VkCommandBuffer>)
+		{
+			func(cmd_buffer);
+		}
+		else
+		{
+			func();
+		}
+		return *this;
+	}
 
-	CommandBufferRecorder &execute(std::function<void(CommandBufferRecorder &)> &&func);
+	CommandBufferRecorder &execute_commands(std::span<const VkCommandBuffer> cmd_buffers);
 
 	BarrierBuilder insert_barrier();
 
@@ -263,13 +405,16 @@ struct CommandBufferRecorder
 
 	void flush();
 
+	// Submit without blocking, the command buffer is recycled once the ticket completes
+	SubmitTicket flush_async(std::function<void()> &&on_complete = {});
+
 	CommandBufferRecorder &submit(
-	    const std::vector<VkSemaphore>          &signal_semaphores = {},
-	    const std::vector<VkSemaphore>          &wait_semaphores   = {},
-	    const std::vector<VkPipelineStageFlags> &wait_stages       = {},
-	    VkFence                                  signal_fence      = VK_NULL_HANDLE);
+	    std::span<const VkSemaphore>          signal_semaphores = {},
+	    std::span<const VkSemaphore>          wait_semaphores   = {},
+	    std::span<const VkPipelineStageFlags> wait_stages       = {},
+	    VkFence                               signal_fence      = VK_NULL_HANDLE);
 
-	CommandBufferRecorder &present(const std::vector<VkSemaphore> &wait_semaphores);
+	CommandBufferRecorder &present(std::span<const VkSemaphore> wait_semaphores);
 
 	template <typename T>
 	CommandBufferRecorder &push_constants(VkPipelineLayout pipeline_layout, VkShaderStageFlags stages, T data)
@@ -315,7 +460,11 @@ struct DescriptorUpdateBuilder
 	DescriptorUpdateBuilder &write_storage_buffers(uint32_t binding, const std::vector<VkBuffer> &buffers);
 	DescriptorUpdateBuilder &write_acceleration_structures(uint32_t binding, const std::vector<AccelerationStructure> &as);
 
+	// Writes in place, the set must not be bound by a submitted frame
 	DescriptorUpdateBuilder &update(VkDescriptorSet set);
+
+	// Replaces a set frames in flight may still bind with a copy of all its bindings, then writes into the copy
+	DescriptorUpdateBuilder &renew(VkDescriptorSet &set);
 };
 
 struct GraphicsPipelineBuilder
@@ -406,8 +555,17 @@ struct Context
 
 	void resize();
 
+	// Called once the fence of the recycled frame has signaled, releases resources retired by that frame
+	void begin_frame();
+
+	// Primary command buffer from the calling thread's pool, recycled by flush()
 	CommandBufferRecorder record_command(bool compute = false) const;
 
+	// Secondary command buffer allocated from a caller owned pool, one pool per recording thread
+	CommandBufferRecorder record_secondary_command(VkCommandPool cmd_pool, bool compute = false) const;
+
+	VkCommandPool create_command_pool(const std::string &name, bool compute = false) const;
+
 	VkSemaphore create_semaphore(const std::string &name) const;
 
 	VkFence create_fence(const std::string &name) const;
@@ -420,17 +578,27 @@ struct Context
 	    VkSamplerAddressMode address_v,
 	    VkSamplerAddressMode address_w) const;
 
+	// Concurrent buffers are read by both the graphics and the compute family without ownership transfers
 	Buffer create_buffer(
 	    const std::string &name,
 	    size_t             size,
 	    VkBufferUsageFlags buffer_usage,
-	    VmaMemoryUsage     memory_usage) const;
+	    VmaMemoryUsage     memory_usage,
+	    bool               concurrent = false) const;
 
+	// The scratch buffer is also large enough for updates when ALLOW_UPDATE is requested
 	std::pair<AccelerationStructure, Buffer> create_acceleration_structure(
 	    const std::string                              &name,
 	    VkAccelerationStructureTypeKHR                  type,
 	    const VkAccelerationStructureGeometryKHR       &geometry,
-	    const VkAccelerationStructureBuildRangeInfoKHR &range) const;
+	    const VkAccelerationStructureBuildRangeInfoKHR &range,
+	    VkBuildAccelerationStructureFlagsKHR            flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR) const;
+
+	// Batched builds sharing one scratch arena, compacted into tightly sized acceleration structures
+	std::vector<AccelerationStructure> create_bottom_level_acceleration_structures(
+	    const std::string                                           &name,
+	    const std::vector<VkAccelerationStructureGeometryKHR>       &geometries,
+	    const std::vector<VkAccelerationStructureBuildRangeInfoKHR> &ranges) const;
 
 	void buffer_copy_to_device(
 	    const Buffer &buffer,
@@ -439,12 +607,30 @@ struct Context
 	    bool          staging = false,
 	    size_t        offset  = 0) const;
 
+	// Staging copy that does not block, the staging buffer is released once the ticket completes
+	SubmitTicket buffer_copy_to_device_async(
+	    const Buffer &buffer,
+	    void         *data,
+	    size_t        size,
+	    size_t        offset = 0) const;
+
 	void buffer_copy_to_host(
 	    void         *data,
 	    size_t        size,
 	    const Buffer &buffer,
 	    bool          staging = false) const;
 
+	// Queue a one-shot job, queued jobs are recorded into one command buffer by submit_immediate()
+	void enqueue_immediate(std::function<void(CommandBufferRecorder &)> &&job, bool compute = false) const;
+
+	SubmitTicket submit_immediate(bool compute = false) const;
+
+	SubmitTicket submit_immediate(CommandBufferRecorder &recorder, std::function<void()> &&on_complete = {}) const;
+
+	void flush_immediate(bool compute = false) const;
+
+	bool is_complete(SubmitTicket ticket) const;
+
 	Texture load_texture_2d(
 	    const std::string &filename,
 	    bool               mipmap = true) const;
@@ -484,7 +670,8 @@ struct Context
 	        .levelCount     = 1,
 	        .baseArrayLayer = 0,
 	        .layerCount     = 1,
-	    }) const;
+	    },
+	    const VkComponentMapping &components = {}) const;
 
 	VkShaderModule load_spirv_shader(
 	    const uint32_t *spirv_code,
@@ -500,6 +687,8 @@ struct Context
 
 	VkDescriptorSet allocate_descriptor_set(VkDescriptorSetLayout layouts) const;
 
+	void renew_descriptor_set(VkDescriptorSet &set) const;
+
 	VkPipelineLayout create_pipeline_layout(
 	    const std::vector<VkDescriptorSetLayout> &layouts,
 	    uint32_t                                  push_data_size = 0,
@@ -526,6 +715,8 @@ struct Context
 
 	void wait(VkFence fence) const;
 
+	void wait(SubmitTicket ticket) const;
+
 	void wait() const;
 
 	bool acquire_next_image(VkSemaphore semaphore);
@@ -549,6 +740,7 @@ struct Context
 		    .pSetLayouts        = layouts.data(),
 		};
 		vkAllocateDescriptorSets(vk_device, &allocate_info, descriptor_sets.data());
+		track_descriptor_sets(layout, descriptor_sets.data(), N);
 		return descriptor_sets;
 	}
 
@@ -576,8 +768,88 @@ struct Context
 		return *this;
 	}
 
+	// Destroy once every frame in flight at the time of the call has completed
+	template <typename T>
+	const Context &deferred_destroy(T &data) const
+	{
+		std::lock_guard<std::mutex> lock(m_deferred_mutex);
+		m_deferred_destroy_queue.emplace_back(m_frame_index.load(), [this, data]() mutable { destroy(data); });
+		data = T{};
+		return *this;
+	}
+
+	template <typename T>
+	const Context &deferred_destroy(std::vector<T> &data) const
+	{
+		for (auto &x : data)
+		{
+			deferred_destroy(x);
+		}
+		data.clear();
+		return *this;
+	}
+
+	template <typename T, size_t N>
+	const Context &deferred_destroy(std::array<T, N> &data) const
+	{
+		for (auto &x : data)
+		{
+			deferred_destroy(x);
+		}
+		return *this;
+	}
+
 	void set_object_name(VkObjectType type, uint64_t handle, const char *name) const;
 
   private:
+	friend struct CommandBufferRecorder;
+	friend struct DescriptorLayoutBuilder;
+
 	Buffer create_scratch_buffer(size_t size) const;
+
+	AccelerationStructure create_acceleration_structure_storage(const std::string &name, VkAccelerationStructureTypeKHR type, VkDeviceSize size) const;
+
+	VkCommandPool thread_command_pool(bool compute) const;
+
+	// Recycle fences and command buffers of completed one-shot submissions, blocking on the given ticket first
+	void retire_immediate(uint64_t wait_id = 0) const;
+
+	void track_descriptor_layout(VkDescriptorSetLayout layout, const std::vector<VkDescriptorSetLayoutBinding> &bindings) const;
+
+	void track_descriptor_sets(VkDescriptorSetLayout layout, const VkDescriptorSet *sets, uint32_t count) const;
+
+	void flush_deferred_destroy(uint64_t frame_index);
+
+	std::atomic<uint64_t> m_frame_index = 0;
+
+	mutable std::mutex                                              m_deferred_mutex;
+	mutable std::vector<std::pair<uint64_t, std::function<void()>>> m_deferred_destroy_queue;
+	mutable std::vector<std::pair<uint64_t, VkDescriptorSet>>       m_retired_descriptor_sets;
+
+	// Layout and allocation frame of every live descriptor set
+	mutable std::mutex                                                                      m_descriptor_mutex;
+	mutable std::unordered_map<VkDescriptorSet, std::pair<VkDescriptorSetLayout, uint64_t>> m_descriptor_sets;
+	mutable std::unordered_map<VkDescriptorSetLayout, std::vector<VkCopyDescriptorSet>>     m_descriptor_layouts;        // One copy per binding, used to renew sets
+
+	struct ImmediateSubmission
+	{
+		uint64_t              id         = 0;
+		VkFence               fence      = VK_NULL_HANDLE;
+		VkCommandPool         cmd_pool   = VK_NULL_HANDLE;
+		VkCommandBuffer       cmd_buffer = VK_NULL_HANDLE;
+		std::function<void()> on_complete;
+	};
+
+	// Vulkan queues are externally synchronized, one-shot submissions may come from loader threads
+	mutable std::mutex m_queue_mutex;
+
+	mutable std::mutex                                                               m_immediate_mutex;
+	mutable uint64_t                                                                 m_next_ticket = 1;
+	mutable std::vector<ImmediateSubmission>                                         m_immediate_submissions;
+	mutable std::vector<VkFence>                                                     m_free_fences;
+	mutable std::unordered_map<VkCommandPool, std::vector<VkCommandBuffer>>          m_free_cmd_buffers;
+	mutable std::array<std::vector<std::function<void(CommandBufferRecorder &)>>, 2> m_immediate_jobs;
+
+	// Graphics and compute pools of every recording thread, handed back for reuse when the thread exits
+	std::shared_ptr<ThreadCommandPools> m_thread_cmd_pools;
 };
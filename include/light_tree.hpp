@@ -0,0 +1,38 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// World space emissive triangle
+struct LightTriangle
+{
+	glm::vec3 p0;
+	glm::vec3 p1;
+	glm::vec3 p2;
+	float     luminance;        // Luminance of the emitted radiance
+};
+
+// Light tree node, interior nodes keep their left child right after themselves
+// Emitters are two-sided, the bounding cone is over the unsigned triangle normals and its emission spread is always pi/2
+struct LightTreeNode
+{
+	glm::vec3 bbox_min    = glm::vec3(0.f);
+	float     power       = 0.f;
+	glm::vec3 bbox_max    = glm::vec3(0.f);
+	float     cos_theta_o = 1.f;
+	glm::vec3 axis        = glm::vec3(0.f, 0.f, 1.f);
+	int32_t   child       = 0;        // Right child of an interior node, ~emitter for a leaf
+};
+
+// Binned SAOH build over the emitter triangles, one leaf per emitter, 2n - 1 nodes for n emitters
+std::vector<LightTreeNode> build_light_tree(const std::vector<LightTriangle> &triangles);
+
+// Refits the bounds, cones and power of a tree built over the same emitters after they moved
+void refit_light_tree(std::vector<LightTreeNode> &nodes, const std::vector<LightTriangle> &triangles);
+
+// Parent of every node, ~0u for the root, and the leaf of every emitter
+void link_light_tree(const std::vector<LightTreeNode> &nodes, std::vector<uint32_t> &parents, std::vector<uint32_t> &leaves);
+
+// Refits only the leaves of the moved emitters and their ancestors, refitted receives the touched nodes in ascending order
+void refit_light_tree(std::vector<LightTreeNode> &nodes, const std::vector<LightTriangle> &triangles, const std::vector<uint32_t> &parents, const std::vector<uint32_t> &leaves, const std::vector<uint32_t> &moved_emitters, std::vector<uint32_t> &refitted);
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "alias_table.hpp"
+#include "bvh8.hpp"
+#include "light_tree.hpp"
+
+#include <glm/gtc/type_precision.hpp>
+
+#include <atomic>
+#include <string>
+
+struct Emitter;
+struct Material;
+
+// RGBA8 level 0 of a scene texture, sampled bilinearly with repeat like the linear sampler
+// A texture that failed to decode has no texels and samples as white
+struct PathTracerTexture
+{
+	uint32_t             width  = 0;
+	uint32_t             height = 0;
+	std::vector<uint8_t> texels;
+};
+
+// The arrays load_scene() uploads, indexed the same way the shaders index their buffers
+struct PathTracerScene
+{
+	const SceneBVH8                      &bvh;
+	const std::vector<Vertex>            &vertices;
+	const std::vector<uint32_t>          &indices;
+	const std::vector<Instance>          &instances;
+	const std::vector<Material>          &materials;
+	const std::vector<Emitter>           &emitters;
+	const std::vector<AliasTable>        &emitter_alias_table;            // Power proportional, only read by EmitterSampling::AliasTable
+	const std::vector<LightTreeNode>     &light_tree;
+	const std::vector<PathTracerTexture> &textures;
+	const std::vector<glm::u16vec4>      &envmap;                         // Face major RGBA16F cubemap level, empty without envmap
+	uint32_t                              envmap_size;
+	const std::vector<AliasTable>        &envmap_alias_table;             // One column per texel of a coarser cubemap level
+	uint32_t                              envmap_alias_table_size;        // Face size of that level
+};
+
+enum class EmitterSampling
+{
+	LightTree,
+	AliasTable,        // The global power alias table sampling used before the light tree, kept to compare variance against
+};
+
+// Push constants of path_tracing.slang and the view it renders
+struct PathTracerSettings
+{
+	uint32_t  width               = 0;
+	uint32_t  height              = 0;
+	uint32_t  frames              = 64;        // Frames accumulated, frame f seeds its pixels with tea(pixel, f)
+	int32_t   max_depth           = 5;
+	float     bias                = 0.0001f;
+	glm::mat4 view_projection_inv = glm::mat4(1.f);        // Without TAA jitter, pixels are jittered by the rand2() draw the shader discards
+	glm::vec3 cam_pos             = glm::vec3(0.f);
+
+	EmitterSampling emitter_sampling = EmitterSampling::LightTree;
+};
+
+// Mean of settings.frames frames of path_tracing.slang traced on the CPU, rows top to bottom
+// Tiles are spread over all cores with work stealing, progress receives the fraction of finished tiles
+// variance receives the per pixel variance of a single frame's luminance
+std::vector<glm::vec3> render_reference(const PathTracerScene &scene, const PathTracerSettings &settings, std::atomic<float> *progress = nullptr, std::vector<float> *variance = nullptr);
+
+// Radiance HDR for regression comparisons against GPU frames
+bool write_hdr(const std::string &filename, uint32_t width, uint32_t height, const std::vector<glm::vec3> &image);
@@ -20,6 +20,11 @@ struct PathTracing
 
 	void reset_frames();
 
+	// Push constants the CPU reference mirrors
+	int32_t max_depth() const;
+
+	float bias() const;
+
   private:
 	void create_resource();
 
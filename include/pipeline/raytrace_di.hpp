@@ -83,6 +83,7 @@ struct RayTracedDI
 				uint32_t temporal_reuse  = 1;
 				int32_t  M               = 4;
 				int32_t  clamp_threshold = 4;
+				uint32_t sample_envmap   = 0;        // Off by default, the deferred ambient term already carries the envmap
 			} push_constants;
 
 			VkPipelineLayout      pipeline_layout       = VK_NULL_HANDLE;
@@ -9,6 +9,9 @@
 struct RayTracedGI
 {
   public:
+	// Graphics queue stages reading the probes handed over by the compute queue, the acquire makes them all wait for the hand-off
+	static constexpr VkPipelineStageFlags probe_read_stages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
 	RayTracedGI(const Context &context, const Scene &scene, const GBufferPass &gbuffer_pass, RayTracedScale scale = RayTracedScale::Full_Res);
 
 	~RayTracedGI();
@@ -19,8 +22,14 @@ struct RayTracedGI
 
 	void update(const Scene &scene);
 
+	// Probe tracing and update, recorded on the async compute queue
+	void trace(CommandBufferRecorder &recorder, const Scene &scene, const GBufferPass &gbuffer_pass);
+
 	void draw(CommandBufferRecorder &recorder, const Scene &scene, const GBufferPass &gbuffer_pass);
 
+	// Return probe ownership to the compute queue at the end of the graphics frame
+	void release(CommandBufferRecorder &recorder);
+
 	void draw_probe(CommandBufferRecorder &recorder, const VkImageView &render_target, const VkImageView &depth_buffer, const Scene &scene) const;
 
 	bool draw_ui();
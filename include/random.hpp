@@ -0,0 +1,46 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <bit>
+#include <cstdint>
+
+// CPU ports of random.slangh, CPU and GPU paths draw the same sequence from the same seed
+
+inline uint32_t tea(uint32_t val0, uint32_t val1)
+{
+	uint32_t v0 = val0;
+	uint32_t v1 = val1;
+	uint32_t s0 = 0;
+
+	for (uint32_t n = 0; n < 16; n++)
+	{
+		s0 += 0x9e3779b9;
+		v0 += ((v1 << 4) + 0xa341316c) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4);
+		v1 += ((v0 << 4) + 0xad90777d) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761e);
+	}
+
+	return v0;
+}
+
+inline uint32_t pcg(uint32_t &state)
+{
+	uint32_t prev = state * 747796405u + 2891336453u;
+	uint32_t word = ((prev >> ((prev >> 28u) + 4u)) ^ prev) * 277803737u;
+	state         = prev;
+	return (word >> 22u) ^ word;
+}
+
+// rand() in random.slangh
+inline float random_float(uint32_t &seed)
+{
+	return std::bit_cast<float>(0x3f800000u | (pcg(seed) >> 9)) - 1.f;
+}
+
+// rand2() in random.slangh, x is drawn first
+inline glm::vec2 random_float2(uint32_t &seed)
+{
+	float x = random_float(seed);
+	float y = random_float(seed);
+	return glm::vec2(x, y);
+}
@@ -1,6 +1,76 @@
 #pragma once
 
+#include "alias_table.hpp"
+#include "bvh8.hpp"
 #include "context.hpp"
+#include "light_tree.hpp"
+#include "path_tracer.hpp"
+
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_precision.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+
+struct Vertex
+{
+	glm::vec4 position;        // xyz - position, w - texcoord u
+	glm::vec4 normal;          // xyz - normal, w - texcoord v
+};
+
+// Emissive triangle, vertices are fetched through its instance
+struct Emitter
+{
+	uint32_t instance;
+	uint32_t triangle;        // Triangle index within the instance
+	uint32_t radiance;        // E5B9G9R9
+};
+
+struct Mesh
+{
+	uint32_t vertices_offset = 0;
+	uint32_t vertices_count  = 0;
+	uint32_t indices_offset  = 0;
+	uint32_t indices_count   = 0;
+	uint32_t material        = ~0u;
+	float    area            = 0.f;
+};
+
+struct Material
+{
+	uint32_t  alpha_mode;        // 0 - opaque, 1 - mask, 2 - blend
+	uint32_t  double_sided;
+	float     cutoff;
+	float     metallic_factor;
+	float     roughness_factor;
+	float     transmission_factor;
+	float     clearcoat_factor;
+	float     clearcoat_roughness_factor;
+	glm::vec4 base_color;
+	glm::vec3 emissive_factor;
+	int32_t   base_color_texture;
+	int32_t   normal_texture;
+	int32_t   metallic_roughness_texture;
+	int32_t   emissive_texture;
+	float     padding;
+};
+
+struct Instance
+{
+	glm::mat4 transform;
+	glm::mat4 transform_inv;
+	uint32_t  vertices_offset;
+	uint32_t  vertices_count;
+	uint32_t  indices_offset;
+	uint32_t  indices_count;
+	uint32_t  mesh;
+	uint32_t  material;
+	int32_t   emitter;
+	float     area;
+};
 
 struct Scene
 {
@@ -8,14 +78,51 @@ struct Scene
 
 	~Scene();
 
-	void load_scene(const std::string &filename);
+	bool load_scene(const std::string &filename);
+
+	// Builds the scene on a loader thread, poll_load() swaps it in at a frame boundary
+	void load_scene_async(const std::string &filename);
+
+	// Returns true if a finished background load was swapped in, the caller refreshes dependent descriptors
+	bool poll_load();
+
+	bool is_loading() const;
+
+	float load_progress() const;
 
 	void load_envmap(const std::string &filename);
 
 	void update_view(CommandBufferRecorder &recorder);
 
+	// Traces path_tracing.slang on the CPU on a worker thread and writes the mean to a Radiance HDR file
+	// Instance and animation updates, scene swaps and envmap loads wait until it finishes
+	void render_reference_async(const PathTracerSettings &settings, const std::string &filename);
+
+	// Renders the view with the power alias table and with the light tree at equal frames, logs the per pixel variance of both
+	void compare_emitter_sampling_async(const PathTracerSettings &settings);
+
+	bool is_rendering_reference() const;
+
+	float reference_progress() const;
+
 	void update();
 
+	// Moves an instance at runtime, picked up by the next update_instances()
+	void set_instance_transform(uint32_t instance_id, const glm::mat4 &transform);
+
+	// Uploads moved instances and refits the TLAS, rebuilding it once refits degrade too far
+	void update_instances(CommandBufferRecorder &recorder);
+
+	// Plays glTF node animations and skins, skinned BLASes are refit in place
+	void update_animation(CommandBufferRecorder &recorder, float delta_time);
+
+	// Consumes read back mip requests, binds finished mips and streams or evicts under the budget, call before recording passes
+	// Returns true if bound textures changed and texture_streaming.reset_accumulation is set
+	bool update_texture_streaming();
+
+	// Reads back this frame's mip requests, call after the passes
+	void record_texture_feedback(CommandBufferRecorder &recorder);
+
   public:
 	struct
 	{
@@ -52,6 +159,15 @@ struct Scene
 		glm::vec4 jitter                   = glm::vec4(0.f);
 	} view_info;
 
+	struct
+	{
+		size_t   budget        = 512ull << 20;        // Streamed mips only, the resident mip tails are not counted
+		size_t   resident_size = 0;
+		uint32_t pending       = 0;
+
+		bool reset_accumulation = false;        // Restart path tracing accumulation whenever a mip is bound or evicted
+	} texture_streaming;
+
 	struct
 	{
 		VkDescriptorSetLayout layout = VK_NULL_HANDLE;
@@ -73,12 +189,16 @@ struct Scene
 		Buffer indirect_draw;
 		Buffer view;
 		Buffer emitter_alias_table;
+		Buffer light_tree;
 		Buffer mesh_alias_table;
 		Buffer scene;
+		Buffer tlas_instance;
+		Buffer tlas_scratch;
+		Buffer texture_feedback;
 	} buffer;
 
-	std::vector<Texture>     textures;
-	std::vector<VkImageView> texture_views;
+	std::vector<Texture>     textures;             // Resident mip tails
+	std::vector<VkImageView> texture_views;        // Bound views, the streamed mips if present or the tail
 
 	Texture     ggx_lut;
 	VkImageView ggx_lut_view = VK_NULL_HANDLE;
@@ -97,6 +217,7 @@ struct Scene
 		Texture texture;
 		Texture irradiance_sh;
 		Texture prefilter_map;
+		Buffer  alias_table;        // Importance sampling columns over the texels of one cubemap mip
 
 		VkImageView texture_view       = VK_NULL_HANDLE;
 		VkImageView irradiance_sh_view = VK_NULL_HANDLE;
@@ -104,9 +225,230 @@ struct Scene
 	} envmap;
 
   private:
+	// Holds scene content only, used by the background loader
+	explicit Scene(const Context *context);
+
+	void swap_scene(Scene &other);
+
 	void destroy_scene();
 
 	void destroy_envmap();
 
+	void create_envmap();
+
+	void bake_envmap(const std::string &content);
+
+	// Uploads the baked envmap cache, returns false if it is missing or stale
+	bool load_envmap_cache(const std::string &cache_path, uint64_t hash);
+
+	void store_envmap_cache(const std::string &cache_path, uint64_t hash);
+
+	// Builds the importance sampling table from the cubemap level read back or loaded for the cache, keeps level 0 and the table for the reference renderer
+	void create_envmap_alias_table(const void *cubemap, const void *texels);
+
+	void update_node_transforms();
+
+	// Builds the CPU BVHs on first use, later calls refit skinned bottom levels and rebuild the top levels if instances moved since
+	void update_cpu_bvh();
+
+	std::vector<uint32_t> reference_images() const;
+
+	// Texture sources are decoded from the glTF again, nothing of them is kept after the load
+	std::vector<PathTracerTexture> load_reference_textures(const std::vector<uint32_t> &images) const;
+
+	// The CPU BVHs are built on the first call and brought up to date with moved instances on later ones
+	std::vector<glm::vec3> render_reference(const PathTracerSettings &settings, const std::vector<PathTracerTexture> &textures, std::vector<float> *variance = nullptr);
+
+	void evict_texture(uint32_t texture);
+
+	// Rewrites the texture array binding only, the other scene bindings are carried over by the renewal
+	void update_texture_bindings();
+
+	// Body of the loader thread, decodes and uploads queued mips one at a time
+	void load_texture_requests();
+
+	// Drops queued mips and waits for the one being loaded, its result is retired with the others
+	void cancel_texture_requests();
+
 	const Context *m_context = nullptr;
-};
\ No newline at end of file
+
+	std::unique_ptr<Scene> m_loader;
+	std::future<bool>      m_loading;
+	std::atomic<float>     m_progress = 0.f;
+	std::string            m_filename;
+
+	std::future<void>  m_reference;
+	std::atomic<float> m_reference_progress = 0.f;
+
+	// CPU copies of the scene, kept for runtime instance updates
+	std::vector<Vertex>   m_vertices;
+	std::vector<uint32_t> m_indices;
+	std::vector<Mesh>     m_meshes;
+	std::vector<Instance> m_instances;
+	std::vector<Material> m_materials;
+
+	// Emitters do not change when instances move, their world space triangles for the light tree and alias table do
+	std::vector<Emitter>       m_emitters;
+	std::vector<LightTriangle> m_light_triangles;
+	std::vector<float>         m_emitter_weights;        // Luminance times area of every emitter
+	std::vector<LightTreeNode> m_light_tree;
+
+	// Mirror tlas and blas for queries on the CPU, nothing on the per-frame path touches them
+	SceneBVH                      m_cpu_bvh;
+	SceneBVH8                     m_cpu_bvh8;        // Eight wide copy of m_cpu_bvh traced on the CPU
+	std::vector<BVH8Material>     m_bvh8_materials;        // Handed to the first build
+	std::vector<BVH8AlphaTexture> m_bvh8_alpha_textures;
+	std::vector<std::string>      m_bvh8_alpha_caches;        // Cooked base color textures left to decode, see load_scene
+	bool                          m_cpu_bvh_built  = false;
+	bool                          m_cpu_tlas_stale = false;
+	bool                          m_cpu_blas_stale = false;        // Skinned bottom levels
+
+	// Envmap level 0 and its importance sampling table as bound on the GPU, kept for the reference renderer
+	std::vector<glm::u16vec4> m_envmap_texels;        // Face major RGBA16F
+	std::vector<AliasTable>   m_envmap_alias_table;
+
+	std::vector<VkAccelerationStructureInstanceKHR> m_tlas_instances;
+	size_t                                          m_tlas_instance_offset = 0;
+	std::vector<uint32_t>                           m_dirty_instances;
+
+	// Refit quality heuristic, world bounds of every instance at the last full TLAS build
+	std::vector<std::array<glm::vec3, 2>> m_instance_bounds;        // object space
+	std::vector<std::array<glm::vec3, 2>> m_build_bounds;
+	std::vector<float>                    m_refit_areas;
+	float                                 m_build_area = 0.f;
+	float                                 m_refit_area = 0.f;
+
+	struct Node
+	{
+		int32_t   parent      = -1;
+		bool      animated    = false;        // Targeted by a channel or below such a node
+		bool      has_matrix  = false;
+		glm::vec3 translation = glm::vec3(0.f);
+		glm::quat rotation    = glm::quat(1.f, 0.f, 0.f, 0.f);
+		glm::vec3 scale       = glm::vec3(1.f);
+		glm::mat4 matrix      = glm::mat4(1.f);
+	};
+
+	struct AnimationChannel
+	{
+		uint32_t               node          = 0;
+		uint32_t               path          = 0;        // 0 - translation, 1 - rotation, 2 - scale
+		uint32_t               interpolation = 0;        // 0 - linear, 1 - step, 2 - cubic spline
+		std::vector<float>     times;
+		std::vector<glm::vec4> values;        // Cubic spline keys store in-tangent, value, out-tangent
+	};
+
+	struct Animation
+	{
+		std::vector<AnimationChannel> channels;
+		float                         duration = 0.f;
+	};
+
+	struct Skin
+	{
+		std::vector<uint32_t>  joints;
+		std::vector<glm::mat4> inverse_bind_matrices;
+		std::vector<glm::mat4> joint_matrices;
+	};
+
+	// Skinned instances own a copy of their mesh in the dynamic vertex region and a refittable BLAS
+	struct SkinnedInstance
+	{
+		uint32_t instance        = 0;
+		uint32_t skin            = 0;
+		uint32_t mesh            = 0;
+		uint32_t vertices_offset = 0;
+
+		AccelerationStructure blas;
+		Buffer                scratch_buffer;
+
+		VkAccelerationStructureGeometryKHR       geometry = {};
+		VkAccelerationStructureBuildRangeInfoKHR range    = {};
+	};
+
+	std::vector<Node>                          m_nodes;
+	std::vector<uint32_t>                      m_node_order;        // Parents before children
+	std::vector<glm::mat4>                     m_node_worlds;
+	std::vector<Animation>                     m_animations;
+	std::vector<Skin>                          m_skins;
+	std::vector<SkinnedInstance>               m_skinned_instances;
+	std::vector<std::pair<uint32_t, uint32_t>> m_animated_instances;        // instance id - node id
+	std::vector<glm::uvec4>                    m_skin_joints;
+	std::vector<glm::vec4>                     m_skin_weights;
+	float                                      m_animation_time = 0.f;
+
+	// Dynamic vertex region at the tail of the vertex buffer, uploaded through one staging buffer per frame in flight
+	uint32_t              m_dynamic_vertices_offset = 0;
+	std::array<Buffer, 3> m_skinning_staging;
+	uint32_t              m_skinning_staging_index = 0;
+
+	std::vector<VkAccelerationStructureBuildGeometryInfoKHR>      m_skinning_build_infos;
+	std::vector<const VkAccelerationStructureBuildRangeInfoKHR *> m_skinning_build_ranges;
+	std::vector<std::array<glm::vec3, 2>>                         m_skinning_chunk_bounds;
+
+	// Moved emitters refit their light tree paths, the alias table is only rebuilt when their weights change
+	std::vector<AliasTable> m_emitter_alias_table;
+	AliasTableScratch       m_alias_table_scratch;
+	std::vector<uint32_t>   m_light_tree_parents;
+	std::vector<uint32_t>   m_light_tree_leaves;
+	std::vector<uint32_t>   m_moved_emitters;
+	std::vector<float>      m_moved_weights;
+	std::vector<uint32_t>   m_refitted_light_nodes;
+	std::array<Buffer, 3>   m_light_staging;        // Alias table followed by the light tree, created on the first move
+	uint32_t                m_light_staging_index = 0;
+
+	// Streamed textures keep a small mip tail resident, finer mips are read from the texture cache on demand
+	struct StreamedTexture
+	{
+		std::string          name;
+		std::string          cache_path;
+		uint32_t             image          = 0;        // glTF image the reference renderer decodes
+		VkFormat             format         = VK_FORMAT_UNDEFINED;
+		uint32_t             width          = 0;
+		uint32_t             height         = 0;
+		uint32_t             tail_mip       = 0;        // First mip of the resident tail, 0 if the texture is not streamed
+		uint32_t             resident_mip   = 0;        // First mip of the bound view
+		uint32_t             requested_mip  = 0;
+		uint64_t             last_requested = 0;
+		bool                 pending        = false;
+
+		VkImageView tail_view = VK_NULL_HANDLE;
+
+		Texture     streamed;
+		VkImageView streamed_view = VK_NULL_HANDLE;
+		size_t      streamed_size = 0;
+	};
+
+	struct TextureStreamRequest
+	{
+		uint32_t    texture = 0;
+		uint32_t    mip     = 0;
+		std::string name;
+		std::string cache_path;
+	};
+
+	struct TextureStreamResult
+	{
+		uint32_t    texture = 0;
+		uint32_t    mip     = 0;
+		Texture     image;
+		VkImageView view = VK_NULL_HANDLE;
+	};
+
+	std::vector<StreamedTexture> m_streamed_textures;
+	std::array<Buffer, 3>        m_texture_feedback_readback;
+	uint32_t                     m_texture_feedback_index = 0;
+	uint64_t                     m_texture_frame          = 0;
+	std::vector<uint32_t>        m_texture_feedback;          // Requested resolutions read back this frame
+	std::vector<uint32_t>        m_texture_candidates;        // Textures missing mips, most missing first
+
+	// A single loader thread started with the first request, it stays with this Scene when scenes are swapped
+	std::thread                      m_texture_loader;
+	std::mutex                       m_texture_loader_mutex;
+	std::condition_variable          m_texture_loader_condition;
+	std::deque<TextureStreamRequest> m_texture_queue;
+	std::vector<TextureStreamResult> m_texture_results;
+	uint32_t                         m_texture_requests    = 0;        // Queued, loading or finished but not bound yet
+	bool                             m_texture_loader_busy = false;
+	bool                             m_texture_loader_stop = false;
+};
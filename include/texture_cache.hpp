@@ -0,0 +1,70 @@
+#pragma once
+
+#include <volk.h>
+
+#include <string>
+#include <vector>
+
+enum class TextureUsage
+{
+	BaseColor,
+	Normal,
+	MetallicRoughness,
+	Emissive,
+};
+
+// Block compressed mip chain as stored in the KTX2 scene cache
+struct CookedTexture
+{
+	VkFormat           format     = VK_FORMAT_UNDEFINED;
+	uint32_t           width      = 0;        // Extent of level 0
+	uint32_t           height     = 0;
+	uint32_t           mip_levels = 0;
+	uint32_t           first_mip  = 0;        // First level held in levels
+	VkComponentMapping swizzle    = {};
+
+	std::vector<std::vector<uint8_t>> levels;
+};
+
+// Kaiser filtered RGBA8 mip chain down to 1x1, level 0 is a copy of the input
+// Color channels of sRGB textures are filtered in linear space, a non-zero alpha cutoff preserves the alpha tested coverage of level 0
+std::vector<std::vector<uint8_t>> generate_mip_chain(const uint8_t *data, uint32_t width, uint32_t height, bool srgb = false, float alpha_cutoff = 0.f);
+
+// BC7 for base color and emissive, BC5 for normals, BC4 or BC5 for metallic-roughness, blocks are compressed in parallel
+// alpha_cutoff is the cutoff of alpha masked materials using a base color texture, 0 otherwise
+CookedTexture cook_texture(const uint8_t *data, uint32_t width, uint32_t height, TextureUsage usage, float alpha_cutoff = 0.f);
+
+size_t texture_level_size(VkFormat format, uint32_t width, uint32_t height);
+
+// RGBA8 texels of levels[level], BC7 levels are decoded from the mode 6 blocks written by cook_texture
+bool decode_texture_level(const CookedTexture &texture, uint32_t level, std::vector<uint8_t> &texels);
+
+// FNV-1a, stable across platforms and standard libraries so it can key files on disk
+uint64_t hash_cache_key(const void *data, size_t size);
+
+bool write_ktx2(const std::string &filename, const CookedTexture &texture);
+
+// Fails on files written by another cooker version, callers cook again
+bool read_ktx2_header(const std::string &filename, CookedTexture &texture);
+
+// Reads levels [first_mip, mip_levels)
+bool read_ktx2(const std::string &filename, CookedTexture &texture, uint32_t first_mip = 0);
+
+// Baked environment lighting, the payload holds the irradiance SH followed by the cubemap and prefilter map levels
+struct EnvmapCacheHeader
+{
+	uint64_t hash                 = 0;        // Content hash of the source HDR
+	uint32_t cubemap_size         = 0;
+	uint32_t cubemap_mip_levels   = 0;
+	uint32_t prefilter_size       = 0;
+	uint32_t prefilter_mip_levels = 0;
+	uint64_t data_size            = 0;
+};
+
+bool write_envmap_cache(const std::string &filename, const EnvmapCacheHeader &header, const void *data);
+
+// Fails unless the file was written with the same header, the payload is read into data which holds header.data_size bytes
+bool read_envmap_cache(const std::string &filename, const EnvmapCacheHeader &header, void *data);
+
+// Radiance RGBE image to E5B9G9R9 texels, returns false for files left to stb such as old style run lengths or XYZE
+bool decode_rgbe(const uint8_t *data, size_t size, uint32_t &width, uint32_t &height, std::vector<uint32_t> &texels);
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Upper bound of the worker index passed to tasks
+uint32_t work_stealing_worker_count();
+
+// Runs for every index of a dispatch, context is passed through as given
+using WorkStealingTask = void (*)(void *context, uint32_t index, uint32_t worker);
+
+// Remaining share of a worker, begin in the low and end in the high half so both ends move with one compare exchange
+struct alignas(64) WorkStealingShare
+{
+	std::atomic<uint64_t> range = 0;
+};
+
+// Workers parked between dispatches, started on the first one and joined on destruction
+// Concurrent dispatches run one after another, dispatches from inside a task run on the calling worker alone
+// Every worker starts on a contiguous share of the range, workers that run dry steal the back half of the largest remaining share
+class WorkStealingPool
+{
+  public:
+	~WorkStealingPool();
+
+	// Runs task(context, index, worker) for every index in [0, count), the calling thread is worker 0
+	// Nothing is allocated once the first dispatch started the workers
+	void parallel_for(uint32_t count, WorkStealingTask task, void *context);
+
+	// Runs task(index, worker), the task is referenced rather than copied so lambdas of any size stay off the heap
+	template <typename Task>
+	void parallel_for(uint32_t count, Task &&task)
+	{
+		using TaskType = std::remove_reference_t<Task>;
+		parallel_for(
+		    count, [](void *context, uint32_t index, uint32_t worker) { (*static_cast<TaskType *>(context))(index, worker); },
+		    const_cast<void *>(static_cast<const void *>(&task)));
+	}
+
+  private:
+	void run(uint32_t worker);
+	void work_thread(uint32_t worker);
+
+  private:
+	std::vector<std::thread>       m_threads;
+	std::vector<WorkStealingShare> m_shares;
+	std::mutex                     m_dispatch_mutex;        // One dispatch at a time, later callers wait
+	std::mutex                     m_mutex;
+	std::condition_variable        m_start;
+	std::condition_variable        m_finish;
+
+	WorkStealingTask m_task       = nullptr;
+	void            *m_context    = nullptr;
+	uint32_t         m_workers    = 0;        // Pool threads taking part in the current dispatch
+	uint32_t         m_running    = 0;
+	uint64_t         m_generation = 0;
+	bool             m_stop       = false;
+};
+
+// Pool for per-frame work, kept apart from the default pool so a long dispatch such as a reference render never stalls a frame
+WorkStealingPool &get_frame_work_stealing_pool();
+
+// Runs task(index, worker) for every index in [0, count) on the default pool
+void parallel_for_work_stealing(uint32_t count, const std::function<void(uint32_t, uint32_t)> &task);
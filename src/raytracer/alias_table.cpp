@@ -0,0 +1,92 @@
+#include "alias_table.hpp"
+
+#include <algorithm>
+
+void build_alias_table(const float *weights, uint32_t count, AliasTable *table, AliasTableScratch &scratch)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	double total_weight = 0.0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		total_weight += std::max(weights[i], 0.f);
+	}
+
+	// Probabilities scaled to a mean of 1 are kept in double so pairing does not drift
+	// The worklist holds small columns from the front and large columns from the back
+	scratch.scaled.resize(count);
+	scratch.worklist.resize(count);
+
+	double   *scaled      = scratch.scaled.data();
+	uint32_t *worklist    = scratch.worklist.data();
+	uint32_t  small_count = 0;
+	uint32_t  large_begin = count;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		double prob = total_weight > 0.0 ? std::max(weights[i], 0.f) / total_weight : 1.0 / count;
+
+		table[i].ori_prob = static_cast<float>(prob);
+		scaled[i]         = prob * count;
+
+		if (scaled[i] < 1.0)
+		{
+			worklist[small_count++] = i;
+		}
+		else
+		{
+			worklist[--large_begin] = i;
+		}
+	}
+
+	// Each small column is topped up by a large one, which becomes small once it drops below 1
+	while (small_count > 0 && large_begin < count)
+	{
+		uint32_t s = worklist[--small_count];
+		uint32_t l = worklist[large_begin];
+
+		table[s].prob  = static_cast<float>(scaled[s]);
+		table[s].alias = static_cast<int>(l);
+
+		scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+		if (scaled[l] < 1.0)
+		{
+			large_begin++;
+			worklist[small_count++] = l;
+		}
+	}
+
+	// Leftovers of either kind are 1 up to rounding
+	while (large_begin < count)
+	{
+		uint32_t l     = worklist[large_begin++];
+		table[l].prob  = 1.f;
+		table[l].alias = static_cast<int>(l);
+	}
+	while (small_count > 0)
+	{
+		uint32_t s     = worklist[--small_count];
+		table[s].prob  = 1.f;
+		table[s].alias = static_cast<int>(s);
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		table[i].alias_ori_prob = table[table[i].alias].ori_prob;
+	}
+}
+
+void build_alias_table(const float *weights, uint32_t count, AliasTable *table)
+{
+	AliasTableScratch scratch;
+	build_alias_table(weights, count, table, scratch);
+}
+
+std::vector<AliasTable> build_alias_table(const std::vector<float> &weights)
+{
+	std::vector<AliasTable> table(weights.size());
+	build_alias_table(weights.data(), static_cast<uint32_t>(weights.size()), table.data());
+	return table;
+}
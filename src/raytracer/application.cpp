@@ -11,12 +11,36 @@
 
 #include <nfd.h>
 
+#include <atomic>
+#include <cstdlib>
 #include <filesystem>
+#include <new>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb/stb_image_write.h>
 
+#ifdef BENCHMARK
+// Count heap allocations to verify steady-state frames are allocation free
+static std::atomic<uint64_t> allocation_count = 0;
+
+void *operator new(size_t size)
+{
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	if (void *ptr = std::malloc(size))
+	{
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+	std::free(ptr);
+}
+#endif        // BENCHMARK
+
 #define HALTON_SAMPLES 16
+#define ALLOCATION_REPORT_FRAMES 1000
 #define CAMERA_NEAR_PLANE 0.01f
 #define CAMERA_FAR_PLANE 1000.f
 
@@ -78,6 +102,7 @@ Application::Application() :
 	for (uint32_t i = 0; i < 3; i++)
 	{
 		m_recorders.push_back(m_context.record_command());
+		m_compute_recorders.push_back(m_context.record_command(true));
 	}
 
 	m_render_complete  = m_context.create_semaphore("Render Complete Semaphore");
@@ -86,8 +111,12 @@ Application::Application() :
 	for (uint32_t i = 0; i < 3; i++)
 	{
 		m_fences.push_back(m_context.create_fence(fmt::format("Fence #{}", i)));
+		m_compute_complete.push_back(m_context.create_semaphore(fmt::format("Compute Complete Semaphore #{}", i)));
+		m_graphics_complete.push_back(m_context.create_semaphore(fmt::format("Graphics Complete Semaphore #{}", i)));
 	}
 
+	m_jobs.reserve(16);
+
 	for (int32_t i = 1; i <= HALTON_SAMPLES; i++)
 	{
 		m_jitter_samples.push_back(glm::vec2((2.f * halton_sequence(2, i) - 1.f), (2.f * halton_sequence(3, i) - 1.f)));
@@ -108,6 +137,9 @@ Application::~Application()
 	m_context
 	    .destroy(m_render_complete)
 	    .destroy(m_present_complete)
+	    .destroy(m_compute_complete)
+	    .destroy(m_graphics_complete)
+	    .destroy(m_job_cmd_pools)
 	    .destroy(m_fences);
 }
 
@@ -128,13 +160,47 @@ void Application::run()
 
 		update_ui();
 
+		// Swap in a finished background load before any pass records against the scene
+		if (m_scene.poll_load())
+		{
+			m_scene.update();
+			m_renderer.gi.update(m_scene);
+			m_renderer.path_tracing.reset_frames();
+		}
+
+#ifdef BENCHMARK
+		uint64_t allocations = allocation_count.load();
+#endif        // BENCHMARK
+
 		begin_render();
+		if (m_scene.update_texture_streaming())
+		{
+			m_renderer.path_tracing.reset_frames();
+		}
+		if (m_render_mode == RenderMode::Hybrid)
+		{
+			render_async(m_compute_recorders[m_current_frame]);
+		}
 		recorder.begin_marker("Tick");
 		update(recorder);
 		render(recorder);
+		// After the frame's passes, so async compute tracing this frame has finished with the TLAS
+		m_scene.update_animation(recorder, ImGui::GetIO().DeltaTime);
+		m_scene.update_instances(recorder);
+		m_scene.record_texture_feedback(recorder);
 		recorder.end_marker();
 		end_render();
 
+#ifdef BENCHMARK
+		m_frame_allocations      = allocation_count.load() - allocations;
+		m_peak_frame_allocations = std::max(m_peak_frame_allocations, m_frame_allocations);
+		if ((m_num_frames + 1) % ALLOCATION_REPORT_FRAMES == 0)
+		{
+			spdlog::info("Heap allocations per frame over the last {} frames: peak {}, last {}", ALLOCATION_REPORT_FRAMES, m_peak_frame_allocations, m_frame_allocations);
+			m_peak_frame_allocations = 0;
+		}
+#endif        // BENCHMARK
+
 		m_current_frame     = (m_current_frame + 1) % 3;
 		m_context.ping_pong = !m_context.ping_pong;
 		m_num_frames++;
@@ -154,6 +220,7 @@ void Application::begin_render()
 	if (m_resize)
 	{
 		m_context.ping_pong = false;
+		m_render_mode       = m_next_render_mode;
 
 		const float scale_factor[] = {
 		    1.f,
@@ -185,15 +252,48 @@ void Application::begin_render()
 		m_resize = false;
 	}
 	m_context.wait(m_fences[m_current_frame]);
+	m_context.begin_frame();
+	m_frame_arena.reset();
 	m_recorders[m_current_frame].begin();
 }
 
 void Application::end_render()
 {
+	std::array<VkSemaphore, 2>          signal_semaphores = {m_render_complete};
+	std::array<VkSemaphore, 2>          wait_semaphores   = {m_present_complete};
+	std::array<VkPipelineStageFlags, 2> wait_stages       = {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT};
+	uint32_t                            signal_count      = 1;
+	uint32_t                            wait_count        = 1;
+
+	if (m_render_mode == RenderMode::Hybrid)
+	{
+		// Async compute waits for the previous graphics frame to release the probes
+		VkPipelineStageFlags compute_wait_stage = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		uint32_t             compute_wait_count = m_pending_graphics_complete != VK_NULL_HANDLE ? 1 : 0;
+
+		m_compute_recorders[m_current_frame]
+		    .end()
+		    .submit(std::span(&m_compute_complete[m_current_frame], 1), std::span(&m_pending_graphics_complete, compute_wait_count), std::span(&compute_wait_stage, compute_wait_count));
+
+		// Only compute work waits on the async queue, GBuffer rasterization overlaps with it
+		// The probe acquire in RayTracedGI::draw() starts at this stage and extends the wait to every stage reading the probes
+		wait_semaphores[wait_count]       = m_compute_complete[m_current_frame];
+		wait_stages[wait_count++]         = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		signal_semaphores[signal_count++] = m_graphics_complete[m_current_frame];
+		m_pending_graphics_complete       = m_graphics_complete[m_current_frame];
+	}
+	else if (m_pending_graphics_complete != VK_NULL_HANDLE)
+	{
+		// Consume the hand-off semaphore so it can be signaled again
+		wait_semaphores[wait_count] = m_pending_graphics_complete;
+		wait_stages[wait_count++]   = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		m_pending_graphics_complete = VK_NULL_HANDLE;
+	}
+
 	m_recorders[m_current_frame]
 	    .end()
-	    .submit({m_render_complete}, {m_present_complete}, {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT}, m_fences[m_current_frame])
-	    .present({m_render_complete});
+	    .submit(std::span(signal_semaphores.data(), signal_count), std::span(wait_semaphores.data(), wait_count), std::span(wait_stages.data(), wait_count), m_fences[m_current_frame])
+	    .present(std::span(&m_render_complete, 1));
 }
 
 void Application::update_view()
@@ -311,40 +411,76 @@ void Application::update_view()
 
 void Application::update(CommandBufferRecorder &recorder)
 {
-	if (m_update)
-	{
-		m_context.wait();
-	}
-
 	update_view();
 	m_scene.update_view(recorder);
 }
 
+void Application::render_async(CommandBufferRecorder &recorder)
+{
+	recorder.begin()
+	    .begin_marker("Async Compute");
+	m_renderer.gi.trace(recorder, m_scene, m_renderer.gbuffer);
+	recorder.end_marker();
+}
+
 void Application::render(CommandBufferRecorder &recorder)
 {
-	m_renderer.gbuffer.draw(recorder, m_scene);
+	// Capacity is kept across frames, jobs capture nothing and are passed the application when recorded
+	auto &jobs = m_jobs;
+	jobs.clear();
+
+	jobs.push_back([](Application &app, CommandBufferRecorder &recorder) { app.m_renderer.gbuffer.draw(recorder, app.m_scene); });
 
 	if (m_render_mode == RenderMode::PathTracing)
 	{
-		m_renderer.path_tracing.draw(recorder, m_scene, m_renderer.gbuffer);
-		m_renderer.bloom.draw(recorder, m_renderer.path_tracing);
-		m_renderer.tonemap.draw(recorder, m_renderer.bloom);
-		m_renderer.fsr.draw(recorder, m_renderer.tonemap);
-		m_renderer.composite.draw(recorder, m_scene, m_renderer.gbuffer, m_renderer.ao, m_renderer.di, m_renderer.gi, m_renderer.reflection, m_renderer.fsr);
+		jobs.push_back([](Application &app, CommandBufferRecorder &recorder) { app.m_renderer.path_tracing.draw(recorder, app.m_scene, app.m_renderer.gbuffer); });
+		jobs.push_back([](Application &app, CommandBufferRecorder &recorder) { app.m_renderer.bloom.draw(recorder, app.m_renderer.path_tracing); });
+		jobs.push_back([](Application &app, CommandBufferRecorder &recorder) { app.m_renderer.tonemap.draw(recorder, app.m_renderer.bloom); });
+		jobs.push_back([](Application &app, CommandBufferRecorder &recorder) { app.m_renderer.fsr.draw(recorder, app.m_renderer.tonemap); });
+		jobs.push_back([](Application &app, CommandBufferRecorder &recorder) { app.m_renderer.composite.draw(recorder, app.m_scene, app.m_renderer.gbuffer, app.m_renderer.ao, app.m_renderer.di, app.m_renderer.gi, app.m_renderer.reflection, app.m_renderer.fsr); });
 	}
 	else
 	{
-		m_renderer.ao.draw(recorder, m_scene, m_renderer.gbuffer);
-		m_renderer.di.draw(recorder, m_scene, m_renderer.gbuffer);
-		m_renderer.gi.draw(recorder, m_scene, m_renderer.gbuffer);
-		m_renderer.reflection.draw(recorder, m_scene, m_renderer.gbuffer, m_renderer.gi);
-		m_renderer.deferred.draw(recorder, m_scene, m_renderer.gbuffer, m_renderer.ao, m_renderer.di, m_renderer.gi, m_renderer.reflection);
-		m_renderer.taa.draw(recorder, m_scene, m_renderer.gbuffer, m_renderer.deferred);
-		m_renderer.bloom.draw(recorder, m_renderer.taa);
-		m_renderer.tonemap.draw(recorder, m_renderer.bloom);
-		m_renderer.fsr.draw(recorder, m_renderer.tonemap);
-		m_renderer.composite.draw(recorder, m_scene, m_renderer.gbuffer, m_renderer.ao, m_renderer.di, m_renderer.gi, m_renderer.reflection, m_renderer.fsr);
+		jobs.push_back([](Application &app, CommandBufferRecorder &recorder) { app.m_renderer.ao.draw(recorder, app.m_scene, app.m_renderer.gbuffer); });
+		jobs.push_back([](Application &app, CommandBufferRecorder &recorder) { app.m_renderer.di.draw(recorder, app.m_scene, app.m_renderer.gbuffer); });
+		jobs.push_back([](Application &app, CommandBufferRecorder &recorder) { app.m_renderer.gi.draw(recorder, app.m_scene, app.m_renderer.gbuffer); });
+		jobs.push_back([](Application &app, CommandBufferRecorder &recorder) { app.m_renderer.reflection.draw(recorder, app.m_scene, app.m_renderer.gbuffer, app.m_renderer.gi); });
+		jobs.push_back([](Application &app, CommandBufferRecorder &recorder) { app.m_renderer.deferred.draw(recorder, app.m_scene, app.m_renderer.gbuffer, app.m_renderer.ao, app.m_renderer.di, app.m_renderer.gi, app.m_renderer.reflection); });
+		jobs.push_back([](Application &app, CommandBufferRecorder &recorder) { app.m_renderer.taa.draw(recorder, app.m_scene, app.m_renderer.gbuffer, app.m_renderer.deferred); });
+		jobs.push_back([](Application &app, CommandBufferRecorder &recorder) { app.m_renderer.bloom.draw(recorder, app.m_renderer.taa); });
+		jobs.push_back([](Application &app, CommandBufferRecorder &recorder) { app.m_renderer.tonemap.draw(recorder, app.m_renderer.bloom); });
+		jobs.push_back([](Application &app, CommandBufferRecorder &recorder) { app.m_renderer.fsr.draw(recorder, app.m_renderer.tonemap); });
+		jobs.push_back([](Application &app, CommandBufferRecorder &recorder) {
+			app.m_renderer.composite.draw(recorder, app.m_scene, app.m_renderer.gbuffer, app.m_renderer.ao, app.m_renderer.di, app.m_renderer.gi, app.m_renderer.reflection, app.m_renderer.fsr);
+			app.m_renderer.gi.release(recorder);
+		});
+	}
+
+	auto &cmd_pools     = m_job_cmd_pools[m_current_frame];
+	auto &job_recorders = m_job_recorders[m_current_frame];
+	while (job_recorders.size() < jobs.size())
+	{
+		cmd_pools.push_back(m_context.create_command_pool(fmt::format("Job Command Pool #{}-{}", m_current_frame, cmd_pools.size())));
+		job_recorders.push_back(m_context.record_secondary_command(cmd_pools.back()));
 	}
+
+	// Each job records one pass into its own secondary command buffer, the pool is never shared between threads
+	get_frame_work_stealing_pool().parallel_for(static_cast<uint32_t>(jobs.size()), [&](uint32_t i, uint32_t) {
+		vkResetCommandPool(m_context.vk_device, cmd_pools[i], 0);
+		job_recorders[i].begin();
+		jobs[i](*this, job_recorders[i]);
+		job_recorders[i].end();
+	});
+
+	// Stitch in dependency order, barriers recorded by each pass still apply across secondaries
+	std::span<VkCommandBuffer> cmd_buffers = m_frame_arena.allocate<VkCommandBuffer>(jobs.size());
+	for (uint32_t i = 0; i < jobs.size(); i++)
+	{
+		cmd_buffers[i] = job_recorders[i].cmd_buffer;
+	}
+	recorder.execute_commands(cmd_buffers);
+
+	// ImGui records into a render pass instance of the primary command buffer
 	m_renderer.ui.render(recorder, m_context.image_index);
 }
 
@@ -408,19 +544,25 @@ void Application::update_ui()
 		ImGui::Text("CSIG 2023 RayTracer");
 		ImGui::Text("FPS: %.f", ImGui::GetIO().Framerate);
 		ImGui::Text("Frames: %.d", m_num_frames);
+#ifdef BENCHMARK
+		ImGui::Text("Allocations: %llu (peak %llu)", m_frame_allocations, m_peak_frame_allocations);
+#endif        // BENCHMARK
 
 		if (ImGui::Button("Open Scene"))
 		{
 			char *path = nullptr;
 			if (NFD_OpenDialog("gltf,glb", std::filesystem::current_path().string().c_str(), &path) == NFD_OKAY)
 			{
-				m_scene.load_scene(path);
-				m_scene.update();
-				m_renderer.gi.update(m_scene);
-				m_update = true;
+				m_scene.load_scene_async(path);
 			}
 		}
 
+		if (m_scene.is_loading())
+		{
+			ImGui::SameLine();
+			ImGui::ProgressBar(m_scene.load_progress(), ImVec2(100.f, 0.f));
+		}
+
 		ImGui::SameLine();
 
 		if (ImGui::Button("Open HDRI"))
@@ -430,26 +572,27 @@ void Application::update_ui()
 			{
 				m_scene.load_envmap(path);
 				m_scene.update();
-				m_update = true;
 			}
 		}
 
 		const char *const render_modes[] = {"Path Tracing", "Hybrid"};
-		if (ImGui::Combo("Render Mode", reinterpret_cast<int32_t *>(&m_render_mode), render_modes, 2))
+		if (ImGui::Combo("Render Mode", reinterpret_cast<int32_t *>(&m_next_render_mode), render_modes, 2))
 		{
-			m_context.ping_pong = false;
-			m_context.wait();
-			m_renderer.gbuffer.init();
-			m_renderer.path_tracing.init();
-			m_renderer.ao.init();
-			m_renderer.di.init();
-			m_renderer.gi.init();
-			m_renderer.reflection.init();
-			m_renderer.deferred.init();
-			m_renderer.taa.init();
-			m_renderer.bloom.init();
-			m_renderer.fsr.init();
-			m_renderer.composite.init();
+			// Recreate the render targets rather than reinitializing them under frames in flight
+			m_resize = true;
+		}
+
+		if (ImGui::TreeNode("Texture Streaming"))
+		{
+			int32_t budget = static_cast<int32_t>(m_scene.texture_streaming.budget >> 20);
+			if (ImGui::SliderInt("Budget (MB)", &budget, 16, 4096))
+			{
+				m_scene.texture_streaming.budget = static_cast<size_t>(budget) << 20;
+			}
+			ImGui::Checkbox("Reset Accumulation On Residency Change", &m_scene.texture_streaming.reset_accumulation);
+			ImGui::Text("Resident: %.1f MB", static_cast<float>(m_scene.texture_streaming.resident_size) / static_cast<float>(1 << 20));
+			ImGui::Text("Pending: %u", m_scene.texture_streaming.pending);
+			ImGui::TreePop();
 		}
 
 		bool update = false;
@@ -463,6 +606,40 @@ void Application::update_ui()
 			{
 				m_renderer.path_tracing.reset_frames();
 			}
+
+			// Traced on a worker thread, the scene stops animating until the reference is written
+			ImGui::DragInt("Reference Frames", &m_reference_frames, 1.f, 1, 65536);
+			if (m_scene.is_rendering_reference())
+			{
+				ImGui::ProgressBar(m_scene.reference_progress(), ImVec2(100.f, 0.f));
+			}
+			else
+			{
+				PathTracerSettings settings = {
+				    .width               = m_context.render_extent.width,
+				    .height              = m_context.render_extent.height,
+				    .frames              = static_cast<uint32_t>(m_reference_frames),
+				    .max_depth           = m_renderer.path_tracing.max_depth(),
+				    .bias                = m_renderer.path_tracing.bias(),
+				    .view_projection_inv = glm::inverse(m_camera.proj * m_camera.view),
+				    .cam_pos             = m_camera.position,
+				};
+
+				char *output_path = nullptr;
+				if (ImGui::Button("Render Reference") &&
+				    NFD_SaveDialog("hdr", std::filesystem::current_path().string().c_str(), &output_path) == NFD_OKAY)
+				{
+					std::string output_name = std::filesystem::path(output_path).extension() == ".hdr" ? output_path : fmt::format("{}.hdr", output_path);
+					m_scene.render_reference_async(settings, output_name);
+				}
+
+				// Logs the variance of the light tree against the power alias table at the same frame count
+				ImGui::SameLine();
+				if (ImGui::Button("Compare Emitter Sampling"))
+				{
+					m_scene.compare_emitter_sampling_async(settings);
+				}
+			}
 		}
 		else
 		{
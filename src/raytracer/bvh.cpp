@@ -0,0 +1,467 @@
+#include "bvh.hpp"
+#include "scene.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <execution>
+#include <future>
+#include <limits>
+#include <map>
+#include <numeric>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#	include <emmintrin.h>
+#	define BVH_SSE2
+#endif
+
+#define BVH_BINS 16
+#define BVH_PARALLEL_SIZE 16384             // Nodes this large build their right subtree on another thread
+#define BVH_PARALLEL_BIN_SIZE 262144        // Nodes this large are bounded, binned and partitioned in parallel chunks
+#define BVH_BIN_CHUNK_SIZE 65536
+
+// Bounds and id of a primitive, both corners are readable as 16 bytes
+struct BVHPrimitive
+{
+	glm::vec3 bbox_min;
+	uint32_t  id;
+	glm::vec3 bbox_max;
+	uint32_t  padding;
+};
+
+struct BVHBounds
+{
+	glm::vec4 bbox_min = glm::vec4(std::numeric_limits<float>::max());
+	glm::vec4 bbox_max = glm::vec4(-std::numeric_limits<float>::max());
+};
+
+// Primitive bounds per bin along each axis
+struct BVHBins
+{
+	std::array<std::array<BVHBounds, BVH_BINS>, 3> bounds;
+	std::array<std::array<uint32_t, BVH_BINS>, 3>  counts = {};
+};
+
+// Maps doubled centroids, bbox_min + bbox_max, to bins
+struct BVHBinning
+{
+	glm::vec4 offset = glm::vec4(0.f);
+	glm::vec4 scale  = glm::vec4(0.f);        // 0 along axes without centroid extent
+	uint32_t  count  = BVH_BINS;              // Small nodes use fewer bins
+};
+
+inline void grow(BVHBounds &bounds, const BVHBounds &other)
+{
+	bounds.bbox_min = glm::min(bounds.bbox_min, other.bbox_min);
+	bounds.bbox_max = glm::max(bounds.bbox_max, other.bbox_max);
+}
+
+inline float half_area(const BVHBounds &bounds)
+{
+	glm::vec3 extent = glm::max(glm::vec3(bounds.bbox_max - bounds.bbox_min), glm::vec3(0.f));
+	return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+inline float half_area(const BVHNode &node)
+{
+	glm::vec3 extent = glm::max(node.bbox_max - node.bbox_min, glm::vec3(0.f));
+	return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+inline uint32_t bin_index(const BVHBinning &binning, const BVHPrimitive &primitive, uint32_t axis)
+{
+	float centroid = primitive.bbox_min[axis] + primitive.bbox_max[axis];
+	return std::min(static_cast<uint32_t>(std::max((centroid - binning.offset[axis]) * binning.scale[axis], 0.f)), binning.count - 1);
+}
+
+// Bounds and doubled centroid bounds of a primitive range
+inline void bound_primitives(const BVHPrimitive *primitives, uint32_t count, BVHBounds &bounds, BVHBounds &centroid_bounds)
+{
+#ifdef BVH_SSE2
+	__m128 bbox_min     = _mm_set1_ps(std::numeric_limits<float>::max());
+	__m128 bbox_max     = _mm_set1_ps(-std::numeric_limits<float>::max());
+	__m128 centroid_min = bbox_min;
+	__m128 centroid_max = bbox_max;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		__m128 primitive_min = _mm_loadu_ps(glm::value_ptr(primitives[i].bbox_min));
+		__m128 primitive_max = _mm_loadu_ps(glm::value_ptr(primitives[i].bbox_max));
+		__m128 centroid      = _mm_add_ps(primitive_min, primitive_max);
+		bbox_min             = _mm_min_ps(bbox_min, primitive_min);
+		bbox_max             = _mm_max_ps(bbox_max, primitive_max);
+		centroid_min         = _mm_min_ps(centroid_min, centroid);
+		centroid_max         = _mm_max_ps(centroid_max, centroid);
+	}
+	_mm_storeu_ps(glm::value_ptr(bounds.bbox_min), bbox_min);
+	_mm_storeu_ps(glm::value_ptr(bounds.bbox_max), bbox_max);
+	_mm_storeu_ps(glm::value_ptr(centroid_bounds.bbox_min), centroid_min);
+	_mm_storeu_ps(glm::value_ptr(centroid_bounds.bbox_max), centroid_max);
+#else
+	for (uint32_t i = 0; i < count; i++)
+	{
+		glm::vec4 primitive_min = glm::vec4(primitives[i].bbox_min, 0.f);
+		glm::vec4 primitive_max = glm::vec4(primitives[i].bbox_max, 0.f);
+		grow(bounds, BVHBounds{primitive_min, primitive_max});
+		grow(centroid_bounds, BVHBounds{primitive_min + primitive_max, primitive_min + primitive_max});
+	}
+#endif
+}
+
+inline void bin_primitives(const BVHPrimitive *primitives, uint32_t count, const BVHBinning &binning, BVHBins &bins)
+{
+#ifdef BVH_SSE2
+	// One conversion yields the bins along all three axes, bin bounds grow with 16 byte min/max
+	const __m128 offset   = _mm_loadu_ps(glm::value_ptr(binning.offset));
+	const __m128 scale    = _mm_loadu_ps(glm::value_ptr(binning.scale));
+	const __m128 zero     = _mm_setzero_ps();
+	const __m128 last_bin = _mm_set1_ps(static_cast<float>(binning.count - 1));
+	for (uint32_t i = 0; i < count; i++)
+	{
+		__m128 primitive_min = _mm_loadu_ps(glm::value_ptr(primitives[i].bbox_min));
+		__m128 primitive_max = _mm_loadu_ps(glm::value_ptr(primitives[i].bbox_max));
+		__m128 bin           = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(primitive_min, primitive_max), offset), scale);
+		bin                  = _mm_min_ps(_mm_max_ps(bin, zero), last_bin);
+
+		alignas(16) int32_t index[4];
+		_mm_store_si128(reinterpret_cast<__m128i *>(index), _mm_cvttps_epi32(bin));
+		for (uint32_t axis = 0; axis < 3; axis++)
+		{
+			BVHBounds &bounds = bins.bounds[axis][index[axis]];
+			_mm_storeu_ps(glm::value_ptr(bounds.bbox_min), _mm_min_ps(_mm_loadu_ps(glm::value_ptr(bounds.bbox_min)), primitive_min));
+			_mm_storeu_ps(glm::value_ptr(bounds.bbox_max), _mm_max_ps(_mm_loadu_ps(glm::value_ptr(bounds.bbox_max)), primitive_max));
+			bins.counts[axis][index[axis]]++;
+		}
+	}
+#else
+	for (uint32_t i = 0; i < count; i++)
+	{
+		BVHBounds primitive_bounds = {glm::vec4(primitives[i].bbox_min, 0.f), glm::vec4(primitives[i].bbox_max, 0.f)};
+		for (uint32_t axis = 0; axis < 3; axis++)
+		{
+			uint32_t bin = bin_index(binning, primitives[i], axis);
+			grow(bins.bounds[axis][bin], primitive_bounds);
+			bins.counts[axis][bin]++;
+		}
+	}
+#endif
+}
+
+// Runs func over chunks of a large primitive range in parallel, one result per chunk
+template <typename T, typename Func>
+inline std::vector<T> for_each_chunk(uint32_t count, Func &&func)
+{
+	std::vector<uint32_t> chunks((count + BVH_BIN_CHUNK_SIZE - 1) / BVH_BIN_CHUNK_SIZE);
+	std::vector<T>        results(chunks.size());
+	std::iota(chunks.begin(), chunks.end(), 0);
+	std::for_each(std::execution::par, chunks.begin(), chunks.end(), [&](uint32_t chunk) {
+		uint32_t begin = chunk * BVH_BIN_CHUNK_SIZE;
+		func(begin, std::min(count - begin, static_cast<uint32_t>(BVH_BIN_CHUNK_SIZE)), results[chunk]);
+	});
+	return results;
+}
+
+inline uint32_t build_node(std::vector<BVHNode> &nodes, BVHPrimitive *primitives, uint32_t first, uint32_t count, uint32_t max_leaf_size)
+{
+	BVHPrimitive *range = primitives + first;
+
+	BVHBounds bounds, centroid_bounds;
+	if (count >= BVH_PARALLEL_BIN_SIZE)
+	{
+		auto chunk_bounds = for_each_chunk<std::array<BVHBounds, 2>>(count, [&](uint32_t begin, uint32_t chunk_count, std::array<BVHBounds, 2> &result) {
+			bound_primitives(range + begin, chunk_count, result[0], result[1]);
+		});
+		for (auto &chunk : chunk_bounds)
+		{
+			grow(bounds, chunk[0]);
+			grow(centroid_bounds, chunk[1]);
+		}
+	}
+	else
+	{
+		bound_primitives(range, count, bounds, centroid_bounds);
+	}
+
+	uint32_t node_index = static_cast<uint32_t>(nodes.size());
+	nodes.push_back(BVHNode{
+	    .bbox_min = glm::vec3(bounds.bbox_min),
+	    .index    = first,
+	    .bbox_max = glm::vec3(bounds.bbox_max),
+	    .count    = count,
+	});
+
+	if (count == 1)
+	{
+		return node_index;
+	}
+
+	BVHBinning binning;
+	binning.count     = std::min(count, static_cast<uint32_t>(BVH_BINS));
+	glm::vec3  extent = glm::vec3(centroid_bounds.bbox_max - centroid_bounds.bbox_min);
+	for (uint32_t axis = 0; axis < 3; axis++)
+	{
+		binning.offset[axis] = centroid_bounds.bbox_min[axis];
+		binning.scale[axis]  = extent[axis] > 0.f ? static_cast<float>(binning.count) * (1.f - 1e-6f) / extent[axis] : 0.f;
+	}
+
+	BVHBins bins;
+	if (count >= BVH_PARALLEL_BIN_SIZE)
+	{
+		auto chunk_bins = for_each_chunk<BVHBins>(count, [&](uint32_t begin, uint32_t chunk_count, BVHBins &result) {
+			bin_primitives(range + begin, chunk_count, binning, result);
+		});
+		for (auto &chunk : chunk_bins)
+		{
+			for (uint32_t axis = 0; axis < 3; axis++)
+			{
+				for (uint32_t bin = 0; bin < binning.count; bin++)
+				{
+					grow(bins.bounds[axis][bin], chunk.bounds[axis][bin]);
+					bins.counts[axis][bin] += chunk.counts[axis][bin];
+				}
+			}
+		}
+	}
+	else
+	{
+		bin_primitives(range, count, binning, bins);
+	}
+
+	// Sweep the bins from both sides, split cost is the SAH over both children
+	float    best_cost  = std::numeric_limits<float>::max();
+	uint32_t best_axis  = 0;
+	uint32_t best_split = 0;
+	for (uint32_t axis = 0; axis < 3; axis++)
+	{
+		if (binning.scale[axis] == 0.f)
+		{
+			continue;
+		}
+
+		std::array<float, BVH_BINS - 1> costs = {};
+
+		BVHBounds below;
+		uint32_t  below_count = 0;
+		for (uint32_t split = 0; split < binning.count - 1; split++)
+		{
+			grow(below, bins.bounds[axis][split]);
+			below_count += bins.counts[axis][split];
+			costs[split] = half_area(below) * static_cast<float>(below_count);
+		}
+
+		BVHBounds above;
+		uint32_t  above_count = 0;
+		for (uint32_t split = binning.count - 1; split > 0; split--)
+		{
+			grow(above, bins.bounds[axis][split]);
+			above_count += bins.counts[axis][split];
+			costs[split - 1] += half_area(above) * static_cast<float>(above_count);
+		}
+
+		for (uint32_t split = 0; split < binning.count - 1; split++)
+		{
+			if (costs[split] < best_cost)
+			{
+				best_cost  = costs[split];
+				best_axis  = axis;
+				best_split = split;
+			}
+		}
+	}
+
+	// Unit traversal and intersection costs relative to the node area
+	float leaf_cost = half_area(bounds) * static_cast<float>(count);
+	if (count <= max_leaf_size && leaf_cost <= half_area(bounds) + best_cost)
+	{
+		return node_index;
+	}
+
+	uint32_t mid = 0;
+	if (best_cost < std::numeric_limits<float>::max())
+	{
+		auto below = [&](const BVHPrimitive &primitive) {
+			return bin_index(binning, primitive, best_axis) <= best_split;
+		};
+		mid = static_cast<uint32_t>((count >= BVH_PARALLEL_BIN_SIZE ? std::partition(std::execution::par, range, range + count, below) : std::partition(range, range + count, below)) - range);
+	}
+
+	// Coincident centroids split in the middle
+	if (mid == 0 || mid == count)
+	{
+		mid = count / 2;
+	}
+
+	// Large subtrees build their right half on another thread and are appended after the left one
+	uint32_t right = 0;
+	if (count >= BVH_PARALLEL_SIZE)
+	{
+		std::vector<BVHNode>  right_nodes;
+		std::future<uint32_t> right_build = std::async(std::launch::async, build_node, std::ref(right_nodes), primitives, first + mid, count - mid, max_leaf_size);
+
+		build_node(nodes, primitives, first, mid, max_leaf_size);
+		right_build.wait();
+
+		right = static_cast<uint32_t>(nodes.size());
+		for (auto &node : right_nodes)
+		{
+			if (node.count == 0)
+			{
+				node.index += right;
+			}
+		}
+		nodes.insert(nodes.end(), right_nodes.begin(), right_nodes.end());
+	}
+	else
+	{
+		build_node(nodes, primitives, first, mid, max_leaf_size);
+		right = build_node(nodes, primitives, first + mid, count - mid, max_leaf_size);
+	}
+
+	nodes[node_index].index = right;
+	nodes[node_index].count = 0;
+
+	return node_index;
+}
+
+BVH build_bvh(const std::vector<std::array<glm::vec3, 2>> &bounds, uint32_t max_leaf_size)
+{
+	std::vector<BVHPrimitive> primitives(bounds.size());
+	for (uint32_t i = 0; i < bounds.size(); i++)
+	{
+		primitives[i] = BVHPrimitive{
+		    .bbox_min = bounds[i][0],
+		    .id       = i,
+		    .bbox_max = bounds[i][1],
+		    .padding  = 0,
+		};
+	}
+
+	BVH bvh;
+	if (!primitives.empty())
+	{
+		bvh.nodes.reserve(2 * primitives.size() - 1);
+		build_node(bvh.nodes, primitives.data(), 0, static_cast<uint32_t>(primitives.size()), std::max(max_leaf_size, 1u));
+	}
+
+	bvh.primitives.resize(primitives.size());
+	for (uint32_t i = 0; i < primitives.size(); i++)
+	{
+		bvh.primitives[i] = primitives[i].id;
+	}
+
+	return bvh;
+}
+
+void refit_bvh(BVH &bvh, const std::vector<std::array<glm::vec3, 2>> &bounds)
+{
+	// Children are stored after their parent
+	for (size_t i = bvh.nodes.size(); i-- > 0;)
+	{
+		auto &node = bvh.nodes[i];
+
+		node.bbox_min = glm::vec3(std::numeric_limits<float>::max());
+		node.bbox_max = glm::vec3(-std::numeric_limits<float>::max());
+		if (node.count > 0)
+		{
+			for (uint32_t j = node.index; j < node.index + node.count; j++)
+			{
+				node.bbox_min = glm::min(node.bbox_min, bounds[bvh.primitives[j]][0]);
+				node.bbox_max = glm::max(node.bbox_max, bounds[bvh.primitives[j]][1]);
+			}
+		}
+		else
+		{
+			node.bbox_min = glm::min(bvh.nodes[i + 1].bbox_min, bvh.nodes[node.index].bbox_min);
+			node.bbox_max = glm::max(bvh.nodes[i + 1].bbox_max, bvh.nodes[node.index].bbox_max);
+		}
+	}
+}
+
+float sah_cost(const BVH &bvh)
+{
+	if (bvh.nodes.empty() || half_area(bvh.nodes[0]) <= 0.f)
+	{
+		return 0.f;
+	}
+
+	float cost = 0.f;
+	for (auto &node : bvh.nodes)
+	{
+		cost += half_area(node) * static_cast<float>(node.count > 0 ? node.count : 1);
+	}
+
+	return cost / half_area(bvh.nodes[0]);
+}
+
+inline std::vector<std::array<glm::vec3, 2>> triangle_bounds(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, const glm::uvec3 &geometry)
+{
+	std::vector<std::array<glm::vec3, 2>> bounds(geometry.z / 3);
+	for (uint32_t i = 0; i < bounds.size(); i++)
+	{
+		glm::vec3 p0 = glm::vec3(vertices[geometry.x + indices[geometry.y + i * 3 + 0]].position);
+		glm::vec3 p1 = glm::vec3(vertices[geometry.x + indices[geometry.y + i * 3 + 1]].position);
+		glm::vec3 p2 = glm::vec3(vertices[geometry.x + indices[geometry.y + i * 3 + 2]].position);
+		bounds[i]    = {glm::min(p0, glm::min(p1, p2)), glm::max(p0, glm::max(p1, p2))};
+	}
+	return bounds;
+}
+
+SceneBVH build_scene_bvh(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, const std::vector<Instance> &instances)
+{
+	SceneBVH bvh;
+
+	// Instances sharing a vertex and index range share a bottom level
+	std::map<std::array<uint32_t, 3>, uint32_t> geometry_map;
+	for (auto &instance : instances)
+	{
+		auto [it, inserted] = geometry_map.emplace(std::array<uint32_t, 3>{instance.vertices_offset, instance.indices_offset, instance.indices_count}, static_cast<uint32_t>(bvh.geometries.size()));
+		if (inserted)
+		{
+			bvh.geometries.emplace_back(instance.vertices_offset, instance.indices_offset, instance.indices_count);
+		}
+		bvh.instance_blas.push_back(it->second);
+	}
+
+	bvh.blas.resize(bvh.geometries.size());
+
+	std::vector<uint32_t> blas_ids(bvh.geometries.size());
+	std::iota(blas_ids.begin(), blas_ids.end(), 0);
+	std::for_each(std::execution::par, blas_ids.begin(), blas_ids.end(), [&](uint32_t blas_id) {
+		bvh.blas[blas_id] = build_bvh(triangle_bounds(vertices, indices, bvh.geometries[blas_id]));
+	});
+
+	rebuild_scene_tlas(bvh, instances);
+
+	return bvh;
+}
+
+void refit_scene_blas(SceneBVH &bvh, uint32_t instance_id, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices)
+{
+	uint32_t blas_id = bvh.instance_blas[instance_id];
+	refit_bvh(bvh.blas[blas_id], triangle_bounds(vertices, indices, bvh.geometries[blas_id]));
+}
+
+void rebuild_scene_tlas(SceneBVH &bvh, const std::vector<Instance> &instances)
+{
+	std::vector<std::array<glm::vec3, 2>> bounds(instances.size(), {glm::vec3(std::numeric_limits<float>::max()), glm::vec3(-std::numeric_limits<float>::max())});
+	for (uint32_t instance_id = 0; instance_id < instances.size(); instance_id++)
+	{
+		const BVH &blas = bvh.blas[bvh.instance_blas[instance_id]];
+		if (blas.nodes.empty())
+		{
+			continue;
+		}
+
+		for (uint32_t corner = 0; corner < 8; corner++)
+		{
+			glm::vec3 p = glm::vec3(
+			    corner & 1 ? blas.nodes[0].bbox_max.x : blas.nodes[0].bbox_min.x,
+			    corner & 2 ? blas.nodes[0].bbox_max.y : blas.nodes[0].bbox_min.y,
+			    corner & 4 ? blas.nodes[0].bbox_max.z : blas.nodes[0].bbox_min.z);
+			p                     = glm::vec3(instances[instance_id].transform * glm::vec4(p, 1.f));
+			bounds[instance_id][0] = glm::min(bounds[instance_id][0], p);
+			bounds[instance_id][1] = glm::max(bounds[instance_id][1], p);
+		}
+	}
+
+	bvh.tlas = build_bvh(bounds, 1);
+}
@@ -0,0 +1,753 @@
+#include "bvh8.hpp"
+#include "random.hpp"
+#include "scene.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <execution>
+#include <numeric>
+
+#if defined(__AVX2__)
+#	include <immintrin.h>
+#	define BVH8_AVX2
+#elif defined(_M_X64) || defined(__SSE2__)
+#	include <emmintrin.h>
+#	define BVH8_SSE2
+#endif
+
+#define BVH8_STACK_SIZE 512
+#define BVH8_PACKET_SIZE 8
+#define BVH8_FAR_SCALE 1.0000004f        // 1 + 2 gamma(3), keeps the slab test conservative for the watertight triangle test
+#define SHADOW_EPSILON 0.0001f           // ShadowEpsilon in common.slangh
+
+// Ray prepared for the slab and watertight triangle tests
+struct BVH8Ray
+{
+	glm::vec3 origin;
+	float     t_min;
+	glm::vec3 inv_direction;
+	float     t_max;
+	glm::vec3 shear;        // Direction sheared onto the kz axis, xy - shear, z - 1 / direction[kz]
+	uint32_t  kx;
+	uint32_t  ky;
+	uint32_t  kz;
+};
+
+struct BVH8StackEntry
+{
+	int32_t  child;
+	uint32_t count;
+	uint32_t rays;        // Packet rays that reached the node
+	float    t_near;
+};
+
+inline float half_area(const BVHNode &node)
+{
+	glm::vec3 extent = glm::max(node.bbox_max - node.bbox_min, glm::vec3(0.f));
+	return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+inline BVH8Ray setup_ray(const glm::vec3 &origin, const glm::vec3 &direction, float t_min, float t_max)
+{
+	BVH8Ray ray;
+	ray.origin = origin;
+	ray.t_min  = t_min;
+	ray.t_max  = t_max;
+	for (uint32_t axis = 0; axis < 3; axis++)
+	{
+		ray.inv_direction[axis] = 1.f / (std::abs(direction[axis]) > 1e-20f ? direction[axis] : std::copysign(1e-20f, direction[axis]));
+	}
+
+	glm::vec3 abs_direction = glm::abs(direction);
+	ray.kz                  = abs_direction.x > abs_direction.y ? (abs_direction.x > abs_direction.z ? 0 : 2) : (abs_direction.y > abs_direction.z ? 1 : 2);
+	ray.kx                  = (ray.kz + 1) % 3;
+	ray.ky                  = (ray.kx + 1) % 3;
+	if (direction[ray.kz] < 0.f)
+	{
+		std::swap(ray.kx, ray.ky);
+	}
+	ray.shear = glm::vec3(direction[ray.kx] / direction[ray.kz], direction[ray.ky] / direction[ray.kz], 1.f / direction[ray.kz]);
+
+	return ray;
+}
+
+// Slab test against the eight children, returns the bit mask of children hit and their entry distances
+inline uint32_t intersect_node(const BVH8Node &node, const BVH8Ray &ray, float t_max, float *t_near)
+{
+#if defined(BVH8_AVX2)
+	const __m256 origin_x = _mm256_set1_ps(ray.origin.x);
+	const __m256 origin_y = _mm256_set1_ps(ray.origin.y);
+	const __m256 origin_z = _mm256_set1_ps(ray.origin.z);
+	const __m256 inv_x    = _mm256_set1_ps(ray.inv_direction.x);
+	const __m256 inv_y    = _mm256_set1_ps(ray.inv_direction.y);
+	const __m256 inv_z    = _mm256_set1_ps(ray.inv_direction.z);
+
+	__m256 t0_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bbox_min_x), origin_x), inv_x);
+	__m256 t1_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bbox_max_x), origin_x), inv_x);
+	__m256 t0_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bbox_min_y), origin_y), inv_y);
+	__m256 t1_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bbox_max_y), origin_y), inv_y);
+	__m256 t0_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bbox_min_z), origin_z), inv_z);
+	__m256 t1_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bbox_max_z), origin_z), inv_z);
+
+	__m256 near = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0_x, t1_x), _mm256_min_ps(t0_y, t1_y)), _mm256_max_ps(_mm256_min_ps(t0_z, t1_z), _mm256_set1_ps(ray.t_min)));
+	__m256 far  = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0_x, t1_x), _mm256_max_ps(t0_y, t1_y)), _mm256_min_ps(_mm256_max_ps(t0_z, t1_z), _mm256_set1_ps(t_max)));
+	far         = _mm256_mul_ps(far, _mm256_set1_ps(BVH8_FAR_SCALE));
+
+	_mm256_storeu_ps(t_near, near);
+	return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(near, far, _CMP_LE_OQ))) & node.valid;
+#elif defined(BVH8_SSE2)
+	// Two halves of four children
+	const __m128 origin_x = _mm_set1_ps(ray.origin.x);
+	const __m128 origin_y = _mm_set1_ps(ray.origin.y);
+	const __m128 origin_z = _mm_set1_ps(ray.origin.z);
+	const __m128 inv_x    = _mm_set1_ps(ray.inv_direction.x);
+	const __m128 inv_y    = _mm_set1_ps(ray.inv_direction.y);
+	const __m128 inv_z    = _mm_set1_ps(ray.inv_direction.z);
+
+	uint32_t mask = 0;
+	for (uint32_t half = 0; half < 8; half += 4)
+	{
+		__m128 t0_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bbox_min_x + half), origin_x), inv_x);
+		__m128 t1_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bbox_max_x + half), origin_x), inv_x);
+		__m128 t0_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bbox_min_y + half), origin_y), inv_y);
+		__m128 t1_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bbox_max_y + half), origin_y), inv_y);
+		__m128 t0_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bbox_min_z + half), origin_z), inv_z);
+		__m128 t1_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bbox_max_z + half), origin_z), inv_z);
+
+		__m128 near = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0_x, t1_x), _mm_min_ps(t0_y, t1_y)), _mm_max_ps(_mm_min_ps(t0_z, t1_z), _mm_set1_ps(ray.t_min)));
+		__m128 far  = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0_x, t1_x), _mm_max_ps(t0_y, t1_y)), _mm_min_ps(_mm_max_ps(t0_z, t1_z), _mm_set1_ps(t_max)));
+		far         = _mm_mul_ps(far, _mm_set1_ps(BVH8_FAR_SCALE));
+
+		_mm_storeu_ps(t_near + half, near);
+		mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(near, far))) << half;
+	}
+	return mask & node.valid;
+#else
+	uint32_t mask = 0;
+	for (uint32_t i = 0; i < 8; i++)
+	{
+		float t0_x = (node.bbox_min_x[i] - ray.origin.x) * ray.inv_direction.x;
+		float t1_x = (node.bbox_max_x[i] - ray.origin.x) * ray.inv_direction.x;
+		float t0_y = (node.bbox_min_y[i] - ray.origin.y) * ray.inv_direction.y;
+		float t1_y = (node.bbox_max_y[i] - ray.origin.y) * ray.inv_direction.y;
+		float t0_z = (node.bbox_min_z[i] - ray.origin.z) * ray.inv_direction.z;
+		float t1_z = (node.bbox_max_z[i] - ray.origin.z) * ray.inv_direction.z;
+
+		t_near[i] = std::max(std::max(std::min(t0_x, t1_x), std::min(t0_y, t1_y)), std::max(std::min(t0_z, t1_z), ray.t_min));
+		float far = std::min(std::min(std::max(t0_x, t1_x), std::max(t0_y, t1_y)), std::min(std::max(t0_z, t1_z), t_max)) * BVH8_FAR_SCALE;
+		mask |= static_cast<uint32_t>(t_near[i] <= far) << i;
+	}
+	return mask & node.valid;
+#endif
+}
+
+// Watertight ray triangle test, both faces are hit since every instance disables facing culling
+inline bool intersect_triangle(const BVH8Ray &ray, const BVH8Triangle &triangle, float t_max, float &t, glm::vec2 &bary)
+{
+	const glm::vec3 a = triangle.p0 - ray.origin;
+	const glm::vec3 b = triangle.p1 - ray.origin;
+	const glm::vec3 c = triangle.p2 - ray.origin;
+
+	const float a_x = a[ray.kx] - ray.shear.x * a[ray.kz];
+	const float a_y = a[ray.ky] - ray.shear.y * a[ray.kz];
+	const float b_x = b[ray.kx] - ray.shear.x * b[ray.kz];
+	const float b_y = b[ray.ky] - ray.shear.y * b[ray.kz];
+	const float c_x = c[ray.kx] - ray.shear.x * c[ray.kz];
+	const float c_y = c[ray.ky] - ray.shear.y * c[ray.kz];
+
+	float u = c_x * b_y - c_y * b_x;
+	float v = a_x * c_y - a_y * c_x;
+	float w = b_x * a_y - b_y * a_x;
+
+	// Edges through the ray fall back to double precision
+	if (u == 0.f || v == 0.f || w == 0.f)
+	{
+		u = static_cast<float>(static_cast<double>(c_x) * static_cast<double>(b_y) - static_cast<double>(c_y) * static_cast<double>(b_x));
+		v = static_cast<float>(static_cast<double>(a_x) * static_cast<double>(c_y) - static_cast<double>(a_y) * static_cast<double>(c_x));
+		w = static_cast<float>(static_cast<double>(b_x) * static_cast<double>(a_y) - static_cast<double>(b_y) * static_cast<double>(a_x));
+	}
+
+	if ((u < 0.f || v < 0.f || w < 0.f) && (u > 0.f || v > 0.f || w > 0.f))
+	{
+		return false;
+	}
+
+	const float det = u + v + w;
+	if (det == 0.f)
+	{
+		return false;
+	}
+
+	const float inv_det = 1.f / det;
+	t                   = (u * ray.shear.z * a[ray.kz] + v * ray.shear.z * b[ray.kz] + w * ray.shear.z * c[ray.kz]) * inv_det;
+	if (!(t >= ray.t_min && t < t_max))
+	{
+		return false;
+	}
+
+	bary = glm::vec2(v, w) * inv_det;
+	return true;
+}
+
+inline float sample_alpha(const BVH8AlphaTexture &texture, const glm::vec2 &uv)
+{
+	float x  = uv.x * static_cast<float>(texture.width) - 0.5f;
+	float y  = uv.y * static_cast<float>(texture.height) - 0.5f;
+	float fx = std::floor(x);
+	float fy = std::floor(y);
+
+	int64_t  width  = static_cast<int64_t>(texture.width);
+	int64_t  height = static_cast<int64_t>(texture.height);
+	uint32_t x0     = static_cast<uint32_t>(((static_cast<int64_t>(fx) % width) + width) % width);
+	uint32_t y0     = static_cast<uint32_t>(((static_cast<int64_t>(fy) % height) + height) % height);
+	uint32_t x1     = (x0 + 1) % texture.width;
+	uint32_t y1     = (y0 + 1) % texture.height;
+
+	float a00 = texture.alpha[y0 * texture.width + x0];
+	float a10 = texture.alpha[y0 * texture.width + x1];
+	float a01 = texture.alpha[y1 * texture.width + x0];
+	float a11 = texture.alpha[y1 * texture.width + x1];
+
+	float wx = x - fx;
+	float wy = y - fy;
+	return ((a00 * (1.f - wx) + a10 * wx) * (1.f - wy) + (a01 * (1.f - wx) + a11 * wx) * wy) / 255.f;
+}
+
+// hit_test() in raytrace.slangh
+inline bool alpha_test(const SceneBVH8 &bvh8, const BVH8Material &material, const std::array<glm::vec2, 3> &texcoords, const glm::vec2 &bary, uint32_t &seed)
+{
+	float alpha = material.base_alpha;
+	if (material.texture > -1)
+	{
+		glm::vec2 uv = texcoords[0] * (1.f - bary.x - bary.y) + texcoords[1] * bary.x + texcoords[2] * bary.y;
+		alpha *= sample_alpha(bvh8.alpha_textures[material.texture], uv);
+	}
+
+	float opacity = material.alpha_mode == 1 ? (alpha > material.cutoff ? 1.f : 0.f) : alpha;
+
+	return !(random_float(seed) > opacity);
+}
+
+// Pushes the children hit far to near, so the nearest one is popped first
+inline void push_children(BVH8StackEntry *stack, uint32_t &stack_size, const BVH8Node &node, uint32_t mask, const float *t_near, const uint32_t *rays)
+{
+	uint32_t first = stack_size;
+	while (mask)
+	{
+		uint32_t slot = std::countr_zero(mask);
+		mask &= mask - 1;
+
+		BVH8StackEntry entry = {node.child[slot], node.count[slot], rays ? rays[slot] : 1u, t_near[slot]};
+
+		uint32_t i = stack_size++;
+		while (i > first && stack[i - 1].t_near < entry.t_near)
+		{
+			stack[i] = stack[i - 1];
+			i--;
+		}
+		stack[i] = entry;
+	}
+}
+
+// Visits the leaves a ray reaches nearest first, t_max shrinks as the leaf commits hits, the leaf returns true to end the traversal
+template <typename Leaf>
+inline void traverse(const BVH8 &bvh, const BVH8Ray &ray, const float &t_max, Leaf &&leaf)
+{
+	if (bvh.nodes.empty())
+	{
+		return;
+	}
+
+	BVH8StackEntry stack[BVH8_STACK_SIZE];
+	uint32_t       stack_size = 0;
+
+	stack[stack_size++] = {0, 0, 1u, ray.t_min};
+	while (stack_size > 0)
+	{
+		const BVH8StackEntry entry = stack[--stack_size];
+		if (entry.t_near > t_max)
+		{
+			continue;
+		}
+
+		if (entry.count > 0)
+		{
+			if (leaf(static_cast<uint32_t>(~entry.child), entry.count))
+			{
+				return;
+			}
+			continue;
+		}
+
+		const BVH8Node &node = bvh.nodes[entry.child];
+
+		float    t_near[8];
+		uint32_t mask = intersect_node(node, ray, t_max, t_near);
+		push_children(stack, stack_size, node, mask, t_near, nullptr);
+	}
+}
+
+// Packet traversal visits a node if any active ray of the packet reaches it, each child carries the mask of rays that reached it
+template <typename Leaf>
+inline void traverse_packet(const BVH8 &bvh, const BVH8Ray *rays, const float *t_max, const uint32_t &active, uint32_t packet, Leaf &&leaf)
+{
+	if (bvh.nodes.empty())
+	{
+		return;
+	}
+
+	BVH8StackEntry stack[BVH8_STACK_SIZE];
+	uint32_t       stack_size = 0;
+
+	stack[stack_size++] = {0, 0, packet, 0.f};
+	while (stack_size > 0 && active != 0)
+	{
+		BVH8StackEntry entry = stack[--stack_size];
+		entry.rays &= active;
+		if (entry.rays == 0)
+		{
+			continue;
+		}
+
+		if (entry.count > 0)
+		{
+			leaf(static_cast<uint32_t>(~entry.child), entry.count, entry.rays);
+			continue;
+		}
+
+		const BVH8Node &node = bvh.nodes[entry.child];
+
+		uint32_t child_rays[8] = {};
+		float    child_near[8];
+		std::fill_n(child_near, 8, std::numeric_limits<float>::infinity());
+
+		uint32_t mask = 0;
+		for (uint32_t ray_mask = entry.rays; ray_mask; ray_mask &= ray_mask - 1)
+		{
+			uint32_t ray_id = std::countr_zero(ray_mask);
+
+			float    t_near[8];
+			uint32_t ray_hits = intersect_node(node, rays[ray_id], t_max[ray_id], t_near);
+			mask |= ray_hits;
+			for (; ray_hits; ray_hits &= ray_hits - 1)
+			{
+				uint32_t slot = std::countr_zero(ray_hits);
+				child_rays[slot] |= 1u << ray_id;
+				child_near[slot] = std::min(child_near[slot], t_near[slot]);
+			}
+		}
+
+		push_children(stack, stack_size, node, mask, child_near, child_rays);
+	}
+}
+
+template <bool AnyHit>
+inline bool trace_ray(const SceneBVH8 &bvh8, const Ray &ray, bool force_opaque, uint32_t &seed, RayHit &hit)
+{
+	const BVH8Ray world = setup_ray(ray.origin, ray.direction, ray.t_min, ray.t_max);
+
+	float t_max = ray.t_max;
+	bool  found = false;
+
+	hit = RayHit{};
+	traverse(bvh8.tlas, world, t_max, [&](uint32_t first, uint32_t count) {
+		for (uint32_t i = first; i < first + count; i++)
+		{
+			const uint32_t      instance_id = bvh8.tlas.primitives[i];
+			const uint32_t      blas_id     = bvh8.instance_blas[instance_id];
+			const glm::mat4    &transform   = bvh8.world_to_object[instance_id];
+			const BVH8Material &material    = bvh8.materials[bvh8.instance_material[instance_id]];
+			const bool          alpha       = !force_opaque && material.alpha_mode != 0;
+			const auto         &triangles   = bvh8.triangles[blas_id];
+
+			// Distances stay comparable across instances since the direction is not renormalized
+			const BVH8Ray object = setup_ray(glm::vec3(transform * glm::vec4(ray.origin, 1.f)), glm::vec3(transform * glm::vec4(ray.direction, 0.f)), ray.t_min, ray.t_max);
+
+			bool terminated = false;
+			traverse(bvh8.blas[blas_id], object, t_max, [&](uint32_t triangle_first, uint32_t triangle_count) {
+				for (uint32_t j = triangle_first; j < triangle_first + triangle_count; j++)
+				{
+					float     t    = 0.f;
+					glm::vec2 bary = glm::vec2(0.f);
+					if (!intersect_triangle(object, triangles[j], t_max, t, bary) ||
+					    (alpha && !alpha_test(bvh8, material, bvh8.texcoords[blas_id][j], bary, seed)))
+					{
+						continue;
+					}
+
+					t_max = t;
+					hit   = RayHit{t, triangles[j].primitive, instance_id, bary};
+					found = true;
+					if constexpr (AnyHit)
+					{
+						terminated = true;
+						return true;
+					}
+				}
+				return false;
+			});
+
+			if (terminated)
+			{
+				return true;
+			}
+		}
+		return false;
+	});
+
+	return found;
+}
+
+template <bool AnyHit>
+inline uint32_t trace_packet(const SceneBVH8 &bvh8, const Ray *rays, uint32_t count, bool force_opaque, uint32_t *seeds, RayHit *hits)
+{
+	BVH8Ray  world[BVH8_PACKET_SIZE];
+	float    t_max[BVH8_PACKET_SIZE];
+	uint32_t packet = 0;
+	for (uint32_t ray_id = 0; ray_id < std::min(count, static_cast<uint32_t>(BVH8_PACKET_SIZE)); ray_id++)
+	{
+		world[ray_id] = setup_ray(rays[ray_id].origin, rays[ray_id].direction, rays[ray_id].t_min, rays[ray_id].t_max);
+		t_max[ray_id] = rays[ray_id].t_max;
+		hits[ray_id]  = RayHit{};
+		packet |= 1u << ray_id;
+	}
+
+	// Any hit rays leave the packet once they hit
+	uint32_t active   = packet;
+	uint32_t hit_mask = 0;
+	traverse_packet(bvh8.tlas, world, t_max, active, packet, [&](uint32_t first, uint32_t instance_count, uint32_t instance_rays) {
+		for (uint32_t i = first; i < first + instance_count; i++)
+		{
+			const uint32_t      instance_id = bvh8.tlas.primitives[i];
+			const uint32_t      blas_id     = bvh8.instance_blas[instance_id];
+			const glm::mat4    &transform   = bvh8.world_to_object[instance_id];
+			const BVH8Material &material    = bvh8.materials[bvh8.instance_material[instance_id]];
+			const bool          alpha       = !force_opaque && material.alpha_mode != 0;
+			const auto         &triangles   = bvh8.triangles[blas_id];
+
+			BVH8Ray object[BVH8_PACKET_SIZE];
+			for (uint32_t ray_mask = instance_rays & active; ray_mask; ray_mask &= ray_mask - 1)
+			{
+				uint32_t ray_id = std::countr_zero(ray_mask);
+				object[ray_id]  = setup_ray(glm::vec3(transform * glm::vec4(rays[ray_id].origin, 1.f)), glm::vec3(transform * glm::vec4(rays[ray_id].direction, 0.f)), rays[ray_id].t_min, rays[ray_id].t_max);
+			}
+
+			traverse_packet(bvh8.blas[blas_id], object, t_max, active, instance_rays, [&](uint32_t triangle_first, uint32_t triangle_count, uint32_t triangle_rays) {
+				for (uint32_t ray_mask = triangle_rays; ray_mask; ray_mask &= ray_mask - 1)
+				{
+					uint32_t ray_id = std::countr_zero(ray_mask);
+					for (uint32_t j = triangle_first; j < triangle_first + triangle_count; j++)
+					{
+						float     t    = 0.f;
+						glm::vec2 bary = glm::vec2(0.f);
+						if (!intersect_triangle(object[ray_id], triangles[j], t_max[ray_id], t, bary) ||
+						    (alpha && !alpha_test(bvh8, material, bvh8.texcoords[blas_id][j], bary, seeds[ray_id])))
+						{
+							continue;
+						}
+
+						t_max[ray_id] = t;
+						hits[ray_id]  = RayHit{t, triangles[j].primitive, instance_id, bary};
+						hit_mask |= 1u << ray_id;
+						if constexpr (AnyHit)
+						{
+							active &= ~(1u << ray_id);
+							break;
+						}
+					}
+				}
+			});
+		}
+	});
+
+	return hit_mask;
+}
+
+inline uint32_t expand_bits(uint32_t v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+// Ray ids sorted by direction octant, then by the Morton code of the origin within the bounds of all origins
+inline std::vector<uint32_t> sort_rays(const std::vector<Ray> &rays)
+{
+	glm::vec3 bbox_min = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 bbox_max = glm::vec3(-std::numeric_limits<float>::max());
+	for (auto &ray : rays)
+	{
+		bbox_min = glm::min(bbox_min, ray.origin);
+		bbox_max = glm::max(bbox_max, ray.origin);
+	}
+	glm::vec3 scale = 511.f / glm::max(bbox_max - bbox_min, glm::vec3(1e-20f));
+
+	std::vector<uint32_t> ray_ids(rays.size());
+	std::vector<uint64_t> keys(rays.size());
+	std::iota(ray_ids.begin(), ray_ids.end(), 0);
+	std::for_each(std::execution::par, ray_ids.begin(), ray_ids.end(), [&](uint32_t ray_id) {
+		const Ray &ray    = rays[ray_id];
+		uint32_t   octant = static_cast<uint32_t>(ray.direction.x < 0.f) | static_cast<uint32_t>(ray.direction.y < 0.f) << 1 | static_cast<uint32_t>(ray.direction.z < 0.f) << 2;
+		glm::vec3  cell   = glm::min((ray.origin - bbox_min) * scale, glm::vec3(511.f));
+		uint32_t   morton = expand_bits(static_cast<uint32_t>(cell.x)) | expand_bits(static_cast<uint32_t>(cell.y)) << 1 | expand_bits(static_cast<uint32_t>(cell.z)) << 2;
+		keys[ray_id]      = static_cast<uint64_t>(octant << 27 | morton) << 32 | ray_id;
+	});
+	std::sort(std::execution::par, keys.begin(), keys.end());
+
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		ray_ids[i] = static_cast<uint32_t>(keys[i]);
+	}
+
+	return ray_ids;
+}
+
+template <bool AnyHit, typename Result>
+inline void trace_stream(const SceneBVH8 &bvh8, const std::vector<Ray> &rays, bool force_opaque, std::vector<uint32_t> &seeds, Result &&result)
+{
+	std::vector<uint32_t> ray_ids = sort_rays(rays);
+
+	std::vector<uint32_t> packets((rays.size() + BVH8_PACKET_SIZE - 1) / BVH8_PACKET_SIZE);
+	std::iota(packets.begin(), packets.end(), 0);
+	std::for_each(std::execution::par, packets.begin(), packets.end(), [&](uint32_t packet) {
+		uint32_t first = packet * BVH8_PACKET_SIZE;
+		uint32_t count = std::min(static_cast<uint32_t>(rays.size()) - first, static_cast<uint32_t>(BVH8_PACKET_SIZE));
+
+		Ray      packet_rays[BVH8_PACKET_SIZE];
+		uint32_t packet_seeds[BVH8_PACKET_SIZE];
+		RayHit   packet_hits[BVH8_PACKET_SIZE];
+		for (uint32_t i = 0; i < count; i++)
+		{
+			packet_rays[i]  = rays[ray_ids[first + i]];
+			packet_seeds[i] = seeds[ray_ids[first + i]];
+		}
+
+		uint32_t hit_mask = trace_packet<AnyHit>(bvh8, packet_rays, count, force_opaque, packet_seeds, packet_hits);
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			seeds[ray_ids[first + i]] = packet_seeds[i];
+			result(ray_ids[first + i], (hit_mask >> i) & 1u, packet_hits[i]);
+		}
+	});
+}
+
+inline void gather_triangles(SceneBVH8 &bvh8, const SceneBVH &bvh, uint32_t blas_id, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, bool texcoords)
+{
+	const glm::uvec3            &geometry   = bvh.geometries[blas_id];
+	const std::vector<uint32_t> &primitives = bvh.blas[blas_id].primitives;
+
+	bvh8.triangles[blas_id].resize(primitives.size());
+	if (texcoords)
+	{
+		bvh8.texcoords[blas_id].resize(primitives.size());
+	}
+
+	for (uint32_t i = 0; i < primitives.size(); i++)
+	{
+		const Vertex &v0 = vertices[geometry.x + indices[geometry.y + primitives[i] * 3 + 0]];
+		const Vertex &v1 = vertices[geometry.x + indices[geometry.y + primitives[i] * 3 + 1]];
+		const Vertex &v2 = vertices[geometry.x + indices[geometry.y + primitives[i] * 3 + 2]];
+
+		bvh8.triangles[blas_id][i] = BVH8Triangle{
+		    .p0        = glm::vec3(v0.position),
+		    .primitive = primitives[i],
+		    .p1        = glm::vec3(v1.position),
+		    .padding0  = 0,
+		    .p2        = glm::vec3(v2.position),
+		    .padding1  = 0,
+		};
+
+		if (texcoords)
+		{
+			bvh8.texcoords[blas_id][i] = {glm::vec2(v0.position.w, v0.normal.w), glm::vec2(v1.position.w, v1.normal.w), glm::vec2(v2.position.w, v2.normal.w)};
+		}
+	}
+}
+
+BVH8 collapse_bvh(const BVH &bvh)
+{
+	BVH8 bvh8;
+	bvh8.primitives = bvh.primitives;
+	if (bvh.nodes.empty())
+	{
+		return bvh8;
+	}
+
+	// Binary node - BVH8 node, breadth first
+	std::vector<std::pair<uint32_t, uint32_t>> queue = {{0u, 0u}};
+	bvh8.nodes.reserve(bvh.nodes.size() / 4 + 1);
+	bvh8.nodes.emplace_back();
+	for (size_t i = 0; i < queue.size(); i++)
+	{
+		auto [binary_index, index] = queue[i];
+
+		std::array<uint32_t, 8> children    = {};
+		uint32_t                child_count = 0;
+		if (bvh.nodes[binary_index].count > 0)
+		{
+			// A root leaf gets an interior node of its own
+			children[child_count++] = binary_index;
+		}
+		else
+		{
+			children[child_count++] = binary_index + 1;
+			children[child_count++] = bvh.nodes[binary_index].index;
+		}
+
+		while (child_count < 8)
+		{
+			int32_t largest      = -1;
+			float   largest_area = -1.f;
+			for (uint32_t j = 0; j < child_count; j++)
+			{
+				if (bvh.nodes[children[j]].count == 0 && half_area(bvh.nodes[children[j]]) > largest_area)
+				{
+					largest      = static_cast<int32_t>(j);
+					largest_area = half_area(bvh.nodes[children[j]]);
+				}
+			}
+
+			if (largest < 0)
+			{
+				break;
+			}
+
+			uint32_t opened         = children[largest];
+			children[largest]       = opened + 1;
+			children[child_count++] = bvh.nodes[opened].index;
+		}
+
+		BVH8Node node = {};
+		for (uint32_t j = 0; j < child_count; j++)
+		{
+			const BVHNode &child = bvh.nodes[children[j]];
+
+			node.bbox_min_x[j] = child.bbox_min.x;
+			node.bbox_min_y[j] = child.bbox_min.y;
+			node.bbox_min_z[j] = child.bbox_min.z;
+			node.bbox_max_x[j] = child.bbox_max.x;
+			node.bbox_max_y[j] = child.bbox_max.y;
+			node.bbox_max_z[j] = child.bbox_max.z;
+			node.valid |= 1u << j;
+
+			if (child.count > 0)
+			{
+				node.child[j] = ~static_cast<int32_t>(child.index);
+				node.count[j] = static_cast<uint8_t>(child.count);
+			}
+			else
+			{
+				node.child[j] = static_cast<int32_t>(bvh8.nodes.size());
+				bvh8.nodes.emplace_back();
+				queue.emplace_back(children[j], static_cast<uint32_t>(node.child[j]));
+			}
+		}
+		bvh8.nodes[index] = node;
+	}
+
+	return bvh8;
+}
+
+SceneBVH8 build_scene_bvh8(const SceneBVH &bvh, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, const std::vector<Instance> &instances, std::vector<BVH8Material> &&materials, std::vector<BVH8AlphaTexture> &&alpha_textures)
+{
+	SceneBVH8 bvh8;
+	bvh8.materials      = std::move(materials);
+	bvh8.alpha_textures = std::move(alpha_textures);
+	bvh8.instance_blas  = bvh.instance_blas;
+
+	bvh8.blas.resize(bvh.blas.size());
+	bvh8.triangles.resize(bvh.blas.size());
+	bvh8.texcoords.resize(bvh.blas.size());
+
+	// Only bottom levels of alpha tested instances keep texcoords
+	std::vector<uint8_t> blas_texcoords(bvh.blas.size(), 0);
+	for (uint32_t instance_id = 0; instance_id < instances.size(); instance_id++)
+	{
+		const BVH8Material &material = bvh8.materials[instances[instance_id].material];
+		bvh8.instance_material.push_back(instances[instance_id].material);
+		if (material.alpha_mode != 0 && material.texture > -1)
+		{
+			blas_texcoords[bvh.instance_blas[instance_id]] = 1;
+		}
+	}
+
+	std::vector<uint32_t> blas_ids(bvh.blas.size());
+	std::iota(blas_ids.begin(), blas_ids.end(), 0);
+	std::for_each(std::execution::par, blas_ids.begin(), blas_ids.end(), [&](uint32_t blas_id) {
+		bvh8.blas[blas_id] = collapse_bvh(bvh.blas[blas_id]);
+		gather_triangles(bvh8, bvh, blas_id, vertices, indices, blas_texcoords[blas_id]);
+	});
+
+	rebuild_scene_bvh8_tlas(bvh8, bvh, instances);
+
+	return bvh8;
+}
+
+void refit_scene_bvh8_blas(SceneBVH8 &bvh8, const SceneBVH &bvh, uint32_t instance_id, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices)
+{
+	uint32_t blas_id   = bvh8.instance_blas[instance_id];
+	bvh8.blas[blas_id] = collapse_bvh(bvh.blas[blas_id]);
+	gather_triangles(bvh8, bvh, blas_id, vertices, indices, !bvh8.texcoords[blas_id].empty());
+}
+
+void rebuild_scene_bvh8_tlas(SceneBVH8 &bvh8, const SceneBVH &bvh, const std::vector<Instance> &instances)
+{
+	bvh8.tlas = collapse_bvh(bvh.tlas);
+
+	bvh8.world_to_object.resize(instances.size());
+	for (uint32_t instance_id = 0; instance_id < instances.size(); instance_id++)
+	{
+		bvh8.world_to_object[instance_id] = instances[instance_id].transform_inv;
+	}
+}
+
+Ray shadow_ray(const glm::vec3 &origin, const glm::vec3 &direction, float max_dist)
+{
+	return Ray{
+	    .origin    = origin,
+	    .t_min     = 0.001f,
+	    .direction = direction,
+	    .t_max     = (1.f - SHADOW_EPSILON) * max_dist,
+	};
+}
+
+bool closest_hit(const SceneBVH8 &bvh8, const Ray &ray, bool force_opaque, uint32_t &seed, RayHit &hit)
+{
+	return trace_ray<false>(bvh8, ray, force_opaque, seed, hit);
+}
+
+bool any_hit(const SceneBVH8 &bvh8, const Ray &ray, uint32_t &seed)
+{
+	RayHit hit;
+	return trace_ray<true>(bvh8, ray, false, seed, hit);
+}
+
+uint32_t closest_hit_packet(const SceneBVH8 &bvh8, const Ray *rays, uint32_t count, bool force_opaque, uint32_t *seeds, RayHit *hits)
+{
+	return trace_packet<false>(bvh8, rays, count, force_opaque, seeds, hits);
+}
+
+uint32_t any_hit_packet(const SceneBVH8 &bvh8, const Ray *rays, uint32_t count, uint32_t *seeds)
+{
+	RayHit hits[BVH8_PACKET_SIZE];
+	return trace_packet<true>(bvh8, rays, count, false, seeds, hits);
+}
+
+void closest_hit_stream(const SceneBVH8 &bvh8, const std::vector<Ray> &rays, bool force_opaque, std::vector<uint32_t> &seeds, std::vector<RayHit> &hits)
+{
+	hits.resize(rays.size());
+	trace_stream<false>(bvh8, rays, force_opaque, seeds, [&](uint32_t ray_id, uint32_t, const RayHit &hit) {
+		hits[ray_id] = hit;
+	});
+}
+
+void any_hit_stream(const SceneBVH8 &bvh8, const std::vector<Ray> &rays, std::vector<uint32_t> &seeds, std::vector<uint8_t> &occluded)
+{
+	occluded.resize(rays.size());
+	trace_stream<true>(bvh8, rays, false, seeds, [&](uint32_t ray_id, uint32_t hit, const RayHit &) {
+		occluded[ray_id] = static_cast<uint8_t>(hit);
+	});
+}
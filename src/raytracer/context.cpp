@@ -16,11 +16,47 @@
 
 #include <glm/gtx/hash.hpp>
 
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#define DEFERRED_DESTROY_LATENCY 3
+
+// Upper bound of the scratch arena shared by batched BLAS builds
+#define BLAS_SCRATCH_BUDGET (256ull << 20)
+
+struct ThreadCommandPools
+{
+	std::mutex                                                        mutex;
+	std::unordered_map<std::thread::id, std::array<VkCommandPool, 2>> pools;
+	std::vector<std::array<VkCommandPool, 2>>                         free_pools;        // Left by exited threads, their command buffers may still be in flight
+};
+
+// Moves the pools of an exiting thread to the free list, the Context may already be gone
+struct ThreadCommandPoolRelease
+{
+	std::weak_ptr<ThreadCommandPools> pools;
+
+	~ThreadCommandPoolRelease()
+	{
+		if (auto thread_pools = pools.lock())
+		{
+			std::lock_guard<std::mutex> lock(thread_pools->mutex);
+			auto                        iter = thread_pools->pools.find(std::this_thread::get_id());
+			if (iter != thread_pools->pools.end())
+			{
+				thread_pools->free_pools.push_back(iter->second);
+				thread_pools->pools.erase(iter);
+			}
+		}
+	}
+};
+
+static thread_local ThreadCommandPoolRelease thread_command_pool_release;
+
 namespace std
 {
 template <>
@@ -40,7 +76,7 @@ struct hash<std::unordered_map<std::string, std::string>>
 }        // namespace std
 
 static VkDebugUtilsMessengerEXT vkDebugUtilsMessengerEXT;
-static uint32_t                 marker_depth = 0;
+static thread_local uint32_t    marker_depth = 0;
 
 inline size_t align(size_t x, size_t alignment)
 {
@@ -239,6 +275,37 @@ inline const std::vector<const char *> get_device_extension_support(VkPhysicalDe
 	return result;
 }
 
+LinearAllocator::LinearAllocator(size_t capacity) :
+    m_data(std::make_unique<uint8_t[]>(capacity)), m_capacity(capacity)
+{
+}
+
+void *LinearAllocator::allocate(size_t size, size_t alignment)
+{
+	size_t padded = size + alignment - 1;
+	size_t offset = m_offset.fetch_add(padded);
+	if (offset + padded <= m_capacity)
+	{
+		return reinterpret_cast<void *>(align(reinterpret_cast<size_t>(m_data.get() + offset), alignment));
+	}
+
+	spdlog::warn("Linear allocator out of memory, requested {} bytes, capacity {} bytes", size, m_capacity);
+	std::lock_guard<std::mutex> lock(m_overflow_mutex);
+	m_overflow.emplace_back(std::make_unique<uint8_t[]>(padded));
+	return reinterpret_cast<void *>(align(reinterpret_cast<size_t>(m_overflow.back().get()), alignment));
+}
+
+void LinearAllocator::reset()
+{
+	m_offset = 0;
+	m_overflow.clear();
+}
+
+size_t LinearAllocator::size() const
+{
+	return std::min(m_offset.load(), m_capacity);
+}
+
 BarrierBuilder::BarrierBuilder(CommandBufferRecorder &recorder) :
     recorder(recorder)
 {
@@ -246,7 +313,7 @@ BarrierBuilder::BarrierBuilder(CommandBufferRecorder &recorder) :
 
 BarrierBuilder &BarrierBuilder::add_image_barrier(VkImage image, VkAccessFlags src_mask, VkAccessFlags dst_mask, VkImageLayout old_layout, VkImageLayout new_layout, const VkImageSubresourceRange &range)
 {
-	image_barriers.push_back(VkImageMemoryBarrier{
+	push_image_barrier() = VkImageMemoryBarrier{
 	    .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
 	    .srcAccessMask       = src_mask,
 	    .dstAccessMask       = dst_mask,
@@ -256,13 +323,13 @@ BarrierBuilder &BarrierBuilder::add_image_barrier(VkImage image, VkAccessFlags s
 	    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
 	    .image               = image,
 	    .subresourceRange    = range,
-	});
+	};
 	return *this;
 }
 
 BarrierBuilder &BarrierBuilder::add_buffer_barrier(VkBuffer buffer, VkAccessFlags src_mask, VkAccessFlags dst_mask, size_t size, size_t offset)
 {
-	buffer_barriers.push_back(VkBufferMemoryBarrier{
+	push_buffer_barrier() = VkBufferMemoryBarrier{
 	    .sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
 	    .pNext               = nullptr,
 	    .srcAccessMask       = src_mask,
@@ -272,7 +339,92 @@ BarrierBuilder &BarrierBuilder::add_buffer_barrier(VkBuffer buffer, VkAccessFlag
 	    .buffer              = buffer,
 	    .offset              = offset,
 	    .size                = size,
-	});
+	};
+	return *this;
+}
+
+BarrierBuilder &BarrierBuilder::add_image_release(VkImage image, VkAccessFlags src_mask, VkAccessFlags dst_mask, VkImageLayout old_layout, VkImageLayout new_layout, uint32_t dst_family, const VkImageSubresourceRange &range)
+{
+	uint32_t src_family = recorder.queue_family();
+	if (src_family == dst_family)
+	{
+		// Same family, the release carries the whole transition and the acquire is skipped
+		return add_image_barrier(image, src_mask, dst_mask, old_layout, new_layout, range);
+	}
+	push_image_barrier() = VkImageMemoryBarrier{
+	    .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+	    .srcAccessMask       = src_mask,
+	    .dstAccessMask       = 0,
+	    .oldLayout           = old_layout,
+	    .newLayout           = new_layout,
+	    .srcQueueFamilyIndex = src_family,
+	    .dstQueueFamilyIndex = dst_family,
+	    .image               = image,
+	    .subresourceRange    = range,
+	};
+	return *this;
+}
+
+BarrierBuilder &BarrierBuilder::add_image_acquire(VkImage image, VkAccessFlags src_mask, VkAccessFlags dst_mask, VkImageLayout old_layout, VkImageLayout new_layout, uint32_t src_family, const VkImageSubresourceRange &range)
+{
+	uint32_t dst_family = recorder.queue_family();
+	if (src_family == dst_family)
+	{
+		return *this;
+	}
+	push_image_barrier() = VkImageMemoryBarrier{
+	    .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+	    .srcAccessMask       = 0,
+	    .dstAccessMask       = dst_mask,
+	    .oldLayout           = old_layout,
+	    .newLayout           = new_layout,
+	    .srcQueueFamilyIndex = src_family,
+	    .dstQueueFamilyIndex = dst_family,
+	    .image               = image,
+	    .subresourceRange    = range,
+	};
+	return *this;
+}
+
+BarrierBuilder &BarrierBuilder::add_buffer_release(VkBuffer buffer, VkAccessFlags src_mask, VkAccessFlags dst_mask, uint32_t dst_family, size_t size, size_t offset)
+{
+	uint32_t src_family = recorder.queue_family();
+	if (src_family == dst_family)
+	{
+		return add_buffer_barrier(buffer, src_mask, dst_mask, size, offset);
+	}
+	push_buffer_barrier() = VkBufferMemoryBarrier{
+	    .sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+	    .pNext               = nullptr,
+	    .srcAccessMask       = src_mask,
+	    .dstAccessMask       = 0,
+	    .srcQueueFamilyIndex = src_family,
+	    .dstQueueFamilyIndex = dst_family,
+	    .buffer              = buffer,
+	    .offset              = offset,
+	    .size                = size,
+	};
+	return *this;
+}
+
+BarrierBuilder &BarrierBuilder::add_buffer_acquire(VkBuffer buffer, VkAccessFlags src_mask, VkAccessFlags dst_mask, uint32_t src_family, size_t size, size_t offset)
+{
+	uint32_t dst_family = recorder.queue_family();
+	if (src_family == dst_family)
+	{
+		return *this;
+	}
+	push_buffer_barrier() = VkBufferMemoryBarrier{
+	    .sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+	    .pNext               = nullptr,
+	    .srcAccessMask       = 0,
+	    .dstAccessMask       = dst_mask,
+	    .srcQueueFamilyIndex = src_family,
+	    .dstQueueFamilyIndex = dst_family,
+	    .buffer              = buffer,
+	    .offset              = offset,
+	    .size                = size,
+	};
 	return *this;
 }
 
@@ -283,13 +435,36 @@ CommandBufferRecorder &BarrierBuilder::insert(VkPipelineStageFlags src_stage, Vk
 	    src_stage,
 	    dst_stage,
 	    0, 0, nullptr,
-	    static_cast<uint32_t>(buffer_barriers.size()), buffer_barriers.data(),
-	    static_cast<uint32_t>(image_barriers.size()), image_barriers.data());
+	    buffer_barrier_count, buffer_barriers.data(),
+	    image_barrier_count, image_barriers.data());
 	return recorder;
 }
 
+VkImageMemoryBarrier &BarrierBuilder::push_image_barrier()
+{
+	if (image_barrier_count == MAX_BARRIER_COUNT)
+	{
+		// Out of inline storage, flush pending barriers conservatively
+		insert();
+		image_barrier_count  = 0;
+		buffer_barrier_count = 0;
+	}
+	return image_barriers[image_barrier_count++];
+}
+
+VkBufferMemoryBarrier &BarrierBuilder::push_buffer_barrier()
+{
+	if (buffer_barrier_count == MAX_BARRIER_COUNT)
+	{
+		insert();
+		image_barrier_count  = 0;
+		buffer_barrier_count = 0;
+	}
+	return buffer_barriers[buffer_barrier_count++];
+}
+
 CommandBufferRecorder::CommandBufferRecorder(const Context &context, bool compute) :
-    context(&context), compute(compute)
+    cmd_pool(compute ? context.compute_cmd_pool : context.graphics_cmd_pool), level(VK_COMMAND_BUFFER_LEVEL_PRIMARY), context(&context), compute(compute)
 {
 	VkCommandBufferAllocateInfo allocate_info =
 	    {
@@ -301,12 +476,39 @@ CommandBufferRecorder::CommandBufferRecorder(const Context &context, bool comput
 	vkAllocateCommandBuffers(this->context->vk_device, &allocate_info, &cmd_buffer);
 }
 
+CommandBufferRecorder::CommandBufferRecorder(const Context &context, VkCommandPool cmd_pool, VkCommandBufferLevel level, bool compute) :
+    cmd_pool(cmd_pool), level(level), context(&context), compute(compute)
+{
+	VkCommandBufferAllocateInfo allocate_info =
+	    {
+	        .sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+	        .commandPool        = cmd_pool,
+	        .level              = level,
+	        .commandBufferCount = 1,
+	    };
+	vkAllocateCommandBuffers(this->context->vk_device, &allocate_info, &cmd_buffer);
+}
+
+CommandBufferRecorder::CommandBufferRecorder(const Context &context, VkCommandPool cmd_pool, VkCommandBuffer cmd_buffer, bool compute) :
+    cmd_buffer(cmd_buffer), cmd_pool(cmd_pool), level(VK_COMMAND_BUFFER_LEVEL_PRIMARY), context(&context), compute(compute)
+{
+}
+
+uint32_t CommandBufferRecorder::queue_family() const
+{
+	return compute ? context->compute_family.value() : context->graphics_family.value();
+}
+
 CommandBufferRecorder &CommandBufferRecorder::begin()
 {
+	// Secondary command buffers record whole passes, nothing to inherit
+	VkCommandBufferInheritanceInfo inheritance_info = {
+	    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+	};
 	VkCommandBufferBeginInfo begin_info = {
 	    .sType            = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
 	    .flags            = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-	    .pInheritanceInfo = nullptr,
+	    .pInheritanceInfo = level == VK_COMMAND_BUFFER_LEVEL_SECONDARY ? &inheritance_info : nullptr,
 	};
 	vkBeginCommandBuffer(cmd_buffer, &begin_info);
 	return *this;
@@ -318,7 +520,7 @@ CommandBufferRecorder &CommandBufferRecorder::end()
 	return *this;
 }
 
-CommandBufferRecorder &CommandBufferRecorder::begin_marker(const std::string &name)
+CommandBufferRecorder &CommandBufferRecorder::begin_marker(const char *name)
 {
 	static std::vector<std::array<float, 4>> colors = {
 	    {0, 1, 0, 1},
@@ -333,7 +535,7 @@ CommandBufferRecorder &CommandBufferRecorder::begin_marker(const std::string &na
 	auto                 color = colors[marker_depth++];
 	VkDebugUtilsLabelEXT label = {
 	    .sType      = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT,
-	    .pLabelName = name.c_str(),
+	    .pLabelName = name,
 	    .color      = {color[0], color[1], color[2], color[3]},
 	};
 	vkCmdBeginDebugUtilsLabelEXT(cmd_buffer, &label);
@@ -352,14 +554,14 @@ CommandBufferRecorder &CommandBufferRecorder::end_marker()
 
 CommandBufferRecorder &CommandBufferRecorder::add_color_attachment(VkImageView view, VkAttachmentLoadOp load_op, VkAttachmentStoreOp store_op, VkClearColorValue clear_value)
 {
-	color_attachments.push_back(VkRenderingAttachmentInfo{
+	color_attachments[color_attachment_count++] = VkRenderingAttachmentInfo{
 	    .sType       = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
 	    .imageView   = view,
 	    .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
 	    .loadOp      = load_op,
 	    .storeOp     = store_op,
 	    .clearValue  = {.color = clear_value},
-	});
+	};
 	return *this;
 }
 
@@ -407,7 +609,7 @@ CommandBufferRecorder &CommandBufferRecorder::begin_rendering(uint32_t width, ui
 	    .sType                = VK_STRUCTURE_TYPE_RENDERING_INFO,
 	    .renderArea           = {0, 0, width, height},
 	    .layerCount           = layer,
-	    .colorAttachmentCount = static_cast<uint32_t>(color_attachments.size()),
+	    .colorAttachmentCount = color_attachment_count,
 	    .pColorAttachments    = color_attachments.data(),
 	    .pDepthAttachment     = depth_stencil_attachment.has_value() ? &depth_stencil_attachment.value() : nullptr,
 	};
@@ -418,14 +620,14 @@ CommandBufferRecorder &CommandBufferRecorder::begin_rendering(uint32_t width, ui
 CommandBufferRecorder &CommandBufferRecorder::end_rendering()
 {
 	vkCmdEndRendering(cmd_buffer);
-	color_attachments.clear();
+	color_attachment_count   = 0;
 	depth_stencil_attachment = std::optional<VkRenderingAttachmentInfo>{};
 	return *this;
 }
 
 CommandBufferRecorder &CommandBufferRecorder::update_buffer(VkBuffer buffer, void *data, size_t size, size_t offset)
 {
-	vkCmdUpdateBuffer(cmd_buffer, buffer, 0, size, data);
+	vkCmdUpdateBuffer(cmd_buffer, buffer, offset, size, data);
 	return *this;
 }
 
@@ -435,6 +637,17 @@ CommandBufferRecorder &CommandBufferRecorder::push_constants(VkPipelineLayout pi
 	return *this;
 }
 
+CommandBufferRecorder &CommandBufferRecorder::copy_buffer(VkBuffer src_buffer, VkBuffer dst_buffer, size_t size, size_t src_offset, size_t dst_offset)
+{
+	VkBufferCopy region = {
+	    .srcOffset = src_offset,
+	    .dstOffset = dst_offset,
+	    .size      = size,
+	};
+	vkCmdCopyBuffer(cmd_buffer, src_buffer, dst_buffer, 1, &region);
+	return *this;
+}
+
 CommandBufferRecorder &CommandBufferRecorder::copy_buffer_to_image(VkBuffer buffer, VkImage image, const VkExtent3D &extent, const VkOffset3D &offset, const VkImageSubresourceLayers &range)
 {
 	VkBufferImageCopy copy_info = {
@@ -489,25 +702,35 @@ CommandBufferRecorder &CommandBufferRecorder::blit_image(VkImage src_image, VkIm
 	return *this;
 }
 
-CommandBufferRecorder &CommandBufferRecorder::bind_descriptor_set(VkPipelineBindPoint bind_point, VkPipelineLayout pipeline_layout, const std::vector<VkDescriptorSet> &descriptor_sets)
+CommandBufferRecorder &CommandBufferRecorder::bind_descriptor_set(VkPipelineBindPoint bind_point, VkPipelineLayout pipeline_layout, std::span<const VkDescriptorSet> descriptor_sets)
 {
 	vkCmdBindDescriptorSets(cmd_buffer, bind_point, pipeline_layout, 0, static_cast<uint32_t>(descriptor_sets.size()), descriptor_sets.data(), 0, nullptr);
 	return *this;
 }
 
+CommandBufferRecorder &CommandBufferRecorder::bind_descriptor_set(VkPipelineBindPoint bind_point, VkPipelineLayout pipeline_layout, std::initializer_list<VkDescriptorSet> descriptor_sets)
+{
+	return bind_descriptor_set(bind_point, pipeline_layout, std::span<const VkDescriptorSet>(descriptor_sets.begin(), descriptor_sets.size()));
+}
+
 CommandBufferRecorder &CommandBufferRecorder::bind_pipeline(VkPipelineBindPoint bind_point, VkPipeline pipeline)
 {
 	vkCmdBindPipeline(cmd_buffer, bind_point, pipeline);
 	return *this;
 }
 
-CommandBufferRecorder &CommandBufferRecorder::bind_vertex_buffers(const std::vector<VkBuffer> &vertex_buffers)
+CommandBufferRecorder &CommandBufferRecorder::bind_vertex_buffers(std::span<const VkBuffer> vertex_buffers)
 {
-	std::vector<size_t> offsets(vertex_buffers.size(), 0);
+	static const std::array<VkDeviceSize, 16> offsets = {};
 	vkCmdBindVertexBuffers(cmd_buffer, 0, static_cast<uint32_t>(vertex_buffers.size()), vertex_buffers.data(), offsets.data());
 	return *this;
 }
 
+CommandBufferRecorder &CommandBufferRecorder::bind_vertex_buffers(std::initializer_list<VkBuffer> vertex_buffers)
+{
+	return bind_vertex_buffers(std::span<const VkBuffer>(vertex_buffers.begin(), vertex_buffers.size()));
+}
+
 CommandBufferRecorder &CommandBufferRecorder::bind_index_buffer(VkBuffer index_buffer, size_t offset, VkIndexType type)
 {
 	vkCmdBindIndexBuffer(cmd_buffer, index_buffer, offset, type);
@@ -574,21 +797,22 @@ CommandBufferRecorder &CommandBufferRecorder::build_acceleration_structure(const
 	return *this;
 }
 
-CommandBufferRecorder &CommandBufferRecorder::execute(std::function<void(void)> &&func)
-{
-	func();
-	return *this;
-}
-
-CommandBufferRecorder &CommandBufferRecorder::execute(std::function<void(VkCommandBuffer)> &&func)
+CommandBufferRecorder &CommandBufferRecorder::build_acceleration_structure(std::span<const VkAccelerationStructureBuildGeometryInfoKHR> geometry_infos, std::span<const VkAccelerationStructureBuildRangeInfoKHR *const> range_infos)
 {
-	func(cmd_buffer);
+	vkCmdBuildAccelerationStructuresKHR(
+	    cmd_buffer,
+	    static_cast<uint32_t>(geometry_infos.size()),
+	    geometry_infos.data(),
+	    range_infos.data());
 	return *this;
 }
 
-CommandBufferRecorder &CommandBufferRecorder::execute(std::function<void(CommandBufferRecorder &)> &&func)
+CommandBufferRecorder &CommandBufferRecorder::execute_commands(std::span<const VkCommandBuffer> cmd_buffers)
 {
-	func(*this);
+	if (!cmd_buffers.empty())
+	{
+		vkCmdExecuteCommands(cmd_buffer, static_cast<uint32_t>(cmd_buffers.size()), cmd_buffers.data());
+	}
 	return *this;
 }
 
@@ -733,34 +957,15 @@ CommandBufferRecorder &CommandBufferRecorder::generate_mipmap(VkImage image, uin
 
 void CommandBufferRecorder::flush()
 {
-	VkFence           fence       = VK_NULL_HANDLE;
-	VkFenceCreateInfo create_info = {
-	    .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-	    .flags = 0,
-	};
-	vkCreateFence(context->vk_device, &create_info, nullptr, &fence);
-	VkSubmitInfo submit_info = {
-	    .sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-	    .waitSemaphoreCount   = 0,
-	    .pWaitSemaphores      = nullptr,
-	    .pWaitDstStageMask    = 0,
-	    .commandBufferCount   = 1,
-	    .pCommandBuffers      = &cmd_buffer,
-	    .signalSemaphoreCount = 0,
-	    .pSignalSemaphores    = nullptr,
-	};
-	vkQueueSubmit(compute ? context->compute_queue : context->graphics_queue, 1, &submit_info, fence);
-
-	// Wait
-	vkWaitForFences(context->vk_device, 1, &fence, VK_TRUE, UINT64_MAX);
-	vkResetFences(context->vk_device, 1, &fence);
+	context->wait(context->submit_immediate(*this));
+}
 
-	// Release resource
-	vkDestroyFence(context->vk_device, fence, nullptr);
-	vkFreeCommandBuffers(context->vk_device, compute ? context->compute_cmd_pool : context->graphics_cmd_pool, 1, &cmd_buffer);
+SubmitTicket CommandBufferRecorder::flush_async(std::function<void()> &&on_complete)
+{
+	return context->submit_immediate(*this, std::move(on_complete));
 }
 
-CommandBufferRecorder &CommandBufferRecorder::submit(const std::vector<VkSemaphore> &signal_semaphores, const std::vector<VkSemaphore> &wait_semaphores, const std::vector<VkPipelineStageFlags> &wait_stages, VkFence signal_fence)
+CommandBufferRecorder &CommandBufferRecorder::submit(std::span<const VkSemaphore> signal_semaphores, std::span<const VkSemaphore> wait_semaphores, std::span<const VkPipelineStageFlags> wait_stages, VkFence signal_fence)
 {
 	VkSubmitInfo submit_info = {
 	    .sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
@@ -772,11 +977,12 @@ CommandBufferRecorder &CommandBufferRecorder::submit(const std::vector<VkSemapho
 	    .signalSemaphoreCount = static_cast<uint32_t>(signal_semaphores.size()),
 	    .pSignalSemaphores    = signal_semaphores.data(),
 	};
-	vkQueueSubmit(context->graphics_queue, 1, &submit_info, signal_fence);
+	std::lock_guard<std::mutex> lock(context->m_queue_mutex);
+	vkQueueSubmit(compute ? context->compute_queue : context->graphics_queue, 1, &submit_info, signal_fence);
 	return *this;
 }
 
-CommandBufferRecorder &CommandBufferRecorder::present(const std::vector<VkSemaphore> &wait_semaphores)
+CommandBufferRecorder &CommandBufferRecorder::present(std::span<const VkSemaphore> wait_semaphores)
 {
 	VkPresentInfoKHR present_info   = {};
 	present_info.sType              = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -786,6 +992,7 @@ CommandBufferRecorder &CommandBufferRecorder::present(const std::vector<VkSemaph
 	present_info.pImageIndices      = &context->image_index;
 	present_info.pWaitSemaphores    = wait_semaphores.data();
 	present_info.waitSemaphoreCount = static_cast<uint32_t>(wait_semaphores.size());
+	std::lock_guard<std::mutex> lock(context->m_queue_mutex);
 	vkQueuePresentKHR(context->present_queue, &present_info);
 	return *this;
 }
@@ -839,6 +1046,7 @@ VkDescriptorSetLayout DescriptorLayoutBuilder::create()
 		create_info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
 	}
 	vkCreateDescriptorSetLayout(context->vk_device, &create_info, nullptr, &layout);
+	context->track_descriptor_layout(layout, bindings);
 	return layout;
 }
 
@@ -1086,6 +1294,12 @@ DescriptorUpdateBuilder &DescriptorUpdateBuilder::update(VkDescriptorSet set)
 	return *this;
 }
 
+DescriptorUpdateBuilder &DescriptorUpdateBuilder::renew(VkDescriptorSet &set)
+{
+	context->renew_descriptor_set(set);
+	return update(set);
+}
+
 GraphicsPipelineBuilder::GraphicsPipelineBuilder(const Context &context, VkPipelineLayout layout) :
     context(&context), pipeline_layout(layout)
 {
@@ -1615,6 +1829,7 @@ Context::Context(uint32_t width, uint32_t height, float upscale_factor) :
 
 			ENABLE_DEVICE_FEATURE(physical_device_features.features, physical_device_features_enable.features, multiViewport);
 			ENABLE_DEVICE_FEATURE(physical_device_features.features, physical_device_features_enable.features, shaderInt64);
+			ENABLE_DEVICE_FEATURE(physical_device_features.features, physical_device_features_enable.features, fragmentStoresAndAtomics);        // for texture streaming feedback
 			ENABLE_DEVICE_FEATURE(physical_device_vulkan12_features, physical_device_vulkan12_features_enable, shaderFloat16);        // for fsr
 			ENABLE_DEVICE_FEATURE(physical_device_vulkan12_features, physical_device_vulkan12_features_enable, descriptorIndexing);
 			ENABLE_DEVICE_FEATURE(physical_device_vulkan12_features, physical_device_vulkan12_features_enable, bufferDeviceAddress);
@@ -1740,6 +1955,9 @@ Context::Context(uint32_t width, uint32_t height, float upscale_factor) :
 		vkCreateCommandPool(vk_device, &create_info, nullptr, &compute_cmd_pool);
 	}
 
+	m_thread_cmd_pools = std::make_shared<ThreadCommandPools>();
+	m_thread_cmd_pools->pools[std::this_thread::get_id()] = {graphics_cmd_pool, compute_cmd_pool};
+
 	{
 		VkPipelineCacheCreateInfo create_info = {
 		    .sType           = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
@@ -1911,6 +2129,33 @@ Context::~Context()
 {
 	vkDeviceWaitIdle(vk_device);
 
+	retire_immediate();
+	flush_deferred_destroy(UINT64_MAX);
+
+	for (auto &fence : m_free_fences)
+	{
+		vkDestroyFence(vk_device, fence, nullptr);
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_thread_cmd_pools->mutex);
+		for (auto &[thread_id, cmd_pools] : m_thread_cmd_pools->pools)
+		{
+			m_thread_cmd_pools->free_pools.push_back(cmd_pools);
+		}
+		for (auto &cmd_pools : m_thread_cmd_pools->free_pools)
+		{
+			for (auto &cmd_pool : cmd_pools)
+			{
+				if (cmd_pool != graphics_cmd_pool && cmd_pool != compute_cmd_pool)
+				{
+					vkDestroyCommandPool(vk_device, cmd_pool, nullptr);
+				}
+			}
+		}
+		m_thread_cmd_pools->pools.clear();
+		m_thread_cmd_pools->free_pools.clear();
+	}
+
 	// Destroy window
 	glfwDestroyWindow(window);
 	glfwTerminate();
@@ -1936,6 +2181,43 @@ Context::~Context()
 	vkDestroyInstance(vk_instance, nullptr);
 }
 
+void Context::begin_frame()
+{
+	retire_immediate();
+	flush_deferred_destroy(++m_frame_index);
+}
+
+void Context::flush_deferred_destroy(uint64_t frame_index)
+{
+	std::vector<std::function<void()>> retired;
+	{
+		std::lock_guard<std::mutex> lock(m_deferred_mutex);
+		// Resources retired during frame n are last referenced by frame n, whose fence is waited DEFERRED_DESTROY_LATENCY frames later
+		auto iter = std::stable_partition(
+		    m_deferred_destroy_queue.begin(), m_deferred_destroy_queue.end(),
+		    [frame_index](const auto &entry) { return entry.first + DEFERRED_DESTROY_LATENCY > frame_index; });
+		for (auto it = iter; it != m_deferred_destroy_queue.end(); it++)
+		{
+			retired.emplace_back(std::move(it->second));
+		}
+		m_deferred_destroy_queue.erase(iter, m_deferred_destroy_queue.end());
+
+		// Renewed descriptor sets are freed here directly, they are already untracked
+		auto set_iter = std::stable_partition(
+		    m_retired_descriptor_sets.begin(), m_retired_descriptor_sets.end(),
+		    [frame_index](const auto &entry) { return entry.first + DEFERRED_DESTROY_LATENCY > frame_index; });
+		for (auto it = set_iter; it != m_retired_descriptor_sets.end(); it++)
+		{
+			vkFreeDescriptorSets(vk_device, vk_descriptor_pool, 1, &it->second);
+		}
+		m_retired_descriptor_sets.erase(set_iter, m_retired_descriptor_sets.end());
+	}
+	for (auto &destroy : retired)
+	{
+		destroy();
+	}
+}
+
 void Context::resize()
 {
 	wait();
@@ -2027,7 +2309,36 @@ void Context::resize()
 
 CommandBufferRecorder Context::record_command(bool compute) const
 {
-	return CommandBufferRecorder(*this, compute);
+	VkCommandPool cmd_pool = thread_command_pool(compute);
+	{
+		std::lock_guard<std::mutex> lock(m_immediate_mutex);
+		auto                       &free_cmd_buffers = m_free_cmd_buffers[cmd_pool];
+		if (!free_cmd_buffers.empty())
+		{
+			VkCommandBuffer cmd_buffer = free_cmd_buffers.back();
+			free_cmd_buffers.pop_back();
+			return CommandBufferRecorder(*this, cmd_pool, cmd_buffer, compute);
+		}
+	}
+	return CommandBufferRecorder(*this, cmd_pool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, compute);
+}
+
+CommandBufferRecorder Context::record_secondary_command(VkCommandPool cmd_pool, bool compute) const
+{
+	return CommandBufferRecorder(*this, cmd_pool, VK_COMMAND_BUFFER_LEVEL_SECONDARY, compute);
+}
+
+VkCommandPool Context::create_command_pool(const std::string &name, bool compute) const
+{
+	VkCommandPoolCreateInfo create_info = {
+	    .sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+	    .flags            = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+	    .queueFamilyIndex = compute ? compute_family.value() : graphics_family.value(),
+	};
+	VkCommandPool cmd_pool = VK_NULL_HANDLE;
+	vkCreateCommandPool(vk_device, &create_info, nullptr, &cmd_pool);
+	set_object_name(VK_OBJECT_TYPE_COMMAND_POOL, (uint64_t) cmd_pool, name.c_str());
+	return cmd_pool;
 }
 
 VkSemaphore Context::create_semaphore(const std::string &name) const
@@ -2080,7 +2391,7 @@ VkSampler Context::create_sampler(VkFilter mag_filter, VkFilter min_filter, VkSa
 	return sampler;
 }
 
-Buffer Context::create_buffer(const std::string &name, size_t size, VkBufferUsageFlags buffer_usage, VmaMemoryUsage memory_usage) const
+Buffer Context::create_buffer(const std::string &name, size_t size, VkBufferUsageFlags buffer_usage, VmaMemoryUsage memory_usage, bool concurrent) const
 {
 	Buffer buffer;
 
@@ -2090,6 +2401,13 @@ Buffer Context::create_buffer(const std::string &name, size_t size, VkBufferUsag
 	    .usage       = buffer_usage,
 	    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
 	};
+	uint32_t queue_families[] = {graphics_family.value(), compute_family.value()};
+	if (concurrent && queue_families[0] != queue_families[1])
+	{
+		buffer_create_info.sharingMode           = VK_SHARING_MODE_CONCURRENT;
+		buffer_create_info.queueFamilyIndexCount = 2;
+		buffer_create_info.pQueueFamilyIndices   = queue_families;
+	}
 	VmaAllocationCreateInfo allocation_create_info = {
 	    .usage = memory_usage,
 	};
@@ -2107,12 +2425,12 @@ Buffer Context::create_buffer(const std::string &name, size_t size, VkBufferUsag
 	return buffer;
 }
 
-std::pair<AccelerationStructure, Buffer> Context::create_acceleration_structure(const std::string &name, VkAccelerationStructureTypeKHR type, const VkAccelerationStructureGeometryKHR &geometry, const VkAccelerationStructureBuildRangeInfoKHR &range) const
+std::pair<AccelerationStructure, Buffer> Context::create_acceleration_structure(const std::string &name, VkAccelerationStructureTypeKHR type, const VkAccelerationStructureGeometryKHR &geometry, const VkAccelerationStructureBuildRangeInfoKHR &range, VkBuildAccelerationStructureFlagsKHR flags) const
 {
 	VkAccelerationStructureBuildGeometryInfoKHR build_geometry_info = {
 	    .sType                    = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
 	    .type                     = type,
-	    .flags                    = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+	    .flags                    = flags,
 	    .mode                     = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
 	    .srcAccelerationStructure = VK_NULL_HANDLE,
 	    .geometryCount            = 1,
@@ -2134,34 +2452,15 @@ std::pair<AccelerationStructure, Buffer> Context::create_acceleration_structure(
 	    &range.primitiveCount,
 	    &build_sizes_info);
 
-	// Create acceleration structure
-	AccelerationStructure acceleration_structure = {};
+	AccelerationStructure acceleration_structure = create_acceleration_structure_storage(name, type, build_sizes_info.accelerationStructureSize);
+
+	VkDeviceSize scratch_size = build_sizes_info.buildScratchSize;
+	if (flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR)
 	{
-		VkBufferCreateInfo buffer_create_info = {
-		    .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-		    .size  = build_sizes_info.accelerationStructureSize,
-		    .usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-		};
-		VmaAllocationCreateInfo allocation_create_info = {
-		    .usage = VMA_MEMORY_USAGE_GPU_ONLY,
-		};
-		VmaAllocationInfo allocation_info = {};
-		vmaCreateBuffer(vma_allocator, &buffer_create_info, &allocation_create_info, &acceleration_structure.buffer.vk_buffer, &acceleration_structure.buffer.vma_allocation, &allocation_info);
-		VkAccelerationStructureCreateInfoKHR as_create_info = {
-		    .sType  = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
-		    .buffer = acceleration_structure.buffer.vk_buffer,
-		    .size   = build_sizes_info.accelerationStructureSize,
-		    .type   = type,
-		};
-		vkCreateAccelerationStructureKHR(vk_device, &as_create_info, nullptr, &acceleration_structure.vk_as);
-		VkAccelerationStructureDeviceAddressInfoKHR as_device_address_info = {
-		    .sType                 = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
-		    .accelerationStructure = acceleration_structure.vk_as,
-		};
-		acceleration_structure.device_address = vkGetAccelerationStructureDeviceAddressKHR(vk_device, &as_device_address_info);
+		scratch_size = std::max(scratch_size, build_sizes_info.updateScratchSize);
 	}
 
-	Buffer scratch_buffer = create_scratch_buffer(build_sizes_info.buildScratchSize);
+	Buffer scratch_buffer = create_scratch_buffer(scratch_size);
 
 	build_geometry_info.scratchData.deviceAddress = scratch_buffer.device_address;
 	build_geometry_info.dstAccelerationStructure  = acceleration_structure.vk_as;
@@ -2174,11 +2473,106 @@ std::pair<AccelerationStructure, Buffer> Context::create_acceleration_structure(
 	    .end()
 	    .flush();
 
-	set_object_name(VK_OBJECT_TYPE_ACCELERATION_STRUCTURE_KHR, (uint64_t) acceleration_structure.vk_as, name.c_str());
 	return {acceleration_structure, scratch_buffer};
 }
 
+AccelerationStructure Context::create_acceleration_structure_storage(const std::string &name, VkAccelerationStructureTypeKHR type, VkDeviceSize size) const
+{
+	AccelerationStructure acceleration_structure = {};
+
+	// Builds run on the compute queue and both families trace against the result
+	VkBufferCreateInfo buffer_create_info = {
+	    .sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+	    .size        = size,
+	    .usage       = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+	    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	};
+	uint32_t queue_families[] = {graphics_family.value(), compute_family.value()};
+	if (queue_families[0] != queue_families[1])
+	{
+		buffer_create_info.sharingMode           = VK_SHARING_MODE_CONCURRENT;
+		buffer_create_info.queueFamilyIndexCount = 2;
+		buffer_create_info.pQueueFamilyIndices   = queue_families;
+	}
+	VmaAllocationCreateInfo allocation_create_info = {
+	    .usage = VMA_MEMORY_USAGE_GPU_ONLY,
+	};
+	VmaAllocationInfo allocation_info = {};
+	vmaCreateBuffer(vma_allocator, &buffer_create_info, &allocation_create_info, &acceleration_structure.buffer.vk_buffer, &acceleration_structure.buffer.vma_allocation, &allocation_info);
+	VkAccelerationStructureCreateInfoKHR as_create_info = {
+	    .sType  = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+	    .buffer = acceleration_structure.buffer.vk_buffer,
+	    .size   = size,
+	    .type   = type,
+	};
+	vkCreateAccelerationStructureKHR(vk_device, &as_create_info, nullptr, &acceleration_structure.vk_as);
+	VkAccelerationStructureDeviceAddressInfoKHR as_device_address_info = {
+	    .sType                 = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+	    .accelerationStructure = acceleration_structure.vk_as,
+	};
+	acceleration_structure.device_address = vkGetAccelerationStructureDeviceAddressKHR(vk_device, &as_device_address_info);
+
+	set_object_name(VK_OBJECT_TYPE_ACCELERATION_STRUCTURE_KHR, (uint64_t) acceleration_structure.vk_as, name.c_str());
+	return acceleration_structure;
+}
+
 void Context::buffer_copy_to_device(const Buffer &buffer, void *data, size_t size, bool staging, size_t offset) const
+{
+	if (staging)
+	{
+		wait(buffer_copy_to_device_async(buffer, data, size, offset));
+	}
+	else
+	{
+		uint8_t *mapped_data = nullptr;
+		vmaMapMemory(vma_allocator, buffer.vma_allocation, reinterpret_cast<void **>(&mapped_data));
+		std::memcpy(mapped_data + offset, data, size);
+		vmaUnmapMemory(vma_allocator, buffer.vma_allocation);
+		vmaFlushAllocation(vma_allocator, buffer.vma_allocation, offset, size);
+		mapped_data = nullptr;
+	}
+}
+
+SubmitTicket Context::buffer_copy_to_device_async(const Buffer &buffer, void *data, size_t size, size_t offset) const
+{
+	Buffer staging_buffer;
+	{
+		VkBufferCreateInfo buffer_create_info = {
+		    .sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		    .size        = size,
+		    .usage       = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		};
+		VmaAllocationCreateInfo allocation_create_info = {
+		    .usage = VMA_MEMORY_USAGE_CPU_TO_GPU};
+		VmaAllocationInfo allocation_info = {};
+		vmaCreateBuffer(vma_allocator, &buffer_create_info, &allocation_create_info, &staging_buffer.vk_buffer, &staging_buffer.vma_allocation, &allocation_info);
+	}
+
+	if (data)
+	{
+		uint8_t *mapped_data = nullptr;
+		vmaMapMemory(vma_allocator, staging_buffer.vma_allocation, reinterpret_cast<void **>(&mapped_data));
+		std::memcpy(mapped_data, data, size);
+		vmaUnmapMemory(vma_allocator, staging_buffer.vma_allocation);
+		vmaFlushAllocation(vma_allocator, staging_buffer.vma_allocation, 0, size);
+		mapped_data = nullptr;
+	}
+
+	VkBufferCopy copy_info = {
+	    .srcOffset = 0,
+	    .dstOffset = offset,
+	    .size      = size,
+	};
+
+	return record_command()
+	    .begin()
+	    .execute([&](VkCommandBuffer cmd_buffer) { vkCmdCopyBuffer(cmd_buffer, staging_buffer.vk_buffer, buffer.vk_buffer, 1, &copy_info); })
+	    .end()
+	    .flush_async([this, staging_buffer]() { vmaDestroyBuffer(vma_allocator, staging_buffer.vk_buffer, staging_buffer.vma_allocation); });
+}
+
+void Context::buffer_copy_to_host(void *data, size_t size, const Buffer &buffer, bool staging) const
 {
 	if (staging)
 	{
@@ -2187,205 +2581,210 @@ void Context::buffer_copy_to_device(const Buffer &buffer, void *data, size_t siz
 			VkBufferCreateInfo buffer_create_info = {
 			    .sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
 			    .size        = size,
-			    .usage       = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			    .usage       = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 			    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
 			};
 			VmaAllocationCreateInfo allocation_create_info = {
-			    .usage = VMA_MEMORY_USAGE_CPU_TO_GPU};
+			    .usage = VMA_MEMORY_USAGE_GPU_TO_CPU};
 			VmaAllocationInfo allocation_info = {};
 			vmaCreateBuffer(vma_allocator, &buffer_create_info, &allocation_create_info, &staging_buffer.vk_buffer, &staging_buffer.vma_allocation, &allocation_info);
 		}
 
+		VkBufferCopy copy_info = {
+		    .srcOffset = 0,
+		    .dstOffset = 0,
+		    .size      = size,
+		};
+
+		record_command()
+		    .begin()
+		    .execute([&](VkCommandBuffer cmd_buffer) { vkCmdCopyBuffer(cmd_buffer, buffer.vk_buffer, staging_buffer.vk_buffer, 1, &copy_info); })
+		    .end()
+		    .flush();
+
 		if (data)
 		{
 			uint8_t *mapped_data = nullptr;
 			vmaMapMemory(vma_allocator, staging_buffer.vma_allocation, reinterpret_cast<void **>(&mapped_data));
-			std::memcpy(mapped_data, data, size);
+			std::memcpy(data, mapped_data, size);
 			vmaUnmapMemory(vma_allocator, staging_buffer.vma_allocation);
 			vmaFlushAllocation(vma_allocator, staging_buffer.vma_allocation, 0, size);
 			mapped_data = nullptr;
 		}
 
-		// Allocate command buffer
-		VkCommandBuffer cmd_buffer = VK_NULL_HANDLE;
-		{
-			VkCommandBufferAllocateInfo allocate_info =
-			    {
-			        .sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-			        .commandPool        = graphics_cmd_pool,
-			        .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-			        .commandBufferCount = 1,
-			    };
-			vkAllocateCommandBuffers(vk_device, &allocate_info, &cmd_buffer);
-		}
-
-		// Create fence
-		VkFence fence = VK_NULL_HANDLE;
-		{
-			VkFenceCreateInfo create_info = {
-			    .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-			    .flags = 0,
-			};
-			vkCreateFence(vk_device, &create_info, nullptr, &fence);
-		}
-
-		VkCommandBufferBeginInfo begin_info = {
-		    .sType            = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-		    .flags            = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-		    .pInheritanceInfo = nullptr,
-		};
-
-		vkBeginCommandBuffer(cmd_buffer, &begin_info);
-
-		{
-			VkBufferCopy copy_info = {
-			    .srcOffset = 0,
-			    .dstOffset = offset,
-			    .size      = size,
-			};
-			vkCmdCopyBuffer(cmd_buffer, staging_buffer.vk_buffer, buffer.vk_buffer, 1, &copy_info);
-		}
-
-		vkEndCommandBuffer(cmd_buffer);
-
-		// Submit command buffer
-		{
-			VkSubmitInfo submit_info = {
-			    .sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-			    .waitSemaphoreCount   = 0,
-			    .pWaitSemaphores      = nullptr,
-			    .pWaitDstStageMask    = 0,
-			    .commandBufferCount   = 1,
-			    .pCommandBuffers      = &cmd_buffer,
-			    .signalSemaphoreCount = 0,
-			    .pSignalSemaphores    = nullptr,
-			};
-			vkQueueSubmit(graphics_queue, 1, &submit_info, fence);
-		}
-
-		// Wait
-		vkWaitForFences(vk_device, 1, &fence, VK_TRUE, UINT64_MAX);
-		vkResetFences(vk_device, 1, &fence);
-
-		// Release resource
-		vkDestroyFence(vk_device, fence, nullptr);
-		vkFreeCommandBuffers(vk_device, graphics_cmd_pool, 1, &cmd_buffer);
 		vmaDestroyBuffer(vma_allocator, staging_buffer.vk_buffer, staging_buffer.vma_allocation);
 	}
 	else
 	{
 		uint8_t *mapped_data = nullptr;
+		vmaInvalidateAllocation(vma_allocator, buffer.vma_allocation, 0, size);
 		vmaMapMemory(vma_allocator, buffer.vma_allocation, reinterpret_cast<void **>(&mapped_data));
-		std::memcpy(mapped_data, data, size);
+		std::memcpy(data, mapped_data, size);
 		vmaUnmapMemory(vma_allocator, buffer.vma_allocation);
-		vmaFlushAllocation(vma_allocator, buffer.vma_allocation, 0, size);
 		mapped_data = nullptr;
 	}
 }
 
-void Context::buffer_copy_to_host(void *data, size_t size, const Buffer &buffer, bool staging) const
+void Context::enqueue_immediate(std::function<void(CommandBufferRecorder &)> &&job, bool compute) const
 {
-	if (staging)
+	std::lock_guard<std::mutex> lock(m_immediate_mutex);
+	m_immediate_jobs[compute ? 1 : 0].emplace_back(std::move(job));
+}
+
+SubmitTicket Context::submit_immediate(bool compute) const
+{
+	std::vector<std::function<void(CommandBufferRecorder &)>> jobs;
 	{
-		Buffer staging_buffer;
-		{
-			VkBufferCreateInfo buffer_create_info = {
-			    .sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-			    .size        = size,
-			    .usage       = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-			    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-			};
-			VmaAllocationCreateInfo allocation_create_info = {
-			    .usage = VMA_MEMORY_USAGE_GPU_TO_CPU};
-			VmaAllocationInfo allocation_info = {};
-			vmaCreateBuffer(vma_allocator, &buffer_create_info, &allocation_create_info, &staging_buffer.vk_buffer, &staging_buffer.vma_allocation, &allocation_info);
-		}
+		std::lock_guard<std::mutex> lock(m_immediate_mutex);
+		jobs.swap(m_immediate_jobs[compute ? 1 : 0]);
+	}
 
-		// Allocate command buffer
-		VkCommandBuffer cmd_buffer = VK_NULL_HANDLE;
-		{
-			VkCommandBufferAllocateInfo allocate_info =
-			    {
-			        .sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-			        .commandPool        = graphics_cmd_pool,
-			        .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-			        .commandBufferCount = 1,
-			    };
-			vkAllocateCommandBuffers(vk_device, &allocate_info, &cmd_buffer);
-		}
+	if (jobs.empty())
+	{
+		return {};
+	}
 
-		// Create fence
-		VkFence fence = VK_NULL_HANDLE;
+	CommandBufferRecorder recorder = record_command(compute);
+	recorder.begin();
+	for (auto &job : jobs)
+	{
+		job(recorder);
+	}
+	recorder.end();
+
+	return submit_immediate(recorder);
+}
+
+SubmitTicket Context::submit_immediate(CommandBufferRecorder &recorder, std::function<void()> &&on_complete) const
+{
+	ImmediateSubmission submission = {
+	    .cmd_pool    = recorder.cmd_pool,
+	    .cmd_buffer  = recorder.cmd_buffer,
+	    .on_complete = std::move(on_complete),
+	};
+
+	{
+		std::lock_guard<std::mutex> lock(m_immediate_mutex);
+		submission.id = m_next_ticket++;
+		if (m_free_fences.empty())
 		{
 			VkFenceCreateInfo create_info = {
 			    .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
 			    .flags = 0,
 			};
-			vkCreateFence(vk_device, &create_info, nullptr, &fence);
+			vkCreateFence(vk_device, &create_info, nullptr, &submission.fence);
+		}
+		else
+		{
+			submission.fence = m_free_fences.back();
+			m_free_fences.pop_back();
 		}
+	}
 
-		VkCommandBufferBeginInfo begin_info = {
-		    .sType            = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-		    .flags            = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-		    .pInheritanceInfo = nullptr,
-		};
+	VkSubmitInfo submit_info = {
+	    .sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+	    .waitSemaphoreCount   = 0,
+	    .pWaitSemaphores      = nullptr,
+	    .pWaitDstStageMask    = 0,
+	    .commandBufferCount   = 1,
+	    .pCommandBuffers      = &recorder.cmd_buffer,
+	    .signalSemaphoreCount = 0,
+	    .pSignalSemaphores    = nullptr,
+	};
 
-		vkBeginCommandBuffer(cmd_buffer, &begin_info);
+	{
+		std::lock_guard<std::mutex> lock(m_queue_mutex);
+		vkQueueSubmit(recorder.compute ? compute_queue : graphics_queue, 1, &submit_info, submission.fence);
+	}
 
-		{
-			VkBufferCopy copy_info = {
-			    .srcOffset = 0,
-			    .dstOffset = 0,
-			    .size      = size,
-			};
-			vkCmdCopyBuffer(cmd_buffer, buffer.vk_buffer, staging_buffer.vk_buffer, 1, &copy_info);
-		}
+	SubmitTicket ticket = {submission.id};
+	{
+		std::lock_guard<std::mutex> lock(m_immediate_mutex);
+		m_immediate_submissions.emplace_back(std::move(submission));
+	}
+	return ticket;
+}
+
+void Context::flush_immediate(bool compute) const
+{
+	wait(submit_immediate(compute));
+}
 
-		vkEndCommandBuffer(cmd_buffer);
+bool Context::is_complete(SubmitTicket ticket) const
+{
+	retire_immediate();
+	std::lock_guard<std::mutex> lock(m_immediate_mutex);
+	return std::none_of(m_immediate_submissions.begin(), m_immediate_submissions.end(), [ticket](const ImmediateSubmission &submission) { return submission.id == ticket.id; });
+}
 
-		// Submit command buffer
+VkCommandPool Context::thread_command_pool(bool compute) const
+{
+	std::lock_guard<std::mutex> lock(m_thread_cmd_pools->mutex);
+	auto [iter, inserted] = m_thread_cmd_pools->pools.try_emplace(std::this_thread::get_id());
+	if (inserted)
+	{
+		// Command pools are externally synchronized, every recording thread gets its own, preferably one left by an exited thread
+		if (!m_thread_cmd_pools->free_pools.empty())
 		{
-			VkSubmitInfo submit_info = {
-			    .sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-			    .waitSemaphoreCount   = 0,
-			    .pWaitSemaphores      = nullptr,
-			    .pWaitDstStageMask    = 0,
-			    .commandBufferCount   = 1,
-			    .pCommandBuffers      = &cmd_buffer,
-			    .signalSemaphoreCount = 0,
-			    .pSignalSemaphores    = nullptr,
-			};
-			vkQueueSubmit(graphics_queue, 1, &submit_info, fence);
+			iter->second = m_thread_cmd_pools->free_pools.back();
+			m_thread_cmd_pools->free_pools.pop_back();
+		}
+		else
+		{
+			for (uint32_t i = 0; i < 2; i++)
+			{
+				VkCommandPoolCreateInfo create_info = {
+				    .sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+				    .flags            = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+				    .queueFamilyIndex = i == 0 ? graphics_family.value() : compute_family.value(),
+				};
+				vkCreateCommandPool(vk_device, &create_info, nullptr, &iter->second[i]);
+			}
 		}
+		thread_command_pool_release.pools = m_thread_cmd_pools;
+	}
+	return iter->second[compute ? 1 : 0];
+}
 
-		// Wait
+void Context::retire_immediate(uint64_t wait_id) const
+{
+	if (wait_id != 0)
+	{
+		VkFence fence = VK_NULL_HANDLE;
+		{
+			std::lock_guard<std::mutex> lock(m_immediate_mutex);
+			auto                        iter = std::find_if(m_immediate_submissions.begin(), m_immediate_submissions.end(), [wait_id](const ImmediateSubmission &submission) { return submission.id == wait_id; });
+			if (iter == m_immediate_submissions.end())
+			{
+				// Already retired
+				return;
+			}
+			fence = iter->fence;
+		}
 		vkWaitForFences(vk_device, 1, &fence, VK_TRUE, UINT64_MAX);
-		vkResetFences(vk_device, 1, &fence);
-
-		// Release resource
-		vkDestroyFence(vk_device, fence, nullptr);
-		vkFreeCommandBuffers(vk_device, graphics_cmd_pool, 1, &cmd_buffer);
+	}
 
-		if (data)
+	std::vector<std::function<void()>> completed;
+	{
+		std::lock_guard<std::mutex> lock(m_immediate_mutex);
+		auto iter = std::stable_partition(
+		    m_immediate_submissions.begin(), m_immediate_submissions.end(),
+		    [this](const ImmediateSubmission &submission) { return vkGetFenceStatus(vk_device, submission.fence) != VK_SUCCESS; });
+		for (auto it = iter; it != m_immediate_submissions.end(); it++)
 		{
-			uint8_t *mapped_data = nullptr;
-			vmaMapMemory(vma_allocator, staging_buffer.vma_allocation, reinterpret_cast<void **>(&mapped_data));
-			std::memcpy(data, mapped_data, size);
-			vmaUnmapMemory(vma_allocator, staging_buffer.vma_allocation);
-			vmaFlushAllocation(vma_allocator, staging_buffer.vma_allocation, 0, size);
-			mapped_data = nullptr;
+			vkResetFences(vk_device, 1, &it->fence);
+			m_free_fences.push_back(it->fence);
+			m_free_cmd_buffers[it->cmd_pool].push_back(it->cmd_buffer);
+			if (it->on_complete)
+			{
+				completed.emplace_back(std::move(it->on_complete));
+			}
 		}
-
-		vmaDestroyBuffer(vma_allocator, staging_buffer.vk_buffer, staging_buffer.vma_allocation);
+		m_immediate_submissions.erase(iter, m_immediate_submissions.end());
 	}
-	else
+	for (auto &on_complete : completed)
 	{
-		uint8_t *mapped_data = nullptr;
-		vmaMapMemory(vma_allocator, buffer.vma_allocation, reinterpret_cast<void **>(&mapped_data));
-		std::memcpy(data, mapped_data, size);
-		vmaUnmapMemory(vma_allocator, buffer.vma_allocation);
-		vmaFlushAllocation(vma_allocator, buffer.vma_allocation, 0, size);
-		mapped_data = nullptr;
+		on_complete();
 	}
 }
 
@@ -2531,7 +2930,7 @@ Texture Context::create_texture_2d_array(const std::string &name, uint32_t width
 	return texture;
 }
 
-VkImageView Context::create_texture_view(const std::string &name, VkImage image, VkFormat format, VkImageViewType type, const VkImageSubresourceRange &range) const
+VkImageView Context::create_texture_view(const std::string &name, VkImage image, VkFormat format, VkImageViewType type, const VkImageSubresourceRange &range, const VkComponentMapping &components) const
 {
 	VkImageView           texture_view     = VK_NULL_HANDLE;
 	VkImageViewCreateInfo view_create_info = {
@@ -2539,7 +2938,7 @@ VkImageView Context::create_texture_view(const std::string &name, VkImage image,
 	    .image            = image,
 	    .viewType         = type,
 	    .format           = format,
-	    .components       = {VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY},
+	    .components       = components,
 	    .subresourceRange = range,
 	};
 	vkCreateImageView(vk_device, &view_create_info, nullptr, &texture_view);
@@ -2621,9 +3020,43 @@ VkDescriptorSet Context::allocate_descriptor_set(VkDescriptorSetLayout layout) c
 	     .pSetLayouts        = &layout,
     };
 	vkAllocateDescriptorSets(vk_device, &allocate_info, &descriptor_set);
+	track_descriptor_sets(layout, &descriptor_set, 1);
 	return descriptor_set;
 }
 
+void Context::track_descriptor_layout(VkDescriptorSetLayout layout, const std::vector<VkDescriptorSetLayoutBinding> &bindings) const
+{
+	std::vector<VkCopyDescriptorSet> copies;
+	copies.reserve(bindings.size());
+	for (auto &binding : bindings)
+	{
+		if (binding.descriptorCount == 0)
+		{
+			continue;
+		}
+		copies.push_back(VkCopyDescriptorSet{
+		    .sType           = VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET,
+		    .srcBinding      = binding.binding,
+		    .srcArrayElement = 0,
+		    .dstBinding      = binding.binding,
+		    .dstArrayElement = 0,
+		    .descriptorCount = binding.descriptorCount,
+		});
+	}
+
+	std::lock_guard<std::mutex> lock(m_descriptor_mutex);
+	m_descriptor_layouts[layout] = std::move(copies);
+}
+
+void Context::track_descriptor_sets(VkDescriptorSetLayout layout, const VkDescriptorSet *sets, uint32_t count) const
+{
+	std::lock_guard<std::mutex> lock(m_descriptor_mutex);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		m_descriptor_sets[sets[i]] = std::make_pair(layout, m_frame_index.load());
+	}
+}
+
 VkPipelineLayout Context::create_pipeline_layout(const std::vector<VkDescriptorSetLayout> &layouts, uint32_t push_data_size, VkShaderStageFlags stage) const
 {
 	VkPipelineLayout    layout = VK_NULL_HANDLE;
@@ -2699,8 +3132,14 @@ void Context::wait(VkFence fence) const
 	vkResetFences(vk_device, 1, &fence);
 }
 
+void Context::wait(SubmitTicket ticket) const
+{
+	retire_immediate(ticket.id);
+}
+
 void Context::wait() const
 {
+	std::lock_guard<std::mutex> lock(m_queue_mutex);
 	vkDeviceWaitIdle(vk_device);
 }
 
@@ -2783,6 +3222,10 @@ const Context &Context::destroy(VkDescriptorSetLayout &layout) const
 {
 	if (layout)
 	{
+		{
+			std::lock_guard<std::mutex> lock(m_descriptor_mutex);
+			m_descriptor_layouts.erase(layout);
+		}
 		vkDestroyDescriptorSetLayout(vk_device, layout, nullptr);
 		layout = VK_NULL_HANDLE;
 	}
@@ -2796,6 +3239,10 @@ const Context &Context::destroy(VkDescriptorSet &set) const
 	{
 		vkFreeDescriptorSets(vk_device, vk_descriptor_pool, 1, &set);
 	}
+	{
+		std::lock_guard<std::mutex> lock(m_descriptor_mutex);
+		m_descriptor_sets.erase(set);
+	}
 	return *this;
 }
 
@@ -2843,6 +3290,17 @@ const Context &Context::destroy(VkFence &fence) const
 	return *this;
 }
 
+template <>
+const Context &Context::destroy(VkCommandPool &cmd_pool) const
+{
+	if (cmd_pool)
+	{
+		vkDestroyCommandPool(vk_device, cmd_pool, nullptr);
+		cmd_pool = VK_NULL_HANDLE;
+	}
+	return *this;
+}
+
 template <>
 const Context &Context::destroy(VkSampler &sampler) const
 {
@@ -2877,6 +3335,7 @@ template const Context &Context::destroy<VkPipelineLayout>(VkPipelineLayout &) c
 template const Context &Context::destroy<VkPipeline>(VkPipeline &) const;
 template const Context &Context::destroy<VkSemaphore>(VkSemaphore &) const;
 template const Context &Context::destroy<VkFence>(VkFence &) const;
+template const Context &Context::destroy<VkCommandPool>(VkCommandPool &) const;
 template const Context &Context::destroy<VkSampler>(VkSampler &) const;
 template const Context &Context::destroy<AccelerationStructure>(AccelerationStructure &) const;
 
@@ -2927,3 +3386,198 @@ Buffer Context::create_scratch_buffer(size_t size) const
 	buffer.device_address = align(buffer.device_address, properties.minAccelerationStructureScratchOffsetAlignment);
 	return buffer;
 }
+
+void Context::renew_descriptor_set(VkDescriptorSet &set) const
+{
+	VkDescriptorSetLayout            layout = VK_NULL_HANDLE;
+	std::vector<VkCopyDescriptorSet> copies;
+	{
+		std::lock_guard<std::mutex> lock(m_descriptor_mutex);
+		auto                        iter = m_descriptor_sets.find(set);
+		if (iter == m_descriptor_sets.end() || iter->second.second == m_frame_index)
+		{
+			// Not submitted yet, safe to write in place
+			return;
+		}
+		layout = iter->second.first;
+		copies = m_descriptor_layouts[layout];
+		m_descriptor_sets.erase(iter);
+	}
+
+	VkDescriptorSet retired = set;
+	set                     = allocate_descriptor_set(layout);
+
+	// The copy holds every binding of the retired set, callers only write what changed
+	for (auto &copy : copies)
+	{
+		copy.srcSet = retired;
+		copy.dstSet = set;
+	}
+	vkUpdateDescriptorSets(vk_device, 0, nullptr, static_cast<uint32_t>(copies.size()), copies.data());
+
+	std::lock_guard<std::mutex> lock(m_deferred_mutex);
+	m_retired_descriptor_sets.emplace_back(m_frame_index.load(), retired);
+}
+
+std::vector<AccelerationStructure> Context::create_bottom_level_acceleration_structures(const std::string &name, const std::vector<VkAccelerationStructureGeometryKHR> &geometries, const std::vector<VkAccelerationStructureBuildRangeInfoKHR> &ranges) const
+{
+	const uint32_t count = static_cast<uint32_t>(geometries.size());
+
+	std::vector<AccelerationStructure> acceleration_structures(count);
+	if (count == 0)
+	{
+		return acceleration_structures;
+	}
+
+	VkPhysicalDeviceAccelerationStructurePropertiesKHR properties = {
+	    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR,
+	};
+	VkPhysicalDeviceProperties2 dev_props2 = {
+	    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+	    .pNext = &properties,
+	};
+	vkGetPhysicalDeviceProperties2(vk_physical_device, &dev_props2);
+
+	std::vector<VkAccelerationStructureBuildGeometryInfoKHR>      build_geometry_infos(count);
+	std::vector<const VkAccelerationStructureBuildRangeInfoKHR *> range_infos(count);
+	std::vector<VkAccelerationStructureKHR>                       as_handles(count);
+	std::vector<VkDeviceSize>                                     scratch_sizes(count);
+
+	VkDeviceSize max_scratch_size   = 0;
+	VkDeviceSize total_scratch_size = 0;
+	VkDeviceSize uncompacted_size   = 0;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		build_geometry_infos[i] = {
+		    .sType                    = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+		    .type                     = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+		    .flags                    = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR,
+		    .mode                     = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+		    .srcAccelerationStructure = VK_NULL_HANDLE,
+		    .geometryCount            = 1,
+		    .pGeometries              = &geometries[i],
+		    .ppGeometries             = nullptr,
+		};
+
+		VkAccelerationStructureBuildSizesInfoKHR build_sizes_info = {
+		    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
+		};
+
+		vkGetAccelerationStructureBuildSizesKHR(
+		    vk_device,
+		    VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+		    &build_geometry_infos[i],
+		    &ranges[i].primitiveCount,
+		    &build_sizes_info);
+
+		acceleration_structures[i] = create_acceleration_structure_storage(fmt::format("{} #{} (Uncompacted)", name, i), VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, build_sizes_info.accelerationStructureSize);
+
+		build_geometry_infos[i].dstAccelerationStructure = acceleration_structures[i].vk_as;
+		range_infos[i]                                   = &ranges[i];
+		as_handles[i]                                    = acceleration_structures[i].vk_as;
+		scratch_sizes[i]                                 = align(build_sizes_info.buildScratchSize, properties.minAccelerationStructureScratchOffsetAlignment);
+
+		max_scratch_size    = std::max(max_scratch_size, scratch_sizes[i]);
+		total_scratch_size += scratch_sizes[i];
+		uncompacted_size   += build_sizes_info.accelerationStructureSize;
+	}
+
+	// Builds are packed into the arena batch by batch, a batch reuses the scratch memory of the previous one
+	VkDeviceSize scratch_capacity = std::max(max_scratch_size, std::min<VkDeviceSize>(total_scratch_size, BLAS_SCRATCH_BUDGET));
+	Buffer       scratch_buffer   = create_scratch_buffer(scratch_capacity);
+
+	VkQueryPool query_pool = VK_NULL_HANDLE;
+	{
+		VkQueryPoolCreateInfo create_info = {
+		    .sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		    .queryType  = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+		    .queryCount = count,
+		};
+		vkCreateQueryPool(vk_device, &create_info, nullptr, &query_pool);
+	}
+
+	VkMemoryBarrier build_barrier = {
+	    .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+	    .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+	    .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+	};
+
+	CommandBufferRecorder recorder = record_command(true);
+	recorder.begin()
+	    .execute([&](VkCommandBuffer cmd_buffer) { vkCmdResetQueryPool(cmd_buffer, query_pool, 0, count); });
+
+	for (uint32_t batch_begin = 0; batch_begin < count;)
+	{
+		uint32_t     batch_end      = batch_begin;
+		VkDeviceSize scratch_offset = 0;
+		while (batch_end < count && scratch_offset + scratch_sizes[batch_end] <= scratch_capacity)
+		{
+			build_geometry_infos[batch_end].scratchData.deviceAddress = scratch_buffer.device_address + scratch_offset;
+			scratch_offset += scratch_sizes[batch_end++];
+		}
+
+		uint32_t batch_count = batch_end - batch_begin;
+		recorder
+		    .build_acceleration_structure(
+		        std::span(build_geometry_infos.data() + batch_begin, batch_count),
+		        std::span(range_infos.data() + batch_begin, batch_count))
+		    .execute([&](VkCommandBuffer cmd_buffer) {
+			    vkCmdPipelineBarrier(
+			        cmd_buffer,
+			        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+			        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+			        0, 1, &build_barrier, 0, nullptr, 0, nullptr);
+			    vkCmdWriteAccelerationStructuresPropertiesKHR(
+			        cmd_buffer,
+			        batch_count,
+			        as_handles.data() + batch_begin,
+			        VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+			        query_pool,
+			        batch_begin);
+		    });
+
+		batch_begin = batch_end;
+	}
+
+	recorder.end()
+	    .flush();
+
+	std::vector<VkDeviceSize> compacted_sizes(count);
+	vkGetQueryPoolResults(vk_device, query_pool, 0, count, count * sizeof(VkDeviceSize), compacted_sizes.data(), sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+	// Copy into tightly sized acceleration structures
+	std::vector<AccelerationStructure> compacted_acceleration_structures(count);
+
+	VkDeviceSize compacted_size = 0;
+
+	recorder = record_command(true);
+	recorder.begin();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		compacted_acceleration_structures[i] = create_acceleration_structure_storage(fmt::format("{} #{}", name, i), VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, compacted_sizes[i]);
+		compacted_size += compacted_sizes[i];
+
+		VkCopyAccelerationStructureInfoKHR copy_info = {
+		    .sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR,
+		    .src   = acceleration_structures[i].vk_as,
+		    .dst   = compacted_acceleration_structures[i].vk_as,
+		    .mode  = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR,
+		};
+		recorder.execute([&](VkCommandBuffer cmd_buffer) { vkCmdCopyAccelerationStructureKHR(cmd_buffer, &copy_info); });
+	}
+	recorder.end()
+	    .flush();
+
+	vkDestroyQueryPool(vk_device, query_pool, nullptr);
+	destroy(acceleration_structures)
+	    .destroy(scratch_buffer);
+
+	spdlog::info("Compacted {} {}: {:.2f} MB -> {:.2f} MB, {:.2f} MB saved",
+	             count, name,
+	             static_cast<double>(uncompacted_size) / (1024.0 * 1024.0),
+	             static_cast<double>(compacted_size) / (1024.0 * 1024.0),
+	             static_cast<double>(uncompacted_size - compacted_size) / (1024.0 * 1024.0));
+
+	return compacted_acceleration_structures;
+}
@@ -0,0 +1,381 @@
+#include "light_tree.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <future>
+#include <limits>
+#include <numbers>
+
+#define LIGHT_TREE_BINS 12
+#define LIGHT_TREE_PARALLEL_SIZE 16384
+
+// Bounds of a set of emitters, an empty cone has cos_theta_o > 1
+struct LightBounds
+{
+	glm::vec3 bbox_min    = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 bbox_max    = glm::vec3(-std::numeric_limits<float>::max());
+	glm::vec3 axis        = glm::vec3(0.f, 0.f, 1.f);
+	float     cos_theta_o = 2.f;
+	float     power       = 0.f;
+};
+
+struct LightPrimitive
+{
+	LightBounds bounds;
+	glm::vec3   centroid = glm::vec3(0.f);
+	uint32_t    emitter  = 0;
+};
+
+inline float safe_acos(float x)
+{
+	return std::acos(std::clamp(x, -1.f, 1.f));
+}
+
+inline glm::vec3 rotate(const glm::vec3 &v, const glm::vec3 &axis, float theta)
+{
+	// Rodrigues' rotation
+	return v * std::cos(theta) + glm::cross(axis, v) * std::sin(theta) + axis * glm::dot(axis, v) * (1.f - std::cos(theta));
+}
+
+// Smallest cone around two cones, normals are unsigned so b may flip to the side of a
+inline void merge_cone(glm::vec3 &axis, float &cos_theta_o, glm::vec3 b_axis, float b_cos_theta_o)
+{
+	if (b_cos_theta_o > 1.f)
+	{
+		return;
+	}
+	if (cos_theta_o > 1.f)
+	{
+		axis        = b_axis;
+		cos_theta_o = b_cos_theta_o;
+		return;
+	}
+
+	if (glm::dot(axis, b_axis) < 0.f)
+	{
+		b_axis = -b_axis;
+	}
+
+	// Containment tests on cos(theta_d + theta), the angles are only needed for a new cone
+	float cos_d = std::min(glm::dot(axis, b_axis), 1.f);
+	float sin_d = std::sqrt(std::max(0.f, 1.f - cos_d * cos_d));
+	float sin_a = std::sqrt(std::max(0.f, 1.f - cos_theta_o * cos_theta_o));
+	float sin_b = std::sqrt(std::max(0.f, 1.f - b_cos_theta_o * b_cos_theta_o));
+
+	if (cos_theta_o <= -1.f || (sin_d * b_cos_theta_o + cos_d * sin_b >= 0.f && cos_d * b_cos_theta_o - sin_d * sin_b >= cos_theta_o))
+	{
+		return;
+	}
+	if (b_cos_theta_o <= -1.f || (sin_d * cos_theta_o + cos_d * sin_a >= 0.f && cos_d * cos_theta_o - sin_d * sin_a >= b_cos_theta_o))
+	{
+		axis        = b_axis;
+		cos_theta_o = b_cos_theta_o;
+		return;
+	}
+
+	float theta_a = safe_acos(cos_theta_o);
+	float theta_b = safe_acos(b_cos_theta_o);
+	float theta_d = safe_acos(cos_d);
+
+	float     theta_o = 0.5f * (theta_a + theta_d + theta_b);
+	glm::vec3 w_r     = glm::cross(axis, b_axis);
+	if (theta_o >= std::numbers::pi_v<float> || glm::dot(w_r, w_r) < 1e-12f)
+	{
+		cos_theta_o = -1.f;
+		return;
+	}
+
+	axis        = glm::normalize(rotate(axis, glm::normalize(w_r), theta_o - theta_a));
+	cos_theta_o = std::cos(theta_o);
+}
+
+inline void merge(LightBounds &a, const LightBounds &b)
+{
+	a.bbox_min = glm::min(a.bbox_min, b.bbox_min);
+	a.bbox_max = glm::max(a.bbox_max, b.bbox_max);
+	a.power += b.power;
+	merge_cone(a.axis, a.cos_theta_o, b.axis, b.cos_theta_o);
+}
+
+// Orientation measure of a cone with an emission spread of pi/2
+inline float orientation_measure(float cos_theta_o)
+{
+	if (cos_theta_o > 1.f)
+	{
+		return 0.f;
+	}
+
+	float theta_o = safe_acos(cos_theta_o);
+	float theta_w = std::min(theta_o + 0.5f * std::numbers::pi_v<float>, std::numbers::pi_v<float>);
+	float sin_o   = std::sin(theta_o);
+	return 2.f * std::numbers::pi_v<float> * (1.f - cos_theta_o) +
+	       0.5f * std::numbers::pi_v<float> * (2.f * theta_w * sin_o - std::cos(theta_o - 2.f * theta_w) - 2.f * theta_o * sin_o + cos_theta_o);
+}
+
+inline float surface_area(const LightBounds &bounds)
+{
+	glm::vec3 d = glm::max(bounds.bbox_max - bounds.bbox_min, glm::vec3(0.f));
+	return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+// Surface area orientation heuristic
+inline float split_cost(const LightBounds &bounds)
+{
+	return bounds.power * orientation_measure(bounds.cos_theta_o) * surface_area(bounds);
+}
+
+inline LightBounds emitter_bounds(const LightTriangle &triangle)
+{
+	const glm::vec3 &p0     = triangle.p0;
+	const glm::vec3 &p1     = triangle.p1;
+	const glm::vec3 &p2     = triangle.p2;
+	glm::vec3        normal = glm::cross(p1 - p0, p2 - p0);
+	float            area   = glm::length(normal) * 0.5f;
+
+	LightBounds bounds;
+	bounds.bbox_min    = glm::min(p0, glm::min(p1, p2));
+	bounds.bbox_max    = glm::max(p0, glm::max(p1, p2));
+	bounds.axis        = area > 0.f ? normal / (2.f * area) : glm::vec3(0.f, 0.f, 1.f);
+	bounds.cos_theta_o = 1.f;
+	bounds.power       = triangle.luminance * area;
+	return bounds;
+}
+
+inline LightBounds node_bounds(const LightTreeNode &node)
+{
+	LightBounds bounds;
+	bounds.bbox_min    = node.bbox_min;
+	bounds.bbox_max    = node.bbox_max;
+	bounds.axis        = node.axis;
+	bounds.cos_theta_o = node.cos_theta_o;
+	bounds.power       = node.power;
+	return bounds;
+}
+
+inline uint32_t build_node(std::vector<LightTreeNode> &nodes, LightPrimitive *primitives, uint32_t count)
+{
+	// Interior cones are merged from the children once they are built
+	LightBounds bounds = primitives[0].bounds;
+	LightBounds centroid_bounds;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (i > 0)
+		{
+			bounds.bbox_min = glm::min(bounds.bbox_min, primitives[i].bounds.bbox_min);
+			bounds.bbox_max = glm::max(bounds.bbox_max, primitives[i].bounds.bbox_max);
+			bounds.power += primitives[i].bounds.power;
+		}
+		centroid_bounds.bbox_min = glm::min(centroid_bounds.bbox_min, primitives[i].centroid);
+		centroid_bounds.bbox_max = glm::max(centroid_bounds.bbox_max, primitives[i].centroid);
+	}
+
+	uint32_t node_index = static_cast<uint32_t>(nodes.size());
+	nodes.push_back(LightTreeNode{
+	    .bbox_min    = bounds.bbox_min,
+	    .power       = bounds.power,
+	    .bbox_max    = bounds.bbox_max,
+	    .cos_theta_o = std::min(bounds.cos_theta_o, 1.f),
+	    .axis        = bounds.axis,
+	    .child       = ~static_cast<int32_t>(primitives[0].emitter),
+	});
+
+	if (count == 1)
+	{
+		return node_index;
+	}
+
+	// Binned split over all three axes
+	glm::vec3 extent     = centroid_bounds.bbox_max - centroid_bounds.bbox_min;
+	glm::vec3 bbox       = bounds.bbox_max - bounds.bbox_min;
+	float     max_extent = std::max(bbox.x, std::max(bbox.y, bbox.z));
+
+	float    best_cost  = std::numeric_limits<float>::max();
+	uint32_t best_axis  = 0;
+	uint32_t best_split = 0;
+	for (uint32_t axis = 0; axis < 3; axis++)
+	{
+		if (extent[axis] <= 0.f)
+		{
+			continue;
+		}
+
+		std::array<LightBounds, LIGHT_TREE_BINS> bins;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			uint32_t bin = std::min(static_cast<uint32_t>(LIGHT_TREE_BINS * (primitives[i].centroid[axis] - centroid_bounds.bbox_min[axis]) / extent[axis]), LIGHT_TREE_BINS - 1u);
+			merge(bins[bin], primitives[i].bounds);
+		}
+
+		std::array<float, LIGHT_TREE_BINS - 1> costs = {};
+
+		LightBounds below;
+		for (uint32_t split = 0; split < LIGHT_TREE_BINS - 1; split++)
+		{
+			merge(below, bins[split]);
+			costs[split] = split_cost(below);
+		}
+
+		LightBounds above;
+		for (uint32_t split = LIGHT_TREE_BINS - 1; split > 0; split--)
+		{
+			merge(above, bins[split]);
+			costs[split - 1] += split_cost(above);
+		}
+
+		// Discourages splitting thin boxes along their short axes
+		float regularizer = max_extent / std::max(bbox[axis], 1e-6f);
+		for (uint32_t split = 0; split < LIGHT_TREE_BINS - 1; split++)
+		{
+			if (costs[split] * regularizer < best_cost)
+			{
+				best_cost  = costs[split] * regularizer;
+				best_axis  = axis;
+				best_split = split;
+			}
+		}
+	}
+
+	uint32_t mid = 0;
+	if (best_cost < std::numeric_limits<float>::max())
+	{
+		float split_position = centroid_bounds.bbox_min[best_axis] + extent[best_axis] * static_cast<float>(best_split + 1) / LIGHT_TREE_BINS;
+
+		mid = static_cast<uint32_t>(std::partition(primitives, primitives + count, [&](const LightPrimitive &primitive) {
+			                            return primitive.centroid[best_axis] < split_position;
+		                            }) -
+		                            primitives);
+	}
+
+	// Coincident centroids or a bin boundary that leaves a side empty split in the middle
+	if (mid == 0 || mid == count)
+	{
+		mid = count / 2;
+	}
+
+	// Large subtrees build their right half on another thread and are appended after the left one
+	uint32_t right = 0;
+	if (count >= LIGHT_TREE_PARALLEL_SIZE)
+	{
+		std::vector<LightTreeNode> right_nodes;
+		std::future<uint32_t>      right_build = std::async(std::launch::async, build_node, std::ref(right_nodes), primitives + mid, count - mid);
+
+		build_node(nodes, primitives, mid);
+		right_build.wait();
+
+		right = static_cast<uint32_t>(nodes.size());
+		for (auto &node : right_nodes)
+		{
+			if (node.child > 0)
+			{
+				node.child += static_cast<int32_t>(right);
+			}
+		}
+		nodes.insert(nodes.end(), right_nodes.begin(), right_nodes.end());
+	}
+	else
+	{
+		build_node(nodes, primitives, mid);
+		right = build_node(nodes, primitives + mid, count - mid);
+	}
+
+	LightBounds children = node_bounds(nodes[node_index + 1]);
+	merge(children, node_bounds(nodes[right]));
+
+	nodes[node_index].cos_theta_o = std::min(children.cos_theta_o, 1.f);
+	nodes[node_index].axis        = children.axis;
+	nodes[node_index].child       = static_cast<int32_t>(right);
+
+	return node_index;
+}
+
+std::vector<LightTreeNode> build_light_tree(const std::vector<LightTriangle> &triangles)
+{
+	std::vector<LightPrimitive> primitives(triangles.size());
+	for (uint32_t i = 0; i < triangles.size(); i++)
+	{
+		const auto &triangle = triangles[i];
+
+		primitives[i].bounds   = emitter_bounds(triangle);
+		primitives[i].centroid = (triangle.p0 + triangle.p1 + triangle.p2) / 3.f;
+		primitives[i].emitter  = i;
+	}
+
+	std::vector<LightTreeNode> nodes;
+	if (!primitives.empty())
+	{
+		nodes.reserve(2 * primitives.size() - 1);
+		build_node(nodes, primitives.data(), static_cast<uint32_t>(primitives.size()));
+	}
+
+	return nodes;
+}
+
+inline void refit_node(std::vector<LightTreeNode> &nodes, const std::vector<LightTriangle> &triangles, size_t i)
+{
+	auto &node = nodes[i];
+
+	LightBounds bounds;
+	if (node.child < 0)
+	{
+		bounds = emitter_bounds(triangles[~node.child]);
+	}
+	else
+	{
+		bounds = node_bounds(nodes[i + 1]);
+		merge(bounds, node_bounds(nodes[node.child]));
+	}
+
+	node.bbox_min    = bounds.bbox_min;
+	node.power       = bounds.power;
+	node.bbox_max    = bounds.bbox_max;
+	node.cos_theta_o = std::min(bounds.cos_theta_o, 1.f);
+	node.axis        = bounds.axis;
+}
+
+void refit_light_tree(std::vector<LightTreeNode> &nodes, const std::vector<LightTriangle> &triangles)
+{
+	// Children are stored after their parent
+	for (size_t i = nodes.size(); i-- > 0;)
+	{
+		refit_node(nodes, triangles, i);
+	}
+}
+
+void link_light_tree(const std::vector<LightTreeNode> &nodes, std::vector<uint32_t> &parents, std::vector<uint32_t> &leaves)
+{
+	parents.assign(nodes.size(), ~0u);
+	leaves.assign((nodes.size() + 1) / 2, ~0u);
+	for (uint32_t i = 0; i < nodes.size(); i++)
+	{
+		if (nodes[i].child < 0)
+		{
+			leaves[~nodes[i].child] = i;
+		}
+		else
+		{
+			parents[i + 1]          = i;
+			parents[nodes[i].child] = i;
+		}
+	}
+}
+
+void refit_light_tree(std::vector<LightTreeNode> &nodes, const std::vector<LightTriangle> &triangles, const std::vector<uint32_t> &parents, const std::vector<uint32_t> &leaves, const std::vector<uint32_t> &moved_emitters, std::vector<uint32_t> &refitted)
+{
+	refitted.clear();
+	for (auto &emitter : moved_emitters)
+	{
+		for (uint32_t node = leaves[emitter]; node != ~0u; node = parents[node])
+		{
+			refitted.push_back(node);
+		}
+	}
+	std::sort(refitted.begin(), refitted.end());
+	refitted.erase(std::unique(refitted.begin(), refitted.end()), refitted.end());
+
+	// Children are stored after their parent
+	for (size_t i = refitted.size(); i-- > 0;)
+	{
+		refit_node(nodes, triangles, refitted[i]);
+	}
+}
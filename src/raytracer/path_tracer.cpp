@@ -0,0 +1,970 @@
+#include "path_tracer.hpp"
+#include "random.hpp"
+#include "scene.hpp"
+#include "work_stealing.hpp"
+
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <stb/stb_image_write.h>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <numbers>
+
+#define PATH_TRACER_TILE_SIZE 16
+#define PATH_TRACER_INFINITY 1e32f        // Infinity in common.slangh
+
+#define POSITIVE_X 0
+#define NEGATIVE_X 1
+#define POSITIVE_Y 2
+#define NEGATIVE_Y 3
+#define POSITIVE_Z 4
+#define NEGATIVE_Z 5
+
+// ShadeState in common.slangh
+struct ShadeState
+{
+	glm::vec3 normal;
+	glm::vec3 geom_normal;
+	glm::vec3 ffnormal;
+	glm::vec3 position;
+	glm::vec3 tangent;
+	glm::vec3 bitangent;
+	float     eta;
+	Material  mat;
+};
+
+struct LightSample
+{
+	glm::vec3 le   = glm::vec3(0.f);
+	glm::vec3 dir  = glm::vec3(0.f);
+	glm::vec3 pos  = glm::vec3(0.f);
+	glm::vec3 norm = glm::vec3(0.f);
+	float     dist = 0.f;
+	float     pdf  = 1.f;
+};
+
+struct BSDFSample
+{
+	glm::vec3 L   = glm::vec3(0.f);
+	glm::vec3 f   = glm::vec3(0.f);
+	float     pdf = 0.f;
+};
+
+inline float luminance(const glm::vec3 &color)
+{
+	return glm::dot(color, glm::vec3(0.212671f, 0.715160f, 0.072169f));
+}
+
+inline glm::vec3 unpack_e5b9g9r9(uint32_t v)
+{
+	float scale = std::exp2(static_cast<float>(static_cast<int32_t>(v >> 27) - 24));
+	return glm::vec3(static_cast<float>(v & 0x1ff), static_cast<float>((v >> 9) & 0x1ff), static_cast<float>((v >> 18) & 0x1ff)) * scale;
+}
+
+inline void coordinate_system(const glm::vec3 &N, glm::vec3 &Nt, glm::vec3 &Nb)
+{
+	Nt = glm::normalize(std::abs(N.z) > 0.99999f ? glm::vec3(-N.x * N.y, 1.f - N.y * N.y, -N.y * N.z) :
+	                                               glm::vec3(-N.x * N.z, -N.y * N.z, 1.f - N.z * N.z));
+	Nb = glm::normalize(glm::cross(Nt, N));
+}
+
+inline float power_heuristic(float a, float b)
+{
+	float t = a * a;
+	return t / (b * b + t);
+}
+
+inline glm::vec3 offset_ray(const glm::vec3 &p, const glm::vec3 &n)
+{
+	const float int_scale   = 256.f;
+	const float float_scale = 1.f / 65536.f;
+	const float origin      = 1.f / 32.f;
+
+	glm::vec3 result;
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		int32_t of_i = static_cast<int32_t>(int_scale * n[i]);
+		float   p_i  = std::bit_cast<float>(std::bit_cast<int32_t>(p[i]) + (p[i] < 0.f ? -of_i : of_i));
+		result[i]    = std::abs(p[i]) < origin ? p[i] + float_scale * n[i] : p_i;
+	}
+	return result;
+}
+
+inline glm::vec3 reflect(const glm::vec3 &I, const glm::vec3 &N)
+{
+	return I - 2.f * glm::dot(N, I) * N;
+}
+
+// HLSL refract(), zero on total internal reflection
+inline glm::vec3 refract(const glm::vec3 &I, const glm::vec3 &N, float eta)
+{
+	float cos_i = glm::dot(-I, N);
+	float k     = 1.f - eta * eta * (1.f - cos_i * cos_i);
+	return k < 0.f ? glm::vec3(0.f) : eta * I + (eta * cos_i - std::sqrt(k)) * N;
+}
+
+// SampleLevel(Linear, uv, 0) with repeat addressing
+inline glm::vec4 sample_texture(const PathTracerTexture &texture, glm::vec2 uv)
+{
+	if (texture.texels.empty())
+	{
+		return glm::vec4(1.f);
+	}
+
+	uv = uv - glm::floor(uv);
+	if (!(uv.x >= 0.f && uv.y >= 0.f))
+	{
+		uv = glm::vec2(0.f);
+	}
+
+	glm::vec2 st = uv * glm::vec2(texture.width, texture.height) - 0.5f;
+	glm::vec2 t  = st - glm::floor(st);
+	int32_t   x0 = static_cast<int32_t>(std::floor(st.x));
+	int32_t   y0 = static_cast<int32_t>(std::floor(st.y));
+
+	auto fetch = [&](int32_t x, int32_t y) {
+		x                = (x + static_cast<int32_t>(texture.width)) % static_cast<int32_t>(texture.width);
+		y                = (y + static_cast<int32_t>(texture.height)) % static_cast<int32_t>(texture.height);
+		const uint8_t *p = texture.texels.data() + (static_cast<size_t>(y) * texture.width + x) * 4;
+		return glm::vec4(p[0], p[1], p[2], p[3]) * (1.f / 255.f);
+	};
+
+	return glm::mix(glm::mix(fetch(x0, y0), fetch(x0 + 1, y0), t.x),
+	                glm::mix(fetch(x0, y0 + 1), fetch(x0 + 1, y0 + 1), t.x), t.y);
+}
+
+// Cube face a direction falls into, uv are the face coordinates in [-1, 1], as envmap_texel() in scene.slangh
+inline uint32_t cubemap_face(const glm::vec3 &dir, glm::vec2 &uv)
+{
+	glm::vec3 a = glm::abs(dir);
+	if (a.x >= a.y && a.x >= a.z)
+	{
+		uv = glm::vec2(dir.x > 0.f ? -dir.z : dir.z, -dir.y) / a.x;
+		return dir.x > 0.f ? POSITIVE_X : NEGATIVE_X;
+	}
+	if (a.y >= a.z)
+	{
+		uv = glm::vec2(dir.x, dir.y > 0.f ? dir.z : -dir.z) / a.y;
+		return dir.y > 0.f ? POSITIVE_Y : NEGATIVE_Y;
+	}
+	uv = glm::vec2(dir.z > 0.f ? dir.x : -dir.x, -dir.y) / a.z;
+	return dir.z > 0.f ? POSITIVE_Z : NEGATIVE_Z;
+}
+
+// EnvMap.SampleLevel(Linear, dir, 0), bilinear within the face and clamped at its edges
+inline glm::vec3 sample_envmap(const PathTracerScene &scene, const glm::vec3 &dir)
+{
+	if (scene.envmap.empty())
+	{
+		return glm::vec3(0.f);
+	}
+
+	glm::vec2 uv;
+	uint32_t  face = cubemap_face(dir, uv);
+	int32_t   size = static_cast<int32_t>(scene.envmap_size);
+
+	glm::vec2 st = (uv * 0.5f + 0.5f) * static_cast<float>(size) - 0.5f;
+	glm::vec2 t  = st - glm::floor(st);
+	int32_t   x0 = static_cast<int32_t>(std::floor(st.x));
+	int32_t   y0 = static_cast<int32_t>(std::floor(st.y));
+
+	auto fetch = [&](int32_t x, int32_t y) {
+		x = std::clamp(x, 0, size - 1);
+		y = std::clamp(y, 0, size - 1);
+		return glm::vec3(glm::unpackHalf(scene.envmap[(static_cast<size_t>(face) * size + y) * size + x]));
+	};
+
+	return glm::mix(glm::mix(fetch(x0, y0), fetch(x0 + 1, y0), t.x),
+	                glm::mix(fetch(x0, y0 + 1), fetch(x0 + 1, y0 + 1), t.x), t.y);
+}
+
+inline void sample_envmap_alias_table(const PathTracerScene &scene, const glm::vec2 &rnd, int32_t &index, float &pdf)
+{
+	const int32_t column_count    = static_cast<int32_t>(scene.envmap_alias_table.size());
+	int32_t       selected_column = std::min(static_cast<int32_t>(static_cast<float>(column_count) * rnd.x), column_count - 1);
+	AliasTable    col             = scene.envmap_alias_table[selected_column];
+	if (col.prob > rnd.y)
+	{
+		index = selected_column;
+		pdf   = col.ori_prob;
+	}
+	else
+	{
+		index = col.alias;
+		pdf   = col.alias_ori_prob;
+	}
+}
+
+// sample_emitter_alias_table() in scene.slangh
+inline void sample_emitter_alias_table(const PathTracerScene &scene, const glm::vec2 &rnd, int32_t &index, float &pdf)
+{
+	const int32_t column_count    = static_cast<int32_t>(scene.emitter_alias_table.size());
+	int32_t       selected_column = std::min(static_cast<int32_t>(static_cast<float>(column_count) * rnd.x), column_count - 1);
+	AliasTable    col             = scene.emitter_alias_table[selected_column];
+	if (col.prob > rnd.y)
+	{
+		index = selected_column;
+		pdf   = col.ori_prob;
+	}
+	else
+	{
+		index = col.alias;
+		pdf   = col.alias_ori_prob;
+	}
+}
+
+inline int32_t envmap_texel(const PathTracerScene &scene, const glm::vec3 &dir, glm::vec2 &uv)
+{
+	int32_t    size  = static_cast<int32_t>(scene.envmap_alias_table_size);
+	uint32_t   face  = cubemap_face(dir, uv);
+	glm::ivec2 texel = glm::min(glm::ivec2((uv * 0.5f + 0.5f) * static_cast<float>(size)), size - 1);
+	return (static_cast<int32_t>(face) * size + texel.y) * size + texel.x;
+}
+
+// Uniform point within the face coordinates of a texel
+inline glm::vec3 envmap_texel_direction(const PathTracerScene &scene, int32_t index, const glm::vec2 &rnd, glm::vec2 &uv)
+{
+	int32_t    size  = static_cast<int32_t>(scene.envmap_alias_table_size);
+	int32_t    face  = index / (size * size);
+	glm::ivec2 texel = glm::ivec2(index % size, (index / size) % size);
+	uv               = (glm::vec2(texel) + rnd) / static_cast<float>(size) * 2.f - 1.f;
+	switch (face)
+	{
+		case POSITIVE_X:
+			return glm::normalize(glm::vec3(1.f, -uv.y, -uv.x));
+		case NEGATIVE_X:
+			return glm::normalize(glm::vec3(-1.f, -uv.y, uv.x));
+		case POSITIVE_Y:
+			return glm::normalize(glm::vec3(uv.x, 1.f, uv.y));
+		case NEGATIVE_Y:
+			return glm::normalize(glm::vec3(uv.x, -1.f, -uv.y));
+		case POSITIVE_Z:
+			return glm::normalize(glm::vec3(uv.x, -uv.y, 1.f));
+		default:
+			return glm::normalize(glm::vec3(-uv.x, -uv.y, -1.f));
+	}
+}
+
+// Solid angle density of a direction within its texel
+inline float envmap_texel_pdf(const PathTracerScene &scene, const glm::vec2 &uv)
+{
+	float d = 1.f + glm::dot(uv, uv);
+	return d * std::sqrt(d) * static_cast<float>(scene.envmap_alias_table_size * scene.envmap_alias_table_size) * 0.25f;
+}
+
+inline float envmap_pdf(const PathTracerScene &scene, const glm::vec3 &dir)
+{
+	if (scene.envmap_alias_table.empty())
+	{
+		return 0.f;
+	}
+
+	glm::vec2 uv;
+	int32_t   index = envmap_texel(scene, dir, uv);
+	return scene.envmap_alias_table[index].ori_prob * envmap_texel_pdf(scene, uv);
+}
+
+inline float envmap_selection_pdf(const PathTracerScene &scene)
+{
+	return scene.emitters.empty() ? 1.f : 0.5f;
+}
+
+// Vertices of a triangle of an instance
+inline std::array<const Vertex *, 3> fetch_triangle(const PathTracerScene &scene, const Instance &instance, uint32_t primitive_id)
+{
+	const uint32_t *index  = scene.indices.data() + instance.indices_offset + primitive_id * 3;
+	const Vertex   *vertex = scene.vertices.data() + instance.vertices_offset;
+	return {vertex + index[0], vertex + index[1], vertex + index[2]};
+}
+
+// get_shade_state() in raytrace.slangh
+inline ShadeState get_shade_state(const PathTracerScene &scene, const Ray &ray, const RayHit &hit)
+{
+	const Instance &instance = scene.instances[hit.instance_id];
+	const glm::vec3 bary     = glm::vec3(1.f - hit.bary.x - hit.bary.y, hit.bary.x, hit.bary.y);
+
+	auto [v0, v1, v2] = fetch_triangle(scene, instance, hit.primitive_id);
+
+	const glm::mat3 world_to_object = glm::mat3(instance.transform_inv);
+	const glm::vec3 world_position  = ray.origin + hit.t * ray.direction;
+
+	// mul(WorldToObject4x3, n) is the inverse transpose of the object to world transform
+	const glm::vec3 normal       = glm::vec3(v0->normal) * bary.x + glm::vec3(v1->normal) * bary.y + glm::vec3(v2->normal) * bary.z;
+	glm::vec3       world_normal = glm::normalize(normal * world_to_object);
+	glm::vec3       geom_normal  = glm::normalize(glm::cross(glm::vec3(v1->position) - glm::vec3(v0->position), glm::vec3(v2->position) - glm::vec3(v0->position)));
+	glm::vec3       wgeom_normal = glm::normalize(geom_normal * world_to_object);
+	glm::vec3       ffnormal     = glm::dot(world_normal, ray.direction) <= 0.f ? world_normal : -world_normal;
+
+	glm::vec3 world_tangent, world_bitangent;
+	coordinate_system(ffnormal, world_tangent, world_bitangent);
+
+	const glm::vec2 uv0       = glm::vec2(v0->position.w, v0->normal.w);
+	const glm::vec2 uv1       = glm::vec2(v1->position.w, v1->normal.w);
+	const glm::vec2 uv2       = glm::vec2(v2->position.w, v2->normal.w);
+	const glm::vec2 tex_coord = uv0 * bary.x + uv1 * bary.y + uv2 * bary.z;
+
+	Material material = scene.materials[instance.material];
+
+	if (material.normal_texture > -1)
+	{
+		// mul(float3x3(T, B, N), n) as in the shader
+		glm::vec4 texel      = sample_texture(scene.textures[material.normal_texture], tex_coord);
+		glm::vec2 xy         = glm::vec2(texel) * 2.f - 1.f;
+		glm::vec3 normal_vec = glm::normalize(glm::vec3(xy, std::sqrt(std::clamp(1.f - glm::dot(xy, xy), 0.f, 1.f))));
+		world_normal         = glm::normalize(glm::vec3(glm::dot(world_tangent, normal_vec), glm::dot(world_bitangent, normal_vec), glm::dot(world_normal, normal_vec)));
+		ffnormal             = glm::dot(world_normal, ray.direction) <= 0.f ? world_normal : -world_normal;
+		coordinate_system(ffnormal, world_tangent, world_bitangent);
+	}
+
+	if (material.metallic_roughness_texture > -1)
+	{
+		glm::vec4 metallic_roughness = sample_texture(scene.textures[material.metallic_roughness_texture], tex_coord);
+		material.roughness_factor *= metallic_roughness.g;
+		material.metallic_factor *= metallic_roughness.b;
+	}
+	material.roughness_factor = std::max(0.001f, material.roughness_factor);
+
+	if (material.base_color_texture > -1)
+	{
+		glm::vec4 base_color = sample_texture(scene.textures[material.base_color_texture], tex_coord);
+		base_color           = glm::vec4(glm::pow(glm::vec3(base_color), glm::vec3(2.2f)), base_color.a);
+		material.base_color *= base_color;
+	}
+
+	if (material.emissive_texture > -1)
+	{
+		material.emissive_factor *= glm::pow(glm::vec3(sample_texture(scene.textures[material.emissive_texture], tex_coord)), glm::vec3(2.2f));
+	}
+
+	ShadeState sstate;
+	sstate.normal      = world_normal;
+	sstate.geom_normal = wgeom_normal;
+	sstate.ffnormal    = ffnormal;
+	sstate.position    = world_position;
+	sstate.tangent     = world_tangent;
+	sstate.bitangent   = world_bitangent;
+	sstate.mat         = material;
+
+	if (glm::dot(sstate.normal, sstate.geom_normal) <= 0.f)
+	{
+		sstate.normal *= -1.f;
+	}
+
+	sstate.eta = glm::dot(sstate.normal, sstate.ffnormal) > 0.f ? 1.f / 1.5f : 1.5f;
+	return sstate;
+}
+
+inline float cos_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b)
+{
+	return cos_a > cos_b ? 1.f : cos_a * cos_b + sin_a * sin_b;
+}
+
+inline float sin_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b)
+{
+	return cos_a > cos_b ? 0.f : sin_a * cos_b - cos_a * sin_b;
+}
+
+// light_tree_importance() in raytrace.slangh
+inline float light_tree_importance(const LightTreeNode &node, const glm::vec3 &p, const glm::vec3 &n)
+{
+	glm::vec3 center = 0.5f * (node.bbox_min + node.bbox_max);
+	float     radius = 0.5f * glm::length(node.bbox_max - node.bbox_min);
+	glm::vec3 d      = center - p;
+	float     dist2  = glm::dot(d, d);
+	glm::vec3 wi     = d / std::sqrt(std::max(dist2, 1e-12f));
+
+	float cos_theta_u = dist2 < radius * radius ? -1.f : std::sqrt(std::max(0.f, 1.f - radius * radius / dist2));
+	float sin_theta_u = std::sqrt(std::max(0.f, 1.f - cos_theta_u * cos_theta_u));
+	dist2             = std::max(dist2, radius * radius);
+
+	float cos_theta   = std::abs(glm::dot(node.axis, wi));
+	float sin_theta   = std::sqrt(std::max(0.f, 1.f - cos_theta * cos_theta));
+	float sin_theta_o = std::sqrt(std::max(0.f, 1.f - node.cos_theta_o * node.cos_theta_o));
+	float cos_theta_x = cos_sub_clamped(sin_theta, cos_theta, sin_theta_o, node.cos_theta_o);
+	float sin_theta_x = sin_sub_clamped(sin_theta, cos_theta, sin_theta_o, node.cos_theta_o);
+	float cos_theta_p = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_u, cos_theta_u);
+	if (cos_theta_p <= 0.f)
+	{
+		return 0.f;
+	}
+
+	float cos_theta_i  = std::abs(glm::dot(n, wi));
+	float sin_theta_i  = std::sqrt(std::max(0.f, 1.f - cos_theta_i * cos_theta_i));
+	float cos_theta_ip = cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_u, cos_theta_u);
+
+	return node.power * cos_theta_p * cos_theta_ip / dist2;
+}
+
+// sample_light_tree() in raytrace.slangh
+inline bool sample_light_tree(const PathTracerScene &scene, const glm::vec3 &p, const glm::vec3 &n, uint32_t &seed, uint32_t &emitter_id, float &pmf)
+{
+	uint32_t             node_index = 0;
+	const LightTreeNode *node       = &scene.light_tree[0];
+	emitter_id                      = 0;
+	pmf                             = 1.f;
+	while (node->child > 0)
+	{
+		const LightTreeNode &left             = scene.light_tree[node_index + 1];
+		const LightTreeNode &right            = scene.light_tree[node->child];
+		float                importance_left  = light_tree_importance(left, p, n);
+		float                importance_right = light_tree_importance(right, p, n);
+		if (importance_left + importance_right <= 0.f)
+		{
+			return false;
+		}
+
+		float prob_left = importance_left / (importance_left + importance_right);
+		if (random_float(seed) < prob_left)
+		{
+			node_index = node_index + 1;
+			node       = &left;
+			pmf *= prob_left;
+		}
+		else
+		{
+			node_index = static_cast<uint32_t>(node->child);
+			node       = &right;
+			pmf *= 1.f - prob_left;
+		}
+	}
+	emitter_id = static_cast<uint32_t>(~node->child);
+	return node->power > 0.f;
+}
+
+// sample_light_idx() in raytrace.slangh, ids past the emitters are envmap texels
+inline LightSample sample_light_idx(const PathTracerScene &scene, const ShadeState &sstate, uint32_t idx, uint32_t &seed)
+{
+	LightSample ls;
+
+	if (idx < scene.emitters.size())
+	{
+		const Emitter  &emitter  = scene.emitters[idx];
+		const Instance &instance = scene.instances[emitter.instance];
+
+		auto [v0, v1, v2] = fetch_triangle(scene, instance, emitter.triangle);
+
+		const glm::vec3 p0 = glm::vec3(instance.transform * glm::vec4(glm::vec3(v0->position), 1.f));
+		const glm::vec3 p1 = glm::vec3(instance.transform * glm::vec4(glm::vec3(v1->position), 1.f));
+		const glm::vec3 p2 = glm::vec3(instance.transform * glm::vec4(glm::vec3(v2->position), 1.f));
+
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float     area   = 0.5f * glm::length(normal);
+		float     a      = std::sqrt(random_float(seed));
+		float     b      = a * random_float(seed);
+
+		ls.pos  = p0 + (p1 - p0) * (1.f - a) + (p2 - p0) * b;
+		ls.norm = normal / std::max(2.f * area, 1e-20f);
+		ls.dir  = glm::normalize(ls.pos - sstate.position);
+		ls.dist = glm::length(ls.pos - sstate.position);
+		ls.le   = unpack_e5b9g9r9(emitter.radiance);
+
+		const Material &material = scene.materials[instance.material];
+		if (material.emissive_texture > -1)
+		{
+			const glm::vec2 uv0 = glm::vec2(v0->position.w, v0->normal.w);
+			const glm::vec2 uv1 = glm::vec2(v1->position.w, v1->normal.w);
+			const glm::vec2 uv2 = glm::vec2(v2->position.w, v2->normal.w);
+			const glm::vec2 uv  = uv0 + (uv1 - uv0) * (1.f - a) + (uv2 - uv0) * b;
+			ls.le *= glm::pow(glm::vec3(sample_texture(scene.textures[material.emissive_texture], uv)), glm::vec3(2.2f));
+		}
+		ls.pdf = ls.dist * ls.dist / (area * std::abs(glm::dot(ls.norm, -ls.dir)));
+	}
+	else
+	{
+		glm::vec2 uv;
+		ls.dir  = envmap_texel_direction(scene, static_cast<int32_t>(idx - scene.emitters.size()), random_float2(seed), uv);
+		ls.dist = PATH_TRACER_INFINITY;
+		ls.pos  = sstate.position + ls.dir * ls.dist;
+		ls.norm = -ls.dir;
+		ls.le   = sample_envmap(scene, ls.dir);
+		ls.pdf  = envmap_texel_pdf(scene, uv);
+	}
+	return ls;
+}
+
+inline LightSample empty_light_sample(const ShadeState &sstate)
+{
+	LightSample ls;
+	ls.dir  = sstate.ffnormal;
+	ls.pos  = sstate.position;
+	ls.norm = -sstate.ffnormal;
+	return ls;
+}
+
+// sample_light() in raytrace.slangh, EmitterSampling::AliasTable picks emitters as the shader did before the light tree
+inline LightSample sample_light(const PathTracerScene &scene, const PathTracerSettings &settings, const ShadeState &sstate, uint32_t &seed)
+{
+	if (random_float(seed) < envmap_selection_pdf(scene))
+	{
+		if (scene.envmap_alias_table.empty())
+		{
+			return empty_light_sample(sstate);
+		}
+
+		int32_t texel;
+		float   texel_pdf;
+		sample_envmap_alias_table(scene, random_float2(seed), texel, texel_pdf);
+		LightSample ls = sample_light_idx(scene, sstate, static_cast<uint32_t>(scene.emitters.size()) + static_cast<uint32_t>(texel), seed);
+		ls.pdf *= texel_pdf * envmap_selection_pdf(scene);
+		return ls;
+	}
+
+	uint32_t emitter_id;
+	float    emitter_pdf;
+	if (settings.emitter_sampling == EmitterSampling::AliasTable && !scene.emitters.empty())
+	{
+		int32_t index;
+		sample_emitter_alias_table(scene, random_float2(seed), index, emitter_pdf);
+		emitter_id = static_cast<uint32_t>(index);
+	}
+	else if (scene.emitters.empty() || !sample_light_tree(scene, sstate.position, sstate.normal, seed, emitter_id, emitter_pdf))
+	{
+		return empty_light_sample(sstate);
+	}
+	LightSample ls = sample_light_idx(scene, sstate, emitter_id, seed);
+	ls.pdf *= emitter_pdf * (1.f - envmap_selection_pdf(scene));
+	return ls;
+}
+
+// bsdf.slangh
+
+inline glm::vec3 cosine_sample_hemisphere(float r1, float r2)
+{
+	glm::vec3 dir;
+	float     r   = std::sqrt(r1);
+	float     phi = 2.f * std::numbers::pi_v<float> * r2;
+	dir.x         = r * std::cos(phi);
+	dir.y         = r * std::sin(phi);
+	dir.z         = std::sqrt(std::max(0.f, 1.f - dir.x * dir.x - dir.y * dir.y));
+	return dir;
+}
+
+inline glm::vec3 importance_sample_GTR2(float rgh, float r1, float r2)
+{
+	float a = std::max(0.001f, rgh);
+
+	float phi = r1 * 2.f * std::numbers::pi_v<float>;
+
+	float cos_theta = std::sqrt((1.f - r2) / (1.f + (a * a - 1.f) * r2));
+	float sin_theta = std::clamp(std::sqrt(1.f - (cos_theta * cos_theta)), 0.f, 1.f);
+
+	return glm::vec3(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+}
+
+inline float GTR1(float NdotH, float a)
+{
+	if (a >= 1.f)
+	{
+		return 1.f / std::numbers::pi_v<float>;
+	}
+	float a2 = a * a;
+	float t  = 1.f + (a2 - 1.f) * NdotH * NdotH;
+	return (a2 - 1.f) / (std::numbers::pi_v<float> * std::log(a2) * t);
+}
+
+inline float GTR2(float NdotH, float a)
+{
+	float a2 = a * a;
+	float t  = 1.f + (a2 - 1.f) * NdotH * NdotH;
+	return a2 / (std::numbers::pi_v<float> * t * t);
+}
+
+inline float schlick_fresnel(float u)
+{
+	float m  = std::clamp(1.f - u, 0.f, 1.f);
+	float m2 = m * m;
+	return m2 * m2 * m;
+}
+
+inline float SmithG_GGX(float NdotV, float alphaG)
+{
+	float a = alphaG * alphaG;
+	float b = NdotV * NdotV;
+	return 1.f / (NdotV + std::sqrt(a + b - a * b));
+}
+
+inline float dielectric_fresnel(float cos_theta_i, float eta)
+{
+	float sin_theta_t_sq = eta * eta * (1.f - cos_theta_i * cos_theta_i);
+
+	// Total internal reflection
+	if (sin_theta_t_sq > 1.f)
+	{
+		return 1.f;
+	}
+
+	float cos_theta_t = std::sqrt(std::max(1.f - sin_theta_t_sq, 0.f));
+
+	float rs = (eta * cos_theta_t - cos_theta_i) / (eta * cos_theta_t + cos_theta_i);
+	float rp = (eta * cos_theta_i - cos_theta_t) / (eta * cos_theta_i + cos_theta_t);
+
+	return 0.5f * (rs * rs + rp * rp);
+}
+
+inline glm::vec3 eval_diffuse(const ShadeState &sstate, const glm::vec3 &V, const glm::vec3 &N, const glm::vec3 &L, const glm::vec3 &H, float &pdf)
+{
+	if (glm::dot(N, L) < 0.f)
+	{
+		return glm::vec3(0.f);
+	}
+
+	pdf = glm::dot(N, L) * (1.f / std::numbers::pi_v<float>);
+
+	float FL   = schlick_fresnel(glm::dot(N, L));
+	float FV   = schlick_fresnel(glm::dot(N, V));
+	float Fd90 = 0.5f + 2.f * glm::dot(L, H) * glm::dot(L, H) * sstate.mat.roughness_factor;
+	float Fd   = glm::mix(1.f, Fd90, FL) * glm::mix(1.f, Fd90, FV);
+
+	return ((1.f / std::numbers::pi_v<float>) * Fd * glm::vec3(sstate.mat.base_color)) * (1.f - sstate.mat.metallic_factor);
+}
+
+inline glm::vec3 eval_specular(const ShadeState &sstate, const glm::vec3 &Cspec0, const glm::vec3 &V, const glm::vec3 &N, const glm::vec3 &L, const glm::vec3 &H, float &pdf)
+{
+	if (glm::dot(N, L) < 0.f)
+	{
+		return glm::vec3(0.f);
+	}
+
+	float D = GTR2(glm::dot(N, H), sstate.mat.roughness_factor);
+	pdf     = D * glm::dot(N, H) / (4.f * glm::dot(V, H));
+
+	float     FH = schlick_fresnel(glm::dot(L, H));
+	glm::vec3 F  = glm::mix(Cspec0, glm::vec3(1.f), FH);
+	float     G  = SmithG_GGX(glm::dot(N, L), sstate.mat.roughness_factor) * SmithG_GGX(glm::dot(N, V), sstate.mat.roughness_factor);
+	return F * D * G;
+}
+
+inline glm::vec3 eval_clearcoat(const ShadeState &sstate, const glm::vec3 &V, const glm::vec3 &N, const glm::vec3 &L, const glm::vec3 &H, float &pdf)
+{
+	if (glm::dot(N, L) < 0.f)
+	{
+		return glm::vec3(0.f);
+	}
+
+	float D = GTR1(glm::dot(N, H), sstate.mat.clearcoat_roughness_factor);
+	pdf     = D * glm::dot(N, H) / (4.f * glm::dot(V, H));
+
+	float FH = schlick_fresnel(glm::dot(L, H));
+	float F  = glm::mix(0.04f, 1.f, FH);
+	float G  = SmithG_GGX(glm::dot(N, L), 0.25f) * SmithG_GGX(glm::dot(N, V), 0.25f);
+	return glm::vec3(0.25f * sstate.mat.clearcoat_factor * F * D * G);
+}
+
+inline glm::vec3 eval_dielectric_reflection(const ShadeState &sstate, const glm::vec3 &V, const glm::vec3 &N, const glm::vec3 &L, const glm::vec3 &H, float &pdf)
+{
+	if (glm::dot(N, L) < 0.f)
+	{
+		return glm::vec3(0.f);
+	}
+
+	float F = dielectric_fresnel(glm::dot(V, H), sstate.eta);
+	float D = GTR2(glm::dot(N, H), sstate.mat.roughness_factor);
+
+	pdf = D * glm::dot(N, H) * F / (4.f * glm::dot(V, H));
+
+	float G = SmithG_GGX(std::abs(glm::dot(N, L)), sstate.mat.roughness_factor) * SmithG_GGX(glm::dot(N, V), sstate.mat.roughness_factor);
+	return glm::vec3(sstate.mat.base_color) * F * D * G;
+}
+
+inline glm::vec3 eval_dielectric_refraction(const ShadeState &sstate, const glm::vec3 &V, const glm::vec3 &N, const glm::vec3 &L, const glm::vec3 &H, float &pdf)
+{
+	float F = dielectric_fresnel(std::abs(glm::dot(V, H)), sstate.eta);
+	float D = GTR2(glm::dot(N, H), sstate.mat.roughness_factor);
+
+	float denom_sqrt = glm::dot(L, H) * sstate.eta + glm::dot(V, H);
+	pdf              = D * glm::dot(N, H) * (1.f - F) * std::abs(glm::dot(L, H)) / (denom_sqrt * denom_sqrt);
+
+	float G = SmithG_GGX(std::abs(glm::dot(N, L)), sstate.mat.roughness_factor) * SmithG_GGX(glm::dot(N, V), sstate.mat.roughness_factor);
+	return glm::vec3(sstate.mat.base_color) * (1.f - F) * D * G * std::abs(glm::dot(V, H)) * std::abs(glm::dot(L, H)) * 4.f * sstate.eta * sstate.eta / (denom_sqrt * denom_sqrt);
+}
+
+// f and pdf are those of the sampled lobe while eval_bsdf() reports the whole mixture, kept as in bsdf.slangh so the reference matches the GPU
+inline BSDFSample sample_bsdf(const ShadeState &sstate, const glm::vec3 &V, uint32_t &seed)
+{
+	BSDFSample bs;
+
+	float r1 = random_float(seed);
+	float r2 = random_float(seed);
+
+	float diffuse_ratio = 0.5f * (1.f - sstate.mat.metallic_factor);
+	float trans_weight  = (1.f - sstate.mat.metallic_factor) * sstate.mat.transmission_factor;
+
+	glm::vec3 Cdlin  = glm::vec3(sstate.mat.base_color);
+	glm::vec3 Cspec0 = glm::mix(glm::vec3(0.f), Cdlin, sstate.mat.metallic_factor);
+
+	if (random_float(seed) < trans_weight)
+	{
+		glm::vec3 H = importance_sample_GTR2(sstate.mat.roughness_factor, r1, r2);
+		H           = glm::normalize(sstate.tangent * H.x + sstate.bitangent * H.y + sstate.ffnormal * H.z);
+
+		glm::vec3 R = reflect(-V, H);
+		float     F = dielectric_fresnel(std::abs(glm::dot(R, H)), sstate.eta);
+
+		if (random_float(seed) < F)
+		{
+			bs.L = glm::normalize(R);
+			bs.f = eval_dielectric_reflection(sstate, V, sstate.ffnormal, bs.L, H, bs.pdf);
+		}
+		else
+		{
+			bs.L = glm::normalize(refract(-V, H, sstate.eta));
+			bs.f = eval_dielectric_refraction(sstate, V, sstate.ffnormal, bs.L, H, bs.pdf);
+		}
+
+		bs.f *= trans_weight;
+		bs.pdf *= trans_weight;
+	}
+	else
+	{
+		if (random_float(seed) < diffuse_ratio)
+		{
+			glm::vec3 L = cosine_sample_hemisphere(r1, r2);
+			bs.L        = sstate.tangent * L.x + sstate.bitangent * L.y + sstate.ffnormal * L.z;
+			glm::vec3 H = glm::normalize(bs.L + V);
+			bs.f        = eval_diffuse(sstate, V, sstate.ffnormal, bs.L, H, bs.pdf);
+			bs.pdf *= diffuse_ratio;
+		}
+		else
+		{
+			float primary_spec_ratio = 1.f / (1.f + sstate.mat.clearcoat_factor);
+			if (random_float(seed) < primary_spec_ratio)
+			{
+				glm::vec3 H = importance_sample_GTR2(sstate.mat.roughness_factor, r1, r2);
+				H           = sstate.tangent * H.x + sstate.bitangent * H.y + sstate.ffnormal * H.z;
+				bs.L        = glm::normalize(reflect(-V, H));
+				bs.f        = eval_specular(sstate, Cspec0, V, sstate.normal, bs.L, H, bs.pdf);
+				bs.pdf *= primary_spec_ratio * (1.f - diffuse_ratio);
+			}
+			else
+			{
+				glm::vec3 H = importance_sample_GTR2(sstate.mat.clearcoat_roughness_factor, r1, r2);
+				H           = sstate.tangent * H.x + sstate.bitangent * H.y + sstate.ffnormal * H.z;
+				bs.L        = glm::normalize(reflect(-V, H));
+				bs.f        = eval_clearcoat(sstate, V, sstate.normal, bs.L, H, bs.pdf);
+				bs.pdf *= (1.f - primary_spec_ratio) * (1.f - diffuse_ratio);
+			}
+		}
+
+		bs.f *= 1.f - trans_weight;
+		bs.pdf *= 1.f - trans_weight;
+	}
+
+	return bs;
+}
+
+inline glm::vec3 eval_bsdf(const ShadeState &sstate, const glm::vec3 &V, const glm::vec3 &N, const glm::vec3 &L, float &pdf)
+{
+	glm::vec3 H = glm::dot(N, L) < 0.f ? glm::normalize(L * (1.f / sstate.eta) + V) : glm::normalize(L + V);
+
+	float diffuse_ratio      = 0.5f * (1.f - sstate.mat.metallic_factor);
+	float primary_spec_ratio = 1.f / (1.f + sstate.mat.clearcoat_factor);
+	float trans_weight       = (1.f - sstate.mat.metallic_factor) * sstate.mat.transmission_factor;
+
+	glm::vec3 brdf = glm::vec3(0.f);
+	glm::vec3 bsdf = glm::vec3(0.f);
+
+	float brdf_pdf = 0.f;
+	float bsdf_pdf = 0.f;
+
+	if (trans_weight > 0.f)
+	{
+		if (glm::dot(N, L) < 0.f)
+		{
+			bsdf = eval_dielectric_refraction(sstate, V, N, L, H, bsdf_pdf);
+		}
+		else
+		{
+			bsdf = eval_dielectric_reflection(sstate, V, N, L, H, bsdf_pdf);
+		}
+	}
+
+	// Lobes below the surface return early and leave the previous lobe's pdf, as in the shader
+	float m_pdf = 0.f;
+
+	if (trans_weight < 1.f)
+	{
+		glm::vec3 Cdlin  = glm::vec3(sstate.mat.base_color);
+		glm::vec3 Cspec0 = glm::mix(glm::vec3(0.f), Cdlin, sstate.mat.metallic_factor);
+
+		brdf += eval_diffuse(sstate, V, N, L, H, m_pdf);
+		brdf_pdf += m_pdf * diffuse_ratio;
+
+		brdf += eval_specular(sstate, Cspec0, V, N, L, H, m_pdf);
+		brdf_pdf += m_pdf * primary_spec_ratio * (1.f - diffuse_ratio);
+
+		brdf += eval_clearcoat(sstate, V, N, L, H, m_pdf);
+		brdf_pdf += m_pdf * (1.f - primary_spec_ratio) * (1.f - diffuse_ratio);
+	}
+
+	pdf = glm::mix(brdf_pdf, bsdf_pdf, trans_weight);
+	return glm::mix(brdf, bsdf, trans_weight);
+}
+
+// path_trace() in path_tracing.slang, the primary ray is traced rather than read from the G-buffer
+inline glm::vec3 trace_path(const PathTracerScene &scene, const PathTracerSettings &settings, Ray ray, uint32_t &seed)
+{
+	glm::vec3 radiance   = glm::vec3(0.f);
+	glm::vec3 throughput = glm::vec3(1.f);
+
+	RayHit hit;
+	if (!closest_hit(scene.bvh, ray, false, seed, hit))
+	{
+		return sample_envmap(scene, ray.direction);
+	}
+	ShadeState sstate = get_shade_state(scene, ray, hit);
+	bool       is_hit = true;
+
+	float prev_bsdf_pdf = 0.f;
+	for (int32_t trace_depth = 0; trace_depth < settings.max_depth; trace_depth++)
+	{
+		if (!is_hit)
+		{
+			// The envmap is also reached by next event estimation
+			float mis_weight = power_heuristic(prev_bsdf_pdf, envmap_selection_pdf(scene) * envmap_pdf(scene, ray.direction));
+			radiance += throughput * mis_weight * sample_envmap(scene, ray.direction);
+			break;
+		}
+
+		radiance += sstate.mat.emissive_factor * throughput;
+
+		LightSample ls = sample_light(scene, settings, sstate, seed);
+		if (glm::any(glm::greaterThan(ls.le, glm::vec3(0.f))))
+		{
+			glm::vec3 origin = offset_ray(sstate.position, glm::dot(ls.dir, sstate.ffnormal) > 0.f ? sstate.ffnormal : -sstate.ffnormal);
+			if (!any_hit(scene.bvh, shadow_ray(origin, ls.dir, glm::length(origin - ls.pos)), seed))
+			{
+				float     bsdf_pdf;
+				glm::vec3 f          = eval_bsdf(sstate, -ray.direction, sstate.ffnormal, ls.dir, bsdf_pdf);
+				float     mis_weight = std::max(0.f, power_heuristic(ls.pdf, bsdf_pdf));
+				radiance += throughput * mis_weight * f * ls.le * std::abs(glm::dot(sstate.ffnormal, ls.dir)) / ls.pdf;
+			}
+		}
+
+		BSDFSample bs = sample_bsdf(sstate, -ray.direction, seed);
+		if (bs.pdf > 0.f)
+		{
+			throughput *= bs.f * std::abs(glm::dot(sstate.ffnormal, bs.L)) / bs.pdf;
+			prev_bsdf_pdf = bs.pdf;
+		}
+		else
+		{
+			break;
+		}
+
+		float rr_pcont = trace_depth >= 3 ?
+		                     std::min(std::max(throughput.x, std::max(throughput.y, throughput.z)) * sstate.eta * sstate.eta + 0.001f, 0.95f) :
+		                     1.f;
+
+		ray.direction = bs.L;
+		ray.origin    = sstate.position + settings.bias * (glm::dot(bs.L, sstate.ffnormal) > 0.f ? sstate.ffnormal : -sstate.ffnormal);
+
+		if (random_float(seed) >= rr_pcont)
+		{
+			break;
+		}
+
+		throughput /= rr_pcont;
+
+		is_hit = closest_hit(scene.bvh, ray, false, seed, hit);
+		if (is_hit)
+		{
+			sstate = get_shade_state(scene, ray, hit);
+		}
+	}
+
+	float lum = luminance(radiance);
+	if (lum > 1.f)
+	{
+		radiance *= 1.f / lum;
+	}
+
+	return radiance;
+}
+
+std::vector<glm::vec3> render_reference(const PathTracerScene &scene, const PathTracerSettings &settings, std::atomic<float> *progress, std::vector<float> *variance)
+{
+	std::vector<glm::vec3> image(static_cast<size_t>(settings.width) * settings.height, glm::vec3(0.f));
+	if (variance)
+	{
+		variance->assign(image.size(), 0.f);
+	}
+
+	uint32_t tiles_x = (settings.width + PATH_TRACER_TILE_SIZE - 1) / PATH_TRACER_TILE_SIZE;
+	uint32_t tiles_y = (settings.height + PATH_TRACER_TILE_SIZE - 1) / PATH_TRACER_TILE_SIZE;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	std::atomic<uint32_t> finished_tiles = 0;
+	parallel_for_work_stealing(tiles_x * tiles_y, [&](uint32_t tile, uint32_t) {
+		uint32_t x_begin = (tile % tiles_x) * PATH_TRACER_TILE_SIZE;
+		uint32_t y_begin = (tile / tiles_x) * PATH_TRACER_TILE_SIZE;
+		uint32_t x_end   = std::min(x_begin + PATH_TRACER_TILE_SIZE, settings.width);
+		uint32_t y_end   = std::min(y_begin + PATH_TRACER_TILE_SIZE, settings.height);
+
+		for (uint32_t y = y_begin; y < y_end; y++)
+		{
+			for (uint32_t x = x_begin; x < x_end; x++)
+			{
+				glm::vec3 accumulated = glm::vec3(0.f);
+				uint32_t  count       = 0;
+				float     mean        = 0.f;        // Welford's running luminance mean and squared deviation
+				float     m2          = 0.f;
+				for (uint32_t frame = 0; frame < settings.frames; frame++)
+				{
+					uint32_t seed = tea(settings.width * y + x, frame);
+
+					// world_position_from_depth() on the near plane of the reversed depth
+					glm::vec2 frag_coord = glm::vec2(x, y) + random_float2(seed);
+					glm::vec2 screen_pos = frag_coord / glm::vec2(settings.width, settings.height) * 2.f - 1.f;
+					glm::vec4 world_pos  = settings.view_projection_inv * glm::vec4(screen_pos, 1.f, 1.f);
+
+					Ray ray;
+					ray.origin    = settings.cam_pos;
+					ray.direction = glm::normalize(glm::vec3(world_pos) / world_pos.w - settings.cam_pos);
+
+					// Progressive accumulation skips frames with NaN pixels
+					glm::vec3 color = trace_path(scene, settings, ray, seed);
+					if (!glm::any(glm::isnan(color)))
+					{
+						accumulated = glm::mix(accumulated, color, 1.f / static_cast<float>(++count));
+
+						float delta = luminance(color) - mean;
+						mean += delta / static_cast<float>(count);
+						m2 += delta * (luminance(color) - mean);
+					}
+				}
+				image[static_cast<size_t>(y) * settings.width + x] = accumulated;
+				if (variance && count > 1)
+				{
+					(*variance)[static_cast<size_t>(y) * settings.width + x] = m2 / static_cast<float>(count - 1);
+				}
+			}
+		}
+
+		if (progress)
+		{
+			*progress = static_cast<float>(++finished_tiles) / static_cast<float>(tiles_x * tiles_y);
+		}
+	});
+
+	float time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+	spdlog::info("Rendered {}x{} reference with {} frames in {:.2f} s on {} workers", settings.width, settings.height, settings.frames, time, work_stealing_worker_count());
+
+	return image;
+}
+
+bool write_hdr(const std::string &filename, uint32_t width, uint32_t height, const std::vector<glm::vec3> &image)
+{
+	if (image.size() != static_cast<size_t>(width) * height || image.empty())
+	{
+		return false;
+	}
+	return stbi_write_hdr(filename.c_str(), static_cast<int32_t>(width), static_cast<int32_t>(height), 3, glm::value_ptr(image[0])) != 0;
+}
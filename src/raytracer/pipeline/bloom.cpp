@@ -4,6 +4,11 @@
 
 #include <spdlog/fmt/fmt.h>
 
+// Marker names are static so recording a frame does not format strings
+static const char *DOWN_SAMPLE_MARKERS[] = {"Down Sample #0", "Down Sample #1", "Down Sample #2", "Down Sample #3"};
+static const char *BLUR_MARKERS[]        = {"Blur #0", "Blur #1", "Blur #2", "Blur #3"};
+static const char *UP_SAMPLE_MARKERS[]   = {"Up Sample #0", "Up Sample #1", "Up Sample #2"};
+
 Bloom::Bloom(const Context &context) :
     m_context(&context)
 {
@@ -149,7 +154,6 @@ void Bloom::init()
 
 void Bloom::resize()
 {
-	m_context->wait();
 	destroy_resource();
 	create_resource();
 }
@@ -196,7 +200,7 @@ void Bloom::draw(CommandBufferRecorder &recorder, VkDescriptorSet input_set)
 	    .execute([&]() {
 		    for (uint32_t i = 0; i < 4; i++)
 		    {
-			    recorder.begin_marker(fmt::format("Down Sample #{}", i))
+			    recorder.begin_marker(DOWN_SAMPLE_MARKERS[i])
 			        .bind_descriptor_set(VK_PIPELINE_BIND_POINT_COMPUTE, m_dowsample.pipeline_layout, {m_dowsample.descriptor_sets[i]})
 			        .bind_pipeline(VK_PIPELINE_BIND_POINT_COMPUTE, m_dowsample.pipeline)
 			        .dispatch({m_context->render_extent.width >> (i + 1), m_context->render_extent.height >> (i + 1), 1}, {8, 8, 1})
@@ -215,7 +219,7 @@ void Bloom::draw(CommandBufferRecorder &recorder, VkDescriptorSet input_set)
 	    .execute([&]() {
 		    for (uint32_t i = 0; i < 4; i++)
 		    {
-			    recorder.begin_marker(fmt::format("Blur #{}", i))
+			    recorder.begin_marker(BLUR_MARKERS[i])
 			        .bind_descriptor_set(VK_PIPELINE_BIND_POINT_COMPUTE, m_blur.pipeline_layout, {m_blur.descriptor_sets[i]})
 			        .bind_pipeline(VK_PIPELINE_BIND_POINT_COMPUTE, m_blur.pipeline)
 			        .dispatch({m_context->render_extent.width >> (i + 1), m_context->render_extent.height >> (i + 1), 1}, {8, 8, 1})
@@ -263,7 +267,7 @@ void Bloom::draw(CommandBufferRecorder &recorder, VkDescriptorSet input_set)
 	    .execute([&]() {
 		    for (int32_t i = 2; i >= 0; i--)
 		    {
-			    recorder.begin_marker(fmt::format("Up Sample #{}", i))
+			    recorder.begin_marker(UP_SAMPLE_MARKERS[i])
 			        .bind_descriptor_set(VK_PIPELINE_BIND_POINT_COMPUTE, m_upsample.pipeline_layout, {m_upsample.descriptor_sets[i]})
 			        .bind_pipeline(VK_PIPELINE_BIND_POINT_COMPUTE, m_upsample.pipeline)
 			        .push_constants(m_upsample.pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, m_upsample.push_constants)
@@ -368,28 +372,28 @@ void Bloom::update_descriptor()
 {
 	m_context->update_descriptor()
 	    .write_storage_images(0, {mask_view})
-	    .update(m_mask.descriptor_set);
+	    .renew(m_mask.descriptor_set);
 
 	m_context->update_descriptor()
 	    .write_sampled_images(0, {output_view})
-	    .update(descriptor.set);
+	    .renew(descriptor.set);
 
 	m_context->update_descriptor()
 	    .write_sampled_images(0, {mask_view})
 	    .write_storage_images(1, {level_view[0]})
 	    .write_samplers(2, {sampler})
-	    .update(m_dowsample.descriptor_sets[0]);
+	    .renew(m_dowsample.descriptor_sets[0]);
 
 	m_context->update_descriptor()
 	    .write_sampled_images(0, {blur_view[3]})
 	    .write_sampled_images(1, {blur_view[2]})
 	    .write_storage_images(2, {level_view[2]})
-	    .update(m_upsample.descriptor_sets[2]);
+	    .renew(m_upsample.descriptor_sets[2]);
 
 	m_context->update_descriptor()
 	    .write_sampled_images(0, {level_view[0]})
 	    .write_storage_images(1, {output_view})
-	    .update(m_blend.descriptor_set);
+	    .renew(m_blend.descriptor_set);
 
 	for (uint32_t i = 1; i < 4; i++)
 	{
@@ -397,7 +401,7 @@ void Bloom::update_descriptor()
 		    .write_sampled_images(0, {level_view[i - 1]})
 		    .write_storage_images(1, {level_view[i]})
 		    .write_samplers(2, {sampler})
-		    .update(m_dowsample.descriptor_sets[i]);
+		    .renew(m_dowsample.descriptor_sets[i]);
 	}
 
 	for (uint32_t i = 0; i < 4; i++)
@@ -405,7 +409,7 @@ void Bloom::update_descriptor()
 		m_context->update_descriptor()
 		    .write_sampled_images(0, {level_view[i]})
 		    .write_storage_images(1, {blur_view[i]})
-		    .update(m_blur.descriptor_sets[i]);
+		    .renew(m_blur.descriptor_sets[i]);
 	}
 
 	for (int32_t i = 1; i >= 0; i--)
@@ -414,18 +418,18 @@ void Bloom::update_descriptor()
 		    .write_sampled_images(0, {level_view[i + 1]})
 		    .write_sampled_images(1, {blur_view[i]})
 		    .write_storage_images(2, {level_view[i]})
-		    .update(m_upsample.descriptor_sets[i]);
+		    .renew(m_upsample.descriptor_sets[i]);
 	}
 }
 
 void Bloom::destroy_resource()
 {
-	m_context->destroy(mask_image)
-	    .destroy(mask_view)
-	    .destroy(output_image)
-	    .destroy(output_view)
-	    .destroy(level_image)
-	    .destroy(level_view)
-	    .destroy(blur_image)
-	    .destroy(blur_view);
+	m_context->deferred_destroy(mask_image)
+	    .deferred_destroy(mask_view)
+	    .deferred_destroy(output_image)
+	    .deferred_destroy(output_view)
+	    .deferred_destroy(level_image)
+	    .deferred_destroy(level_view)
+	    .deferred_destroy(blur_image)
+	    .deferred_destroy(blur_view);
 }
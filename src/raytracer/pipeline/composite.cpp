@@ -73,7 +73,6 @@ void CompositePass::init()
 
 void CompositePass::resize()
 {
-	m_context->wait();
 	destroy_resource();
 	create_resource();
 }
@@ -201,13 +200,13 @@ void CompositePass::update_descriptor()
 {
 	m_context->update_descriptor()
 	    .write_storage_images(0, {composite_view})
-	    .update(m_descriptor_set);
+	    .renew(m_descriptor_set);
 }
 
 void CompositePass::destroy_resource()
 {
-	m_context->destroy(composite_image)
-	    .destroy(composite_view);
+	m_context->deferred_destroy(composite_image)
+	    .deferred_destroy(composite_view);
 }
 
 void CompositePass::blit(CommandBufferRecorder &recorder)
@@ -59,7 +59,6 @@ void DeferredPass::init()
 
 void DeferredPass::resize()
 {
-	m_context->wait();
 	destroy_resource();
 	create_resource();
 }
@@ -123,14 +122,14 @@ void DeferredPass::update_descriptor()
 {
 	m_context->update_descriptor()
 	    .write_storage_images(0, {deferred_view})
-	    .update(m_descriptor_set);
+	    .renew(m_descriptor_set);
 	m_context->update_descriptor()
 	    .write_sampled_images(0, {deferred_view})
-	    .update(descriptor.set);
+	    .renew(descriptor.set);
 }
 
 void DeferredPass::destroy_resource()
 {
-	m_context->destroy(deferred_image)
-	    .destroy(deferred_view);
+	m_context->deferred_destroy(deferred_image)
+	    .deferred_destroy(deferred_view);
 }
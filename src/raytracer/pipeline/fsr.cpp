@@ -45,12 +45,6 @@ FSR1Pass::FSR1Pass(const Context &context, const Tonemap &tonemap) :
 	    VK_SAMPLER_MIPMAP_MODE_NEAREST,
 	    VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
 
-	m_fsr_params_buffer = m_context->create_buffer(
-	    "FSR easu and rcas parameter Buffer",
-	    pad_uniform_buffer_size(context, sizeof(FSRPassUniforms)) * 2,
-	    VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-	    VMA_MEMORY_USAGE_CPU_TO_GPU);
-
 	m_easu.descriptor_layout = m_context->create_descriptor_layout()
 	                               // Uniform buffers for easu & rcas; offseted differently for each
 	                               .add_descriptor_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
@@ -100,7 +94,6 @@ FSR1Pass::~FSR1Pass()
 	m_context->destroy(sampler)
 	    .destroy(descriptor.layout)
 	    .destroy(descriptor.set)
-	    .destroy(m_fsr_params_buffer)
 	    .destroy(m_easu.descriptor_set)
 	    .destroy(m_easu.descriptor_layout)
 	    .destroy(m_easu.pipeline_layout)
@@ -113,7 +106,6 @@ FSR1Pass::~FSR1Pass()
 
 void FSR1Pass::resize()
 {
-	m_context->wait();
 	destroy_resource();
 	create_resource();
 }
@@ -212,6 +204,12 @@ void FSR1Pass::create_resource()
 	    "FSR intermediate View",
 	    intermediate_image.vk_image,
 	    VK_FORMAT_R16G16B16A16_SFLOAT);
+	// Parameters are written from the host, frames in flight keep reading the retired buffer
+	m_fsr_params_buffer = m_context->create_buffer(
+	    "FSR easu and rcas parameter Buffer",
+	    pad_uniform_buffer_size(*m_context, sizeof(FSRPassUniforms)) * 2,
+	    VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+	    VMA_MEMORY_USAGE_CPU_TO_GPU);
 
 	init();
 	update_descriptor();
@@ -226,7 +224,7 @@ void FSR1Pass::update_descriptor()
 	    .write_storage_images(1, {intermediate_image_view})
 	    // Sampler
 	    .write_samplers(2, {sampler})
-	    .update(m_easu.descriptor_set);
+	    .renew(m_easu.descriptor_set);
 
 	m_context->update_descriptor()
 	    // FSR Uniform
@@ -237,11 +235,11 @@ void FSR1Pass::update_descriptor()
 	    .write_storage_images(2, {upsampled_image_view})
 	    // Sampler
 	    .write_samplers(3, {sampler})
-	    .update(m_rcas.descriptor_set);
+	    .renew(m_rcas.descriptor_set);
 
 	m_context->update_descriptor()
 	    .write_sampled_images(0, {upsampled_image_view})
-	    .update(descriptor.set);
+	    .renew(descriptor.set);
 
 	{
 		memset(&m_easu_buffer_data, 0, sizeof(FSRPassUniforms));
@@ -277,8 +275,9 @@ void FSR1Pass::update_descriptor()
 
 void FSR1Pass::destroy_resource()
 {
-	m_context->destroy(upsampled_image)
-	    .destroy(upsampled_image_view)
-	    .destroy(intermediate_image)
-	    .destroy(intermediate_image_view);
+	m_context->deferred_destroy(upsampled_image)
+	    .deferred_destroy(upsampled_image_view)
+	    .deferred_destroy(intermediate_image)
+	    .deferred_destroy(intermediate_image_view)
+	    .deferred_destroy(m_fsr_params_buffer);
 }
@@ -93,7 +93,6 @@ void GBufferPass::init()
 
 void GBufferPass::resize()
 {
-	m_context->wait();
 	destroy_resource();
 	create_resource();
 }
@@ -374,19 +373,19 @@ void GBufferPass::update_descriptor()
 		    .write_sampled_images(5, {gbufferB_view[!i]})
 		    .write_sampled_images(6, {gbufferC_view[!i]})
 		    .write_sampled_images(7, {depth_buffer_view[!i]})
-		    .update(descriptor.sets[i]);
+		    .renew(descriptor.sets[i]);
 	}
 }
 
 void GBufferPass::destroy_resource()
 {
-	m_context->destroy(gbufferA)
-	    .destroy(gbufferB)
-	    .destroy(gbufferC)
-	    .destroy(depth_buffer)
-	    .destroy(gbufferA_view)
-	    .destroy(gbufferB_view)
-	    .destroy(gbufferC_view)
-	    .destroy(depth_buffer_view)
-		.destroy(m_pipeline);
+	m_context->deferred_destroy(gbufferA)
+	    .deferred_destroy(gbufferB)
+	    .deferred_destroy(gbufferC)
+	    .deferred_destroy(depth_buffer)
+	    .deferred_destroy(gbufferA_view)
+	    .deferred_destroy(gbufferB_view)
+	    .deferred_destroy(gbufferC_view)
+	    .deferred_destroy(depth_buffer_view)
+	    .deferred_destroy(m_pipeline);
 }
@@ -56,7 +56,6 @@ void PathTracing::init()
 
 void PathTracing::resize()
 {
-	m_context->wait();
 	destroy_resource();
 	create_resource();
 }
@@ -98,6 +97,16 @@ void PathTracing::reset_frames()
 	m_push_constant.frame_count = 0;
 }
 
+int32_t PathTracing::max_depth() const
+{
+	return m_push_constant.max_depth;
+}
+
+float PathTracing::bias() const
+{
+	return m_push_constant.bias;
+}
+
 void PathTracing::create_resource()
 {
 	for (uint32_t i = 0; i < 2; i++)
@@ -117,15 +126,15 @@ void PathTracing::update_descriptor()
 		m_context->update_descriptor()
 		    .write_storage_images(0, {render_target_view[i]})
 		    .write_sampled_images(1, {render_target_view[i]})
-		    .update(m_descriptor_sets[i]);
+		    .renew(m_descriptor_sets[i]);
 		m_context->update_descriptor()
 		    .write_sampled_images(0, {render_target_view[i]})
-		    .update(descriptor.sets[i]);
+		    .renew(descriptor.sets[i]);
 	}
 }
 
 void PathTracing::destroy_resource()
 {
-	m_context->destroy(render_target)
-	    .destroy(render_target_view);
+	m_context->deferred_destroy(render_target)
+	    .deferred_destroy(render_target_view);
 }
@@ -140,7 +140,6 @@ void RayTracedAO::init()
 
 void RayTracedAO::resize()
 {
-	m_context->wait();
 	destroy_resource();
 	create_resource();
 }
@@ -336,7 +335,7 @@ void RayTracedAO::update_descriptor()
 {
 	m_context->update_descriptor()
 	    .write_storage_images(0, {raytraced_image_view})
-	    .update(m_raytraced.descriptor_set);
+	    .renew(m_raytraced.descriptor_set);
 
 	for (uint32_t i = 0; i < 2; i++)
 	{
@@ -348,7 +347,7 @@ void RayTracedAO::update_descriptor()
 		    .write_sampled_images(4, {history_length_image_view[!i]})
 		    .write_storage_buffers(5, {denoise_tile_buffer.vk_buffer})
 		    .write_storage_buffers(6, {denoise_tile_dispatch_args_buffer.vk_buffer})
-		    .update(m_temporal_accumulation.descriptor_sets[i]);
+		    .renew(m_temporal_accumulation.descriptor_sets[i]);
 	}
 
 	for (uint32_t i = 0; i < 2; i++)
@@ -360,32 +359,32 @@ void RayTracedAO::update_descriptor()
 			    .write_sampled_images(1, {j == 0 ? ao_image_view[i] : bilateral_blur_image_view[0]})
 			    .write_sampled_images(2, {history_length_image_view[i]})
 			    .write_storage_buffers(3, {denoise_tile_buffer.vk_buffer})
-			    .update(m_bilateral_blur.descriptor_sets[i][j]);
+			    .renew(m_bilateral_blur.descriptor_sets[i][j]);
 		}
 	}
 
 	m_context->update_descriptor()
 	    .write_storage_images(0, {upsampled_ao_image_view})
 	    .write_sampled_images(1, {bilateral_blur_image_view[1]})
-	    .update(m_upsampling.descriptor_set);
+	    .renew(m_upsampling.descriptor_set);
 
 	m_context->update_descriptor()
 	    .write_sampled_images(0, {upsampled_ao_image_view})
-	    .update(descriptor.set);
+	    .renew(descriptor.set);
 }
 
 void RayTracedAO::destroy_resource()
 {
-	m_context->destroy(raytraced_image)
-	    .destroy(raytraced_image_view)
-	    .destroy(ao_image)
-	    .destroy(ao_image_view)
-	    .destroy(history_length_image)
-	    .destroy(history_length_image_view)
-	    .destroy(bilateral_blur_image)
-	    .destroy(bilateral_blur_image_view)
-	    .destroy(upsampled_ao_image)
-	    .destroy(upsampled_ao_image_view)
-	    .destroy(denoise_tile_buffer)
-	    .destroy(denoise_tile_dispatch_args_buffer);
+	m_context->deferred_destroy(raytraced_image)
+	    .deferred_destroy(raytraced_image_view)
+	    .deferred_destroy(ao_image)
+	    .deferred_destroy(ao_image_view)
+	    .deferred_destroy(history_length_image)
+	    .deferred_destroy(history_length_image_view)
+	    .deferred_destroy(bilateral_blur_image)
+	    .deferred_destroy(bilateral_blur_image_view)
+	    .deferred_destroy(upsampled_ao_image)
+	    .deferred_destroy(upsampled_ao_image_view)
+	    .deferred_destroy(denoise_tile_buffer)
+	    .deferred_destroy(denoise_tile_dispatch_args_buffer);
 }
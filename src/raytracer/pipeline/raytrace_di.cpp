@@ -6,6 +6,8 @@
 #define NUM_THREADS_X 8
 #define NUM_THREADS_Y 8
 
+static const char *DENOISE_ITERATION_MARKERS[] = {"Iteration - 0", "Iteration - 1", "Iteration - 2"};
+
 struct Reservoir
 {
 	int       light_id;
@@ -261,7 +263,6 @@ void RayTracedDI::init()
 
 void RayTracedDI::resize()
 {
-	m_context->wait();
 	destroy_resource();
 	create_resource();
 }
@@ -368,7 +369,7 @@ void RayTracedDI::draw(CommandBufferRecorder &recorder, const Scene &scene, cons
 		    bool ping_pong = false;
 		    for (uint32_t i = 0; i < 3; i++)
 		    {
-			    recorder.begin_marker(fmt::format("Iteration - {}", i))
+			    recorder.begin_marker(DENOISE_ITERATION_MARKERS[i])
 			        .begin_marker("Copy Tile Data")
 			        .bind_descriptor_set(VK_PIPELINE_BIND_POINT_COMPUTE, m_denoise.copy_tiles.pipeline_layout, {i == 0 ? m_denoise.copy_tiles.copy_reprojection_sets[m_context->ping_pong] : m_denoise.copy_tiles.copy_atrous_sets[ping_pong]})
 			        .bind_pipeline(VK_PIPELINE_BIND_POINT_COMPUTE, m_denoise.copy_tiles.pipeline)
@@ -443,6 +444,7 @@ bool RayTracedDI::draw_ui()
 	{
 		update |= ImGui::Checkbox("Temporal Reuse", reinterpret_cast<bool *>(&m_raytrace.temporal.push_constants.temporal_reuse));
 		update |= ImGui::Checkbox("Spatial Reuse", reinterpret_cast<bool *>(&m_raytrace.spatial.push_constants.spatial_reuse));
+		update |= ImGui::Checkbox("Sample Envmap", reinterpret_cast<bool *>(&m_raytrace.temporal.push_constants.sample_envmap));
 		ImGui::TreePop();
 	}
 	return update;
@@ -552,18 +554,18 @@ void RayTracedDI::update_descriptor()
 	m_context->update_descriptor()
 	    .write_storage_buffers(0, {temporal_reservoir_buffer.vk_buffer})
 	    .write_storage_buffers(1, {passthrough_reservoir_buffer.vk_buffer})
-	    .update(m_raytrace.temporal.descriptor_set);
+	    .renew(m_raytrace.temporal.descriptor_set);
 
 	m_context->update_descriptor()
 	    .write_storage_buffers(0, {spatial_reservoir_buffer.vk_buffer})
 	    .write_storage_buffers(1, {passthrough_reservoir_buffer.vk_buffer})
-	    .update(m_raytrace.spatial.descriptor_set);
+	    .renew(m_raytrace.spatial.descriptor_set);
 
 	m_context->update_descriptor()
 	    .write_storage_buffers(0, {temporal_reservoir_buffer.vk_buffer})
 	    .write_storage_buffers(1, {spatial_reservoir_buffer.vk_buffer})
 	    .write_storage_images(2, {raytraced_view})
-	    .update(m_raytrace.composite.descriptor_set);
+	    .renew(m_raytrace.composite.descriptor_set);
 
 	for (uint32_t i = 0; i < 2; i++)
 	{
@@ -577,60 +579,60 @@ void RayTracedDI::update_descriptor()
 		    .write_storage_buffers(6, {denoise_tile_dispatch_args_buffer.vk_buffer})
 		    .write_storage_buffers(7, {copy_tile_data_buffer.vk_buffer})
 		    .write_storage_buffers(8, {copy_tile_dispatch_args_buffer.vk_buffer})
-		    .update(m_reprojection.descriptor_sets[i]);
+		    .renew(m_reprojection.descriptor_sets[i]);
 
 		m_context->update_descriptor()
 		    .write_storage_images(0, {a_trous_view[0]})
 		    .write_sampled_images(1, {reprojection_output_view[i]})
 		    .write_storage_buffers(2, {copy_tile_data_buffer.vk_buffer})
-		    .update(m_denoise.copy_tiles.copy_reprojection_sets[i]);
+		    .renew(m_denoise.copy_tiles.copy_reprojection_sets[i]);
 
 		m_context->update_descriptor()
 		    .write_storage_images(0, {a_trous_view[i]})
 		    .write_sampled_images(1, {a_trous_view[!i]})
 		    .write_storage_buffers(2, {copy_tile_data_buffer.vk_buffer})
-		    .update(m_denoise.copy_tiles.copy_atrous_sets[i]);
+		    .renew(m_denoise.copy_tiles.copy_atrous_sets[i]);
 
 		m_context->update_descriptor()
 		    .write_storage_images(0, {a_trous_view[0]})
 		    .write_sampled_images(1, {reprojection_output_view[i]})
 		    .write_storage_buffers(2, {denoise_tile_data_buffer.vk_buffer})
-		    .update(m_denoise.a_trous.filter_reprojection_sets[i]);
+		    .renew(m_denoise.a_trous.filter_reprojection_sets[i]);
 
 		m_context->update_descriptor()
 		    .write_storage_images(0, {a_trous_view[i]})
 		    .write_sampled_images(1, {a_trous_view[!i]})
 		    .write_storage_buffers(2, {denoise_tile_data_buffer.vk_buffer})
-		    .update(m_denoise.a_trous.filter_atrous_sets[i]);
+		    .renew(m_denoise.a_trous.filter_atrous_sets[i]);
 	}
 
 	m_context->update_descriptor()
 	    .write_storage_images(0, {upsampling_view})
 	    .write_sampled_images(1, {a_trous_view[0]})
-	    .update(m_upsampling.descriptor_set);
+	    .renew(m_upsampling.descriptor_set);
 
 	m_context->update_descriptor()
 	    .write_sampled_images(0, {upsampling_view})
-	    .update(descriptor.set);
+	    .renew(descriptor.set);
 }
 
 void RayTracedDI::destroy_resource()
 {
-	m_context->destroy(raytraced_image)
-	    .destroy(raytraced_view)
-	    .destroy(reprojection_output_image)
-	    .destroy(reprojection_output_view)
-	    .destroy(reprojection_moment_image)
-	    .destroy(reprojection_moment_view)
-	    .destroy(a_trous_image)
-	    .destroy(a_trous_view)
-	    .destroy(upsampling_image)
-	    .destroy(upsampling_view)
-	    .destroy(temporal_reservoir_buffer)
-	    .destroy(passthrough_reservoir_buffer)
-	    .destroy(spatial_reservoir_buffer)
-	    .destroy(denoise_tile_data_buffer)
-	    .destroy(copy_tile_data_buffer)
-	    .destroy(denoise_tile_dispatch_args_buffer)
-	    .destroy(copy_tile_dispatch_args_buffer);
+	m_context->deferred_destroy(raytraced_image)
+	    .deferred_destroy(raytraced_view)
+	    .deferred_destroy(reprojection_output_image)
+	    .deferred_destroy(reprojection_output_view)
+	    .deferred_destroy(reprojection_moment_image)
+	    .deferred_destroy(reprojection_moment_view)
+	    .deferred_destroy(a_trous_image)
+	    .deferred_destroy(a_trous_view)
+	    .deferred_destroy(upsampling_image)
+	    .deferred_destroy(upsampling_view)
+	    .deferred_destroy(temporal_reservoir_buffer)
+	    .deferred_destroy(passthrough_reservoir_buffer)
+	    .deferred_destroy(spatial_reservoir_buffer)
+	    .deferred_destroy(denoise_tile_data_buffer)
+	    .deferred_destroy(copy_tile_data_buffer)
+	    .deferred_destroy(denoise_tile_dispatch_args_buffer)
+	    .deferred_destroy(copy_tile_dispatch_args_buffer);
 }
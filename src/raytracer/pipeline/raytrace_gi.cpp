@@ -153,12 +153,47 @@ RayTracedGI::~RayTracedGI()
 
 void RayTracedGI::init()
 {
+	// Probe tracing and update run on the async compute queue, hand the shared resources over to it
+	// The release has to name the same layouts as the per-frame acquire, transition the probe grid first
 	m_context->record_command()
 	    .begin()
 	    .insert_barrier()
-	    .add_buffer_barrier(
+	    .add_image_barrier(
+	        probe_grid_irradiance_image[m_context->ping_pong].vk_image,
+	        0, VK_ACCESS_SHADER_READ_BIT,
+	        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+	    .add_image_barrier(
+	        probe_grid_depth_image[m_context->ping_pong].vk_image,
+	        0, VK_ACCESS_SHADER_READ_BIT,
+	        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+	    .add_image_barrier(
+	        sample_probe_grid_image.vk_image,
+	        0, VK_ACCESS_SHADER_READ_BIT,
+	        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+	    .insert()
+	    .insert_barrier()
+	    .add_buffer_release(
 	        uniform_buffer.vk_buffer,
-	        0, VK_ACCESS_SHADER_READ_BIT)
+	        0, VK_ACCESS_TRANSFER_WRITE_BIT,
+	        m_context->compute_family.value())
+	    .add_image_release(
+	        probe_grid_irradiance_image[m_context->ping_pong].vk_image,
+	        VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+	        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	        m_context->compute_family.value())
+	    .add_image_release(
+	        probe_grid_depth_image[m_context->ping_pong].vk_image,
+	        VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+	        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	        m_context->compute_family.value())
+	    .insert()
+	    .end()
+	    .flush();
+
+	// Compute queue only resources
+	m_context->record_command(true)
+	    .begin()
+	    .insert_barrier()
 	    .add_image_barrier(
 	        radiance_image.vk_image,
 	        0, VK_ACCESS_SHADER_WRITE_BIT,
@@ -167,14 +202,6 @@ void RayTracedGI::init()
 	        direction_depth_image.vk_image,
 	        0, VK_ACCESS_SHADER_WRITE_BIT,
 	        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL)
-	    .add_image_barrier(
-	        probe_grid_irradiance_image[m_context->ping_pong].vk_image,
-	        0, VK_ACCESS_SHADER_READ_BIT,
-	        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-	    .add_image_barrier(
-	        probe_grid_depth_image[m_context->ping_pong].vk_image,
-	        0, VK_ACCESS_SHADER_READ_BIT,
-	        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
 	    .add_image_barrier(
 	        probe_grid_irradiance_image[!m_context->ping_pong].vk_image,
 	        0, VK_ACCESS_SHADER_WRITE_BIT,
@@ -183,10 +210,6 @@ void RayTracedGI::init()
 	        probe_grid_depth_image[!m_context->ping_pong].vk_image,
 	        0, VK_ACCESS_SHADER_WRITE_BIT,
 	        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL)
-	    .add_image_barrier(
-	        sample_probe_grid_image.vk_image,
-	        0, VK_ACCESS_SHADER_READ_BIT,
-	        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
 	    .insert()
 	    .end()
 	    .flush();
@@ -194,7 +217,6 @@ void RayTracedGI::init()
 
 void RayTracedGI::resize()
 {
-	m_context->wait();
 	destroy_resource();
 	create_resource();
 }
@@ -223,7 +245,7 @@ void RayTracedGI::update(const Scene &scene)
 	}
 }
 
-void RayTracedGI::draw(CommandBufferRecorder &recorder, const Scene &scene, const GBufferPass &gbuffer_pass)
+void RayTracedGI::trace(CommandBufferRecorder &recorder, const Scene &scene, const GBufferPass &gbuffer_pass)
 {
 	UBO ubo = {
 	    .grid_start                   = m_probe_update.params.grid_start + m_probe_update.params.grid_offset,
@@ -253,15 +275,16 @@ void RayTracedGI::draw(CommandBufferRecorder &recorder, const Scene &scene, cons
 
 	m_probe_update.update_probe.push_constants.frame_count = m_frame_count;
 
-	m_probe_sample.push_constants.gbuffer_mip  = m_gbuffer_mip;
-	m_probe_sample.push_constants.gi_intensity = m_probe_sample.params.gi_intensity;
+	uint32_t graphics_family = m_context->graphics_family.value();
 
 	{
 		recorder
-		    .begin_marker("RayTraced GI")
+		    .begin_marker("RayTraced GI Probe")
 		    .insert_barrier()
-		    .add_buffer_barrier(uniform_buffer.vk_buffer, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT)
-		    .insert(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT)
+		    .add_buffer_acquire(uniform_buffer.vk_buffer, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, graphics_family)
+		    .add_image_acquire(probe_grid_irradiance_image[m_context->ping_pong].vk_image, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, graphics_family)
+		    .add_image_acquire(probe_grid_depth_image[m_context->ping_pong].vk_image, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, graphics_family)
+		    .insert(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
 		    .update_buffer(uniform_buffer.vk_buffer, &ubo, sizeof(UBO))
 		    .insert_barrier()
 		    .add_buffer_barrier(uniform_buffer.vk_buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT)
@@ -286,10 +309,6 @@ void RayTracedGI::draw(CommandBufferRecorder &recorder, const Scene &scene, cons
 		        direction_depth_image.vk_image,
 		        VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
 		        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-		    .add_image_barrier(
-		        sample_probe_grid_image.vk_image,
-		        VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
-		        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL)
 		    .insert()
 
 		    .begin_marker("Probe Update")
@@ -325,10 +344,40 @@ void RayTracedGI::draw(CommandBufferRecorder &recorder, const Scene &scene, cons
 
 		    .end_marker()
 
+		    // Hand the updated probes over to the graphics queue, keep the previous ones for next frame's update
 		    .insert_barrier()
-		    .add_image_barrier(probe_grid_irradiance_image[!m_context->ping_pong].vk_image, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-		    .add_image_barrier(probe_grid_depth_image[!m_context->ping_pong].vk_image, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-		    .insert(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
+		    .add_buffer_release(uniform_buffer.vk_buffer, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_READ_BIT, graphics_family)
+		    .add_image_release(probe_grid_irradiance_image[!m_context->ping_pong].vk_image, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, graphics_family)
+		    .add_image_release(probe_grid_depth_image[!m_context->ping_pong].vk_image, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, graphics_family)
+		    .add_image_barrier(probe_grid_irradiance_image[m_context->ping_pong].vk_image, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL)
+		    .add_image_barrier(probe_grid_depth_image[m_context->ping_pong].vk_image, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL)
+		    .add_image_barrier(radiance_image.vk_image, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL)
+		    .add_image_barrier(direction_depth_image.vk_image, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL)
+		    .insert(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+	}
+
+	m_frame_count++;
+}
+
+void RayTracedGI::draw(CommandBufferRecorder &recorder, const Scene &scene, const GBufferPass &gbuffer_pass)
+{
+	m_probe_sample.push_constants.gbuffer_mip  = m_gbuffer_mip;
+	m_probe_sample.push_constants.gi_intensity = m_probe_sample.params.gi_intensity;
+
+	uint32_t compute_family = m_context->compute_family.value();
+
+	{
+		recorder
+		    .begin_marker("RayTraced GI")
+		    .insert_barrier()
+		    .add_buffer_acquire(uniform_buffer.vk_buffer, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_READ_BIT, compute_family)
+		    .add_image_acquire(probe_grid_irradiance_image[!m_context->ping_pong].vk_image, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, compute_family)
+		    .add_image_acquire(probe_grid_depth_image[!m_context->ping_pong].vk_image, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, compute_family)
+		    .add_image_barrier(
+		        sample_probe_grid_image.vk_image,
+		        VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+		        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL)
+		    .insert(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, probe_read_stages)
 
 		    .begin_marker("Sample Probe Grid")
 		    .bind_descriptor_set(VK_PIPELINE_BIND_POINT_COMPUTE, m_probe_sample.pipeline_layout,
@@ -343,18 +392,24 @@ void RayTracedGI::draw(CommandBufferRecorder &recorder, const Scene &scene, cons
 		    .end_marker()
 
 		    .insert_barrier()
-		    .add_buffer_barrier(uniform_buffer.vk_buffer, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT)
-		    .add_image_barrier(probe_grid_irradiance_image[m_context->ping_pong].vk_image, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL)
-		    .add_image_barrier(probe_grid_depth_image[m_context->ping_pong].vk_image, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL)
-		    .add_image_barrier(radiance_image.vk_image, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL)
-		    .add_image_barrier(direction_depth_image.vk_image, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL)
 		    .add_image_barrier(sample_probe_grid_image.vk_image, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
 		    .insert(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
 
 		    .end_marker();
 	}
+}
 
-	m_frame_count++;
+void RayTracedGI::release(CommandBufferRecorder &recorder)
+{
+	// Probes sampled this frame are the input of next frame's probe update on the compute queue
+	uint32_t compute_family = m_context->compute_family.value();
+
+	recorder
+	    .insert_barrier()
+	    .add_buffer_release(uniform_buffer.vk_buffer, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, compute_family)
+	    .add_image_release(probe_grid_irradiance_image[!m_context->ping_pong].vk_image, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, compute_family)
+	    .add_image_release(probe_grid_depth_image[!m_context->ping_pong].vk_image, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, compute_family)
+	    .insert(probe_read_stages, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 }
 
 void RayTracedGI::draw_probe(CommandBufferRecorder &recorder, const VkImageView &render_target, const VkImageView &depth_buffer, const Scene &scene) const
@@ -401,8 +456,6 @@ bool RayTracedGI::draw_ui()
 
 void RayTracedGI::create_resource()
 {
-	m_context->wait();
-
 	float scale_divisor = std::powf(2.0f, float(m_scale));
 
 	m_width  = m_context->render_extent.width / static_cast<uint32_t>(scale_divisor);
@@ -566,7 +619,7 @@ void RayTracedGI::update_descriptor()
 {
 	m_context->update_descriptor()
 	    .write_sampled_images(0, {sample_probe_grid_view})
-	    .update(descriptor.set);
+	    .renew(descriptor.set);
 
 	for (uint32_t i = 0; i < 2; i++)
 	{
@@ -576,7 +629,7 @@ void RayTracedGI::update_descriptor()
 		    .write_storage_images(2, {direction_depth_view})
 		    .write_sampled_images(3, {probe_grid_irradiance_view[i]})
 		    .write_sampled_images(4, {probe_grid_depth_view[i]})
-		    .update(m_raytraced.descriptor_sets[i]);
+		    .renew(m_raytraced.descriptor_sets[i]);
 
 		m_context->update_descriptor()
 		    .write_storage_images(0, {probe_grid_irradiance_view[!i]})
@@ -586,47 +639,47 @@ void RayTracedGI::update_descriptor()
 		    .write_sampled_images(4, {radiance_view})
 		    .write_sampled_images(5, {direction_depth_view})
 		    .write_uniform_buffers(6, {uniform_buffer.vk_buffer})
-		    .update(m_probe_update.update_probe.descriptor_sets[i]);
+		    .renew(m_probe_update.update_probe.descriptor_sets[i]);
 
 		m_context->update_descriptor()
 		    .write_storage_images(0, {probe_grid_irradiance_view[!i]})
 		    .write_storage_images(1, {probe_grid_depth_view[!i]})
-		    .update(m_probe_update.update_border.descriptor_sets[i]);
+		    .renew(m_probe_update.update_border.descriptor_sets[i]);
 
 		m_context->update_descriptor()
 		    .write_uniform_buffers(0, {uniform_buffer.vk_buffer})
 		    .write_sampled_images(1, {probe_grid_irradiance_view[!i]})
 		    .write_sampled_images(2, {probe_grid_depth_view[!i]})
 		    .write_storage_images(3, {sample_probe_grid_view})
-		    .update(m_probe_sample.descriptor_sets[i]);
+		    .renew(m_probe_sample.descriptor_sets[i]);
 
 		m_context->update_descriptor()
 		    .write_uniform_buffers(0, {uniform_buffer.vk_buffer})
 		    .write_sampled_images(1, {probe_grid_irradiance_view[!i]})
-		    .update(m_probe_visualize.descriptor_sets[i]);
+		    .renew(m_probe_visualize.descriptor_sets[i]);
 
 		m_context->update_descriptor()
 		    .write_sampled_images(0, {probe_grid_irradiance_view[!i]})
 		    .write_sampled_images(1, {probe_grid_depth_view[!i]})
 		    .write_uniform_buffers(2, {uniform_buffer.vk_buffer})
-		    .update(ddgi_descriptor.sets[i]);
+		    .renew(ddgi_descriptor.sets[i]);
 	}
 }
 
 void RayTracedGI::destroy_resource()
 {
-	m_context->destroy(radiance_image)
-	    .destroy(radiance_view)
-	    .destroy(direction_depth_image)
-	    .destroy(direction_depth_view)
-	    .destroy(probe_grid_irradiance_image)
-	    .destroy(probe_grid_irradiance_view)
-	    .destroy(probe_grid_depth_image)
-	    .destroy(probe_grid_depth_view)
-	    .destroy(sample_probe_grid_image)
-	    .destroy(sample_probe_grid_view)
-	    .destroy(m_probe_visualize.vertex_buffer)
-	    .destroy(m_probe_visualize.index_buffer)
-	    .destroy(uniform_buffer)
-	    .destroy(m_probe_visualize.pipeline);
+	m_context->deferred_destroy(radiance_image)
+	    .deferred_destroy(radiance_view)
+	    .deferred_destroy(direction_depth_image)
+	    .deferred_destroy(direction_depth_view)
+	    .deferred_destroy(probe_grid_irradiance_image)
+	    .deferred_destroy(probe_grid_irradiance_view)
+	    .deferred_destroy(probe_grid_depth_image)
+	    .deferred_destroy(probe_grid_depth_view)
+	    .deferred_destroy(sample_probe_grid_image)
+	    .deferred_destroy(sample_probe_grid_view)
+	    .deferred_destroy(m_probe_visualize.vertex_buffer)
+	    .deferred_destroy(m_probe_visualize.index_buffer)
+	    .deferred_destroy(uniform_buffer)
+	    .deferred_destroy(m_probe_visualize.pipeline);
 }
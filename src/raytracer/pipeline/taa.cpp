@@ -70,7 +70,6 @@ void TAA::init()
 
 void TAA::resize()
 {
-	m_context->wait();
 	destroy_resource();
 	create_resource();
 }
@@ -142,20 +141,20 @@ void TAA::update_descriptor()
 		m_context->update_descriptor()
 		    .write_storage_images(0, {output_view[i]})
 		    .write_sampled_images(1, {output_view[!i]})
-		    .update(m_descriptor_sets[i]);
+		    .renew(m_descriptor_sets[i]);
 	}
 
 	for (uint32_t i = 0; i < 2; i++)
 	{
 		m_context->update_descriptor()
 		    .write_sampled_images(0, {output_view[i]})
-		    .update(descriptor.sets[i]);
+		    .renew(descriptor.sets[i]);
 	}
 }
 
 void TAA::destroy_resource()
 {
 	m_context
-	    ->destroy(output_image)
-	    .destroy(output_view);
+	    ->deferred_destroy(output_image)
+	    .deferred_destroy(output_view);
 }
@@ -54,7 +54,6 @@ void Tonemap::init()
 
 void Tonemap::resize()
 {
-	m_context->wait();
 	destroy_resource();
 	create_resource();
 }
@@ -171,15 +170,15 @@ void Tonemap::update_descriptor()
 {
 	m_context->update_descriptor()
 	    .write_storage_images(0, {render_target_view})
-	    .update(m_descriptor.output_set);
+	    .renew(m_descriptor.output_set);
 
 	m_context->update_descriptor()
 	    .write_sampled_images(0, {render_target_view})
-	    .update(descriptor.set);
+	    .renew(descriptor.set);
 }
 
 void Tonemap::destroy_resource()
 {
-	m_context->destroy(render_target)
-	    .destroy(render_target_view);
+	m_context->deferred_destroy(render_target)
+	    .deferred_destroy(render_target_view);
 }
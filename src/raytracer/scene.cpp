@@ -1,16 +1,33 @@
 #include "scene.hpp"
+#include "alias_table.hpp"
+#include "texture_cache.hpp"
+#include "work_stealing.hpp"
 
 #define CGLTF_IMPLEMENTATION
 #include <cgltf.h>
 
 #include <stb/stb_image.h>
 
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <execution>
 #include <filesystem>
-#include <queue>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <unordered_set>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#	include <emmintrin.h>
+#	define SCENE_SSE2
+#endif
 
 #define CUBEMAP_SIZE 1024
 #define IRRADIANCE_CUBEMAP_SIZE 128
@@ -19,159 +36,649 @@
 #define CUBEMAP_FACE_NUM 6
 #define PREFILTER_MAP_SIZE 256
 #define PREFILTER_MIP_LEVELS 5
+#define CUBEMAP_MIP_LEVELS 5
+#define ENVMAP_ALIAS_TABLE_MIP 2
+#define UPDATE_BUFFER_MAX_SIZE 65536
+#define TLAS_REBUILD_THRESHOLD 1.5f
+#define SKINNING_CHUNK_SIZE 1024
+#define EMITTER_CHUNK_SIZE 4096
+#define EMISSION_INTEGRATION_TEXELS 1024
+#define EMISSION_TEXTURE_SIZE 256
+#define TEXTURE_STREAMING_TAIL_SIZE 128
+#define TEXTURE_STREAMING_MAX_REQUESTS 4
+#define TEXTURE_STREAMING_IDLE_FRAMES 120
+#define BVH8_BENCHMARK_RESOLUTION 512
+#define BVH_BUILD_BENCHMARK_RUNS 7
 
-struct Vertex
+struct Light
 {
-	glm::vec4 position;        // xyz - position, w - texcoord u
-	glm::vec4 normal;          // xyz - normal, w - texcoord v
+	glm::vec3 pos;
+	uint32_t  instance_id;
 };
 
-struct Emitter
+inline const std::string get_path_dictionary(const std::string &path)
 {
-	glm::vec4 p0;
-	glm::vec4 p1;
-	glm::vec4 p2;
-	glm::vec4 n0;
-	glm::vec4 n1;
-	glm::vec4 n2;
-	glm::vec4 intensity;
-};
+	if (std::filesystem::exists(path) &&
+	    std::filesystem::is_directory(path))
+	{
+		return path;
+	}
 
-struct Light
+	size_t last_index = path.find_last_of("\\/");
+
+	if (last_index != std::string::npos)
+	{
+		return path.substr(0, last_index + 1);
+	}
+
+	return "";
+}
+
+inline size_t hash_geometry(const Vertex *vertices, size_t vertices_count, const uint32_t *indices, size_t indices_count)
 {
-	glm::vec3 pos;
-	uint32_t  instance_id;
-};
+	size_t vertices_hash = std::hash<std::string_view>{}(std::string_view(reinterpret_cast<const char *>(vertices), vertices_count * sizeof(Vertex)));
+	size_t indices_hash  = std::hash<std::string_view>{}(std::string_view(reinterpret_cast<const char *>(indices), indices_count * sizeof(uint32_t)));
+	return vertices_hash ^ (indices_hash + 0x9e3779b9 + (vertices_hash << 6) + (vertices_hash >> 2));
+}
 
-struct Mesh
+// Solid angle of the cube face region [-1, x] x [-1, y]
+inline float cubemap_area_integral(float x, float y)
 {
-	uint32_t vertices_offset = 0;
-	uint32_t vertices_count  = 0;
-	uint32_t indices_offset  = 0;
-	uint32_t indices_count   = 0;
-	uint32_t material        = ~0u;
-	float    area            = 0.f;
-};
+	return std::atan2(x * y, std::sqrt(x * x + y * y + 1.f));
+}
 
-struct Material
+// One column per texel of a RGBA16F cubemap level, weighted by luminance times the texel's solid angle
+inline std::vector<AliasTable> build_envmap_alias_table(const glm::u16vec4 *texels, uint32_t size)
 {
-	uint32_t  alpha_mode;        // 0 - opaque, 1 - mask, 2 - blend
-	uint32_t  double_sided;
-	float     cutoff;
-	float     metallic_factor;
-	float     roughness_factor;
-	float     transmission_factor;
-	float     clearcoat_factor;
-	float     clearcoat_roughness_factor;
-	glm::vec4 base_color;
-	glm::vec3 emissive_factor;
-	int32_t   base_color_texture;
-	int32_t   normal_texture;
-	int32_t   metallic_roughness_texture;
-	glm::vec2 padding;
-};
+	std::vector<float> texel_probs(CUBEMAP_FACE_NUM * size * size);
+	std::vector<float> solid_angles(size * size);
+	for (uint32_t y = 0; y < size; y++)
+	{
+		for (uint32_t x = 0; x < size; x++)
+		{
+			float x0 = 2.f * static_cast<float>(x) / static_cast<float>(size) - 1.f;
+			float y0 = 2.f * static_cast<float>(y) / static_cast<float>(size) - 1.f;
+			float x1 = x0 + 2.f / static_cast<float>(size);
+			float y1 = y0 + 2.f / static_cast<float>(size);
+
+			solid_angles[y * size + x] = cubemap_area_integral(x0, y0) - cubemap_area_integral(x0, y1) - cubemap_area_integral(x1, y0) + cubemap_area_integral(x1, y1);
+		}
+	}
+
+	bool black = true;
+	for (uint32_t i = 0; i < texel_probs.size(); i++)
+	{
+		glm::vec4 color = glm::unpackHalf(texels[i]);
+		texel_probs[i]  = std::max(glm::dot(glm::vec3(color), glm::vec3(0.212671f, 0.715160f, 0.072169f)), 0.f) * solid_angles[i % solid_angles.size()];
+		black &= texel_probs[i] <= 0.f;
+	}
+
+	// A black envmap falls back to uniform directions
+	if (black)
+	{
+		for (uint32_t i = 0; i < texel_probs.size(); i++)
+		{
+			texel_probs[i] = solid_angles[i % solid_angles.size()];
+		}
+	}
+
+	return build_alias_table(texel_probs);
+}
 
-struct Instance
+// RGBA8 texels of a glTF image, freed with stbi_image_free
+inline uint8_t *load_gltf_image(const cgltf_image *image, const std::string &filename, int32_t &width, int32_t &height)
 {
-	glm::mat4 transform;
-	glm::mat4 transform_inv;
-	uint32_t  vertices_offset;
-	uint32_t  vertices_count;
-	uint32_t  indices_offset;
-	uint32_t  indices_count;
-	uint32_t  mesh;
-	uint32_t  material;
-	int32_t   emitter;
-	float     area;
-};
+	uint8_t *image_data = nullptr;
+	int32_t  channel = 0, req_channel = 4;
+
+	if (image->uri)
+	{
+		// External image
+		image_data = stbi_load((get_path_dictionary(filename) + image->uri).c_str(), &width, &height, &channel, req_channel);
+	}
+	else if (image->buffer_view)
+	{
+		// Image embedded in a buffer view
+		uint8_t *data = static_cast<uint8_t *>(image->buffer_view->buffer->data) + image->buffer_view->offset;
+		size_t   size = image->buffer_view->size;
+
+		image_data = stbi_load_from_memory(static_cast<stbi_uc *>(data), static_cast<int32_t>(size), &width, &height, &channel, req_channel);
+	}
+
+	return image_data;
+}
 
-struct AliasTable
+// CPU copy of an emissive texture for estimating the power of its emitters, RGBA8 sRGB levels
+struct EmissiveTexture
 {
-	float prob;         // The i's column's event i's prob
-	int   alias;        // The i's column's another event's idx
-	float ori_prob;
-	float alias_ori_prob;
+	uint32_t                          width  = 0;
+	uint32_t                          height = 0;
+	std::vector<std::vector<uint8_t>> levels;
 };
 
-inline const std::string get_path_dictionary(const std::string &path)
+// Mean linear emission over the UV footprint of a triangle, the average of the texels whose centers it covers
+// Integrates on the finest level where the footprint bounds hold at most EMISSION_INTEGRATION_TEXELS texels, footprints missing every texel center take the texel under their centroid
+inline glm::vec3 integrate_emission(const EmissiveTexture &texture, const glm::vec2 &uv0, const glm::vec2 &uv1, const glm::vec2 &uv2)
 {
-	if (std::filesystem::exists(path) &&
-	    std::filesystem::is_directory(path))
+	static const std::array<float, 256> srgb_to_linear = [] {
+		std::array<float, 256> table = {};
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			table[i] = std::pow(static_cast<float>(i) / 255.f, 2.2f);        // Matches the shaders
+		}
+		return table;
+	}();
+
+	uint32_t  level  = 0;
+	glm::vec2 extent = (glm::max(uv0, glm::max(uv1, uv2)) - glm::min(uv0, glm::min(uv1, uv2))) * glm::vec2(texture.width, texture.height);
+	while (level + 1 < texture.levels.size() && extent.x * extent.y > EMISSION_INTEGRATION_TEXELS)
 	{
-		return path;
+		extent *= 0.5f;
+		level++;
 	}
 
-	size_t last_index = path.find_last_of("\\/");
+	const int32_t  width  = static_cast<int32_t>(std::max(texture.width >> level, 1u));
+	const int32_t  height = static_cast<int32_t>(std::max(texture.height >> level, 1u));
+	const uint8_t *texels = texture.levels[level].data();
 
-	if (last_index != std::string::npos)
+	// Repeat addressing
+	auto fetch = [&](int32_t x, int32_t y) {
+		x                    = (x % width + width) % width;
+		y                    = (y % height + height) % height;
+		const uint8_t *texel = texels + (static_cast<size_t>(y) * width + x) * 4;
+		return glm::vec3(srgb_to_linear[texel[0]], srgb_to_linear[texel[1]], srgb_to_linear[texel[2]]);
+	};
+
+	// Footprint still too large on the coarsest level or not finite
+	if (!(extent.x * extent.y <= EMISSION_INTEGRATION_TEXELS))
 	{
-		return path.substr(0, last_index + 1);
+		glm::vec3 sum = glm::vec3(0.f);
+		for (int32_t y = 0; y < height; y++)
+		{
+			for (int32_t x = 0; x < width; x++)
+			{
+				sum += fetch(x, y);
+			}
+		}
+		return sum / static_cast<float>(width * height);
 	}
 
-	return "";
+	// Texel centers sit on integer coordinates
+	const glm::vec2 size = glm::vec2(width, height);
+	const glm::vec2 p0   = uv0 * size - 0.5f;
+	const glm::vec2 p1   = uv1 * size - 0.5f;
+	const glm::vec2 p2   = uv2 * size - 0.5f;
+
+	auto edge = [](const glm::vec2 &a, const glm::vec2 &b, const glm::vec2 &p) {
+		return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+	};
+
+	glm::vec3 sum   = glm::vec3(0.f);
+	uint32_t  count = 0;
+
+	const float orientation = edge(p0, p1, p2) < 0.f ? -1.f : 1.f;
+	const glm::ivec2 begin  = glm::ivec2(glm::ceil(glm::min(p0, glm::min(p1, p2))));
+	const glm::ivec2 end    = glm::ivec2(glm::floor(glm::max(p0, glm::max(p1, p2))));
+	for (int32_t y = begin.y; y <= end.y; y++)
+	{
+		for (int32_t x = begin.x; x <= end.x; x++)
+		{
+			const glm::vec2 p = glm::vec2(x, y);
+			if (orientation * edge(p1, p2, p) >= 0.f &&
+			    orientation * edge(p2, p0, p) >= 0.f &&
+			    orientation * edge(p0, p1, p) >= 0.f)
+			{
+				sum += fetch(x, y);
+				count++;
+			}
+		}
+	}
+
+	if (count == 0)
+	{
+		const glm::vec2 centroid = (p0 + p1 + p2) / 3.f;
+		return fetch(static_cast<int32_t>(std::floor(centroid.x + 0.5f)), static_cast<int32_t>(std::floor(centroid.y + 0.5f)));
+	}
+
+	return sum / static_cast<float>(count);
 }
 
-inline std::vector<AliasTable> build_alias_table(std::vector<float> &probs, float total_weight)
+#ifdef SCENE_SSE2
+// Columns of the affine transform times (p.x, p.y, p.z, 1)
+inline glm::vec3 transform_point_sse(const __m128 *columns, const glm::vec4 &p)
 {
-	std::vector<AliasTable> alias_table(probs.size());
-	std::queue<uint32_t>    greater_queue;
-	std::queue<uint32_t>    smaller_queue;
-	for (uint32_t i = 0; i < probs.size(); i++)
-	{
-		alias_table[i].ori_prob = probs[i] / total_weight;
-		probs[i] *= static_cast<float>(probs.size()) / total_weight;
-		if (probs[i] >= 1.f)
+	__m128 result = _mm_mul_ps(columns[0], _mm_set1_ps(p.x));
+	result        = _mm_add_ps(result, _mm_mul_ps(columns[1], _mm_set1_ps(p.y)));
+	result        = _mm_add_ps(result, _mm_mul_ps(columns[2], _mm_set1_ps(p.z)));
+	result        = _mm_add_ps(result, columns[3]);
+
+	glm::vec4 point;
+	_mm_storeu_ps(glm::value_ptr(point), result);
+	return glm::vec3(point);
+}
+#endif
+
+// World space triangles of a run of emitters, luminance of the triangles is kept
+// Weights are luminance times area, the emitter alias table is built from them
+inline void transform_emitters(const Emitter *emitters, LightTriangle *triangles, float *weights, uint32_t count, const std::vector<Instance> &instances, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices)
+{
+	const Instance *instance = nullptr;
+	const Vertex   *vertex   = nullptr;
+	const uint32_t *index    = nullptr;
+#ifdef SCENE_SSE2
+	__m128 columns[4];
+#endif
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		// Runs usually stay within one instance, its transform is loaded once
+		if (instance != &instances[emitters[i].instance])
 		{
-			greater_queue.push(i);
+			instance = &instances[emitters[i].instance];
+			vertex   = vertices.data() + instance->vertices_offset;
+			index    = indices.data() + instance->indices_offset;
+#ifdef SCENE_SSE2
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				columns[c] = _mm_loadu_ps(glm::value_ptr(instance->transform[c]));
+			}
+#endif
 		}
-		else
+
+		const uint32_t tri_idx = emitters[i].triangle;
+		const Vertex  &v0      = vertex[index[tri_idx * 3 + 0]];
+		const Vertex  &v1      = vertex[index[tri_idx * 3 + 1]];
+		const Vertex  &v2      = vertex[index[tri_idx * 3 + 2]];
+
+		LightTriangle &triangle = triangles[i];
+#ifdef SCENE_SSE2
+		triangle.p0 = transform_point_sse(columns, v0.position);
+		triangle.p1 = transform_point_sse(columns, v1.position);
+		triangle.p2 = transform_point_sse(columns, v2.position);
+#else
+		triangle.p0 = instance->transform * glm::vec4(glm::vec3(v0.position), 1.f);
+		triangle.p1 = instance->transform * glm::vec4(glm::vec3(v1.position), 1.f);
+		triangle.p2 = instance->transform * glm::vec4(glm::vec3(v2.position), 1.f);
+#endif
+
+		weights[i] = triangle.luminance * glm::length(glm::cross(triangle.p1 - triangle.p0, triangle.p2 - triangle.p1)) * 0.5f;
+	}
+}
+
+inline std::array<glm::vec3, 2> transform_bounds(const std::array<glm::vec3, 2> &bounds, const glm::mat4 &transform)
+{
+	std::array<glm::vec3, 2> result = {glm::vec3(std::numeric_limits<float>::max()), -glm::vec3(std::numeric_limits<float>::max())};
+	for (uint32_t corner = 0; corner < 8; corner++)
+	{
+		glm::vec3 p = glm::vec3(
+		    bounds[corner & 1].x,
+		    bounds[(corner >> 1) & 1].y,
+		    bounds[(corner >> 2) & 1].z);
+		p         = transform * glm::vec4(p, 1.f);
+		result[0] = glm::min(result[0], p);
+		result[1] = glm::max(result[1], p);
+	}
+	return result;
+}
+
+inline float surface_area(const std::array<glm::vec3, 2> &bounds)
+{
+	glm::vec3 extent = glm::max(bounds[1] - bounds[0], glm::vec3(0.f));
+	return 2.f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+#ifdef BVH_BENCHMARK
+// Median of repeated CPU BVH builds in Mtris/s with the SAH cost of the result, bottom level refits and top level rebuilds are timed on the same scene
+inline void benchmark_cpu_bvh(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, const std::vector<Instance> &instances)
+{
+	auto median = [](auto &&run) {
+		std::array<float, BVH_BUILD_BENCHMARK_RUNS> times = {};
+		for (float &time : times)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			run();
+			time = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		}
+		std::sort(times.begin(), times.end());
+		return times[BVH_BUILD_BENCHMARK_RUNS / 2];
+	};
+
+	// The first build also warms up the allocator and the thread pool
+	SceneBVH bvh   = build_scene_bvh(vertices, indices, instances);
+	auto     build = [&]() {
+		bvh = build_scene_bvh(vertices, indices, instances);
+	};
+	float build_time = median(build);
+
+	size_t triangle_count = 0;
+	float  blas_cost      = 0.f;
+	for (const BVH &blas : bvh.blas)
+	{
+		triangle_count += blas.primitives.size();
+		blas_cost += sah_cost(blas) * static_cast<float>(blas.primitives.size());
+	}
+	blas_cost /= static_cast<float>(std::max<size_t>(triangle_count, 1));
+
+	// One instance of every bottom level is refitted, as skinning does for its instances
+	std::vector<uint32_t> blas_instances(bvh.blas.size(), ~0u);
+	for (uint32_t instance_id = 0; instance_id < bvh.instance_blas.size(); instance_id++)
+	{
+		if (blas_instances[bvh.instance_blas[instance_id]] == ~0u)
+		{
+			blas_instances[bvh.instance_blas[instance_id]] = instance_id;
+		}
+	}
+
+	float refit_time = median([&]() {
+		for (uint32_t instance_id : blas_instances)
+		{
+			if (instance_id != ~0u)
+			{
+				refit_scene_blas(bvh, instance_id, vertices, indices);
+			}
+		}
+	});
+	float tlas_time = median([&]() {
+		rebuild_scene_tlas(bvh, instances);
+	});
+
+	spdlog::info("CPU BVH build over {} triangles and {} instances: {:.2f} ms, {:.2f} Mtris/s, SAH cost TLAS {:.2f} BLAS {:.2f}, median of {} runs",
+	             triangle_count, instances.size(), build_time, static_cast<float>(triangle_count) / std::max(build_time, 1e-3f) * 1e-3f, sah_cost(bvh.tlas), blas_cost, BVH_BUILD_BENCHMARK_RUNS);
+	spdlog::info("CPU BVH refit of every BLAS {:.2f} ms, TLAS rebuild {:.2f} ms", refit_time, tlas_time);
+}
+
+// Mrays/s of the CPU BVH8, primary rays leave the center of the scene through a 90 degree frustum, shadow rays aim at random emitters
+inline void benchmark_cpu_bvh8(const SceneBVH8 &bvh8, const std::vector<LightTriangle> &light_triangles)
+{
+	if (bvh8.tlas.nodes.empty())
+	{
+		return;
+	}
+
+	std::array<glm::vec3, 2> bounds = {glm::vec3(std::numeric_limits<float>::max()), -glm::vec3(std::numeric_limits<float>::max())};
+	const BVH8Node          &root   = bvh8.tlas.nodes[0];
+	for (uint32_t i = 0; i < 8; i++)
+	{
+		if (root.valid & (1u << i))
 		{
-			smaller_queue.push(i);
+			bounds[0] = glm::min(bounds[0], glm::vec3(root.bbox_min_x[i], root.bbox_min_y[i], root.bbox_min_z[i]));
+			bounds[1] = glm::max(bounds[1], glm::vec3(root.bbox_max_x[i], root.bbox_max_y[i], root.bbox_max_z[i]));
 		}
 	}
-	while (!greater_queue.empty() && !smaller_queue.empty())
+
+	std::mt19937                          rng(0);
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+
+	auto measure = [](auto &&trace) {
+		auto start = std::chrono::high_resolution_clock::now();
+		trace();
+		return std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	};
+
+	std::vector<Ray> primary_rays(BVH8_BENCHMARK_RESOLUTION * BVH8_BENCHMARK_RESOLUTION);
+	for (uint32_t y = 0; y < BVH8_BENCHMARK_RESOLUTION; y++)
 	{
-		uint32_t g = greater_queue.front();
-		uint32_t s = smaller_queue.front();
+		for (uint32_t x = 0; x < BVH8_BENCHMARK_RESOLUTION; x++)
+		{
+			glm::vec2 ndc = (glm::vec2(x, y) + 0.5f) / static_cast<float>(BVH8_BENCHMARK_RESOLUTION) * 2.f - 1.f;
+
+			primary_rays[y * BVH8_BENCHMARK_RESOLUTION + x] = Ray{
+			    .origin    = (bounds[0] + bounds[1]) * 0.5f,
+			    .direction = glm::normalize(glm::vec3(ndc.x, -ndc.y, -1.f)),
+			};
+		}
+	}
 
-		greater_queue.pop();
-		smaller_queue.pop();
+	std::vector<uint32_t> seeds(primary_rays.size(), 0);
+	std::vector<RayHit>   primary_hits(primary_rays.size());
+	std::vector<uint32_t> ray_ids(primary_rays.size());
+	std::iota(ray_ids.begin(), ray_ids.end(), 0);
+
+	float single_time = measure([&]() {
+		std::for_each(std::execution::par, ray_ids.begin(), ray_ids.end(), [&](uint32_t ray_id) {
+			closest_hit(bvh8, primary_rays[ray_id], false, seeds[ray_id], primary_hits[ray_id]);
+		});
+	});
+	float primary_time = measure([&]() {
+		closest_hit_stream(bvh8, primary_rays, false, seeds, primary_hits);
+	});
+
+	// Secondary rays leave the primary hits, diffuse directions are uniform over the hemisphere facing the primary ray origin
+	std::vector<Ray> shadow_rays;
+	std::vector<Ray> diffuse_rays;
+	for (uint32_t ray_id = 0; ray_id < primary_rays.size(); ray_id++)
+	{
+		if (primary_hits[ray_id].t == std::numeric_limits<float>::infinity())
+		{
+			continue;
+		}
 
-		alias_table[s].prob  = probs[s];
-		alias_table[s].alias = g;
+		glm::vec3 p = primary_rays[ray_id].origin + primary_rays[ray_id].direction * primary_hits[ray_id].t;
 
-		probs[g] = (probs[s] + probs[g]) - 1.f;
+		glm::vec3 target = bounds[0] + (bounds[1] - bounds[0]) * glm::vec3(uniform(rng), uniform(rng), uniform(rng));
+		if (!light_triangles.empty())
+		{
+			const LightTriangle &triangle = light_triangles[std::min(static_cast<size_t>(uniform(rng) * static_cast<float>(light_triangles.size())), light_triangles.size() - 1)];
 
-		if (probs[g] < 1.f)
+			float su = std::sqrt(uniform(rng));
+			float v  = uniform(rng);
+			target   = triangle.p0 * (1.f - su) + triangle.p1 * (su * (1.f - v)) + triangle.p2 * (su * v);
+		}
+		if (glm::length(target - p) > 1e-6f)
 		{
-			smaller_queue.push(g);
+			shadow_rays.push_back(shadow_ray(p, glm::normalize(target - p), glm::length(target - p)));
 		}
-		else
+
+		float     z         = 1.f - 2.f * uniform(rng);
+		float     phi       = 2.f * glm::pi<float>() * uniform(rng);
+		float     r         = std::sqrt(std::max(0.f, 1.f - z * z));
+		glm::vec3 direction = glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+		diffuse_rays.push_back(Ray{
+		    .origin    = p,
+		    .direction = glm::dot(direction, primary_rays[ray_id].direction) > 0.f ? -direction : direction,
+		});
+	}
+
+	std::vector<uint8_t> occluded;
+	std::vector<RayHit>  diffuse_hits;
+
+	seeds.assign(shadow_rays.size(), 0);
+	float shadow_time = measure([&]() {
+		any_hit_stream(bvh8, shadow_rays, seeds, occluded);
+	});
+
+	seeds.assign(diffuse_rays.size(), 0);
+	float diffuse_time = measure([&]() {
+		closest_hit_stream(bvh8, diffuse_rays, false, seeds, diffuse_hits);
+	});
+
+	auto mrays = [](size_t count, float time) {
+		return static_cast<float>(count) / std::max(time, 1e-3f) * 1e-3f;
+	};
+	spdlog::info("CPU BVH8 primary {:.2f} Mrays/s ({:.2f} Mrays/s single ray), shadow {:.2f} Mrays/s, diffuse {:.2f} Mrays/s", mrays(primary_rays.size(), primary_time), mrays(primary_rays.size(), single_time), mrays(shadow_rays.size(), shadow_time), mrays(diffuse_rays.size(), diffuse_time));
+}
+#endif        // BVH_BENCHMARK
+
+// Linear blend skinning, returns the bounds of the skinned vertices
+// The chunk bounds are scratch reused across frames
+inline std::array<glm::vec3, 2> skin_vertices(const Vertex *src, const glm::uvec4 *joints, const glm::vec4 *weights, const std::vector<glm::mat4> &joint_matrices, Vertex *dst, uint32_t count,
+                                              std::vector<std::array<glm::vec3, 2>> &chunk_bounds)
+{
+	uint32_t chunk_count = (count + SKINNING_CHUNK_SIZE - 1) / SKINNING_CHUNK_SIZE;
+	chunk_bounds.assign(chunk_count, {glm::vec3(std::numeric_limits<float>::max()), -glm::vec3(std::numeric_limits<float>::max())});
+	get_frame_work_stealing_pool().parallel_for(chunk_count, [&](uint32_t chunk, uint32_t) {
+		auto &bounds = chunk_bounds[chunk];
+		for (uint32_t i = chunk * SKINNING_CHUNK_SIZE; i < std::min(count, (chunk + 1) * SKINNING_CHUNK_SIZE); i++)
 		{
-			greater_queue.push(g);
+			glm::mat4 skin_matrix = weights[i].x * joint_matrices[joints[i].x] +
+			                        weights[i].y * joint_matrices[joints[i].y] +
+			                        weights[i].z * joint_matrices[joints[i].z] +
+			                        weights[i].w * joint_matrices[joints[i].w];
+
+			// Normals take the inverse transpose, the cofactor matrix is that up to the determinant and keeps non-uniformly scaled joints correct
+			glm::mat3 linear   = glm::mat3(skin_matrix);
+			glm::mat3 cofactor = glm::mat3(glm::cross(linear[1], linear[2]), glm::cross(linear[2], linear[0]), glm::cross(linear[0], linear[1]));
+			float     det      = glm::dot(linear[0], cofactor[0]);
+
+			glm::vec3 position = skin_matrix * glm::vec4(glm::vec3(src[i].position), 1.f);
+			glm::vec3 normal   = glm::normalize((det < 0.f ? -cofactor : cofactor) * glm::vec3(src[i].normal));
+
+			dst[i].position = glm::vec4(position, src[i].position.w);
+			dst[i].normal   = glm::vec4(normal, src[i].normal.w);
+			bounds[0]       = glm::min(bounds[0], position);
+			bounds[1]       = glm::max(bounds[1], position);
 		}
+	});
+
+	std::array<glm::vec3, 2> bounds = {glm::vec3(std::numeric_limits<float>::max()), -glm::vec3(std::numeric_limits<float>::max())};
+	for (auto &chunk : chunk_bounds)
+	{
+		bounds[0] = glm::min(bounds[0], chunk[0]);
+		bounds[1] = glm::max(bounds[1], chunk[1]);
 	}
-	while (!greater_queue.empty())
+	return bounds;
+}
+
+inline void update_buffer_chunked(CommandBufferRecorder &recorder, VkBuffer buffer, void *data, size_t size, size_t offset = 0)
+{
+	// vkCmdUpdateBuffer is limited to 64 KB per command
+	for (size_t chunk = 0; chunk < size; chunk += UPDATE_BUFFER_MAX_SIZE)
 	{
-		uint32_t g = greater_queue.front();
-		greater_queue.pop();
-		alias_table[g].prob  = 1.f;
-		alias_table[g].alias = g;
+		recorder.update_buffer(buffer, static_cast<uint8_t *>(data) + chunk, std::min<size_t>(UPDATE_BUFFER_MAX_SIZE, size - chunk), offset + chunk);
 	}
-	while (!greater_queue.empty())
+}
+
+inline size_t mip_chain_size(VkFormat format, uint32_t width, uint32_t height, uint32_t first_mip)
+{
+	uint32_t mip_levels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height))) + 1);
+
+	size_t size = 0;
+	for (uint32_t mip = first_mip; mip < mip_levels; mip++)
 	{
-		uint32_t s = smaller_queue.front();
-		smaller_queue.pop();
-		alias_table[s].prob  = 1.f;
-		alias_table[s].alias = s;
+		size += texture_level_size(format, std::max(width >> mip, 1u), std::max(height >> mip, 1u));
 	}
+	return size;
+}
 
-	for (auto &table : alias_table)
+// Creates a texture holding the levels read from a cooked texture, safe to call from loader and streaming threads
+inline std::pair<Texture, VkImageView> upload_texture_mips(const Context &context, const std::string &name, const CookedTexture &cooked)
+{
+	uint32_t width  = std::max(cooked.width >> cooked.first_mip, 1u);
+	uint32_t height = std::max(cooked.height >> cooked.first_mip, 1u);
+
+	// Levels are packed in one staging buffer with a copy region per level
+	std::vector<uint8_t>           chain;
+	std::vector<VkBufferImageCopy> regions;
+	for (uint32_t i = 0; i < cooked.levels.size(); i++)
 	{
-		table.alias_ori_prob = alias_table[table.alias].ori_prob;
+		regions.push_back(VkBufferImageCopy{
+		    .bufferOffset     = chain.size(),
+		    .imageSubresource = {
+		        .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+		        .mipLevel       = i,
+		        .baseArrayLayer = 0,
+		        .layerCount     = 1,
+		    },
+		    .imageExtent = {std::max(width >> i, 1u), std::max(height >> i, 1u), 1},
+		});
+		chain.insert(chain.end(), cooked.levels[i].begin(), cooked.levels[i].end());
 	}
 
-	return alias_table;
+	VkImageSubresourceRange range = {
+	    .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	    .baseMipLevel   = 0,
+	    .levelCount     = static_cast<uint32_t>(regions.size()),
+	    .baseArrayLayer = 0,
+	    .layerCount     = 1,
+	};
+
+	Texture texture        = context.create_texture_2d(name, width, height, cooked.format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, true);
+	Buffer  staging_buffer = context.create_buffer("Image Staging Buffer", chain.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	context.buffer_copy_to_device(staging_buffer, chain.data(), chain.size());
+	context.record_command()
+	    .begin()
+	    .insert_barrier()
+	    .add_image_barrier(
+	        texture.vk_image,
+	        0, VK_ACCESS_TRANSFER_WRITE_BIT,
+	        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	        range)
+	    .insert()
+	    .execute([&](VkCommandBuffer cmd_buffer) {
+		    vkCmdCopyBufferToImage(cmd_buffer, staging_buffer.vk_buffer, texture.vk_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+	    })
+	    .insert_barrier()
+	    .add_image_barrier(
+	        texture.vk_image,
+	        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+	        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	        range)
+	    .insert()
+	    .end()
+	    .flush();
+	context.destroy(staging_buffer);
+
+	VkImageView view = context.create_texture_view(name + " - View", texture.vk_image, cooked.format, VK_IMAGE_VIEW_TYPE_2D, range, cooked.swizzle);
+
+	return {texture, view};
+}
+
+// Payload layout of the envmap cache, the RGBA32F irradiance SH goes first so every RGBA16F level stays aligned to its texel size
+struct EnvmapCacheLayout
+{
+	EnvmapCacheHeader              header;
+	VkBufferImageCopy              irradiance_sh = {};
+	std::vector<VkBufferImageCopy> cubemap;
+	std::vector<VkBufferImageCopy> prefilter_map;
+};
+
+inline EnvmapCacheLayout envmap_cache_layout(uint64_t hash)
+{
+	EnvmapCacheLayout layout;
+	layout.header = {
+	    .hash                 = hash,
+	    .cubemap_size         = CUBEMAP_SIZE,
+	    .cubemap_mip_levels   = CUBEMAP_MIP_LEVELS,
+	    .prefilter_size       = PREFILTER_MAP_SIZE,
+	    .prefilter_mip_levels = PREFILTER_MIP_LEVELS,
+	};
+
+	layout.irradiance_sh = VkBufferImageCopy{
+	    .bufferOffset     = 0,
+	    .imageSubresource = {
+	        .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	        .mipLevel       = 0,
+	        .baseArrayLayer = 0,
+	        .layerCount     = 1,
+	    },
+	    .imageExtent = {9, 1, 1},
+	};
+
+	size_t offset = 9 * sizeof(glm::vec4);
+
+	auto add_cubemap_levels = [&offset](std::vector<VkBufferImageCopy> &regions, uint32_t size, uint32_t mip_levels) {
+		for (uint32_t mip = 0; mip < mip_levels; mip++)
+		{
+			uint32_t mip_size = std::max(size >> mip, 1u);
+			regions.push_back(VkBufferImageCopy{
+			    .bufferOffset     = offset,
+			    .imageSubresource = {
+			        .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+			        .mipLevel       = mip,
+			        .baseArrayLayer = 0,
+			        .layerCount     = CUBEMAP_FACE_NUM,
+			    },
+			    .imageExtent = {mip_size, mip_size, 1},
+			});
+			offset += static_cast<size_t>(mip_size) * mip_size * CUBEMAP_FACE_NUM * 4 * sizeof(uint16_t);
+		}
+	};
+	add_cubemap_levels(layout.cubemap, CUBEMAP_SIZE, CUBEMAP_MIP_LEVELS);
+	add_cubemap_levels(layout.prefilter_map, PREFILTER_MAP_SIZE, PREFILTER_MIP_LEVELS);
+
+	layout.header.data_size = offset;
+
+	return layout;
 }
 
 Scene::Scene(const Context &context) :
@@ -202,7 +709,7 @@ Scene::Scene(const Context &context) :
 	ggx_lut      = m_context->load_texture_2d(PROJECT_DIR "assets/textures/lut/brdf_lut.png");
 	ggx_lut_view = m_context->create_texture_view("LUT view", ggx_lut.vk_image, VK_FORMAT_R8G8B8A8_UNORM);
 
-	buffer.view = m_context->create_buffer("View Buffer", sizeof(view_info), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	buffer.view = m_context->create_buffer("View Buffer", sizeof(view_info), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, true);
 	m_context->buffer_copy_to_device(buffer.view, &view_info, sizeof(view_info));
 
 	linear_sampler  = m_context->create_sampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_LINEAR, VK_SAMPLER_ADDRESS_MODE_REPEAT, VK_SAMPLER_ADDRESS_MODE_REPEAT, VK_SAMPLER_ADDRESS_MODE_REPEAT);
@@ -247,13 +754,33 @@ Scene::Scene(const Context &context) :
 	                        .add_descriptor_binding(17, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_ALL_GRAPHICS)
 	                        // Scrambling Ranking Tile
 	                        .add_descriptor_bindless_binding(18, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_ALL_GRAPHICS)
+	                        // Texture Feedback Buffer
+	                        .add_descriptor_binding(19, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_ALL_GRAPHICS)
+	                        // Envmap Alias Table Buffer
+	                        .add_descriptor_binding(20, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_ALL_GRAPHICS)
+	                        // Light Tree Buffer
+	                        .add_descriptor_binding(21, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_ALL_GRAPHICS)
 	                        .create();
 
 	descriptor.set = m_context->allocate_descriptor_set({descriptor.layout});
 }
 
+Scene::Scene(const Context *context) :
+    m_context(context)
+{
+}
+
 Scene::~Scene()
 {
+	if (m_loading.valid())
+	{
+		m_loading.wait();
+	}
+	if (m_reference.valid())
+	{
+		m_reference.wait();
+	}
+
 	m_context->wait();
 	m_context->destroy(descriptor.layout)
 	    .destroy(descriptor.set)
@@ -268,166 +795,333 @@ Scene::~Scene()
 	    .destroy(nearest_sampler);
 	destroy_scene();
 	destroy_envmap();
+
+	{
+		std::lock_guard<std::mutex> lock(m_texture_loader_mutex);
+		m_texture_loader_stop = true;
+	}
+	m_texture_loader_condition.notify_all();
+	if (m_texture_loader.joinable())
+	{
+		m_texture_loader.join();
+	}
 }
 
-void Scene::load_scene(const std::string &filename)
+bool Scene::load_scene(const std::string &filename)
 {
-	m_context->wait();
 	destroy_scene();
 
+	scene_info = {};
+	m_progress = 0.f;
+	m_filename = filename;
+
 	cgltf_options options  = {};
 	cgltf_data   *raw_data = nullptr;
 	cgltf_result  result   = cgltf_parse_file(&options, filename.c_str(), &raw_data);
 	if (result != cgltf_result_success)
 	{
 		spdlog::error("Failed to load gltf {}", filename);
-		return;
+		return false;
 	}
 	result = cgltf_load_buffers(&options, raw_data, filename.c_str());
 	if (result != cgltf_result_success)
 	{
 		spdlog::error("Failed to load gltf {}", filename);
-		return;
+		cgltf_free(raw_data);
+		return false;
 	}
 
-	std::unordered_map<cgltf_texture *, uint32_t>           texture_map;
+	std::unordered_map<std::string, uint32_t>               texture_map;                  // cache path - texture id
 	std::unordered_map<cgltf_material *, uint32_t>          material_map;
 	std::unordered_map<cgltf_mesh *, std::vector<uint32_t>> mesh_map;
+	std::unordered_map<size_t, std::vector<uint32_t>>       geometry_map;                 // geometry hash - geometry ids
+	std::unordered_map<uint64_t, uint32_t>                  geometry_material_map;        // geometry id << 32 | material id - mesh id
 
 	std::vector<Emitter>  emitters;
 	std::vector<Light>    lights;
 	std::vector<Material> materials;
+	std::vector<int32_t>  material_emission;        // material id - emissive texture id, -1 for a flat emissive factor
 	std::vector<Mesh>     meshes;
+	std::vector<uint32_t> mesh_geometry;             // mesh id - geometry id
+	std::vector<uint32_t> geometry_owner;            // geometry id - id of the mesh that owns the vertex/index range
 	std::vector<Instance> instances;
 	std::vector<uint32_t> indices;
 	std::vector<Vertex>   vertices;
 
-	auto load_texture = [&](cgltf_texture *gltf_texture) -> int32_t {
-		if (!gltf_texture)
+	std::vector<glm::uvec4> skin_joints;
+	std::vector<glm::vec4>  skin_weights;
+
+	// Textures are cooked once into block compressed KTX2 files next to the scene and loaded from there afterwards
+	const std::filesystem::path cache_dictionary = std::filesystem::path(filename).parent_path() / "cache";
+
+	auto texture_name = [&](cgltf_texture *gltf_texture) -> std::string {
+		return gltf_texture->image->uri ? std::string(gltf_texture->image->uri) : fmt::format("GLTF Texture #{}", gltf_texture->image - raw_data->images);
+	};
+
+	auto texture_source = [&](cgltf_texture *gltf_texture) -> std::filesystem::path {
+		return gltf_texture->image->uri ? std::filesystem::path(get_path_dictionary(filename) + gltf_texture->image->uri) : std::filesystem::path(filename);
+	};
+
+	// One cache file per image and usage, external images are keyed by their path relative to the glTF so equal stems in other folders do not collide
+	auto texture_cache_path = [&](cgltf_texture *gltf_texture, TextureUsage usage, float alpha_cutoff) -> std::string {
+		static const char *usage_names[] = {"base_color", "normal", "metallic_roughness", "emissive"};
+
+		std::string stem = gltf_texture->image->uri ?
+		                       fmt::format("{}_{:016x}", texture_source(gltf_texture).stem().string(), hash_cache_key(gltf_texture->image->uri, std::strlen(gltf_texture->image->uri))) :
+		                       fmt::format("{}_{}", std::filesystem::path(filename).stem().string(), gltf_texture->image - raw_data->images);
+		std::string mask = alpha_cutoff > 0.f ? fmt::format(".mask{}", static_cast<uint32_t>(alpha_cutoff * 100.f + 0.5f)) : "";
+		return (cache_dictionary / fmt::format("{}.{}{}.ktx2", stem, usage_names[static_cast<uint32_t>(usage)], mask)).string();
+	};
+
+	// Cook again if the cache is missing, older than the source image or written by another cooker version
+	auto is_cache_valid = [&](cgltf_texture *gltf_texture, const std::string &cache_path, CookedTexture &cooked) -> bool {
+		std::error_code error;
+		return std::filesystem::exists(cache_path, error) &&
+		       std::filesystem::last_write_time(cache_path, error) >= std::filesystem::last_write_time(texture_source(gltf_texture), error) &&
+		       read_ktx2_header(cache_path, cooked);
+	};
+
+	auto cook_gltf_texture = [&](cgltf_texture *gltf_texture, TextureUsage usage, float alpha_cutoff, CookedTexture &cooked) -> bool {
+		int32_t  width = 0, height = 0;
+		uint8_t *image_data = load_gltf_image(gltf_texture->image, filename, width, height);
+		if (!image_data)
 		{
-			return -1;
+			spdlog::warn("Failed to load texture {}", texture_name(gltf_texture));
+			return false;
 		}
-		if (texture_map.find(gltf_texture) != texture_map.end())
+
+		spdlog::info("Cooking texture {}", texture_name(gltf_texture));
+		cooked = cook_texture(image_data, static_cast<uint32_t>(width), static_cast<uint32_t>(height), usage, alpha_cutoff);
+		stbi_image_free(image_data);
+
+		return true;
+	};
+
+	// Cook every stale texture up front, one texture per task
+	{
+		struct CookRequest
+		{
+			cgltf_texture *texture;
+			TextureUsage   usage;
+			float          alpha_cutoff;
+		};
+
+		std::vector<CookRequest>        requests;
+		std::unordered_set<std::string> visited;
+
+		auto add_request = [&](cgltf_texture *gltf_texture, TextureUsage usage, float alpha_cutoff) {
+			// Every usage of an image is cooked on its own, as load_texture keys textures by cache path
+			if (gltf_texture && visited.insert(texture_cache_path(gltf_texture, usage, alpha_cutoff)).second)
+			{
+				requests.push_back(CookRequest{gltf_texture, usage, alpha_cutoff});
+			}
+		};
+
+		for (size_t i = 0; i < raw_data->materials_count; i++)
 		{
-			return texture_map.at(gltf_texture);
+			auto &raw_material = raw_data->materials[i];
+
+			add_request(raw_material.normal_texture.texture, TextureUsage::Normal, 0.f);
+			add_request(raw_material.emissive_texture.texture, TextureUsage::Emissive, 0.f);
+			if (raw_material.has_pbr_metallic_roughness)
+			{
+				add_request(raw_material.pbr_metallic_roughness.base_color_texture.texture, TextureUsage::BaseColor, raw_material.alpha_mode == cgltf_alpha_mode_mask ? raw_material.alpha_cutoff : 0.f);
+				add_request(raw_material.pbr_metallic_roughness.metallic_roughness_texture.texture, TextureUsage::MetallicRoughness, 0.f);
+			}
 		}
 
-		uint8_t *raw_data = nullptr;
-		size_t   raw_size = 0;
-		int32_t  width = 0, height = 0, channel = 0, req_channel = 4;
+		std::error_code error;
+		std::filesystem::create_directories(cache_dictionary, error);
 
-		std::string name = "";
+		std::atomic<uint32_t> cooked_count = 0;
+		std::for_each(std::execution::par, requests.begin(), requests.end(), [&](const CookRequest &request) {
+			std::string   cache_path = texture_cache_path(request.texture, request.usage, request.alpha_cutoff);
+			CookedTexture cooked;
+			if (!is_cache_valid(request.texture, cache_path, cooked) &&
+			    cook_gltf_texture(request.texture, request.usage, request.alpha_cutoff, cooked))
+			{
+				write_ktx2(cache_path, cooked);
+			}
+			m_progress = 0.4f * static_cast<float>(++cooked_count) / static_cast<float>(requests.size());
+		});
+	}
 
-		if (gltf_texture->image->uri)
+	auto load_texture = [&](cgltf_texture *gltf_texture, TextureUsage usage, float alpha_cutoff) -> int32_t {
+		if (!gltf_texture)
 		{
-			// Load external texture
-			std::string path = get_path_dictionary(filename) + gltf_texture->image->uri;
-			raw_data         = stbi_load(path.c_str(), &width, &height, &channel, req_channel);
-			name             = gltf_texture->image->uri;
+			return -1;
 		}
-		else if (gltf_texture->image->buffer_view)
+		std::string cache_path = texture_cache_path(gltf_texture, usage, alpha_cutoff);
+		if (texture_map.find(cache_path) != texture_map.end())
 		{
-			// Load internal texture
-			uint8_t *data = static_cast<uint8_t *>(gltf_texture->image->buffer_view->buffer->data) + gltf_texture->image->buffer_view->offset;
-			size_t   size = gltf_texture->image->buffer_view->size;
+			return texture_map.at(cache_path);
+		}
 
-			raw_data = stbi_load_from_memory(static_cast<stbi_uc *>(data), static_cast<int32_t>(size), &width, &height, &channel, req_channel);
+		StreamedTexture streamed;
+		streamed.name       = texture_name(gltf_texture);
+		streamed.cache_path = cache_path;
+		streamed.image      = static_cast<uint32_t>(gltf_texture->image - raw_data->images);
 
-			name = fmt::format("GLTF Texture #{}", textures.size());
+		// The cache is only stale here if it could not be written up front, the texture is then uploaded in full
+		CookedTexture cooked;
+		bool          cached = is_cache_valid(gltf_texture, streamed.cache_path, cooked);
+		if (!cached)
+		{
+			if (!cook_gltf_texture(gltf_texture, usage, alpha_cutoff, cooked))
+			{
+				return -1;
+			}
+			spdlog::warn("Failed to write texture cache {}, texture {} is not streamed", streamed.cache_path, streamed.name);
 		}
 
-		raw_size = static_cast<size_t>(width) * static_cast<size_t>(height) * static_cast<size_t>(req_channel) * sizeof(uint8_t);
+		// Only the mip tail is uploaded up front, finer mips are streamed in from the cache once requested
+		streamed.format = cooked.format;
+		streamed.width  = cooked.width;
+		streamed.height = cooked.height;
+		while (cached && (std::max(streamed.width, streamed.height) >> streamed.tail_mip) > TEXTURE_STREAMING_TAIL_SIZE)
+		{
+			streamed.tail_mip++;
+		}
+		streamed.resident_mip  = streamed.tail_mip;
+		streamed.requested_mip = streamed.tail_mip;
 
-		uint32_t mip_level      = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height))) + 1);
-		Texture  image          = m_context->create_texture_2d(name, (uint32_t) width, (uint32_t) height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, true);
-		Buffer   staging_buffer = m_context->create_buffer("Image Staging Buffer", raw_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-		m_context->buffer_copy_to_device(staging_buffer, raw_data, raw_size);
-		m_context->record_command()
-		    .begin()
-		    .insert_barrier()
-		    .add_image_barrier(
-		        image.vk_image,
-		        0, VK_ACCESS_TRANSFER_WRITE_BIT,
-		        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		        {
-		            .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
-		            .baseMipLevel   = 0,
-		            .levelCount     = mip_level,
-		            .baseArrayLayer = 0,
-		            .layerCount     = 1,
-		        })
-		    .insert()
-		    .copy_buffer_to_image(staging_buffer.vk_buffer, image.vk_image, {(uint32_t) width, (uint32_t) height, 1})
-		    .insert_barrier()
-		    .add_image_barrier(
-		        image.vk_image,
-		        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
-		        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-		        {
-		            .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
-		            .baseMipLevel   = 0,
-		            .levelCount     = mip_level,
-		            .baseArrayLayer = 0,
-		            .layerCount     = 1,
-		        })
-		    .insert()
-		    .generate_mipmap(image.vk_image, (uint32_t) width, (uint32_t) height, mip_level)
-		    .insert_barrier()
-		    .add_image_barrier(
-		        image.vk_image,
-		        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
-		        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-		        {
-		            .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
-		            .baseMipLevel   = 0,
-		            .levelCount     = mip_level,
-		            .baseArrayLayer = 0,
-		            .layerCount     = 1,
-		        })
-		    .insert()
-		    .end()
-		    .flush();
-		m_context->destroy(staging_buffer);
+		if (cached && !read_ktx2(streamed.cache_path, cooked, streamed.tail_mip))
+		{
+			spdlog::warn("Failed to read texture cache {}", streamed.cache_path);
+			return -1;
+		}
 
-		stbi_image_free(raw_data);
-		textures.push_back(image);
-		texture_map[gltf_texture] = static_cast<uint32_t>(textures.size() - 1);
+		auto [image, view] = upload_texture_mips(*m_context, streamed.name, cooked);
 
-		texture_views.push_back(m_context->create_texture_view(
-		    name + " - View",
-		    image.vk_image,
-		    VK_FORMAT_R8G8B8A8_UNORM,
-		    VK_IMAGE_VIEW_TYPE_2D,
-		    {
-		        .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
-		        .baseMipLevel   = 0,
-		        .levelCount     = mip_level,
-		        .baseArrayLayer = 0,
-		        .layerCount     = 1,
-		    }));
+		streamed.tail_view = view;
+		textures.push_back(image);
+		texture_views.push_back(view);
+		m_streamed_textures.emplace_back(std::move(streamed));
+		texture_map[cache_path] = static_cast<uint32_t>(textures.size() - 1);
 
-		return texture_map.at(gltf_texture);
+		return texture_map.at(cache_path);
 	};
 
 	// Load material
+	std::vector<EmissiveTexture>  emissive_textures;
+	std::vector<BVH8Material>     alpha_materials;
+	std::vector<BVH8AlphaTexture> alpha_textures;
+	std::vector<std::string>      alpha_caches;        // Cache path of each alpha texture left to decode, empty if it was decoded from the source
 	{
+		std::unordered_map<cgltf_texture *, int32_t> emissive_texture_map;
+		std::unordered_map<cgltf_texture *, int32_t> alpha_texture_map;
+
+		// CPU mip chain of an emissive texture for estimating the power of its emitters
+		// The coarse levels of the cooked texture are decoded, the source image only if the cache could not be written
+		auto load_emissive_texture = [&](cgltf_texture *gltf_texture) -> int32_t {
+			if (emissive_texture_map.find(gltf_texture) != emissive_texture_map.end())
+			{
+				return emissive_texture_map.at(gltf_texture);
+			}
+
+			EmissiveTexture texture;
+			CookedTexture   cooked;
+			std::string     cache_path = texture_cache_path(gltf_texture, TextureUsage::Emissive, 0.f);
+			if (is_cache_valid(gltf_texture, cache_path, cooked))
+			{
+				uint32_t first_mip = 0;
+				while (first_mip + 1 < cooked.mip_levels && (std::max(cooked.width, cooked.height) >> first_mip) > EMISSION_TEXTURE_SIZE)
+				{
+					first_mip++;
+				}
+				if (read_ktx2(cache_path, cooked, first_mip))
+				{
+					texture.width  = std::max(cooked.width >> first_mip, 1u);
+					texture.height = std::max(cooked.height >> first_mip, 1u);
+					texture.levels.resize(cooked.levels.size());
+					for (uint32_t level = 0; level < cooked.levels.size(); level++)
+					{
+						if (!decode_texture_level(cooked, level, texture.levels[level]))
+						{
+							texture.levels.clear();
+							break;
+						}
+					}
+				}
+			}
+
+			if (texture.levels.empty())
+			{
+				int32_t  width = 0, height = 0;
+				uint8_t *image_data = load_gltf_image(gltf_texture->image, filename, width, height);
+				if (!image_data)
+				{
+					return emissive_texture_map[gltf_texture] = -1;
+				}
+
+				texture.width  = static_cast<uint32_t>(width);
+				texture.height = static_cast<uint32_t>(height);
+				texture.levels = generate_mip_chain(image_data, texture.width, texture.height, true);
+				stbi_image_free(image_data);
+			}
+
+			emissive_textures.emplace_back(std::move(texture));
+			return emissive_texture_map[gltf_texture] = static_cast<int32_t>(emissive_textures.size() - 1);
+		};
+
+		// CPU alpha of a base color texture for the alpha test of CPU rays
+		// Level 0 of the cooked texture is decoded by the first CPU BVH build, the source image here only if the cache could not be written
+		auto load_alpha_texture = [&](cgltf_texture *gltf_texture, float alpha_cutoff) -> int32_t {
+			if (alpha_texture_map.find(gltf_texture) != alpha_texture_map.end())
+			{
+				return alpha_texture_map.at(gltf_texture);
+			}
+
+			CookedTexture cooked;
+			std::string   cache_path = texture_cache_path(gltf_texture, TextureUsage::BaseColor, alpha_cutoff);
+			if (is_cache_valid(gltf_texture, cache_path, cooked))
+			{
+				alpha_textures.emplace_back();
+				alpha_caches.emplace_back(std::move(cache_path));
+				return alpha_texture_map[gltf_texture] = static_cast<int32_t>(alpha_textures.size() - 1);
+			}
+
+			int32_t  width = 0, height = 0;
+			uint8_t *image_data = load_gltf_image(gltf_texture->image, filename, width, height);
+			if (!image_data)
+			{
+				return alpha_texture_map[gltf_texture] = -1;
+			}
+
+			BVH8AlphaTexture texture;
+			texture.width  = static_cast<uint32_t>(width);
+			texture.height = static_cast<uint32_t>(height);
+			texture.alpha.resize(static_cast<size_t>(width) * static_cast<size_t>(height));
+			for (size_t i = 0; i < texture.alpha.size(); i++)
+			{
+				texture.alpha[i] = image_data[i * 4 + 3];
+			}
+			stbi_image_free(image_data);
+
+			alpha_textures.emplace_back(std::move(texture));
+			alpha_caches.emplace_back();
+			return alpha_texture_map[gltf_texture] = static_cast<int32_t>(alpha_textures.size() - 1);
+		};
+
 		for (size_t i = 0; i < raw_data->materials_count; i++)
 		{
 			auto    &raw_material = raw_data->materials[i];
 			Material material     = {};
 
-			material.normal_texture = load_texture(raw_material.normal_texture.texture);
-			material.double_sided   = raw_material.double_sided;
-			material.alpha_mode     = raw_material.alpha_mode;
-			material.cutoff         = raw_material.alpha_cutoff;
+			material.normal_texture   = load_texture(raw_material.normal_texture.texture, TextureUsage::Normal, 0.f);
+			material.emissive_texture = load_texture(raw_material.emissive_texture.texture, TextureUsage::Emissive, 0.f);
+			material.double_sided     = raw_material.double_sided;
+			material.alpha_mode       = raw_material.alpha_mode;
+			material.cutoff           = raw_material.alpha_cutoff;
 			std::memcpy(glm::value_ptr(material.emissive_factor), raw_material.emissive_factor, sizeof(glm::vec3));
+			material_emission.push_back(material.emissive_texture > -1 && material.emissive_factor != glm::vec3(0.f) ? load_emissive_texture(raw_material.emissive_texture.texture) : -1);
 			if (raw_material.has_pbr_metallic_roughness)
 			{
 				material.metallic_factor  = raw_material.pbr_metallic_roughness.metallic_factor;
 				material.roughness_factor = raw_material.pbr_metallic_roughness.roughness_factor;
 				std::memcpy(glm::value_ptr(material.base_color), raw_material.pbr_metallic_roughness.base_color_factor, sizeof(glm::vec4));
-				material.base_color_texture         = load_texture(raw_material.pbr_metallic_roughness.base_color_texture.texture);
-				material.metallic_roughness_texture = load_texture(raw_material.pbr_metallic_roughness.metallic_roughness_texture.texture);
+				material.base_color_texture         = load_texture(raw_material.pbr_metallic_roughness.base_color_texture.texture, TextureUsage::BaseColor, raw_material.alpha_mode == cgltf_alpha_mode_mask ? raw_material.alpha_cutoff : 0.f);
+				material.metallic_roughness_texture = load_texture(raw_material.pbr_metallic_roughness.metallic_roughness_texture.texture, TextureUsage::MetallicRoughness, 0.f);
 			}
 			if (raw_material.has_clearcoat)
 			{
@@ -439,18 +1133,51 @@ void Scene::load_scene(const std::string &filename)
 				material.transmission_factor = raw_material.transmission.transmission_factor;
 			}
 
+			// Same condition as the force opaque instance flag
+			BVH8Material alpha_material = {};
+			if (material.alpha_mode != 0 &&
+			    (material.base_color.w != 1.f || material.base_color_texture != -1))
+			{
+				alpha_material = BVH8Material{
+				    .alpha_mode = material.alpha_mode,
+				    .cutoff     = material.cutoff,
+				    .base_alpha = material.base_color.w,
+				    .texture    = material.base_color_texture > -1 ? load_alpha_texture(raw_material.pbr_metallic_roughness.base_color_texture.texture, raw_material.alpha_mode == cgltf_alpha_mode_mask ? raw_material.alpha_cutoff : 0.f) : -1,
+				};
+			}
+			alpha_materials.push_back(alpha_material);
+
 			materials.emplace_back(material);
 			material_map[&raw_material] = static_cast<uint32_t>(materials.size() - 1);
+
+			// Texture cooking and upload dominates the load
+			m_progress = 0.4f + 0.2f * static_cast<float>(i + 1) / static_cast<float>(raw_data->materials_count);
 		}
 
 		// Create material buffer
 		{
-			buffer.material = m_context->create_buffer("Material Buffer", materials.size() * sizeof(Material), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			buffer.material = m_context->create_buffer("Material Buffer", materials.size() * sizeof(Material), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY, true);
 			m_context->buffer_copy_to_device(buffer.material, materials.data(), materials.size() * sizeof(Material), true);
 
 			scene_info.material_count       = static_cast<uint32_t>(materials.size());
 			scene_info.material_buffer_addr = buffer.material.device_address;
 		}
+
+		// Create texture streaming feedback buffers, one requested resolution per texture
+		{
+			size_t feedback_size = std::max<size_t>(m_streamed_textures.size(), 1) * sizeof(uint32_t);
+
+			buffer.texture_feedback = m_context->create_buffer("Texture Feedback Buffer", feedback_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			for (size_t i = 0; i < m_texture_feedback_readback.size(); i++)
+			{
+				m_texture_feedback_readback[i] = m_context->create_buffer(fmt::format("Texture Feedback Readback Buffer - {}", i), feedback_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+			}
+			m_context->record_command()
+			    .begin()
+			    .fill_buffer(buffer.texture_feedback.vk_buffer, 0)
+			    .end()
+			    .flush();
+		}
 	}
 
 	// Load geometry
@@ -477,6 +1204,8 @@ void Scene::load_scene(const std::string &filename)
 				    .area            = 0.f,
 				};
 
+				bool skinned = false;
+
 				indices.resize(indices.size() + primitive.indices->count);
 				for (size_t i = 0; i < primitive.indices->count; i++)
 				{
@@ -519,50 +1248,314 @@ void Scene::load_scene(const std::string &filename)
 							vertices[mesh.vertices_offset + i].normal.w   = texcoord.y;
 						}
 					}
+					else if (strcmp(attr_name, "JOINTS_0") == 0)
+					{
+						skin_joints.resize(mesh.vertices_offset + attribute.data->count);
+						for (size_t i = 0; i < attribute.data->count; ++i)
+						{
+							cgltf_accessor_read_uint(attribute.data, i, &skin_joints[mesh.vertices_offset + i].x, 4);
+						}
+						skinned = true;
+					}
+					else if (strcmp(attr_name, "WEIGHTS_0") == 0)
+					{
+						skin_weights.resize(mesh.vertices_offset + attribute.data->count);
+						for (size_t i = 0; i < attribute.data->count; ++i)
+						{
+							cgltf_accessor_read_float(attribute.data, i, &skin_weights[mesh.vertices_offset + i].x, 4);
+						}
+					}
+				}
+
+				// Identical geometry shares one vertex/index range and one BLAS, skinned geometry keeps its own joints and weights
+				std::vector<uint32_t> *candidates  = nullptr;
+				uint32_t               geometry_id = ~0u;
+				if (!skinned)
+				{
+					candidates = &geometry_map[hash_geometry(vertices.data() + mesh.vertices_offset, mesh.vertices_count, indices.data() + mesh.indices_offset, mesh.indices_count)];
+					for (auto &candidate : *candidates)
+					{
+						const Mesh &owner = meshes[geometry_owner[candidate]];
+						if (owner.vertices_count == mesh.vertices_count &&
+						    owner.indices_count == mesh.indices_count &&
+						    std::memcmp(vertices.data() + owner.vertices_offset, vertices.data() + mesh.vertices_offset, mesh.vertices_count * sizeof(Vertex)) == 0 &&
+						    std::memcmp(indices.data() + owner.indices_offset, indices.data() + mesh.indices_offset, mesh.indices_count * sizeof(uint32_t)) == 0)
+						{
+							geometry_id = candidate;
+							break;
+						}
+					}
+				}
+
+				if (geometry_id == ~0u)
+				{
+					geometry_id = static_cast<uint32_t>(geometry_owner.size());
+					geometry_owner.push_back(static_cast<uint32_t>(meshes.size()));
+					if (candidates)
+					{
+						candidates->push_back(geometry_id);
+					}
+				}
+				else
+				{
+					const Mesh &owner = meshes[geometry_owner[geometry_id]];
+					vertices.resize(mesh.vertices_offset);
+					indices.resize(mesh.indices_offset);
+					mesh.vertices_offset = owner.vertices_offset;
+					mesh.indices_offset  = owner.indices_offset;
+
+					// Same geometry and material, reuse the mesh itself
+					auto iter = geometry_material_map.find(static_cast<uint64_t>(geometry_id) << 32 | mesh.material);
+					if (iter != geometry_material_map.end())
+					{
+						mesh_map[&raw_mesh].push_back(iter->second);
+						continue;
+					}
 				}
 
+				geometry_material_map.emplace(static_cast<uint64_t>(geometry_id) << 32 | mesh.material, static_cast<uint32_t>(meshes.size()));
 				meshes.push_back(mesh);
+				mesh_geometry.push_back(geometry_id);
 				mesh_map[&raw_mesh].push_back(static_cast<uint32_t>(meshes.size() - 1));
 			}
 		}
 
+		if (geometry_owner.size() < meshes.size())
+		{
+			spdlog::info("Deduplicated mesh geometry: {} meshes share {} BLAS", meshes.size(), geometry_owner.size());
+		}
+
+		// Load node hierarchy, skins and animations
+		{
+			m_nodes.assign(raw_data->nodes_count, {});
+			m_node_order.clear();
+			for (size_t i = 0; i < raw_data->nodes_count; i++)
+			{
+				const cgltf_node &raw_node = raw_data->nodes[i];
+
+				Node &node      = m_nodes[i];
+				node.parent     = raw_node.parent ? static_cast<int32_t>(raw_node.parent - raw_data->nodes) : -1;
+				node.has_matrix = raw_node.has_matrix;
+				if (raw_node.has_matrix)
+				{
+					std::memcpy(glm::value_ptr(node.matrix), raw_node.matrix, sizeof(glm::mat4));
+				}
+				if (raw_node.has_translation)
+				{
+					std::memcpy(glm::value_ptr(node.translation), raw_node.translation, sizeof(glm::vec3));
+				}
+				if (raw_node.has_rotation)
+				{
+					node.rotation = glm::quat(raw_node.rotation[3], raw_node.rotation[0], raw_node.rotation[1], raw_node.rotation[2]);
+				}
+				if (raw_node.has_scale)
+				{
+					std::memcpy(glm::value_ptr(node.scale), raw_node.scale, sizeof(glm::vec3));
+				}
+				if (!raw_node.parent)
+				{
+					m_node_order.push_back(static_cast<uint32_t>(i));
+				}
+			}
+			for (size_t i = 0; i < m_node_order.size(); i++)
+			{
+				const cgltf_node &raw_node = raw_data->nodes[m_node_order[i]];
+				for (size_t child = 0; child < raw_node.children_count; child++)
+				{
+					m_node_order.push_back(static_cast<uint32_t>(raw_node.children[child] - raw_data->nodes));
+				}
+			}
+
+			m_skins.assign(raw_data->skins_count, {});
+			for (size_t i = 0; i < raw_data->skins_count; i++)
+			{
+				const cgltf_skin &raw_skin = raw_data->skins[i];
+
+				Skin &skin = m_skins[i];
+				skin.joints.resize(raw_skin.joints_count);
+				skin.inverse_bind_matrices.resize(raw_skin.joints_count, glm::mat4(1.f));
+				skin.joint_matrices.resize(raw_skin.joints_count, glm::mat4(1.f));
+				for (size_t joint = 0; joint < raw_skin.joints_count; joint++)
+				{
+					skin.joints[joint] = static_cast<uint32_t>(raw_skin.joints[joint] - raw_data->nodes);
+					if (raw_skin.inverse_bind_matrices)
+					{
+						cgltf_accessor_read_float(raw_skin.inverse_bind_matrices, joint, glm::value_ptr(skin.inverse_bind_matrices[joint]), 16);
+					}
+				}
+			}
+
+			m_animations.assign(raw_data->animations_count, {});
+			m_animation_time = 0.f;
+			for (size_t i = 0; i < raw_data->animations_count; i++)
+			{
+				const cgltf_animation &raw_animation = raw_data->animations[i];
+
+				Animation &animation = m_animations[i];
+				for (size_t channel_id = 0; channel_id < raw_animation.channels_count; channel_id++)
+				{
+					const cgltf_animation_channel &raw_channel = raw_animation.channels[channel_id];
+
+					// Morph target weights are not supported
+					if (!raw_channel.target_node ||
+					    (raw_channel.target_path != cgltf_animation_path_type_translation &&
+					     raw_channel.target_path != cgltf_animation_path_type_rotation &&
+					     raw_channel.target_path != cgltf_animation_path_type_scale))
+					{
+						continue;
+					}
+
+					const cgltf_animation_sampler &sampler = *raw_channel.sampler;
+
+					AnimationChannel channel = {
+					    .node          = static_cast<uint32_t>(raw_channel.target_node - raw_data->nodes),
+					    .path          = raw_channel.target_path == cgltf_animation_path_type_translation ? 0u : (raw_channel.target_path == cgltf_animation_path_type_rotation ? 1u : 2u),
+					    .interpolation = sampler.interpolation == cgltf_interpolation_type_step ? 1u : (sampler.interpolation == cgltf_interpolation_type_cubic_spline ? 2u : 0u),
+					};
+
+					channel.times.resize(sampler.input->count);
+					for (size_t key = 0; key < sampler.input->count; key++)
+					{
+						cgltf_accessor_read_float(sampler.input, key, &channel.times[key], 1);
+					}
+					channel.values.resize(sampler.output->count);
+					for (size_t key = 0; key < sampler.output->count; key++)
+					{
+						cgltf_accessor_read_float(sampler.output, key, &channel.values[key].x, channel.path == 1 ? 4 : 3);
+					}
+					if (channel.times.empty() || channel.values.size() < channel.times.size() * (channel.interpolation == 2 ? 3 : 1))
+					{
+						spdlog::warn("Skip malformed animation channel of node #{}", channel.node);
+						continue;
+					}
+
+					animation.duration = std::max(animation.duration, channel.times.back());
+
+					m_nodes[channel.node].animated = true;
+					animation.channels.emplace_back(std::move(channel));
+				}
+			}
+
+			m_animated_instances.clear();
+			for (auto &node_id : m_node_order)
+			{
+				Node &node = m_nodes[node_id];
+				if (node.parent >= 0 && m_nodes[node.parent].animated)
+				{
+					node.animated = true;
+				}
+			}
+
+			update_node_transforms();
+		}
+
+		// Skinned nodes get their own copy of the mesh at the tail of the vertex buffer, skinned into world space
+		std::unordered_map<const cgltf_node *, std::vector<uint32_t>> skinned_offsets;        // ~0u for primitives without joints
+		m_skinned_instances.clear();
+		m_dynamic_vertices_offset = static_cast<uint32_t>(vertices.size());
+		for (size_t i = 0; i < raw_data->nodes_count; i++)
+		{
+			const cgltf_node &node = raw_data->nodes[i];
+			if (!node.mesh || !node.skin)
+			{
+				continue;
+			}
+
+			auto &offsets = skinned_offsets[&node];
+			for (auto &mesh_id : mesh_map.at(node.mesh))
+			{
+				const auto &mesh = meshes[mesh_id];
+				if (skin_joints.size() < mesh.vertices_offset + mesh.vertices_count ||
+				    skin_weights.size() < mesh.vertices_offset + mesh.vertices_count)
+				{
+					offsets.push_back(~0u);
+					continue;
+				}
+
+				// Joint indices address the node's skin, a mismatched skin is drawn unskinned instead of reading past its joints
+				uint32_t skin_id     = static_cast<uint32_t>(node.skin - raw_data->skins);
+				uint32_t joint_count = static_cast<uint32_t>(m_skins[skin_id].joint_matrices.size());
+				if (std::any_of(skin_joints.begin() + mesh.vertices_offset, skin_joints.begin() + mesh.vertices_offset + mesh.vertices_count, [joint_count](const glm::uvec4 &joints) {
+					    return glm::any(glm::greaterThanEqual(joints, glm::uvec4(joint_count)));
+				    }))
+				{
+					spdlog::warn("Mesh of node {} references joints outside of its skin, it is not skinned", node.name ? node.name : "");
+					offsets.push_back(~0u);
+					continue;
+				}
+
+				SkinnedInstance skinned = {
+				    .skin            = skin_id,
+				    .mesh            = mesh_id,
+				    .vertices_offset = static_cast<uint32_t>(vertices.size()),
+				};
+				vertices.resize(vertices.size() + mesh.vertices_count);
+				skin_vertices(vertices.data() + mesh.vertices_offset, skin_joints.data() + mesh.vertices_offset, skin_weights.data() + mesh.vertices_offset, m_skins[skinned.skin].joint_matrices, vertices.data() + skinned.vertices_offset, mesh.vertices_count, m_skinning_chunk_bounds);
+
+				offsets.push_back(skinned.vertices_offset);
+				m_skinned_instances.emplace_back(std::move(skinned));
+			}
+		}
+
 		scene_info.vertices_count = static_cast<uint32_t>(vertices.size());
 		scene_info.indices_count  = static_cast<uint32_t>(indices.size());
 		scene_info.mesh_count     = static_cast<uint32_t>(meshes.size());
 
-		buffer.vertex = m_context->create_buffer("Vertex Buffer", sizeof(Vertex) * vertices.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		buffer.vertex = m_context->create_buffer("Vertex Buffer", sizeof(Vertex) * vertices.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY, true);
 		m_context->buffer_copy_to_device(buffer.vertex, vertices.data(), sizeof(Vertex) * vertices.size(), true);
 		scene_info.vertex_buffer_addr = buffer.vertex.device_address;
 
-		buffer.index = m_context->create_buffer("Index Buffer", sizeof(uint32_t) * indices.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		buffer.index = m_context->create_buffer("Index Buffer", sizeof(uint32_t) * indices.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY, true);
 		m_context->buffer_copy_to_device(buffer.index, indices.data(), sizeof(uint32_t) * indices.size(), true);
 		scene_info.index_buffer_addr = buffer.index.device_address;
 
 		// Build mesh alias table buffer
 		{
-			std::vector<AliasTable> alias_table;
+			// Tables are laid out by index offset, so only the owner of each range builds one
+			std::vector<uint32_t> owners;
+			std::vector<size_t>   table_offsets;
+			size_t                table_size = 0;
 			for (uint32_t i = 0; i < meshes.size(); i++)
 			{
+				if (geometry_owner[mesh_geometry[i]] == i)
+				{
+					owners.push_back(i);
+					table_offsets.push_back(table_size);
+					table_size += meshes[i].indices_count / 3;
+				}
+			}
+
+			std::vector<AliasTable> alias_table(table_size);
+			std::vector<uint32_t>   owner_indices(owners.size());
+			std::iota(owner_indices.begin(), owner_indices.end(), 0);
+			std::for_each(std::execution::par, owner_indices.begin(), owner_indices.end(), [&](uint32_t owner) {
+				Mesh &mesh = meshes[owners[owner]];
+
 				float              total_weight = 0.f;
-				std::vector<float> mesh_probs(meshes[i].indices_count / 3);
-				for (uint32_t j = 0; j < meshes[i].indices_count / 3; j++)
+				std::vector<float> mesh_probs(mesh.indices_count / 3);
+				for (uint32_t j = 0; j < mesh.indices_count / 3; j++)
 				{
-					glm::vec3 v0 = vertices[meshes[i].vertices_offset + indices[meshes[i].indices_offset + 3 * j + 0]].position;
-					glm::vec3 v1 = vertices[meshes[i].vertices_offset + indices[meshes[i].indices_offset + 3 * j + 1]].position;
-					glm::vec3 v2 = vertices[meshes[i].vertices_offset + indices[meshes[i].indices_offset + 3 * j + 2]].position;
-					mesh_probs[j] += glm::length(glm::cross(v1 - v0, v2 - v1)) * 0.5f;
+					glm::vec3 v0 = vertices[mesh.vertices_offset + indices[mesh.indices_offset + 3 * j + 0]].position;
+					glm::vec3 v1 = vertices[mesh.vertices_offset + indices[mesh.indices_offset + 3 * j + 1]].position;
+					glm::vec3 v2 = vertices[mesh.vertices_offset + indices[mesh.indices_offset + 3 * j + 2]].position;
+					mesh_probs[j] = glm::length(glm::cross(v1 - v0, v2 - v1)) * 0.5f;
 					total_weight += mesh_probs[j];
 				}
-				meshes[i].area = total_weight;
+				mesh.area = total_weight;
 
-				std::vector<AliasTable> mesh_alias_table = build_alias_table(mesh_probs, total_weight);
-				alias_table.insert(alias_table.end(), std::make_move_iterator(mesh_alias_table.begin()), std::make_move_iterator(mesh_alias_table.end()));
+				build_alias_table(mesh_probs.data(), static_cast<uint32_t>(mesh_probs.size()), alias_table.data() + table_offsets[owner]);
+			});
+			for (uint32_t i = 0; i < meshes.size(); i++)
+			{
+				meshes[i].area = meshes[geometry_owner[mesh_geometry[i]]].area;
 			}
-			buffer.mesh_alias_table = m_context->create_buffer("Mesh Alias Table Buffer", sizeof(AliasTable) * alias_table.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			buffer.mesh_alias_table = m_context->create_buffer("Mesh Alias Table Buffer", sizeof(AliasTable) * alias_table.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY, true);
 			m_context->buffer_copy_to_device(buffer.mesh_alias_table, alias_table.data(), sizeof(AliasTable) * alias_table.size(), true);
 			scene_info.mesh_alias_table_buffer_addr = buffer.mesh_alias_table.device_address;
 		}
 
+		m_progress = 0.7f;
+
 		// Load hierarchy
 		{
 			for (size_t i = 0; i < raw_data->nodes_count; i++)
@@ -573,12 +1566,16 @@ void Scene::load_scene(const std::string &filename)
 				cgltf_node_transform_world(&node, matrix);
 				if (node.mesh)
 				{
-					for (auto &mesh_id : mesh_map.at(node.mesh))
+					const auto &mesh_ids       = mesh_map.at(node.mesh);
+					auto        skinned_offset = skinned_offsets.find(&node);
+					for (uint32_t prim_id = 0; prim_id < mesh_ids.size(); prim_id++)
 					{
-						const auto &mesh = meshes[mesh_id];
+						const uint32_t mesh_id        = mesh_ids[prim_id];
+						const auto    &mesh           = meshes[mesh_id];
+						const uint32_t dynamic_offset = skinned_offset != skinned_offsets.end() ? skinned_offset->second[prim_id] : ~0u;
 
 						Instance instance = {
-						    .vertices_offset = mesh.vertices_offset,
+						    .vertices_offset = dynamic_offset != ~0u ? dynamic_offset : mesh.vertices_offset,
 						    .vertices_count  = mesh.vertices_offset,
 						    .indices_offset  = mesh.indices_offset,
 						    .indices_count   = mesh.indices_count,
@@ -586,34 +1583,34 @@ void Scene::load_scene(const std::string &filename)
 						    .material        = mesh.material,
 						    .area            = mesh.area,
 						};
-						std::memcpy(glm::value_ptr(instance.transform), matrix, sizeof(instance.transform));
+						if (dynamic_offset != ~0u)
+						{
+							// Skinned vertices are already in world space
+							instance.transform = glm::mat4(1.f);
+							for (auto &skinned : m_skinned_instances)
+							{
+								if (skinned.vertices_offset == dynamic_offset)
+								{
+									skinned.instance = static_cast<uint32_t>(instances.size());
+								}
+							}
+						}
+						else
+						{
+							std::memcpy(glm::value_ptr(instance.transform), matrix, sizeof(instance.transform));
+							if (m_nodes[i].animated)
+							{
+								m_animated_instances.emplace_back(static_cast<uint32_t>(instances.size()), static_cast<uint32_t>(i));
+							}
+						}
 						instance.transform_inv = glm::inverse(instance.transform);
-						int32_t emitter_offset = static_cast<int32_t>(emitters.size());
 						if (materials[mesh.material].emissive_factor != glm::vec3(0.f))
 						{
 							lights.push_back(Light{
 							    .pos         = glm::vec3(instance.transform[3]),
 							    .instance_id = mesh_id,
 							});
-							for (uint32_t tri_idx = 0; tri_idx < mesh.indices_count / 3; tri_idx++)
-							{
-								const uint32_t i0 = indices[mesh.indices_offset + tri_idx * 3 + 0];
-								const uint32_t i1 = indices[mesh.indices_offset + tri_idx * 3 + 1];
-								const uint32_t i2 = indices[mesh.indices_offset + tri_idx * 3 + 2];
-
-								glm::mat3 normal_mat = glm::mat3(glm::transpose(glm::inverse(instance.transform)));
-
-								emitters.push_back(Emitter{
-								    .p0        = instance.transform * glm::vec4(glm::vec3(vertices[mesh.vertices_offset + i0].position), 1.f),
-								    .p1        = instance.transform * glm::vec4(glm::vec3(vertices[mesh.vertices_offset + i1].position), 1.f),
-								    .p2        = instance.transform * glm::vec4(glm::vec3(vertices[mesh.vertices_offset + i2].position), 1.f),
-								    .n0        = glm::vec4(glm::normalize(normal_mat * glm::vec3(vertices[mesh.vertices_offset + i0].normal)), 0),
-								    .n1        = glm::vec4(glm::normalize(normal_mat * glm::vec3(vertices[mesh.vertices_offset + i1].normal)), 0),
-								    .n2        = glm::vec4(glm::normalize(normal_mat * glm::vec3(vertices[mesh.vertices_offset + i2].normal)), 0),
-								    .intensity = glm::vec4(materials[mesh.material].emissive_factor, 0.f),
-								});
-							}
-							instance.emitter = emitter_offset;
+							instance.emitter = 0;        // Offset assigned once all instances are known
 						}
 						else
 						{
@@ -625,65 +1622,169 @@ void Scene::load_scene(const std::string &filename)
 			}
 			scene_info.instance_count = static_cast<uint32_t>(instances.size());
 
-			// Compute scene extent
+			// Extract emitters, the emission of every candidate triangle is estimated in parallel chunks and triangles emitting nothing are skipped
 			{
-				for (auto &instance : instances)
+				std::vector<glm::uvec3> candidate_chunks;        // instance id, first triangle, triangle count
+				uint32_t                candidate_count = 0;
+				for (uint32_t instance_id = 0; instance_id < instances.size(); instance_id++)
 				{
-					const auto &mesh = meshes[instance.mesh];
-					for (uint32_t vertex_id = 0; vertex_id < mesh.vertices_count; vertex_id++)
+					auto &instance = instances[instance_id];
+					if (instance.emitter < 0)
 					{
-						glm::vec3 v           = vertices[vertex_id + mesh.vertices_offset].position;
-						v                     = instance.transform * glm::vec4(v, 1.f);
-						scene_info.max_extent = glm::max(scene_info.max_extent, v);
-						scene_info.min_extent = glm::min(scene_info.min_extent, v);
+						continue;
 					}
+					uint32_t triangle_count = instance.indices_count / 3;
+					for (uint32_t first = 0; first < triangle_count; first += EMITTER_CHUNK_SIZE)
+					{
+						candidate_chunks.emplace_back(instance_id, first, std::min(triangle_count - first, static_cast<uint32_t>(EMITTER_CHUNK_SIZE)));
+					}
+					instance.emitter = static_cast<int32_t>(candidate_count);        // Candidate offset until compaction
+					candidate_count += triangle_count;
 				}
-			}
 
-			// Build emitter buffer
-			{
-				buffer.emitter = m_context->create_buffer("Emitter Buffer", std::max(emitters.size(), 1ull) * sizeof(Emitter), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
-				if (!emitters.empty())
+				std::vector<float> candidate_luminance(candidate_count);
+				std::for_each(std::execution::par, candidate_chunks.begin(), candidate_chunks.end(), [&](const glm::uvec3 &chunk) {
+					const auto      &instance  = instances[chunk.x];
+					const glm::vec3 &factor    = materials[instance.material].emissive_factor;
+					const int32_t    emission  = material_emission[instance.material];
+					const Vertex    *vertex    = vertices.data() + instance.vertices_offset;
+					const uint32_t  *index     = indices.data() + instance.indices_offset;
+					for (uint32_t tri_idx = chunk.y; tri_idx < chunk.y + chunk.z; tri_idx++)
+					{
+						glm::vec3 radiance = factor;
+						if (emission >= 0)
+						{
+							const Vertex &v0 = vertex[index[tri_idx * 3 + 0]];
+							const Vertex &v1 = vertex[index[tri_idx * 3 + 1]];
+							const Vertex &v2 = vertex[index[tri_idx * 3 + 2]];
+							radiance *= integrate_emission(emissive_textures[emission], glm::vec2(v0.position.w, v0.normal.w), glm::vec2(v1.position.w, v1.normal.w), glm::vec2(v2.position.w, v2.normal.w));
+						}
+						candidate_luminance[instance.emitter + tri_idx] = glm::dot(radiance, glm::vec3(0.212671f, 0.715160f, 0.072169f));
+					}
+				});
+
+				// Emitters of an instance stay contiguous, offsets are a prefix sum over the triangles that emit
+				m_light_triangles.clear();
+				for (uint32_t instance_id = 0; instance_id < instances.size(); instance_id++)
 				{
-					m_context->buffer_copy_to_device(buffer.emitter, emitters.data(), emitters.size() * sizeof(Emitter), true);
+					auto &instance = instances[instance_id];
+					if (instance.emitter < 0)
+					{
+						continue;
+					}
+					const float   *luminance = candidate_luminance.data() + instance.emitter;
+					const uint32_t packed    = glm::packF3x9_E1x5(materials[instance.material].emissive_factor);
+					const size_t   first     = emitters.size();
+					for (uint32_t tri_idx = 0; tri_idx < instance.indices_count / 3; tri_idx++)
+					{
+						if (luminance[tri_idx] > 0.f)
+						{
+							emitters.push_back(Emitter{
+							    .instance = instance_id,
+							    .triangle = tri_idx,
+							    .radiance = packed,
+							});
+							m_light_triangles.push_back(LightTriangle{.luminance = luminance[tri_idx]});
+						}
+					}
+					instance.emitter = emitters.size() > first ? static_cast<int32_t>(first) : -1;
 				}
-				scene_info.emitter_count       = static_cast<uint32_t>(emitters.size());
-				scene_info.emitter_buffer_addr = buffer.emitter.device_address;
+
+				m_emitter_weights.resize(emitters.size());
+				std::vector<uint32_t> emitter_chunks((emitters.size() + EMITTER_CHUNK_SIZE - 1) / EMITTER_CHUNK_SIZE);
+				std::iota(emitter_chunks.begin(), emitter_chunks.end(), 0);
+				std::for_each(std::execution::par, emitter_chunks.begin(), emitter_chunks.end(), [&](uint32_t chunk) {
+					size_t offset = static_cast<size_t>(chunk) * EMITTER_CHUNK_SIZE;
+					transform_emitters(emitters.data() + offset, m_light_triangles.data() + offset, m_emitter_weights.data() + offset, static_cast<uint32_t>(std::min<size_t>(EMITTER_CHUNK_SIZE, emitters.size() - offset)), instances, vertices, indices);
+				});
 			}
 
-			// Build light buffer
+			// Compute scene extent
 			{
-				buffer.light = m_context->create_buffer("Light Buffer", std::max(lights.size(), 1ull) * sizeof(Light), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
-				if (!lights.empty())
+				std::vector<std::array<glm::vec3, 2>> mesh_bounds(meshes.size(), {glm::vec3(std::numeric_limits<float>::max()), -glm::vec3(std::numeric_limits<float>::max())});
+				for (uint32_t mesh_id = 0; mesh_id < meshes.size(); mesh_id++)
 				{
-					m_context->buffer_copy_to_device(buffer.light, lights.data(), lights.size() * sizeof(Light), true);
+					const auto &mesh = meshes[mesh_id];
+					for (uint32_t vertex_id = 0; vertex_id < mesh.vertices_count; vertex_id++)
+					{
+						glm::vec3 v             = vertices[vertex_id + mesh.vertices_offset].position;
+						mesh_bounds[mesh_id][0] = glm::min(mesh_bounds[mesh_id][0], v);
+						mesh_bounds[mesh_id][1] = glm::max(mesh_bounds[mesh_id][1], v);
+					}
+				}
+
+				m_instance_bounds.resize(instances.size());
+				for (uint32_t instance_id = 0; instance_id < instances.size(); instance_id++)
+				{
+					m_instance_bounds[instance_id] = mesh_bounds[instances[instance_id].mesh];
+				}
+				for (auto &skinned : m_skinned_instances)
+				{
+					auto &bounds = m_instance_bounds[skinned.instance];
+					bounds       = {glm::vec3(std::numeric_limits<float>::max()), -glm::vec3(std::numeric_limits<float>::max())};
+					for (uint32_t vertex_id = 0; vertex_id < meshes[skinned.mesh].vertices_count; vertex_id++)
+					{
+						bounds[0] = glm::min(bounds[0], glm::vec3(vertices[vertex_id + skinned.vertices_offset].position));
+						bounds[1] = glm::max(bounds[1], glm::vec3(vertices[vertex_id + skinned.vertices_offset].position));
+					}
+				}
+
+				for (auto &instance : instances)
+				{
+					const auto &mesh = meshes[instance.mesh];
+					for (uint32_t vertex_id = 0; vertex_id < mesh.vertices_count; vertex_id++)
+					{
+						glm::vec3 v           = vertices[vertex_id + instance.vertices_offset].position;
+						v                     = instance.transform * glm::vec4(v, 1.f);
+						scene_info.max_extent = glm::max(scene_info.max_extent, v);
+						scene_info.min_extent = glm::min(scene_info.min_extent, v);
+					}
 				}
-				// scene_info.light_count = static_cast<uint32_t>(lights.size());
 			}
 
-			// Build emitter alias table buffer
+			// Build emitter buffer
 			{
-				float              total_weight = 0.f;
-				std::vector<float> emitter_probs(emitters.size());
-				for (uint32_t i = 0; i < emitters.size(); i++)
+				buffer.emitter = m_context->create_buffer("Emitter Buffer", std::max(emitters.size(), 1ull) * sizeof(Emitter), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY, true);
+				if (!emitters.empty())
 				{
-					const auto &emitter = emitters[i];
-
-					float area = glm::length(glm::cross(glm::vec3(emitter.p1 - emitter.p0), glm::vec3(emitter.p2 - emitter.p1))) * 0.5f;
+					m_context->buffer_copy_to_device(buffer.emitter, emitters.data(), emitters.size() * sizeof(Emitter), true);
+				}
+				scene_info.emitter_count       = static_cast<uint32_t>(emitters.size());
+				scene_info.emitter_buffer_addr = buffer.emitter.device_address;
+			}
 
-					emitter_probs[i] = glm::dot(glm::vec3(emitter.intensity), glm::vec3(0.212671f, 0.715160f, 0.072169f)) * area;
-					total_weight += emitter_probs[i];
+			// Build light buffer
+			{
+				buffer.light = m_context->create_buffer("Light Buffer", std::max(lights.size(), 1ull) * sizeof(Light), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY, true);
+				if (!lights.empty())
+				{
+					m_context->buffer_copy_to_device(buffer.light, lights.data(), lights.size() * sizeof(Light), true);
 				}
+				// scene_info.light_count = static_cast<uint32_t>(lights.size());
+			}
 
-				std::vector<AliasTable> alias_table = build_alias_table(emitter_probs, total_weight);
-				buffer.emitter_alias_table          = m_context->create_buffer("Emitter Alias Table", std::max(alias_table.size(), 1ull) * sizeof(AliasTable), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
-				if (!alias_table.empty())
+			// Build emitter alias table buffer
+			{
+				m_emitter_alias_table      = build_alias_table(m_emitter_weights);
+				buffer.emitter_alias_table = m_context->create_buffer("Emitter Alias Table", std::max(m_emitter_alias_table.size(), 1ull) * sizeof(AliasTable), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY, true);
+				if (!m_emitter_alias_table.empty())
 				{
-					m_context->buffer_copy_to_device(buffer.emitter_alias_table, alias_table.data(), alias_table.size() * sizeof(AliasTable), true);
+					m_context->buffer_copy_to_device(buffer.emitter_alias_table, m_emitter_alias_table.data(), m_emitter_alias_table.size() * sizeof(AliasTable), true);
 				}
 				scene_info.emitter_alias_table_buffer_addr = buffer.emitter_alias_table.device_address;
 			}
 
+			// Build light tree buffer
+			{
+				m_light_tree      = build_light_tree(m_light_triangles);
+				link_light_tree(m_light_tree, m_light_tree_parents, m_light_tree_leaves);
+				buffer.light_tree = m_context->create_buffer("Light Tree", std::max(m_light_tree.size(), 1ull) * sizeof(LightTreeNode), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY, true);
+				if (!m_light_tree.empty())
+				{
+					m_context->buffer_copy_to_device(buffer.light_tree, m_light_tree.data(), m_light_tree.size() * sizeof(LightTreeNode), true);
+				}
+			}
+
 			// Build draw indirect command buffer
 			{
 				std::vector<VkDrawIndexedIndirectCommand> indirect_commands;
@@ -695,7 +1796,7 @@ void Scene::load_scene(const std::string &filename)
 					    .indexCount    = mesh.indices_count,
 					    .instanceCount = 1,
 					    .firstIndex    = mesh.indices_offset,
-					    .vertexOffset  = static_cast<int32_t>(mesh.vertices_offset),
+					    .vertexOffset  = static_cast<int32_t>(instances[instance_id].vertices_offset),
 					    .firstInstance = instance_id,
 					};
 				}
@@ -704,22 +1805,22 @@ void Scene::load_scene(const std::string &filename)
 			}
 
 			// Create instance buffer
-			buffer.instance = m_context->create_buffer("Instance Buffer", instances.size() * sizeof(Instance), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			buffer.instance = m_context->create_buffer("Instance Buffer", instances.size() * sizeof(Instance), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY, true);
 			m_context->buffer_copy_to_device(buffer.instance, instances.data(), instances.size() * sizeof(Instance), true);
 			scene_info.instance_buffer_addr = buffer.instance.device_address;
 		}
 
 		// Build acceleration structure
 		{
-			std::vector<Buffer> scratch_buffers;
 			// Build bottom level acceleration structure
 			{
-				blas.reserve(meshes.size());
-				for (uint32_t mesh_id = 0; mesh_id < meshes.size(); mesh_id++)
+				std::vector<VkAccelerationStructureGeometryKHR>       geometries(geometry_owner.size());
+				std::vector<VkAccelerationStructureBuildRangeInfoKHR> ranges(geometry_owner.size());
+				for (uint32_t geometry_id = 0; geometry_id < geometry_owner.size(); geometry_id++)
 				{
-					const auto &mesh = meshes[mesh_id];
+					const auto &mesh = meshes[geometry_owner[geometry_id]];
 
-					VkAccelerationStructureGeometryKHR as_geometry = {
+					geometries[geometry_id] = {
 					    .sType        = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
 					    .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
 					    .geometry     = {
@@ -743,45 +1844,62 @@ void Scene::load_scene(const std::string &filename)
 					    .flags = VK_GEOMETRY_NO_DUPLICATE_ANY_HIT_INVOCATION_BIT_KHR,
 					};
 
-					VkAccelerationStructureBuildRangeInfoKHR range_info = {
+					ranges[geometry_id] = {
 					    .primitiveCount  = mesh.indices_count / 3,
 					    .primitiveOffset = mesh.indices_offset * sizeof(uint32_t),
 					    .firstVertex     = mesh.vertices_offset,
 					    .transformOffset = 0,
 					};
+				}
 
-					VkAccelerationStructureBuildGeometryInfoKHR build_geometry_info = {
-					    .sType                    = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
-					    .type                     = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
-					    .flags                    = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
-					    .mode                     = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
-					    .srcAccelerationStructure = VK_NULL_HANDLE,
-					    .geometryCount            = 1,
-					    .pGeometries              = &as_geometry,
-					    .ppGeometries             = nullptr,
-					    .scratchData              = {
-					                     .deviceAddress = 0,
-                        },
-					};
+				// Skinned instances trace their own refittable BLAS, geometry only they reference needs no compacted one
+				std::vector<bool> skinned_instance(instances.size(), false);
+				for (auto &skinned : m_skinned_instances)
+				{
+					skinned_instance[skinned.instance] = true;
+				}
 
-					VkAccelerationStructureBuildSizesInfoKHR build_sizes_info = {
-					    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
-					};
+				std::vector<uint32_t> static_geometries;
+				std::vector<bool>     geometry_used(geometry_owner.size(), false);
+				for (uint32_t instance_id = 0; instance_id < instances.size(); instance_id++)
+				{
+					uint32_t geometry_id = mesh_geometry[instances[instance_id].mesh];
+					if (!skinned_instance[instance_id] && !geometry_used[geometry_id])
+					{
+						geometry_used[geometry_id] = true;
+						static_geometries.push_back(geometry_id);
+					}
+				}
+
+				std::vector<VkAccelerationStructureGeometryKHR>       static_geometry_infos(static_geometries.size());
+				std::vector<VkAccelerationStructureBuildRangeInfoKHR> static_ranges(static_geometries.size());
+				for (size_t i = 0; i < static_geometries.size(); i++)
+				{
+					static_geometry_infos[i] = geometries[static_geometries[i]];
+					static_ranges[i]         = ranges[static_geometries[i]];
+				}
 
-					vkGetAccelerationStructureBuildSizesKHR(
-					    m_context->vk_device,
-					    VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
-					    &build_geometry_info,
-					    &range_info.primitiveCount,
-					    &build_sizes_info);
+				std::vector<AccelerationStructure> static_blas = m_context->create_bottom_level_acceleration_structures("BLAS", static_geometry_infos, static_ranges);
 
-					auto [as, scratch_buffer] = m_context->create_acceleration_structure(fmt::format("BLAS #{}", mesh_id), VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, as_geometry, range_info);
+				blas.assign(geometry_owner.size(), AccelerationStructure{});
+				for (size_t i = 0; i < static_geometries.size(); i++)
+				{
+					blas[static_geometries[i]] = static_blas[i];
+				}
+
+				// Skinned BLASes are not compacted, they are refit every frame by update_animation()
+				for (auto &skinned : m_skinned_instances)
+				{
+					skinned.geometry          = geometries[mesh_geometry[skinned.mesh]];
+					skinned.range             = ranges[mesh_geometry[skinned.mesh]];
+					skinned.range.firstVertex = skinned.vertices_offset;
 
-					blas.push_back(as);
-					scratch_buffers.push_back(scratch_buffer);
+					std::tie(skinned.blas, skinned.scratch_buffer) = m_context->create_acceleration_structure("Skinned BLAS", VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, skinned.geometry, skinned.range, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR);
 				}
 			}
 
+			m_progress = 0.9f;
+
 			// Build top level acceleration structure
 			{
 				std::vector<VkAccelerationStructureInstanceKHR> vk_instances;
@@ -800,7 +1918,7 @@ void Scene::load_scene(const std::string &filename)
 					    .mask                                   = 0xFF,
 					    .instanceShaderBindingTableRecordOffset = 0,
 					    .flags                                  = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR,
-					    .accelerationStructureReference         = blas.at(instance.mesh).device_address,
+					    .accelerationStructureReference         = blas.at(mesh_geometry[instance.mesh]).device_address,
 					};
 
 					const Material &material = materials[instance.material];
@@ -820,8 +1938,15 @@ void Scene::load_scene(const std::string &filename)
 					vk_instances.emplace_back(vk_instance);
 				}
 
-				Buffer instance_buffer = m_context->create_buffer("Instance Stratch Buffer", vk_instances.size() * sizeof(VkAccelerationStructureInstanceKHR) + 16, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
-				m_context->buffer_copy_to_device(instance_buffer, vk_instances.data(), vk_instances.size() * sizeof(VkAccelerationStructureInstanceKHR), true, 16 - instance_buffer.device_address % 16);
+				for (auto &skinned : m_skinned_instances)
+				{
+					vk_instances[skinned.instance].accelerationStructureReference = skinned.blas.device_address;
+				}
+
+				// Kept alive with the scratch buffer so moved instances can be refit in place
+				buffer.tlas_instance   = m_context->create_buffer("TLAS Instance Buffer", vk_instances.size() * sizeof(VkAccelerationStructureInstanceKHR) + 16, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY, true);
+				m_tlas_instance_offset = 16 - buffer.tlas_instance.device_address % 16;
+				m_context->buffer_copy_to_device(buffer.tlas_instance, vk_instances.data(), vk_instances.size() * sizeof(VkAccelerationStructureInstanceKHR), true, m_tlas_instance_offset);
 
 				VkAccelerationStructureGeometryKHR as_geometry = {
 				    .sType        = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
@@ -830,7 +1955,7 @@ void Scene::load_scene(const std::string &filename)
 				            .instances = {
 				                .sType           = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
 				                .arrayOfPointers = VK_FALSE,
-				                .data            = instance_buffer.device_address + (16 - instance_buffer.device_address % 16),
+				                .data            = buffer.tlas_instance.device_address + m_tlas_instance_offset,
                         },
                     },
 				    .flags = 0,
@@ -840,84 +1965,163 @@ void Scene::load_scene(const std::string &filename)
 				    .primitiveCount = static_cast<uint32_t>(vk_instances.size()),
 				};
 
-				Buffer scratch_buffer;
-				std::tie(tlas, scratch_buffer) = m_context->create_acceleration_structure("TLAS", VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR, as_geometry, range_info);
-				scratch_buffers.push_back(instance_buffer);
-				scratch_buffers.push_back(scratch_buffer);
+				std::tie(tlas, buffer.tlas_scratch) = m_context->create_acceleration_structure("TLAS", VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR, as_geometry, range_info, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR);
+
+				m_tlas_instances = std::move(vk_instances);
 			}
+		}
 
-			m_context->destroy(scratch_buffers);
+		m_vertices  = std::move(vertices);
+		m_indices   = std::move(indices);
+		m_meshes    = std::move(meshes);
+		m_instances = std::move(instances);
+		m_materials = std::move(materials);
+		m_emitters  = std::move(emitters);
+
+		m_skin_joints  = std::move(skin_joints);
+		m_skin_weights = std::move(skin_weights);
+		if (!m_skinned_instances.empty())
+		{
+			for (auto &staging_buffer : m_skinning_staging)
+			{
+				staging_buffer = m_context->create_buffer("Skinning Staging Buffer", (m_vertices.size() - m_dynamic_vertices_offset) * sizeof(Vertex), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+			}
 		}
 
-		buffer.scene = m_context->create_buffer("Scene Buffer", sizeof(scene_info), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		m_build_area = 0.f;
+		m_build_bounds.resize(m_instances.size());
+		m_refit_areas.resize(m_instances.size());
+		for (uint32_t instance_id = 0; instance_id < m_instances.size(); instance_id++)
+		{
+			m_build_bounds[instance_id] = transform_bounds(m_instance_bounds[instance_id], m_instances[instance_id].transform);
+			m_refit_areas[instance_id]  = surface_area(m_build_bounds[instance_id]);
+			m_build_area += m_refit_areas[instance_id];
+		}
+		m_refit_area = m_build_area;
+
+		// The CPU BVHs are built once a CPU query needs them
+		m_bvh8_materials      = std::move(alpha_materials);
+		m_bvh8_alpha_textures = std::move(alpha_textures);
+		m_bvh8_alpha_caches   = std::move(alpha_caches);
+		m_cpu_bvh_built       = false;
+#ifdef BVH_BENCHMARK
+		benchmark_cpu_bvh(m_vertices, m_indices, m_instances);
+		update_cpu_bvh();
+		benchmark_cpu_bvh8(m_cpu_bvh8, m_light_triangles);
+#endif        // BVH_BENCHMARK
+
+		buffer.scene = m_context->create_buffer("Scene Buffer", sizeof(scene_info), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY, true);
 		m_context->buffer_copy_to_device(buffer.scene, &scene_info, sizeof(scene_info), true);
 	}
+
+	cgltf_free(raw_data);
+
+	m_progress = 1.f;
+
+	return true;
+}
+
+void Scene::load_scene_async(const std::string &filename)
+{
+	if (is_loading())
+	{
+		spdlog::warn("Another scene is still loading, ignore {}", filename);
+		return;
+	}
+
+	if (!m_loader)
+	{
+		m_loader = std::unique_ptr<Scene>(new Scene(m_context));
+	}
+
+	m_loader->m_progress = 0.f;
+	m_loading            = std::async(std::launch::async, [this, filename]() { return m_loader->load_scene(filename); });
+}
+
+bool Scene::poll_load()
+{
+	// The reference worker reads the live scene
+	if (!m_loading.valid() ||
+	    m_loading.wait_for(std::chrono::seconds(0)) != std::future_status::ready ||
+	    is_rendering_reference())
+	{
+		return false;
+	}
+
+	if (!m_loading.get())
+	{
+		m_loader->destroy_scene();
+		return false;
+	}
+
+	// The loader thread stays with this scene, mips requested for the previous one are dropped
+	cancel_texture_requests();
+	swap_scene(*m_loader);
+
+	// The previous scene may still be in flight, retire it through the deferred deletion queue
+	m_loader->destroy_scene();
+
+	return true;
+}
+
+bool Scene::is_loading() const
+{
+	return m_loading.valid();
+}
+
+float Scene::load_progress() const
+{
+	return m_loader ? m_loader->m_progress.load() : 1.f;
 }
 
 void Scene::load_envmap(const std::string &filename)
 {
-	m_context->wait();
-	destroy_envmap();
+	if (is_rendering_reference())
+	{
+		spdlog::warn("A reference is still rendering, ignore {}", filename);
+		return;
+	}
 
-	int32_t width = 0, height = 0, channel = 0, req_channel = 4;
+	destroy_envmap();
 
-	float *raw_data = stbi_loadf(filename.c_str(), &width, &height, &channel, req_channel);
-	size_t raw_size = static_cast<size_t>(width) * static_cast<size_t>(height) * static_cast<size_t>(req_channel) * sizeof(float);
+	std::ifstream file(filename, std::ios::binary);
+	std::string   content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
 
-	Texture hdr_texture = m_context->create_texture_2d(
-	    "HDRTexture",
-	    (uint32_t) width, (uint32_t) height,
-	    VK_FORMAT_R32G32B32A32_SFLOAT,
-	    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+	// Baked lighting is cached next to the HDR, keyed by its content
+	uint64_t    hash       = hash_cache_key(content.data(), content.size());
+	std::string cache_path = (std::filesystem::path(filename).parent_path() / "cache" / fmt::format("{:016x}.envmap", hash)).string();
 
-	VkImageView hdr_texture_view = m_context->create_texture_view(
-	    "HDRTexture View",
-	    hdr_texture.vk_image,
-	    VK_FORMAT_R32G32B32A32_SFLOAT);
+	create_envmap();
 
-	Buffer staging_buffer = m_context->create_buffer(
-	    "Staging Buffer",
-	    raw_size,
-	    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-	    VMA_MEMORY_USAGE_CPU_TO_GPU);
+	if (load_envmap_cache(cache_path, hash))
+	{
+		return;
+	}
 
-	m_context->buffer_copy_to_device(staging_buffer, raw_data, raw_size);
+	spdlog::info("Baking envmap {}", filename);
+	bake_envmap(content);
+	store_envmap_cache(cache_path, hash);
+}
 
+void Scene::create_envmap()
+{
+	// Baked results are read back into the envmap cache, cached loads upload into the same images
 	envmap.texture = m_context->create_texture_cube(
 	    "Envmap Texture",
 	    CUBEMAP_SIZE, CUBEMAP_SIZE,
-	    VK_FORMAT_R32G32B32A32_SFLOAT,
+	    VK_FORMAT_R16G16B16A16_SFLOAT,
 	    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-	    5);
+	    CUBEMAP_MIP_LEVELS);
 
 	envmap.texture_view = m_context->create_texture_view(
 	    "Envmap Texture View",
 	    envmap.texture.vk_image,
-	    VK_FORMAT_R32G32B32A32_SFLOAT,
+	    VK_FORMAT_R16G16B16A16_SFLOAT,
 	    VK_IMAGE_VIEW_TYPE_CUBE,
 	    {
 	        .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
 	        .baseMipLevel   = 0,
-	        .levelCount     = 5,
-	        .baseArrayLayer = 0,
-	        .layerCount     = 6,
-	    });
-
-	Texture sh_intermediate = m_context->create_texture_2d_array(
-	    "SH Intermediate",
-	    SH_INTERMEDIATE_SIZE * 9, SH_INTERMEDIATE_SIZE, 6,
-	    VK_FORMAT_R32G32B32A32_SFLOAT,
-	    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT);
-
-	VkImageView sh_intermediate_view = m_context->create_texture_view(
-	    "Envmap Texture View",
-	    sh_intermediate.vk_image,
-	    VK_FORMAT_R32G32B32A32_SFLOAT,
-	    VK_IMAGE_VIEW_TYPE_2D_ARRAY,
-	    {
-	        .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
-	        .baseMipLevel   = 0,
-	        .levelCount     = 1,
+	        .levelCount     = CUBEMAP_MIP_LEVELS,
 	        .baseArrayLayer = 0,
 	        .layerCount     = 6,
 	    });
@@ -926,7 +2130,7 @@ void Scene::load_envmap(const std::string &filename)
 	    "Irradiance SH",
 	    9, 1,
 	    VK_FORMAT_R32G32B32A32_SFLOAT,
-	    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT);
+	    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
 
 	envmap.irradiance_sh_view = m_context->create_texture_view(
 	    "Irradiance SH View",
@@ -936,14 +2140,14 @@ void Scene::load_envmap(const std::string &filename)
 	envmap.prefilter_map = m_context->create_texture_cube(
 	    "Envmap Prefilter Map",
 	    PREFILTER_MAP_SIZE, PREFILTER_MAP_SIZE,
-	    VK_FORMAT_R32G32B32A32_SFLOAT,
-	    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+	    VK_FORMAT_R16G16B16A16_SFLOAT,
+	    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
 	    PREFILTER_MIP_LEVELS);
 
 	envmap.prefilter_map_view = m_context->create_texture_view(
 	    "Prefilter Map View",
 	    envmap.prefilter_map.vk_image,
-	    VK_FORMAT_R32G32B32A32_SFLOAT,
+	    VK_FORMAT_R16G16B16A16_SFLOAT,
 	    VK_IMAGE_VIEW_TYPE_CUBE,
 	    {
 	        .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
@@ -952,6 +2156,67 @@ void Scene::load_envmap(const std::string &filename)
 	        .baseArrayLayer = 0,
 	        .layerCount     = CUBEMAP_FACE_NUM,
 	    });
+}
+
+void Scene::bake_envmap(const std::string &content)
+{
+	// Radiance files are uploaded as shared exponent texels at the size of the file, anything else is decoded to RGBA32F by stb
+	uint32_t              width  = 0;
+	uint32_t              height = 0;
+	VkFormat              format = VK_FORMAT_E5B9G9R9_UFLOAT_PACK32;
+	std::vector<uint32_t> texels;
+	if (!decode_rgbe(reinterpret_cast<const uint8_t *>(content.data()), content.size(), width, height, texels))
+	{
+		int32_t float_width = 0, float_height = 0, channel = 0, req_channel = 4;
+
+		float *float_data = stbi_loadf_from_memory(reinterpret_cast<const stbi_uc *>(content.data()), static_cast<int32_t>(content.size()), &float_width, &float_height, &channel, req_channel);
+
+		width  = static_cast<uint32_t>(float_width);
+		height = static_cast<uint32_t>(float_height);
+		format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		texels.resize(static_cast<size_t>(width) * height * req_channel);
+		std::memcpy(texels.data(), float_data, texels.size() * sizeof(float));
+		stbi_image_free(float_data);
+	}
+	size_t raw_size = texels.size() * sizeof(uint32_t);
+
+	Texture hdr_texture = m_context->create_texture_2d(
+	    "HDRTexture",
+	    width, height,
+	    format,
+	    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+
+	VkImageView hdr_texture_view = m_context->create_texture_view(
+	    "HDRTexture View",
+	    hdr_texture.vk_image,
+	    format);
+
+	Buffer staging_buffer = m_context->create_buffer(
+	    "Staging Buffer",
+	    raw_size,
+	    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+	    VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+	m_context->buffer_copy_to_device(staging_buffer, texels.data(), raw_size);
+
+	Texture sh_intermediate = m_context->create_texture_2d_array(
+	    "SH Intermediate",
+	    SH_INTERMEDIATE_SIZE * 9, SH_INTERMEDIATE_SIZE, 6,
+	    VK_FORMAT_R32G32B32A32_SFLOAT,
+	    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT);
+
+	VkImageView sh_intermediate_view = m_context->create_texture_view(
+	    "Envmap Texture View",
+	    sh_intermediate.vk_image,
+	    VK_FORMAT_R32G32B32A32_SFLOAT,
+	    VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+	    {
+	        .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	        .baseMipLevel   = 0,
+	        .levelCount     = 1,
+	        .baseArrayLayer = 0,
+	        .layerCount     = 6,
+	    });
 
 	std::array<VkImageView, PREFILTER_MIP_LEVELS> prefilter_map_views;
 	for (uint32_t i = 0; i < PREFILTER_MIP_LEVELS; i++)
@@ -959,7 +2224,7 @@ void Scene::load_envmap(const std::string &filename)
 		prefilter_map_views[i] = m_context->create_texture_view(
 		    fmt::format("Prefilter Map View Array 2D - {}", i),
 		    envmap.prefilter_map.vk_image,
-		    VK_FORMAT_R32G32B32A32_SFLOAT,
+		    VK_FORMAT_R16G16B16A16_SFLOAT,
 		    VK_IMAGE_VIEW_TYPE_2D_ARRAY,
 		    {
 		        .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
@@ -987,7 +2252,7 @@ void Scene::load_envmap(const std::string &filename)
 	equirectangular_to_cubemap.pipeline        = m_context->create_graphics_pipeline(equirectangular_to_cubemap.pipeline_layout)
 	                                          .add_shader(VK_SHADER_STAGE_VERTEX_BIT, "equirectangular_to_cubemap.slang", "vs_main")
 	                                          .add_shader(VK_SHADER_STAGE_FRAGMENT_BIT, "equirectangular_to_cubemap.slang", "fs_main")
-	                                          .add_color_attachment(VK_FORMAT_R32G32B32A32_SFLOAT)
+	                                          .add_color_attachment(VK_FORMAT_R16G16B16A16_SFLOAT)
 	                                          .add_viewport({
 	                                              .x        = 0,
 	                                              .y        = 0,
@@ -1082,7 +2347,7 @@ void Scene::load_envmap(const std::string &filename)
 	        0, VK_ACCESS_TRANSFER_WRITE_BIT,
 	        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
 	    .insert()
-	    .copy_buffer_to_image(staging_buffer.vk_buffer, hdr_texture.vk_image, {(uint32_t) width, (uint32_t) height, 1})
+	    .copy_buffer_to_image(staging_buffer.vk_buffer, hdr_texture.vk_image, {width, height, 1})
 	    .end_marker()
 	    // Equirectangular to cubemap
 	    .begin_marker("Equirectangular to Cubemap")
@@ -1098,7 +2363,7 @@ void Scene::load_envmap(const std::string &filename)
 	        {
 	            .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
 	            .baseMipLevel   = 0,
-	            .levelCount     = 5,
+	            .levelCount     = CUBEMAP_MIP_LEVELS,
 	            .baseArrayLayer = 0,
 	            .layerCount     = 6,
 	        })
@@ -1117,7 +2382,7 @@ void Scene::load_envmap(const std::string &filename)
 	        {
 	            .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
 	            .baseMipLevel   = 0,
-	            .levelCount     = 5,
+	            .levelCount     = CUBEMAP_MIP_LEVELS,
 	            .baseArrayLayer = 0,
 	            .layerCount     = 6,
 	        })
@@ -1133,7 +2398,7 @@ void Scene::load_envmap(const std::string &filename)
 	            .layerCount     = 6,
 	        })
 	    .insert()
-	    .generate_mipmap(envmap.texture.vk_image, CUBEMAP_SIZE, CUBEMAP_SIZE, 5, 6)
+	    .generate_mipmap(envmap.texture.vk_image, CUBEMAP_SIZE, CUBEMAP_SIZE, CUBEMAP_MIP_LEVELS, 6)
 	    .insert_barrier()
 	    .add_image_barrier(
 	        envmap.texture.vk_image,
@@ -1142,7 +2407,7 @@ void Scene::load_envmap(const std::string &filename)
 	        {
 	            .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
 	            .baseMipLevel   = 0,
-	            .levelCount     = 5,
+	            .levelCount     = CUBEMAP_MIP_LEVELS,
 	            .baseArrayLayer = 0,
 	            .layerCount     = 6,
 	        })
@@ -1247,72 +2512,1247 @@ void Scene::load_envmap(const std::string &filename)
 	    .destroy(cubemap_prefilter.pipeline);
 }
 
-void Scene::update_view(CommandBufferRecorder &recorder)
+bool Scene::load_envmap_cache(const std::string &cache_path, uint64_t hash)
 {
-	recorder.begin_marker("Update View Buffer")
-	    .insert_barrier()
-	    .add_buffer_barrier(
-	        buffer.view.vk_buffer,
-	        VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT)
-	    .insert()
-	    .update_buffer(buffer.view.vk_buffer, &view_info, sizeof(view_info))
-	    .insert_barrier()
-	    .add_buffer_barrier(
-	        buffer.view.vk_buffer,
-	        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT)
-	    .insert()
-	    .end_marker();
-}
+	std::error_code error;
+	if (!std::filesystem::exists(cache_path, error))
+	{
+		return false;
+	}
 
-void Scene::update()
-{
-	m_context->update_descriptor()
-	    .write_acceleration_structures(0, {tlas})
-	    .write_storage_buffers(1, {buffer.instance.vk_buffer})
-	    .write_storage_buffers(2, {buffer.emitter.vk_buffer})
-	    .write_storage_buffers(3, {buffer.light.vk_buffer})
-	    .write_storage_buffers(4, {buffer.material.vk_buffer})
-	    .write_storage_buffers(5, {buffer.vertex.vk_buffer})
-	    .write_storage_buffers(6, {buffer.index.vk_buffer})
-	    .write_uniform_buffers(7, {buffer.view.vk_buffer})
-	    .write_storage_buffers(8, {buffer.emitter_alias_table.vk_buffer})
-	    .write_storage_buffers(9, {buffer.mesh_alias_table.vk_buffer})
-	    .write_uniform_buffers(10, {buffer.scene.vk_buffer})
-	    .write_sampled_images(11, texture_views)
-	    .write_samplers(12, {linear_sampler, nearest_sampler})
-	    .write_sampled_images(13, {envmap.texture_view})
-	    .write_sampled_images(14, {envmap.irradiance_sh_view})
-	    .write_sampled_images(15, {envmap.prefilter_map_view})
-	    .write_sampled_images(16, {ggx_lut_view})
-	    .write_sampled_images(17, {sobol_image_view})
-	    .write_sampled_images(18, {scrambling_ranking_image_views})
-	    .update(descriptor.set);
-}
+	EnvmapCacheLayout layout = envmap_cache_layout(hash);
 
-void Scene::destroy_scene()
-{
-	m_context->destroy(blas)
-	    .destroy(tlas)
-	    .destroy(buffer.instance)
-	    .destroy(buffer.light)
-	    .destroy(buffer.emitter)
-	    .destroy(buffer.material)
-	    .destroy(buffer.vertex)
-	    .destroy(buffer.index)
-	    .destroy(buffer.indirect_draw)
-	    .destroy(buffer.emitter_alias_table)
-	    .destroy(buffer.mesh_alias_table)
-	    .destroy(buffer.scene)
-	    .destroy(textures)
-	    .destroy(texture_views);
+	// The payload is read straight into the staging buffer
+	Buffer staging_buffer = m_context->create_buffer(
+	    "Envmap Cache Staging Buffer",
+	    layout.header.data_size,
+	    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+	    VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+	void *mapped_data = nullptr;
+	vmaMapMemory(m_context->vma_allocator, staging_buffer.vma_allocation, &mapped_data);
+	bool cached = read_envmap_cache(cache_path, layout.header, mapped_data);
+	if (cached)
+	{
+		create_envmap_alias_table(static_cast<const uint8_t *>(mapped_data) + layout.cubemap[0].bufferOffset, static_cast<const uint8_t *>(mapped_data) + layout.cubemap[ENVMAP_ALIAS_TABLE_MIP].bufferOffset);
+	}
+	vmaUnmapMemory(m_context->vma_allocator, staging_buffer.vma_allocation);
+	vmaFlushAllocation(m_context->vma_allocator, staging_buffer.vma_allocation, 0, layout.header.data_size);
+
+	if (cached)
+	{
+		m_context->record_command()
+		    .begin()
+		    .begin_marker("Upload Envmap Cache")
+		    .insert_barrier()
+		    .add_image_barrier(
+		        envmap.texture.vk_image,
+		        0, VK_ACCESS_TRANSFER_WRITE_BIT,
+		        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		        {
+		            .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+		            .baseMipLevel   = 0,
+		            .levelCount     = CUBEMAP_MIP_LEVELS,
+		            .baseArrayLayer = 0,
+		            .layerCount     = CUBEMAP_FACE_NUM,
+		        })
+		    .add_image_barrier(
+		        envmap.irradiance_sh.vk_image,
+		        0, VK_ACCESS_TRANSFER_WRITE_BIT,
+		        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+		    .add_image_barrier(
+		        envmap.prefilter_map.vk_image,
+		        0, VK_ACCESS_TRANSFER_WRITE_BIT,
+		        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		        {
+		            .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+		            .baseMipLevel   = 0,
+		            .levelCount     = PREFILTER_MIP_LEVELS,
+		            .baseArrayLayer = 0,
+		            .layerCount     = CUBEMAP_FACE_NUM,
+		        })
+		    .insert()
+		    .execute([&](VkCommandBuffer cmd_buffer) {
+			    vkCmdCopyBufferToImage(cmd_buffer, staging_buffer.vk_buffer, envmap.irradiance_sh.vk_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &layout.irradiance_sh);
+			    vkCmdCopyBufferToImage(cmd_buffer, staging_buffer.vk_buffer, envmap.texture.vk_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(layout.cubemap.size()), layout.cubemap.data());
+			    vkCmdCopyBufferToImage(cmd_buffer, staging_buffer.vk_buffer, envmap.prefilter_map.vk_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(layout.prefilter_map.size()), layout.prefilter_map.data());
+		    })
+		    .insert_barrier()
+		    .add_image_barrier(
+		        envmap.texture.vk_image,
+		        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+		        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		        {
+		            .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+		            .baseMipLevel   = 0,
+		            .levelCount     = CUBEMAP_MIP_LEVELS,
+		            .baseArrayLayer = 0,
+		            .layerCount     = CUBEMAP_FACE_NUM,
+		        })
+		    .add_image_barrier(
+		        envmap.irradiance_sh.vk_image,
+		        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+		        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+		    .add_image_barrier(
+		        envmap.prefilter_map.vk_image,
+		        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+		        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		        {
+		            .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+		            .baseMipLevel   = 0,
+		            .levelCount     = PREFILTER_MIP_LEVELS,
+		            .baseArrayLayer = 0,
+		            .layerCount     = CUBEMAP_FACE_NUM,
+		        })
+		    .insert()
+		    .end_marker()
+		    .end()
+		    .flush();
+	}
+
+	m_context->destroy(staging_buffer);
+
+	return cached;
+}
+
+void Scene::store_envmap_cache(const std::string &cache_path, uint64_t hash)
+{
+	EnvmapCacheLayout layout = envmap_cache_layout(hash);
+
+	Buffer readback_buffer = m_context->create_buffer(
+	    "Envmap Cache Readback Buffer",
+	    layout.header.data_size,
+	    VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+	    VMA_MEMORY_USAGE_GPU_TO_CPU);
+
+	m_context->record_command()
+	    .begin()
+	    .begin_marker("Read Back Envmap")
+	    .insert_barrier()
+	    .add_image_barrier(
+	        envmap.texture.vk_image,
+	        VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+	        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	        {
+	            .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	            .baseMipLevel   = 0,
+	            .levelCount     = CUBEMAP_MIP_LEVELS,
+	            .baseArrayLayer = 0,
+	            .layerCount     = CUBEMAP_FACE_NUM,
+	        })
+	    .add_image_barrier(
+	        envmap.irradiance_sh.vk_image,
+	        VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+	        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL)
+	    .add_image_barrier(
+	        envmap.prefilter_map.vk_image,
+	        VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+	        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	        {
+	            .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	            .baseMipLevel   = 0,
+	            .levelCount     = PREFILTER_MIP_LEVELS,
+	            .baseArrayLayer = 0,
+	            .layerCount     = CUBEMAP_FACE_NUM,
+	        })
+	    .insert()
+	    .execute([&](VkCommandBuffer cmd_buffer) {
+		    vkCmdCopyImageToBuffer(cmd_buffer, envmap.irradiance_sh.vk_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback_buffer.vk_buffer, 1, &layout.irradiance_sh);
+		    vkCmdCopyImageToBuffer(cmd_buffer, envmap.texture.vk_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback_buffer.vk_buffer, static_cast<uint32_t>(layout.cubemap.size()), layout.cubemap.data());
+		    vkCmdCopyImageToBuffer(cmd_buffer, envmap.prefilter_map.vk_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback_buffer.vk_buffer, static_cast<uint32_t>(layout.prefilter_map.size()), layout.prefilter_map.data());
+	    })
+	    .insert_barrier()
+	    .add_image_barrier(
+	        envmap.texture.vk_image,
+	        VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+	        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	        {
+	            .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	            .baseMipLevel   = 0,
+	            .levelCount     = CUBEMAP_MIP_LEVELS,
+	            .baseArrayLayer = 0,
+	            .layerCount     = CUBEMAP_FACE_NUM,
+	        })
+	    .add_image_barrier(
+	        envmap.irradiance_sh.vk_image,
+	        VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+	        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+	    .add_image_barrier(
+	        envmap.prefilter_map.vk_image,
+	        VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+	        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	        {
+	            .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	            .baseMipLevel   = 0,
+	            .levelCount     = PREFILTER_MIP_LEVELS,
+	            .baseArrayLayer = 0,
+	            .layerCount     = CUBEMAP_FACE_NUM,
+	        })
+	    .insert()
+	    .insert_barrier()
+	    .add_buffer_barrier(
+	        readback_buffer.vk_buffer,
+	        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT)
+	    .insert(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT)
+	    .end_marker()
+	    .end()
+	    .flush();
+
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(cache_path).parent_path(), error);
+
+	void *mapped_data = nullptr;
+	vmaInvalidateAllocation(m_context->vma_allocator, readback_buffer.vma_allocation, 0, layout.header.data_size);
+	vmaMapMemory(m_context->vma_allocator, readback_buffer.vma_allocation, &mapped_data);
+	create_envmap_alias_table(static_cast<const uint8_t *>(mapped_data) + layout.cubemap[0].bufferOffset, static_cast<const uint8_t *>(mapped_data) + layout.cubemap[ENVMAP_ALIAS_TABLE_MIP].bufferOffset);
+	if (!write_envmap_cache(cache_path, layout.header, mapped_data))
+	{
+		spdlog::warn("Failed to write envmap cache {}", cache_path);
+	}
+	vmaUnmapMemory(m_context->vma_allocator, readback_buffer.vma_allocation);
+
+	m_context->destroy(readback_buffer);
+}
+
+void Scene::create_envmap_alias_table(const void *cubemap, const void *texels)
+{
+	m_envmap_alias_table = build_envmap_alias_table(static_cast<const glm::u16vec4 *>(texels), CUBEMAP_SIZE >> ENVMAP_ALIAS_TABLE_MIP);
+
+	envmap.alias_table = m_context->create_buffer("Envmap Alias Table", m_envmap_alias_table.size() * sizeof(AliasTable), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY, true);
+	m_context->buffer_copy_to_device(envmap.alias_table, m_envmap_alias_table.data(), m_envmap_alias_table.size() * sizeof(AliasTable), true);
+
+	m_envmap_texels.assign(static_cast<const glm::u16vec4 *>(cubemap), static_cast<const glm::u16vec4 *>(cubemap) + CUBEMAP_FACE_NUM * CUBEMAP_SIZE * CUBEMAP_SIZE);
+}
+
+void Scene::update_view(CommandBufferRecorder &recorder)
+{
+	recorder.begin_marker("Update View Buffer")
+	    .insert_barrier()
+	    .add_buffer_barrier(
+	        buffer.view.vk_buffer,
+	        VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT)
+	    .insert()
+	    .update_buffer(buffer.view.vk_buffer, &view_info, sizeof(view_info))
+	    .insert_barrier()
+	    .add_buffer_barrier(
+	        buffer.view.vk_buffer,
+	        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT)
+	    .insert()
+	    .end_marker();
+}
+
+void Scene::update_cpu_bvh()
+{
+	if (!m_cpu_bvh_built)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		m_cpu_bvh  = build_scene_bvh(m_vertices, m_indices, m_instances);
+		float time = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		size_t triangle_count = 0;
+		float  blas_cost      = 0.f;
+		for (uint32_t blas_id = 0; blas_id < m_cpu_bvh.blas.size(); blas_id++)
+		{
+			triangle_count += m_cpu_bvh.blas[blas_id].primitives.size();
+			blas_cost += sah_cost(m_cpu_bvh.blas[blas_id]) * static_cast<float>(m_cpu_bvh.blas[blas_id].primitives.size());
+		}
+		blas_cost /= static_cast<float>(std::max<size_t>(triangle_count, 1));
+
+		spdlog::info("Built CPU BVH over {} triangles in {:.2f} ms, SAH cost TLAS {:.2f} BLAS {:.2f}", triangle_count, time, sah_cost(m_cpu_bvh.tlas), blas_cost);
+
+		std::vector<uint32_t> texture_ids(m_bvh8_alpha_caches.size());
+		std::iota(texture_ids.begin(), texture_ids.end(), 0);
+		std::for_each(std::execution::par, texture_ids.begin(), texture_ids.end(), [&](uint32_t texture_id) {
+			const std::string &cache_path = m_bvh8_alpha_caches[texture_id];
+			if (cache_path.empty())
+			{
+				return;
+			}
+
+			BVH8AlphaTexture    &texture = m_bvh8_alpha_textures[texture_id];
+			CookedTexture        cooked;
+			std::vector<uint8_t> texels;
+			if (!read_ktx2(cache_path, cooked) || !decode_texture_level(cooked, 0, texels))
+			{
+				spdlog::warn("Failed to read texture cache {}, CPU rays treat it as opaque", cache_path);
+				texture.width  = 1;
+				texture.height = 1;
+				texture.alpha  = {255};
+				return;
+			}
+
+			texture.width  = cooked.width;
+			texture.height = cooked.height;
+			texture.alpha.resize(static_cast<size_t>(cooked.width) * static_cast<size_t>(cooked.height));
+			for (size_t i = 0; i < texture.alpha.size(); i++)
+			{
+				texture.alpha[i] = texels[i * 4 + 3];
+			}
+		});
+		m_bvh8_alpha_caches.clear();
+
+		m_cpu_bvh8       = build_scene_bvh8(m_cpu_bvh, m_vertices, m_indices, m_instances, std::move(m_bvh8_materials), std::move(m_bvh8_alpha_textures));
+		m_cpu_bvh_built  = true;
+		m_cpu_tlas_stale = false;
+		m_cpu_blas_stale = false;
+		return;
+	}
+
+	if (m_cpu_blas_stale)
+	{
+		for (auto &skinned : m_skinned_instances)
+		{
+			refit_scene_blas(m_cpu_bvh, skinned.instance, m_vertices, m_indices);
+			refit_scene_bvh8_blas(m_cpu_bvh8, m_cpu_bvh, skinned.instance, m_vertices, m_indices);
+		}
+		m_cpu_blas_stale = false;
+	}
+
+	if (m_cpu_tlas_stale)
+	{
+		rebuild_scene_tlas(m_cpu_bvh, m_instances);
+		rebuild_scene_bvh8_tlas(m_cpu_bvh8, m_cpu_bvh, m_instances);
+		m_cpu_tlas_stale = false;
+	}
+}
+
+std::vector<PathTracerTexture> Scene::load_reference_textures(const std::vector<uint32_t> &images) const
+{
+	// The GPU only keeps block compressed mips, the reference samples level 0 of the source images
+	std::vector<PathTracerTexture> cpu_textures(images.size());
+
+	cgltf_options options  = {};
+	cgltf_data   *raw_data = nullptr;
+	if (cgltf_parse_file(&options, m_filename.c_str(), &raw_data) != cgltf_result_success ||
+	    cgltf_load_buffers(&options, raw_data, m_filename.c_str()) != cgltf_result_success)
+	{
+		spdlog::warn("Failed to load gltf {} for the reference, textures are sampled as white", m_filename);
+	}
+	else
+	{
+		std::vector<uint32_t> texture_ids(images.size());
+		std::iota(texture_ids.begin(), texture_ids.end(), 0);
+		std::for_each(std::execution::par, texture_ids.begin(), texture_ids.end(), [&](uint32_t texture_id) {
+			int32_t  width = 0, height = 0;
+			uint8_t *image_data = images[texture_id] < raw_data->images_count ? load_gltf_image(raw_data->images + images[texture_id], m_filename, width, height) : nullptr;
+			if (!image_data)
+			{
+				spdlog::warn("Failed to decode glTF image #{} for the reference, it is sampled as white", images[texture_id]);
+				return;
+			}
+
+			cpu_textures[texture_id].width  = static_cast<uint32_t>(width);
+			cpu_textures[texture_id].height = static_cast<uint32_t>(height);
+			cpu_textures[texture_id].texels.assign(image_data, image_data + static_cast<size_t>(width) * static_cast<size_t>(height) * 4);
+			stbi_image_free(image_data);
+		});
+	}
+	cgltf_free(raw_data);
+
+	return cpu_textures;
+}
+
+std::vector<glm::vec3> Scene::render_reference(const PathTracerSettings &settings, const std::vector<PathTracerTexture> &textures, std::vector<float> *variance)
+{
+	update_cpu_bvh();
+
+	PathTracerScene scene = {
+	    .bvh                     = m_cpu_bvh8,
+	    .vertices                = m_vertices,
+	    .indices                 = m_indices,
+	    .instances               = m_instances,
+	    .materials               = m_materials,
+	    .emitters                = m_emitters,
+	    .emitter_alias_table     = m_emitter_alias_table,
+	    .light_tree              = m_light_tree,
+	    .textures                = textures,
+	    .envmap                  = m_envmap_texels,
+	    .envmap_size             = CUBEMAP_SIZE,
+	    .envmap_alias_table      = m_envmap_alias_table,
+	    .envmap_alias_table_size = CUBEMAP_SIZE >> ENVMAP_ALIAS_TABLE_MIP,
+	};
+
+	return ::render_reference(scene, settings, &m_reference_progress, variance);
+}
+
+std::vector<uint32_t> Scene::reference_images() const
+{
+	// Streaming keeps changing the streamed textures, the worker only needs their images
+	std::vector<uint32_t> images(m_streamed_textures.size());
+	for (uint32_t texture_id = 0; texture_id < m_streamed_textures.size(); texture_id++)
+	{
+		images[texture_id] = m_streamed_textures[texture_id].image;
+	}
+	return images;
+}
+
+void Scene::render_reference_async(const PathTracerSettings &settings, const std::string &filename)
+{
+	if (is_rendering_reference())
+	{
+		spdlog::warn("Another reference is still rendering, ignore {}", filename);
+		return;
+	}
+
+	auto render = [this, settings, filename, images = reference_images()]() {
+		std::vector<glm::vec3> image = render_reference(settings, load_reference_textures(images));
+		if (!write_hdr(filename, settings.width, settings.height, image))
+		{
+			spdlog::error("Failed to write reference {}", filename);
+		}
+	};
+
+	m_reference_progress = 0.f;
+	m_reference          = std::async(std::launch::async, std::move(render));
+}
+
+void Scene::compare_emitter_sampling_async(const PathTracerSettings &settings)
+{
+	if (is_rendering_reference())
+	{
+		spdlog::warn("A reference is still rendering, emitter sampling is not compared");
+		return;
+	}
+
+	auto compare = [this, settings, images = reference_images()]() {
+		std::vector<PathTracerTexture> textures = load_reference_textures(images);
+
+		std::array<std::vector<glm::vec3>, 2> means;
+		std::array<std::vector<float>, 2>     variances;
+		std::array<float, 2>                  times = {};
+		for (uint32_t i = 0; i < 2; i++)
+		{
+			PathTracerSettings sampling_settings = settings;
+			sampling_settings.emitter_sampling   = i == 0 ? EmitterSampling::AliasTable : EmitterSampling::LightTree;
+
+			auto start = std::chrono::high_resolution_clock::now();
+			means[i]   = render_reference(sampling_settings, textures, &variances[i]);
+			times[i]   = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+		}
+
+		// Mean variance is dominated by pixels whose footprint straddles an emitter edge, which both samplers share
+		// The relative variance divides by the squared pixel mean and the median ratio compares the pixels one by one
+		std::array<double, 2>   variance_sum          = {};
+		std::array<double, 2>   relative_variance_sum = {};
+		std::array<uint32_t, 2> lit_pixels            = {};
+		std::vector<float>      ratios;
+		for (size_t pixel = 0; pixel < variances[0].size(); pixel++)
+		{
+			for (uint32_t i = 0; i < 2; i++)
+			{
+				float mean = glm::dot(means[i][pixel], glm::vec3(0.212671f, 0.715160f, 0.072169f));
+				variance_sum[i] += variances[i][pixel];
+				if (mean > 0.f)
+				{
+					relative_variance_sum[i] += variances[i][pixel] / (mean * mean);
+					lit_pixels[i]++;
+				}
+			}
+			if (variances[0][pixel] > 0.f && variances[1][pixel] > 0.f)
+			{
+				ratios.push_back(variances[0][pixel] / variances[1][pixel]);
+			}
+		}
+		std::sort(ratios.begin(), ratios.end());
+
+		auto mean_variance = [&](uint32_t i) {
+			return variance_sum[i] / std::max<size_t>(variances[i].size(), 1);
+		};
+		auto mean_relative_variance = [&](uint32_t i) {
+			return relative_variance_sum[i] / std::max(lit_pixels[i], 1u);
+		};
+		spdlog::info("Emitter sampling at {} frames per pixel over {} emitters", settings.frames, m_emitters.size());
+		spdlog::info("Alias table variance {:.4g}, relative {:.4g}, {:.2f} s", mean_variance(0), mean_relative_variance(0), times[0]);
+		spdlog::info("Light tree variance {:.4g}, relative {:.4g}, {:.2f} s", mean_variance(1), mean_relative_variance(1), times[1]);
+		spdlog::info("Light tree relative variance {:.2f}x lower, median per pixel variance {:.2f}x lower", mean_relative_variance(0) / std::max(mean_relative_variance(1), 1e-12), ratios.empty() ? 1.f : ratios[ratios.size() / 2]);
+	};
+
+	m_reference_progress = 0.f;
+	m_reference          = std::async(std::launch::async, std::move(compare));
+}
+
+bool Scene::is_rendering_reference() const
+{
+	return m_reference.valid() &&
+	       m_reference.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+}
+
+float Scene::reference_progress() const
+{
+	return m_reference_progress.load();
+}
+
+void Scene::set_instance_transform(uint32_t instance_id, const glm::mat4 &transform)
+{
+	if (instance_id >= m_instances.size())
+	{
+		spdlog::warn("Instance #{} is out of range", instance_id);
+		return;
+	}
+	if (is_rendering_reference())
+	{
+		spdlog::warn("A reference is still rendering, instance #{} is not moved", instance_id);
+		return;
+	}
+
+	auto &instance         = m_instances[instance_id];
+	instance.transform     = transform;
+	instance.transform_inv = glm::inverse(transform);
+
+	auto transform_3x4 = glm::mat3x4(glm::transpose(transform));
+	std::memcpy(&m_tlas_instances[instance_id].transform, &transform_3x4, sizeof(VkTransformMatrixKHR));
+
+	m_dirty_instances.push_back(instance_id);
+}
+
+void Scene::update_instances(CommandBufferRecorder &recorder)
+{
+	// Moved instances stay dirty until the reference finished
+	if (m_dirty_instances.empty() || is_rendering_reference())
+	{
+		return;
+	}
+
+	std::sort(m_dirty_instances.begin(), m_dirty_instances.end());
+	m_dirty_instances.erase(std::unique(m_dirty_instances.begin(), m_dirty_instances.end()), m_dirty_instances.end());
+
+	// Refitting keeps the topology of the last build, track how much the instance bounds inflate it
+	m_moved_emitters.clear();
+	m_moved_weights.clear();
+	for (auto &instance_id : m_dirty_instances)
+	{
+		const auto &instance = m_instances[instance_id];
+
+		std::array<glm::vec3, 2> bounds = transform_bounds(m_instance_bounds[instance_id], instance.transform);
+		bounds[0]                       = glm::min(bounds[0], m_build_bounds[instance_id][0]);
+		bounds[1]                       = glm::max(bounds[1], m_build_bounds[instance_id][1]);
+
+		m_refit_area -= m_refit_areas[instance_id];
+		m_refit_areas[instance_id] = surface_area(bounds);
+		m_refit_area += m_refit_areas[instance_id];
+
+		if (instance.emitter >= 0)
+		{
+			uint32_t count = 0;
+			while (instance.emitter + count < m_emitters.size() && m_emitters[instance.emitter + count].instance == instance_id)
+			{
+				m_moved_emitters.push_back(instance.emitter + count);
+				m_moved_weights.push_back(m_emitter_weights[instance.emitter + count]);
+				count++;
+			}
+			transform_emitters(m_emitters.data() + instance.emitter, m_light_triangles.data() + instance.emitter, m_emitter_weights.data() + instance.emitter, count, m_instances, m_vertices, m_indices);
+		}
+	}
+
+	// Rigid motion keeps the emitter areas, only a scaled emitter changes the alias table
+	bool weights_changed = false;
+	for (size_t i = 0; i < m_moved_emitters.size(); i++)
+	{
+		weights_changed |= m_emitter_weights[m_moved_emitters[i]] != m_moved_weights[i];
+	}
+
+	m_cpu_tlas_stale = true;
+
+	bool rebuild = m_refit_area > m_build_area * TLAS_REBUILD_THRESHOLD;
+	if (rebuild)
+	{
+		m_build_area = 0.f;
+		for (uint32_t instance_id = 0; instance_id < m_instances.size(); instance_id++)
+		{
+			m_build_bounds[instance_id] = transform_bounds(m_instance_bounds[instance_id], m_instances[instance_id].transform);
+			m_refit_areas[instance_id]  = surface_area(m_build_bounds[instance_id]);
+			m_build_area += m_refit_areas[instance_id];
+		}
+		m_refit_area = m_build_area;
+	}
+
+	recorder.begin_marker("Update Instances")
+	    .insert_barrier()
+	    .add_buffer_barrier(buffer.instance.vk_buffer, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT)
+	    .add_buffer_barrier(buffer.tlas_instance.vk_buffer, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR, VK_ACCESS_TRANSFER_WRITE_BIT)
+	    .add_buffer_barrier(buffer.emitter_alias_table.vk_buffer, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT)
+	    .add_buffer_barrier(buffer.light_tree.vk_buffer, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT)
+	    .insert();
+
+	// Upload contiguous runs of moved instances
+	for (size_t begin = 0, end = 0; begin < m_dirty_instances.size(); begin = end)
+	{
+		end = begin + 1;
+		while (end < m_dirty_instances.size() && m_dirty_instances[end] == m_dirty_instances[end - 1] + 1)
+		{
+			end++;
+		}
+
+		uint32_t first = m_dirty_instances[begin];
+		uint32_t count = static_cast<uint32_t>(end - begin);
+		update_buffer_chunked(recorder, buffer.instance.vk_buffer, m_instances.data() + first, count * sizeof(Instance), first * sizeof(Instance));
+		update_buffer_chunked(recorder, buffer.tlas_instance.vk_buffer, m_tlas_instances.data() + first, count * sizeof(VkAccelerationStructureInstanceKHR), m_tlas_instance_offset + first * sizeof(VkAccelerationStructureInstanceKHR));
+	}
+
+	// Emitters reference instance triangles, only their areas and bounds follow the instance
+	if (!m_moved_emitters.empty())
+	{
+		size_t alias_table_size = m_emitter_weights.size() * sizeof(AliasTable);
+		if (!m_light_staging[0].vk_buffer)
+		{
+			for (auto &staging_buffer : m_light_staging)
+			{
+				staging_buffer = m_context->create_buffer("Light Staging Buffer", alias_table_size + m_light_tree.size() * sizeof(LightTreeNode), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+			}
+		}
+
+		// Same layout as the skinning staging ring, one buffer per frame in flight
+		const Buffer &staging_buffer = m_light_staging[m_light_staging_index];
+		m_light_staging_index        = (m_light_staging_index + 1) % static_cast<uint32_t>(m_light_staging.size());
+
+		if (weights_changed)
+		{
+			build_alias_table(m_emitter_weights.data(), static_cast<uint32_t>(m_emitter_weights.size()), m_emitter_alias_table.data(), m_alias_table_scratch);
+			m_context->buffer_copy_to_device(staging_buffer, m_emitter_alias_table.data(), alias_table_size);
+			recorder.copy_buffer(staging_buffer.vk_buffer, buffer.emitter_alias_table.vk_buffer, alias_table_size);
+		}
+
+		refit_light_tree(m_light_tree, m_light_triangles, m_light_tree_parents, m_light_tree_leaves, m_moved_emitters, m_refitted_light_nodes);
+
+		// Upload contiguous runs of refitted nodes behind the alias table
+		for (size_t begin = 0, end = 0; begin < m_refitted_light_nodes.size(); begin = end)
+		{
+			end = begin + 1;
+			while (end < m_refitted_light_nodes.size() && m_refitted_light_nodes[end] == m_refitted_light_nodes[end - 1] + 1)
+			{
+				end++;
+			}
+
+			size_t offset = m_refitted_light_nodes[begin] * sizeof(LightTreeNode);
+			size_t size   = (end - begin) * sizeof(LightTreeNode);
+			m_context->buffer_copy_to_device(staging_buffer, m_light_tree.data() + m_refitted_light_nodes[begin], size, false, alias_table_size + offset);
+			recorder.copy_buffer(staging_buffer.vk_buffer, buffer.light_tree.vk_buffer, size, alias_table_size + offset, offset);
+		}
+	}
+
+	VkAccelerationStructureGeometryKHR as_geometry = {
+	    .sType        = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+	    .geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR,
+	    .geometry     = {
+	            .instances = {
+	                .sType           = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
+	                .arrayOfPointers = VK_FALSE,
+	                .data            = buffer.tlas_instance.device_address + m_tlas_instance_offset,
+            },
+        },
+	    .flags = 0,
+	};
+
+	VkAccelerationStructureBuildGeometryInfoKHR build_geometry_info = {
+	    .sType                    = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+	    .type                     = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+	    .flags                    = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR,
+	    .mode                     = rebuild ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR,
+	    .srcAccelerationStructure = rebuild ? VK_NULL_HANDLE : tlas.vk_as,
+	    .dstAccelerationStructure = tlas.vk_as,
+	    .geometryCount            = 1,
+	    .pGeometries              = &as_geometry,
+	    .scratchData              = {
+	                     .deviceAddress = buffer.tlas_scratch.device_address,
+        },
+	};
+
+	VkAccelerationStructureBuildRangeInfoKHR range_info = {
+	    .primitiveCount = static_cast<uint32_t>(m_tlas_instances.size()),
+	};
+
+	recorder.insert_barrier()
+	    .add_buffer_barrier(buffer.instance.vk_buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT)
+	    .add_buffer_barrier(buffer.tlas_instance.vk_buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR)
+	    .add_buffer_barrier(buffer.emitter_alias_table.vk_buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT)
+	    .add_buffer_barrier(buffer.light_tree.vk_buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT)
+	    .add_buffer_barrier(tlas.buffer.vk_buffer, VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR, VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR)
+	    .insert()
+	    .build_acceleration_structure(build_geometry_info, &range_info)
+	    .insert_barrier()
+	    .add_buffer_barrier(tlas.buffer.vk_buffer, VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR, VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR)
+	    .insert()
+	    .end_marker();
+
+	m_dirty_instances.clear();
+}
+
+void Scene::update_animation(CommandBufferRecorder &recorder, float delta_time)
+{
+	if (m_animations.empty() || is_rendering_reference())
+	{
+		return;
+	}
+
+	m_animation_time += delta_time;
+
+	// Every animation loops over its own duration
+	for (auto &animation : m_animations)
+	{
+		float time = animation.duration > 0.f ? std::fmod(m_animation_time, animation.duration) : 0.f;
+		for (auto &channel : animation.channels)
+		{
+			uint32_t key_count = static_cast<uint32_t>(channel.times.size());
+			uint32_t key1      = std::min(static_cast<uint32_t>(std::upper_bound(channel.times.begin(), channel.times.end(), time) - channel.times.begin()), key_count - 1);
+			uint32_t key0      = key1 > 0 ? key1 - 1 : 0;
+			float    interval  = channel.times[key1] - channel.times[key0];
+			float    t         = interval > 0.f ? glm::clamp((time - channel.times[key0]) / interval, 0.f, 1.f) : 0.f;
+
+			glm::vec4 value = glm::vec4(0.f);
+			if (channel.interpolation == 1)
+			{
+				value = channel.values[t < 1.f ? key0 : key1];
+			}
+			else if (channel.interpolation == 2)
+			{
+				// Hermite spline, keys are laid out as in-tangent, value, out-tangent
+				float t2 = t * t;
+				float t3 = t2 * t;
+				value    = (2.f * t3 - 3.f * t2 + 1.f) * channel.values[key0 * 3 + 1] +
+				        (t3 - 2.f * t2 + t) * interval * channel.values[key0 * 3 + 2] +
+				        (-2.f * t3 + 3.f * t2) * channel.values[key1 * 3 + 1] +
+				        (t3 - t2) * interval * channel.values[key1 * 3];
+			}
+			else if (channel.path == 1)
+			{
+				glm::quat q0 = glm::quat(channel.values[key0].w, channel.values[key0].x, channel.values[key0].y, channel.values[key0].z);
+				glm::quat q1 = glm::quat(channel.values[key1].w, channel.values[key1].x, channel.values[key1].y, channel.values[key1].z);
+				glm::quat q  = glm::slerp(q0, q1, t);
+				value        = glm::vec4(q.x, q.y, q.z, q.w);
+			}
+			else
+			{
+				value = glm::mix(channel.values[key0], channel.values[key1], t);
+			}
+
+			Node &node = m_nodes[channel.node];
+			if (channel.path == 0)
+			{
+				node.translation = glm::vec3(value);
+			}
+			else if (channel.path == 1)
+			{
+				node.rotation = glm::normalize(glm::quat(value.w, value.x, value.y, value.z));
+			}
+			else
+			{
+				node.scale = glm::vec3(value);
+			}
+		}
+	}
+
+	update_node_transforms();
+
+	for (auto &[instance_id, node_id] : m_animated_instances)
+	{
+		set_instance_transform(instance_id, m_node_worlds[node_id]);
+	}
+
+	if (m_skinned_instances.empty())
+	{
+		return;
+	}
+
+	for (auto &skinned : m_skinned_instances)
+	{
+		const auto &mesh = m_meshes[skinned.mesh];
+
+		m_instance_bounds[skinned.instance] = skin_vertices(m_vertices.data() + mesh.vertices_offset, m_skin_joints.data() + mesh.vertices_offset, m_skin_weights.data() + mesh.vertices_offset, m_skins[skinned.skin].joint_matrices, m_vertices.data() + skinned.vertices_offset, mesh.vertices_count, m_skinning_chunk_bounds);
+		m_dirty_instances.push_back(skinned.instance);
+	}
+	m_cpu_blas_stale = true;
+
+	// The staging buffer recorded three frames ago is free again once its frame fence was waited
+	const Buffer &staging_buffer = m_skinning_staging[m_skinning_staging_index];
+	size_t        dynamic_size   = (m_vertices.size() - m_dynamic_vertices_offset) * sizeof(Vertex);
+	size_t        dynamic_offset = m_dynamic_vertices_offset * sizeof(Vertex);
+
+	m_skinning_staging_index = (m_skinning_staging_index + 1) % static_cast<uint32_t>(m_skinning_staging.size());
+	m_context->buffer_copy_to_device(staging_buffer, m_vertices.data() + m_dynamic_vertices_offset, dynamic_size);
+
+	m_skinning_build_infos.clear();
+	m_skinning_build_ranges.clear();
+	for (auto &skinned : m_skinned_instances)
+	{
+		m_skinning_build_infos.push_back(VkAccelerationStructureBuildGeometryInfoKHR{
+		    .sType                    = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+		    .type                     = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+		    .flags                    = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR,
+		    .mode                     = VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR,
+		    .srcAccelerationStructure = skinned.blas.vk_as,
+		    .dstAccelerationStructure = skinned.blas.vk_as,
+		    .geometryCount            = 1,
+		    .pGeometries              = &skinned.geometry,
+		    .scratchData              = {
+		                     .deviceAddress = skinned.scratch_buffer.device_address,
+            },
+		});
+		m_skinning_build_ranges.push_back(&skinned.range);
+	}
+
+	recorder.begin_marker("Skinning")
+	    .insert_barrier()
+	    .add_buffer_barrier(buffer.vertex.vk_buffer, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, dynamic_size, dynamic_offset)
+	    .insert()
+	    .copy_buffer(staging_buffer.vk_buffer, buffer.vertex.vk_buffer, dynamic_size, 0, dynamic_offset);
+
+	BarrierBuilder refit_barrier = recorder.insert_barrier();
+	refit_barrier.add_buffer_barrier(buffer.vertex.vk_buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, dynamic_size, dynamic_offset);
+	for (auto &skinned : m_skinned_instances)
+	{
+		refit_barrier.add_buffer_barrier(skinned.blas.buffer.vk_buffer, VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR, VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR);
+	}
+	refit_barrier.insert()
+	    .build_acceleration_structure(m_skinning_build_infos, m_skinning_build_ranges);
+
+	BarrierBuilder trace_barrier = recorder.insert_barrier();
+	for (auto &skinned : m_skinned_instances)
+	{
+		trace_barrier.add_buffer_barrier(skinned.blas.buffer.vk_buffer, VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR, VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+	}
+	trace_barrier.insert()
+	    .end_marker();
+}
+
+bool Scene::update_texture_streaming()
+{
+	if (m_streamed_textures.empty())
+	{
+		return false;
+	}
+
+	bool dirty = false;
+
+	// The slot read back here was last written by the frame whose fence begin_render waited on
+	if (m_texture_frame >= m_texture_feedback_readback.size())
+	{
+		m_texture_feedback.resize(m_streamed_textures.size());
+		m_context->buffer_copy_to_host(m_texture_feedback.data(), m_texture_feedback.size() * sizeof(uint32_t), m_texture_feedback_readback[m_texture_feedback_index]);
+		for (size_t i = 0; i < m_texture_feedback.size(); i++)
+		{
+			uint32_t requested = m_texture_feedback[i];
+			if (requested == 0)
+			{
+				continue;
+			}
+
+			auto    &streamed = m_streamed_textures[i];
+			uint32_t size     = std::max(streamed.width, streamed.height);
+
+			streamed.requested_mip  = requested >= size ? 0 : std::min(static_cast<uint32_t>(std::log2(static_cast<float>(size) / static_cast<float>(requested))), streamed.tail_mip);
+			streamed.last_requested = m_texture_frame;
+		}
+	}
+
+	// Bind finished mips
+	{
+		std::lock_guard<std::mutex> lock(m_texture_loader_mutex);
+		for (auto &result : m_texture_results)
+		{
+			auto &streamed   = m_streamed_textures[result.texture];
+			streamed.pending = false;
+			m_texture_requests--;
+
+			size_t size = mip_chain_size(streamed.format, streamed.width, streamed.height, result.mip);
+			if (!result.image.vk_image)
+			{
+				texture_streaming.resident_size -= size;
+				continue;
+			}
+
+			// The reservation made at request time now replaces the previous streamed mips
+			texture_streaming.resident_size -= streamed.streamed_size;
+			m_context->deferred_destroy(streamed.streamed)
+			    .deferred_destroy(streamed.streamed_view);
+
+			streamed.streamed      = result.image;
+			streamed.streamed_view = result.view;
+			streamed.streamed_size = size;
+			streamed.resident_mip  = result.mip;
+
+			texture_views[result.texture] = result.view;
+			dirty                         = true;
+		}
+		m_texture_results.clear();
+	}
+
+	// Evict the least recently requested textures that are idle or hold finer mips than requested
+	auto evict = [&](size_t required, bool force) -> bool {
+		while (texture_streaming.resident_size + required > texture_streaming.budget)
+		{
+			uint32_t victim = ~0u;
+			for (uint32_t i = 0; i < m_streamed_textures.size(); i++)
+			{
+				auto &streamed = m_streamed_textures[i];
+				if (!streamed.streamed.vk_image || streamed.pending ||
+				    (!force && streamed.last_requested + TEXTURE_STREAMING_IDLE_FRAMES > m_texture_frame && streamed.requested_mip <= streamed.resident_mip))
+				{
+					continue;
+				}
+				if (victim == ~0u || streamed.last_requested < m_streamed_textures[victim].last_requested)
+				{
+					victim = i;
+				}
+			}
+			if (victim == ~0u)
+			{
+				return false;
+			}
+			evict_texture(victim);
+			dirty = true;
+		}
+		return true;
+	};
+
+	// The budget may have been lowered at runtime
+	evict(0, true);
+
+	// Stream the textures missing the most mips first
+	auto &candidates = m_texture_candidates;
+	candidates.clear();
+	for (uint32_t i = 0; i < m_streamed_textures.size(); i++)
+	{
+		auto &streamed = m_streamed_textures[i];
+		if (!streamed.pending && streamed.requested_mip < streamed.resident_mip &&
+		    streamed.last_requested + TEXTURE_STREAMING_IDLE_FRAMES > m_texture_frame)
+		{
+			candidates.push_back(i);
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(), [this](uint32_t lhs, uint32_t rhs) {
+		return m_streamed_textures[lhs].resident_mip - m_streamed_textures[lhs].requested_mip > m_streamed_textures[rhs].resident_mip - m_streamed_textures[rhs].requested_mip;
+	});
+
+	for (uint32_t texture : candidates)
+	{
+		if (m_texture_requests >= TEXTURE_STREAMING_MAX_REQUESTS)
+		{
+			break;
+		}
+
+		auto    &streamed = m_streamed_textures[texture];
+		uint32_t mip      = streamed.requested_mip;
+		size_t   size     = mip_chain_size(streamed.format, streamed.width, streamed.height, mip);
+		if (!evict(size, false))
+		{
+			continue;
+		}
+
+		texture_streaming.resident_size += size;
+		streamed.pending = true;
+		m_texture_requests++;
+
+		{
+			std::lock_guard<std::mutex> lock(m_texture_loader_mutex);
+			m_texture_queue.push_back(TextureStreamRequest{
+			    .texture    = texture,
+			    .mip        = mip,
+			    .name       = streamed.name,
+			    .cache_path = streamed.cache_path,
+			});
+		}
+		m_texture_loader_condition.notify_all();
+
+		if (!m_texture_loader.joinable())
+		{
+			m_texture_loader = std::thread(&Scene::load_texture_requests, this);
+		}
+	}
+
+	texture_streaming.pending = m_texture_requests;
+
+	if (dirty)
+	{
+		update_texture_bindings();
+	}
+
+	return dirty && texture_streaming.reset_accumulation;
+}
+
+void Scene::update_texture_bindings()
+{
+	m_context->update_descriptor()
+	    .write_sampled_images(11, texture_views)
+	    .renew(descriptor.set);
+}
+
+void Scene::load_texture_requests()
+{
+	std::unique_lock<std::mutex> lock(m_texture_loader_mutex);
+	while (true)
+	{
+		m_texture_loader_condition.wait(lock, [this]() { return m_texture_loader_stop || !m_texture_queue.empty(); });
+		if (m_texture_loader_stop)
+		{
+			return;
+		}
+
+		TextureStreamRequest request = std::move(m_texture_queue.front());
+		m_texture_queue.pop_front();
+		m_texture_loader_busy = true;
+		lock.unlock();
+
+		TextureStreamResult result = {
+		    .texture = request.texture,
+		    .mip     = request.mip,
+		};
+
+		CookedTexture cooked;
+		if (read_ktx2(request.cache_path, cooked, request.mip))
+		{
+			std::tie(result.image, result.view) = upload_texture_mips(*m_context, fmt::format("{} - Mip {}", request.name, request.mip), cooked);
+		}
+		else
+		{
+			spdlog::warn("Failed to stream texture {}", request.name);
+		}
+
+		lock.lock();
+		m_texture_results.push_back(result);
+		m_texture_loader_busy = false;
+		m_texture_loader_condition.notify_all();
+	}
+}
+
+void Scene::record_texture_feedback(CommandBufferRecorder &recorder)
+{
+	if (m_streamed_textures.empty())
+	{
+		return;
+	}
+
+	size_t size = m_streamed_textures.size() * sizeof(uint32_t);
+
+	recorder.begin_marker("Texture Feedback")
+	    .insert_barrier()
+	    .add_buffer_barrier(buffer.texture_feedback.vk_buffer, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT)
+	    .insert()
+	    .copy_buffer(buffer.texture_feedback.vk_buffer, m_texture_feedback_readback[m_texture_feedback_index].vk_buffer, size)
+	    .insert_barrier()
+	    .add_buffer_barrier(buffer.texture_feedback.vk_buffer, VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT)
+	    .insert(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT)
+	    .fill_buffer(buffer.texture_feedback.vk_buffer, 0, size)
+	    .insert_barrier()
+	    .add_buffer_barrier(buffer.texture_feedback.vk_buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT)
+	    .insert()
+	    .insert_barrier()
+	    .add_buffer_barrier(m_texture_feedback_readback[m_texture_feedback_index].vk_buffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT)
+	    .insert(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT)
+	    .end_marker();
+
+	m_texture_feedback_index = (m_texture_feedback_index + 1) % static_cast<uint32_t>(m_texture_feedback_readback.size());
+	m_texture_frame++;
+}
+
+void Scene::evict_texture(uint32_t texture)
+{
+	auto &streamed = m_streamed_textures[texture];
+
+	texture_streaming.resident_size -= streamed.streamed_size;
+	m_context->deferred_destroy(streamed.streamed)
+	    .deferred_destroy(streamed.streamed_view);
+
+	streamed.streamed_size = 0;
+	streamed.resident_mip  = streamed.tail_mip;
+	texture_views[texture] = streamed.tail_view;
+}
+
+void Scene::cancel_texture_requests()
+{
+	std::unique_lock<std::mutex> lock(m_texture_loader_mutex);
+	m_texture_queue.clear();
+	m_texture_loader_condition.wait(lock, [this]() { return !m_texture_loader_busy; });
+	for (auto &result : m_texture_results)
+	{
+		m_context->deferred_destroy(result.image)
+		    .deferred_destroy(result.view);
+	}
+	m_texture_results.clear();
+	m_texture_requests        = 0;
+	texture_streaming.pending = 0;
+}
+
+void Scene::update()
+{
+	m_context->update_descriptor()
+	    .write_acceleration_structures(0, {tlas})
+	    .write_storage_buffers(1, {buffer.instance.vk_buffer})
+	    .write_storage_buffers(2, {buffer.emitter.vk_buffer})
+	    .write_storage_buffers(3, {buffer.light.vk_buffer})
+	    .write_storage_buffers(4, {buffer.material.vk_buffer})
+	    .write_storage_buffers(5, {buffer.vertex.vk_buffer})
+	    .write_storage_buffers(6, {buffer.index.vk_buffer})
+	    .write_uniform_buffers(7, {buffer.view.vk_buffer})
+	    .write_storage_buffers(8, {buffer.emitter_alias_table.vk_buffer})
+	    .write_storage_buffers(9, {buffer.mesh_alias_table.vk_buffer})
+	    .write_uniform_buffers(10, {buffer.scene.vk_buffer})
+	    .write_sampled_images(11, texture_views)
+	    .write_samplers(12, {linear_sampler, nearest_sampler})
+	    .write_sampled_images(13, {envmap.texture_view})
+	    .write_sampled_images(14, {envmap.irradiance_sh_view})
+	    .write_sampled_images(15, {envmap.prefilter_map_view})
+	    .write_sampled_images(16, {ggx_lut_view})
+	    .write_sampled_images(17, {sobol_image_view})
+	    .write_sampled_images(18, {scrambling_ranking_image_views})
+	    .write_storage_buffers(19, {buffer.texture_feedback.vk_buffer})
+	    .write_storage_buffers(20, {envmap.alias_table.vk_buffer})
+	    .write_storage_buffers(21, {buffer.light_tree.vk_buffer})
+	    .renew(descriptor.set);
+}
+
+void Scene::destroy_scene()
+{
+	cancel_texture_requests();
+
+	m_context->deferred_destroy(blas)
+	    .deferred_destroy(tlas)
+	    .deferred_destroy(buffer.instance)
+	    .deferred_destroy(buffer.light)
+	    .deferred_destroy(buffer.emitter)
+	    .deferred_destroy(buffer.material)
+	    .deferred_destroy(buffer.vertex)
+	    .deferred_destroy(buffer.index)
+	    .deferred_destroy(buffer.indirect_draw)
+	    .deferred_destroy(buffer.emitter_alias_table)
+	    .deferred_destroy(buffer.light_tree)
+	    .deferred_destroy(buffer.mesh_alias_table)
+	    .deferred_destroy(buffer.scene)
+	    .deferred_destroy(buffer.tlas_instance)
+	    .deferred_destroy(buffer.tlas_scratch)
+	    .deferred_destroy(buffer.texture_feedback)
+	    .deferred_destroy(m_texture_feedback_readback)
+	    .deferred_destroy(textures);
+
+	// Bound views alias the tail and streamed views
+	for (auto &streamed : m_streamed_textures)
+	{
+		m_context->deferred_destroy(streamed.tail_view)
+		    .deferred_destroy(streamed.streamed)
+		    .deferred_destroy(streamed.streamed_view);
+	}
+	texture_views.clear();
+	m_streamed_textures.clear();
+	texture_streaming.resident_size = 0;
+	m_texture_feedback_index        = 0;
+	m_texture_frame                 = 0;
+
+	for (auto &skinned : m_skinned_instances)
+	{
+		m_context->deferred_destroy(skinned.blas)
+		    .deferred_destroy(skinned.scratch_buffer);
+	}
+	m_context->deferred_destroy(m_skinning_staging)
+	    .deferred_destroy(m_light_staging);
+	m_light_staging       = {};
+	m_light_staging_index = 0;
+
+	m_skinned_instances.clear();
+	m_animated_instances.clear();
+	m_animations.clear();
+	m_dirty_instances.clear();
+}
+
+void Scene::swap_scene(Scene &other)
+{
+	std::swap(scene_info, other.scene_info);
+	std::swap(tlas, other.tlas);
+	std::swap(blas, other.blas);
+	std::swap(textures, other.textures);
+	std::swap(texture_views, other.texture_views);
+
+	// The view buffer is owned by the live scene
+	std::swap(buffer, other.buffer);
+	std::swap(buffer.view, other.buffer.view);
+
+	std::swap(m_filename, other.m_filename);
+	std::swap(m_vertices, other.m_vertices);
+	std::swap(m_indices, other.m_indices);
+	std::swap(m_meshes, other.m_meshes);
+	std::swap(m_instances, other.m_instances);
+	std::swap(m_materials, other.m_materials);
+	std::swap(m_emitters, other.m_emitters);
+	std::swap(m_light_triangles, other.m_light_triangles);
+	std::swap(m_emitter_weights, other.m_emitter_weights);
+	std::swap(m_light_tree, other.m_light_tree);
+	std::swap(m_light_tree_parents, other.m_light_tree_parents);
+	std::swap(m_light_tree_leaves, other.m_light_tree_leaves);
+	std::swap(m_emitter_alias_table, other.m_emitter_alias_table);
+	std::swap(m_light_staging, other.m_light_staging);
+	std::swap(m_light_staging_index, other.m_light_staging_index);
+
+	std::swap(m_cpu_bvh, other.m_cpu_bvh);
+	std::swap(m_cpu_bvh8, other.m_cpu_bvh8);
+	std::swap(m_bvh8_materials, other.m_bvh8_materials);
+	std::swap(m_bvh8_alpha_textures, other.m_bvh8_alpha_textures);
+	std::swap(m_bvh8_alpha_caches, other.m_bvh8_alpha_caches);
+	std::swap(m_cpu_bvh_built, other.m_cpu_bvh_built);
+	std::swap(m_cpu_tlas_stale, other.m_cpu_tlas_stale);
+	std::swap(m_cpu_blas_stale, other.m_cpu_blas_stale);
+
+	std::swap(m_tlas_instances, other.m_tlas_instances);
+	std::swap(m_tlas_instance_offset, other.m_tlas_instance_offset);
+	std::swap(m_dirty_instances, other.m_dirty_instances);
+
+	std::swap(m_instance_bounds, other.m_instance_bounds);
+	std::swap(m_build_bounds, other.m_build_bounds);
+	std::swap(m_refit_areas, other.m_refit_areas);
+	std::swap(m_build_area, other.m_build_area);
+	std::swap(m_refit_area, other.m_refit_area);
+
+	std::swap(m_nodes, other.m_nodes);
+	std::swap(m_node_order, other.m_node_order);
+	std::swap(m_node_worlds, other.m_node_worlds);
+	std::swap(m_animations, other.m_animations);
+	std::swap(m_skins, other.m_skins);
+	std::swap(m_skinned_instances, other.m_skinned_instances);
+	std::swap(m_animated_instances, other.m_animated_instances);
+	std::swap(m_skin_joints, other.m_skin_joints);
+	std::swap(m_skin_weights, other.m_skin_weights);
+	std::swap(m_animation_time, other.m_animation_time);
+
+	std::swap(m_dynamic_vertices_offset, other.m_dynamic_vertices_offset);
+	std::swap(m_skinning_staging, other.m_skinning_staging);
+	std::swap(m_skinning_staging_index, other.m_skinning_staging_index);
+
+	// The budget is a user setting and stays with the live scene
+	std::swap(texture_streaming.resident_size, other.texture_streaming.resident_size);
+	std::swap(texture_streaming.pending, other.texture_streaming.pending);
+	std::swap(m_streamed_textures, other.m_streamed_textures);
+	std::swap(m_texture_feedback_readback, other.m_texture_feedback_readback);
+	std::swap(m_texture_feedback_index, other.m_texture_feedback_index);
+	std::swap(m_texture_frame, other.m_texture_frame);
+}
+
+void Scene::update_node_transforms()
+{
+	m_node_worlds.resize(m_nodes.size());
+	for (auto &node_id : m_node_order)
+	{
+		const Node &node = m_nodes[node_id];
+
+		glm::mat4 local = node.has_matrix ?
+		                      node.matrix :
+		                      glm::translate(glm::mat4(1.f), node.translation) * glm::mat4_cast(node.rotation) * glm::scale(glm::mat4(1.f), node.scale);
+
+		m_node_worlds[node_id] = node.parent >= 0 ? m_node_worlds[node.parent] * local : local;
+	}
+
+	for (auto &skin : m_skins)
+	{
+		for (size_t joint = 0; joint < skin.joints.size(); joint++)
+		{
+			skin.joint_matrices[joint] = m_node_worlds[skin.joints[joint]] * skin.inverse_bind_matrices[joint];
+		}
+	}
 }
 
 void Scene::destroy_envmap()
 {
-	m_context->destroy(envmap.texture)
-	    .destroy(envmap.irradiance_sh)
-	    .destroy(envmap.prefilter_map)
-	    .destroy(envmap.texture_view)
-	    .destroy(envmap.irradiance_sh_view)
-	    .destroy(envmap.prefilter_map_view);
+	m_context->deferred_destroy(envmap.texture)
+	    .deferred_destroy(envmap.irradiance_sh)
+	    .deferred_destroy(envmap.prefilter_map)
+	    .deferred_destroy(envmap.alias_table)
+	    .deferred_destroy(envmap.texture_view)
+	    .deferred_destroy(envmap.irradiance_sh_view)
+	    .deferred_destroy(envmap.prefilter_map_view);
 }
\ No newline at end of file
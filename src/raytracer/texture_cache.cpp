@@ -0,0 +1,1310 @@
+#include "texture_cache.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <execution>
+#include <fstream>
+#include <numbers>
+#include <numeric>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#	include <emmintrin.h>
+#	define TEXTURE_CACHE_SSE2
+#endif
+
+#if defined(__AVX__)
+#	include <immintrin.h>
+#	define TEXTURE_CACHE_AVX
+#endif
+
+#define TEXTURE_CACHE_WRITER "CSIG texture cooker 2"
+#define ENVMAP_CACHE_VERSION 2
+#define RGBE_MIN_EXPONENT 113        // E5B9G9R9 exponent 0
+#define RGBE_MAX_EXPONENT 144        // E5B9G9R9 exponent 31
+#define KTX2_HEADER_SIZE 80
+#define KTX2_LEVEL_INDEX_SIZE 24
+#define BC7_REFINE_ITERATIONS 2
+#define MIP_FILTER_RADIUS 3.f
+#define MIP_FILTER_KAISER_ALPHA 4.f
+#define MIP_LINEAR_TABLE_SIZE 65536
+#define MIP_ALPHA_SCALE_MAX 4.f
+#define MIP_ALPHA_SCALE_ITERATIONS 16
+
+static const uint8_t ENVMAP_CACHE_IDENTIFIER[8] = {'C', 'S', 'I', 'G', 'E', 'N', 'V', 0};
+
+static const uint8_t KTX2_IDENTIFIER[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+
+// Interpolation weights of 4-bit BC7 indices, in 1/64
+static const uint32_t BC7_WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// Loads a 4x4 block of RGBA8 texels, texels past the edge repeat the last row and column
+inline void load_block(const uint8_t *data, uint32_t width, uint32_t height, uint32_t block_x, uint32_t block_y, uint8_t *block)
+{
+	for (uint32_t y = 0; y < 4; y++)
+	{
+		const uint8_t *row = data + static_cast<size_t>(std::min(block_y * 4 + y, height - 1)) * width * 4;
+		for (uint32_t x = 0; x < 4; x++)
+		{
+			std::memcpy(block + (y * 4 + x) * 4, row + std::min(block_x * 4 + x, width - 1) * 4, 4);
+		}
+	}
+}
+
+// Nearest palette entry of 16 single channel texels
+inline void select_bc4_indices(const uint8_t *values, const uint8_t *palette, uint8_t *indices)
+{
+#ifdef TEXTURE_CACHE_SSE2
+	__m128i texels     = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values));
+	__m128i best_error = _mm_set1_epi8(-1);
+	__m128i best_index = _mm_setzero_si128();
+	for (int32_t i = 0; i < 8; i++)
+	{
+		__m128i entry = _mm_set1_epi8(static_cast<char>(palette[i]));
+		__m128i error = _mm_or_si128(_mm_subs_epu8(texels, entry), _mm_subs_epu8(entry, texels));
+		__m128i min   = _mm_min_epu8(error, best_error);
+		__m128i less  = _mm_andnot_si128(_mm_cmpeq_epi8(min, best_error), _mm_set1_epi8(-1));
+
+		best_error = min;
+		best_index = _mm_or_si128(_mm_and_si128(less, _mm_set1_epi8(static_cast<char>(i))), _mm_andnot_si128(less, best_index));
+	}
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(indices), best_index);
+#else
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		uint32_t best_error = ~0u;
+		for (uint32_t j = 0; j < 8; j++)
+		{
+			uint32_t error = static_cast<uint32_t>(std::abs(static_cast<int32_t>(values[i]) - static_cast<int32_t>(palette[j])));
+			if (error < best_error)
+			{
+				best_error = error;
+				indices[i] = static_cast<uint8_t>(j);
+			}
+		}
+	}
+#endif
+}
+
+inline void encode_bc4_block(const uint8_t *values, uint8_t *out)
+{
+	uint8_t max = *std::max_element(values, values + 16);
+	uint8_t min = *std::min_element(values, values + 16);
+
+	// max > min selects the 8 value palette, a uniform block only uses index 0
+	std::array<uint8_t, 8> palette = {max, min};
+	for (uint32_t i = 2; i < 8; i++)
+	{
+		palette[i] = static_cast<uint8_t>(((8 - i) * max + (i - 1) * min + 3) / 7);
+	}
+
+	std::array<uint8_t, 16> indices;
+	select_bc4_indices(values, palette.data(), indices.data());
+
+	uint64_t bits = 0;
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		bits |= static_cast<uint64_t>(indices[i]) << (i * 3);
+	}
+
+	out[0] = max;
+	out[1] = min;
+	for (uint32_t i = 0; i < 6; i++)
+	{
+		out[i + 2] = static_cast<uint8_t>(bits >> (i * 8));
+	}
+}
+
+// Nearest palette entry of 16 RGBA texels stored channel by channel, returns the summed squared error
+inline float select_bc7_indices(const float (*texels)[16], const float (*palette)[4], uint8_t *indices)
+{
+	float total_error = 0.f;
+#ifdef TEXTURE_CACHE_SSE2
+	for (uint32_t group = 0; group < 16; group += 4)
+	{
+		__m128 r = _mm_loadu_ps(texels[0] + group);
+		__m128 g = _mm_loadu_ps(texels[1] + group);
+		__m128 b = _mm_loadu_ps(texels[2] + group);
+		__m128 a = _mm_loadu_ps(texels[3] + group);
+
+		__m128  best_error = _mm_set1_ps(FLT_MAX);
+		__m128i best_index = _mm_setzero_si128();
+		for (int32_t i = 0; i < 16; i++)
+		{
+			__m128 dr    = _mm_sub_ps(r, _mm_set1_ps(palette[i][0]));
+			__m128 dg    = _mm_sub_ps(g, _mm_set1_ps(palette[i][1]));
+			__m128 db    = _mm_sub_ps(b, _mm_set1_ps(palette[i][2]));
+			__m128 da    = _mm_sub_ps(a, _mm_set1_ps(palette[i][3]));
+			__m128 error = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_add_ps(_mm_mul_ps(db, db), _mm_mul_ps(da, da)));
+
+			__m128i less = _mm_castps_si128(_mm_cmplt_ps(error, best_error));
+
+			best_error = _mm_min_ps(error, best_error);
+			best_index = _mm_or_si128(_mm_and_si128(less, _mm_set1_epi32(i)), _mm_andnot_si128(less, best_index));
+		}
+
+		alignas(16) float   errors[4];
+		alignas(16) int32_t group_indices[4];
+		_mm_store_ps(errors, best_error);
+		_mm_store_si128(reinterpret_cast<__m128i *>(group_indices), best_index);
+		for (uint32_t i = 0; i < 4; i++)
+		{
+			indices[group + i] = static_cast<uint8_t>(group_indices[i]);
+			total_error += errors[i];
+		}
+	}
+#else
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		float best_error = FLT_MAX;
+		for (uint32_t j = 0; j < 16; j++)
+		{
+			float error = 0.f;
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				error += (texels[c][i] - palette[j][c]) * (texels[c][i] - palette[j][c]);
+			}
+			if (error < best_error)
+			{
+				best_error = error;
+				indices[i] = static_cast<uint8_t>(j);
+			}
+		}
+		total_error += best_error;
+	}
+#endif
+	return total_error;
+}
+
+// Mode 6 endpoints hold 7 bits per channel and a p-bit shared by the channels of the endpoint
+inline std::array<uint8_t, 4> quantize_bc7_endpoint(const float *endpoint)
+{
+	std::array<uint8_t, 4> best_endpoint = {};
+	float                  best_error    = FLT_MAX;
+	for (int32_t p = 0; p < 2; p++)
+	{
+		std::array<uint8_t, 4> quantized = {};
+		float                  error     = 0.f;
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			int32_t value = std::clamp(static_cast<int32_t>(std::round((endpoint[c] - static_cast<float>(p)) * 0.5f)), 0, 127);
+			quantized[c]  = static_cast<uint8_t>((value << 1) | p);
+			error += (static_cast<float>(quantized[c]) - endpoint[c]) * (static_cast<float>(quantized[c]) - endpoint[c]);
+		}
+		if (error < best_error)
+		{
+			best_error    = error;
+			best_endpoint = quantized;
+		}
+	}
+	return best_endpoint;
+}
+
+inline void write_bits(uint8_t *data, uint32_t &offset, uint32_t value, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++, offset++)
+	{
+		if ((value >> i) & 1u)
+		{
+			data[offset >> 3] |= static_cast<uint8_t>(1u << (offset & 7));
+		}
+	}
+}
+
+inline uint32_t read_bits(const uint8_t *data, uint32_t &offset, uint32_t count)
+{
+	uint32_t value = 0;
+	for (uint32_t i = 0; i < count; i++, offset++)
+	{
+		value |= ((data[offset >> 3] >> (offset & 7)) & 1u) << i;
+	}
+	return value;
+}
+
+// BC7 mode 6, endpoints along the principal axis refined by least squares
+inline void encode_bc7_block(const uint8_t *block, uint8_t *out)
+{
+	float texels[4][16];
+	float mean[4] = {};
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			texels[c][i] = static_cast<float>(block[i * 4 + c]);
+			mean[c] += texels[c][i] / 16.f;
+		}
+	}
+
+	float covariance[4][4] = {};
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		for (uint32_t c0 = 0; c0 < 4; c0++)
+		{
+			for (uint32_t c1 = 0; c1 < 4; c1++)
+			{
+				covariance[c0][c1] += (texels[c0][i] - mean[c0]) * (texels[c1][i] - mean[c1]);
+			}
+		}
+	}
+
+	// Principal axis by power iteration
+	float axis[4] = {1.f, 1.f, 1.f, 1.f};
+	for (uint32_t iteration = 0; iteration < 8; iteration++)
+	{
+		float next[4] = {};
+		for (uint32_t c0 = 0; c0 < 4; c0++)
+		{
+			for (uint32_t c1 = 0; c1 < 4; c1++)
+			{
+				next[c0] += covariance[c0][c1] * axis[c1];
+			}
+		}
+		float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2] + next[3] * next[3]);
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			axis[c] = length > 1e-6f ? next[c] / length : 0.f;
+		}
+	}
+
+	float min_t = FLT_MAX, max_t = -FLT_MAX;
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		float t = 0.f;
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			t += (texels[c][i] - mean[c]) * axis[c];
+		}
+		min_t = std::min(min_t, t);
+		max_t = std::max(max_t, t);
+	}
+
+	float endpoints[2][4];
+	for (uint32_t c = 0; c < 4; c++)
+	{
+		endpoints[0][c] = std::clamp(mean[c] + min_t * axis[c], 0.f, 255.f);
+		endpoints[1][c] = std::clamp(mean[c] + max_t * axis[c], 0.f, 255.f);
+	}
+
+	std::array<std::array<uint8_t, 4>, 2> best_endpoints = {};
+	std::array<uint8_t, 16>               best_indices   = {};
+	float                                 best_error     = FLT_MAX;
+	for (uint32_t iteration = 0; iteration <= BC7_REFINE_ITERATIONS; iteration++)
+	{
+		std::array<std::array<uint8_t, 4>, 2> quantized = {quantize_bc7_endpoint(endpoints[0]), quantize_bc7_endpoint(endpoints[1])};
+
+		float palette[16][4];
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				palette[i][c] = static_cast<float>(((64 - BC7_WEIGHTS[i]) * quantized[0][c] + BC7_WEIGHTS[i] * quantized[1][c] + 32) >> 6);
+			}
+		}
+
+		std::array<uint8_t, 16> indices;
+		float                   error = select_bc7_indices(texels, palette, indices.data());
+		if (error < best_error)
+		{
+			best_error     = error;
+			best_endpoints = quantized;
+			best_indices   = indices;
+		}
+
+		// Least squares endpoints for the selected weights
+		float a = 0.f, b = 0.f, d = 0.f;
+		float rhs[2][4] = {};
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			float w = static_cast<float>(BC7_WEIGHTS[indices[i]]) / 64.f;
+			a += (1.f - w) * (1.f - w);
+			b += (1.f - w) * w;
+			d += w * w;
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				rhs[0][c] += (1.f - w) * texels[c][i];
+				rhs[1][c] += w * texels[c][i];
+			}
+		}
+		float det = a * d - b * b;
+		if (std::abs(det) < 1e-6f)
+		{
+			break;
+		}
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			endpoints[0][c] = std::clamp((d * rhs[0][c] - b * rhs[1][c]) / det, 0.f, 255.f);
+			endpoints[1][c] = std::clamp((a * rhs[1][c] - b * rhs[0][c]) / det, 0.f, 255.f);
+		}
+	}
+
+	// The most significant index bit of the first texel is implicitly zero
+	if (best_indices[0] & 8)
+	{
+		std::swap(best_endpoints[0], best_endpoints[1]);
+		for (auto &index : best_indices)
+		{
+			index = 15 - index;
+		}
+	}
+
+	std::memset(out, 0, 16);
+	uint32_t offset = 0;
+	write_bits(out, offset, 1u << 6, 7);
+	for (uint32_t c = 0; c < 4; c++)
+	{
+		write_bits(out, offset, best_endpoints[0][c] >> 1, 7);
+		write_bits(out, offset, best_endpoints[1][c] >> 1, 7);
+	}
+	write_bits(out, offset, best_endpoints[0][0] & 1, 1);
+	write_bits(out, offset, best_endpoints[1][0] & 1, 1);
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		write_bits(out, offset, best_indices[i], i == 0 ? 3 : 4);
+	}
+}
+
+template <typename Encoder>
+inline std::vector<uint8_t> compress_level(const uint8_t *data, uint32_t width, uint32_t height, size_t block_size, Encoder &&encoder)
+{
+	uint32_t blocks_x = (width + 3) / 4;
+	uint32_t blocks_y = (height + 3) / 4;
+
+	std::vector<uint8_t>  blocks(static_cast<size_t>(blocks_x) * blocks_y * block_size);
+	std::vector<uint32_t> rows(blocks_y);
+	std::iota(rows.begin(), rows.end(), 0);
+	std::for_each(std::execution::par, rows.begin(), rows.end(), [&](uint32_t block_y) {
+		uint8_t block[64];
+		for (uint32_t block_x = 0; block_x < blocks_x; block_x++)
+		{
+			load_block(data, width, height, block_x, block_y, block);
+			encoder(block, blocks.data() + (static_cast<size_t>(block_y) * blocks_x + block_x) * block_size);
+		}
+	});
+	return blocks;
+}
+
+inline std::string swizzle_to_string(const VkComponentMapping &swizzle)
+{
+	auto component = [](VkComponentSwizzle value, char identity) {
+		switch (value)
+		{
+			case VK_COMPONENT_SWIZZLE_ZERO:
+				return '0';
+			case VK_COMPONENT_SWIZZLE_ONE:
+				return '1';
+			case VK_COMPONENT_SWIZZLE_R:
+				return 'r';
+			case VK_COMPONENT_SWIZZLE_G:
+				return 'g';
+			case VK_COMPONENT_SWIZZLE_B:
+				return 'b';
+			case VK_COMPONENT_SWIZZLE_A:
+				return 'a';
+			default:
+				return identity;
+		}
+	};
+	return {component(swizzle.r, 'r'), component(swizzle.g, 'g'), component(swizzle.b, 'b'), component(swizzle.a, 'a')};
+}
+
+inline VkComponentMapping swizzle_from_string(const std::string &swizzle)
+{
+	auto component = [](char value) {
+		switch (value)
+		{
+			case '0':
+				return VK_COMPONENT_SWIZZLE_ZERO;
+			case '1':
+				return VK_COMPONENT_SWIZZLE_ONE;
+			case 'r':
+				return VK_COMPONENT_SWIZZLE_R;
+			case 'g':
+				return VK_COMPONENT_SWIZZLE_G;
+			case 'b':
+				return VK_COMPONENT_SWIZZLE_B;
+			case 'a':
+				return VK_COMPONENT_SWIZZLE_A;
+			default:
+				return VK_COMPONENT_SWIZZLE_IDENTITY;
+		}
+	};
+	if (swizzle.size() < 4)
+	{
+		return {};
+	}
+	return {component(swizzle[0]), component(swizzle[1]), component(swizzle[2]), component(swizzle[3])};
+}
+
+inline uint32_t block_size(VkFormat format)
+{
+	return format == VK_FORMAT_BC4_UNORM_BLOCK ? 8 : 16;
+}
+
+inline void append_u32(std::vector<uint8_t> &data, uint32_t value)
+{
+	data.insert(data.end(), reinterpret_cast<const uint8_t *>(&value), reinterpret_cast<const uint8_t *>(&value) + sizeof(value));
+}
+
+inline void append_u64(std::vector<uint8_t> &data, uint64_t value)
+{
+	data.insert(data.end(), reinterpret_cast<const uint8_t *>(&value), reinterpret_cast<const uint8_t *>(&value) + sizeof(value));
+}
+
+inline uint32_t load_u32(const uint8_t *data)
+{
+	uint32_t value = 0;
+	std::memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+inline uint64_t load_u64(const uint8_t *data)
+{
+	uint64_t value = 0;
+	std::memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+inline bool read_header(std::ifstream &file, CookedTexture &texture)
+{
+	uint8_t header[KTX2_HEADER_SIZE];
+	if (!file.read(reinterpret_cast<char *>(header), KTX2_HEADER_SIZE) ||
+	    std::memcmp(header, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+	{
+		return false;
+	}
+
+	VkFormat format = static_cast<VkFormat>(load_u32(header + 12));
+	if ((format != VK_FORMAT_BC7_UNORM_BLOCK && format != VK_FORMAT_BC5_UNORM_BLOCK && format != VK_FORMAT_BC4_UNORM_BLOCK) ||
+	    load_u32(header + 40) == 0 || load_u32(header + 44) != 0)
+	{
+		return false;
+	}
+
+	texture.format     = format;
+	texture.width      = load_u32(header + 20);
+	texture.height     = load_u32(header + 24);
+	texture.mip_levels = load_u32(header + 40);
+	texture.first_mip  = texture.mip_levels;
+	texture.swizzle    = {};
+	texture.levels.clear();
+
+	std::vector<uint8_t> kvd(load_u32(header + 60));
+	file.seekg(load_u32(header + 56));
+	if (!file.read(reinterpret_cast<char *>(kvd.data()), kvd.size()))
+	{
+		return false;
+	}
+
+	// Caches written by another cooker version are stale
+	bool current = false;
+	for (size_t offset = 0; offset + 4 <= kvd.size();)
+	{
+		uint32_t length = load_u32(kvd.data() + offset);
+		if (offset + 4 + length > kvd.size())
+		{
+			break;
+		}
+
+		const char *entry     = reinterpret_cast<const char *>(kvd.data() + offset + 4);
+		const char *entry_end = entry + length;
+		const char *key_end   = std::find(entry, entry_end, '\0');
+
+		std::string key   = std::string(entry, key_end);
+		std::string value = key_end == entry_end ? "" : std::string(key_end + 1, std::find(key_end + 1, entry_end, '\0'));
+		if (key == "KTXswizzle")
+		{
+			texture.swizzle = swizzle_from_string(value);
+		}
+		else if (key == "KTXwriter")
+		{
+			current = value == TEXTURE_CACHE_WRITER;
+		}
+
+		offset += 4 + ((length + 3) & ~3u);
+	}
+
+	return current;
+}
+
+// Kaiser windowed sinc, x in destination texels
+inline float kaiser_sinc(float x)
+{
+	auto bessel_i0 = [](float x) {
+		float sum  = 1.f;
+		float term = 1.f;
+		for (uint32_t k = 1; k < 16; k++)
+		{
+			term *= (x * 0.5f / static_cast<float>(k)) * (x * 0.5f / static_cast<float>(k));
+			sum += term;
+		}
+		return sum;
+	};
+
+	float t = x / MIP_FILTER_RADIUS;
+	if (std::abs(t) >= 1.f)
+	{
+		return 0.f;
+	}
+	float sinc = std::abs(x) < 1e-5f ? 1.f : std::sin(std::numbers::pi_v<float> * x) / (std::numbers::pi_v<float> * x);
+	return sinc * bessel_i0(MIP_FILTER_KAISER_ALPHA * std::sqrt(1.f - t * t)) / bessel_i0(MIP_FILTER_KAISER_ALPHA);
+}
+
+// Normalized filter taps of every destination texel along one axis, source texels past the edge are clamped
+struct FilterTaps
+{
+	std::vector<uint32_t> offsets;        // First tap of each destination texel, one past the end for the last
+	std::vector<uint32_t> texels;
+	std::vector<float>    weights;
+};
+
+inline FilterTaps build_filter_taps(uint32_t src_size, uint32_t dst_size)
+{
+	FilterTaps taps;
+
+	float scale   = static_cast<float>(src_size) / static_cast<float>(dst_size);
+	float support = MIP_FILTER_RADIUS * scale;
+	for (uint32_t i = 0; i < dst_size; i++)
+	{
+		taps.offsets.push_back(static_cast<uint32_t>(taps.weights.size()));
+
+		float   center = (static_cast<float>(i) + 0.5f) * scale;
+		int32_t begin  = static_cast<int32_t>(std::floor(center - support));
+		int32_t end    = static_cast<int32_t>(std::ceil(center + support));
+		float   sum    = 0.f;
+		for (int32_t j = begin; j <= end; j++)
+		{
+			float weight = kaiser_sinc((static_cast<float>(j) + 0.5f - center) / scale);
+			if (weight != 0.f)
+			{
+				taps.texels.push_back(static_cast<uint32_t>(std::clamp(j, 0, static_cast<int32_t>(src_size) - 1)));
+				taps.weights.push_back(weight);
+				sum += weight;
+			}
+		}
+		for (size_t j = taps.offsets.back(); j < taps.weights.size(); j++)
+		{
+			taps.weights[j] /= sum;
+		}
+	}
+	taps.offsets.push_back(static_cast<uint32_t>(taps.weights.size()));
+
+	return taps;
+}
+
+// dst[i] += weight * src[i] over a row of RGBA texels
+inline void accumulate_row(float *dst, const float *src, float weight, size_t count)
+{
+	size_t i = 0;
+#if defined(TEXTURE_CACHE_AVX)
+	__m256 weight8 = _mm256_set1_ps(weight);
+	for (; i + 8 <= count; i += 8)
+	{
+		_mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_mul_ps(_mm256_loadu_ps(src + i), weight8)));
+	}
+#endif
+#ifdef TEXTURE_CACHE_SSE2
+	__m128 weight4 = _mm_set1_ps(weight);
+	for (; i + 4 <= count; i += 4)
+	{
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), weight4)));
+	}
+#endif
+	for (; i < count; i++)
+	{
+		dst[i] += weight * src[i];
+	}
+}
+
+// Separable downsample of linear RGBA float texels, results are clamped to [0, 1] to drop the ringing of the negative lobes
+inline std::vector<float> downsample(const std::vector<float> &src, uint32_t width, uint32_t height, uint32_t next_width, uint32_t next_height)
+{
+	FilterTaps horizontal = build_filter_taps(width, next_width);
+	FilterTaps vertical   = build_filter_taps(height, next_height);
+
+	std::vector<float> rows(static_cast<size_t>(next_width) * height * 4);
+	for (uint32_t y = 0; y < height; y++)
+	{
+		const float *src_row = src.data() + static_cast<size_t>(y) * width * 4;
+		float       *dst_row = rows.data() + static_cast<size_t>(y) * next_width * 4;
+		for (uint32_t x = 0; x < next_width; x++)
+		{
+#ifdef TEXTURE_CACHE_SSE2
+			__m128 sum = _mm_setzero_ps();
+			for (uint32_t tap = horizontal.offsets[x]; tap < horizontal.offsets[x + 1]; tap++)
+			{
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(src_row + horizontal.texels[tap] * 4), _mm_set1_ps(horizontal.weights[tap])));
+			}
+			_mm_storeu_ps(dst_row + x * 4, sum);
+#else
+			for (uint32_t tap = horizontal.offsets[x]; tap < horizontal.offsets[x + 1]; tap++)
+			{
+				for (uint32_t c = 0; c < 4; c++)
+				{
+					dst_row[x * 4 + c] += src_row[horizontal.texels[tap] * 4 + c] * horizontal.weights[tap];
+				}
+			}
+#endif
+		}
+	}
+
+	std::vector<float> level(static_cast<size_t>(next_width) * next_height * 4);
+	for (uint32_t y = 0; y < next_height; y++)
+	{
+		float *dst_row = level.data() + static_cast<size_t>(y) * next_width * 4;
+		for (uint32_t tap = vertical.offsets[y]; tap < vertical.offsets[y + 1]; tap++)
+		{
+			accumulate_row(dst_row, rows.data() + static_cast<size_t>(vertical.texels[tap]) * next_width * 4, vertical.weights[tap], static_cast<size_t>(next_width) * 4);
+		}
+	}
+	for (auto &value : level)
+	{
+		value = std::clamp(value, 0.f, 1.f);
+	}
+
+	return level;
+}
+
+inline float srgb_to_linear(float value)
+{
+	return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+inline float linear_to_srgb(float value)
+{
+	return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.f / 2.4f) - 0.055f;
+}
+
+// Fraction of texels passing the alpha test once alpha is scaled
+inline float alpha_coverage(const std::vector<float> &texels, float alpha_cutoff, float scale)
+{
+	size_t count = 0;
+	for (size_t i = 3; i < texels.size(); i += 4)
+	{
+		count += texels[i] * scale >= alpha_cutoff;
+	}
+	return static_cast<float>(count) / static_cast<float>(texels.size() / 4);
+}
+
+std::vector<std::vector<uint8_t>> generate_mip_chain(const uint8_t *data, uint32_t width, uint32_t height, bool srgb, float alpha_cutoff)
+{
+	// Color channels of sRGB textures are filtered in linear space
+	static const std::array<float, 256> srgb_table = []() {
+		std::array<float, 256> table;
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			table[i] = srgb_to_linear(static_cast<float>(i) / 255.f);
+		}
+		return table;
+	}();
+	static const std::vector<uint8_t> linear_table = []() {
+		std::vector<uint8_t> table(MIP_LINEAR_TABLE_SIZE);
+		for (uint32_t i = 0; i < MIP_LINEAR_TABLE_SIZE; i++)
+		{
+			table[i] = static_cast<uint8_t>(linear_to_srgb(static_cast<float>(i) / static_cast<float>(MIP_LINEAR_TABLE_SIZE - 1)) * 255.f + 0.5f);
+		}
+		return table;
+	}();
+
+	std::vector<std::vector<uint8_t>> levels;
+	levels.emplace_back(data, data + static_cast<size_t>(width) * height * 4);
+
+	std::vector<float> texels(static_cast<size_t>(width) * height * 4);
+	for (size_t i = 0; i < texels.size(); i++)
+	{
+		texels[i] = srgb && i % 4 != 3 ? srgb_table[data[i]] : static_cast<float>(data[i]) / 255.f;
+	}
+
+	// Alpha tested textures keep the fraction of texels passing the test of level 0 in every level
+	float coverage = alpha_cutoff > 0.f ? alpha_coverage(texels, alpha_cutoff, 1.f) : 0.f;
+
+	while (width > 1 || height > 1)
+	{
+		uint32_t next_width  = std::max(width / 2, 1u);
+		uint32_t next_height = std::max(height / 2, 1u);
+
+		// Every level is filtered from the unquantized, unscaled level above
+		texels = downsample(texels, width, height, next_width, next_height);
+
+		float alpha_scale = 1.f;
+		if (alpha_cutoff > 0.f)
+		{
+			float min_scale = 0.f;
+			float max_scale = MIP_ALPHA_SCALE_MAX;
+			for (uint32_t i = 0; i < MIP_ALPHA_SCALE_ITERATIONS; i++)
+			{
+				alpha_scale = (min_scale + max_scale) * 0.5f;
+				if (alpha_coverage(texels, alpha_cutoff, alpha_scale) < coverage)
+				{
+					min_scale = alpha_scale;
+				}
+				else
+				{
+					max_scale = alpha_scale;
+				}
+			}
+			alpha_scale = max_scale;
+		}
+
+		std::vector<uint8_t> level(texels.size());
+		for (size_t i = 0; i < texels.size(); i++)
+		{
+			if (i % 4 == 3)
+			{
+				level[i] = static_cast<uint8_t>(std::min(texels[i] * alpha_scale, 1.f) * 255.f + 0.5f);
+			}
+			else
+			{
+				level[i] = srgb ? linear_table[static_cast<size_t>(texels[i] * static_cast<float>(MIP_LINEAR_TABLE_SIZE - 1) + 0.5f)] : static_cast<uint8_t>(texels[i] * 255.f + 0.5f);
+			}
+		}
+		levels.emplace_back(std::move(level));
+
+		width  = next_width;
+		height = next_height;
+	}
+
+	return levels;
+}
+
+CookedTexture cook_texture(const uint8_t *data, uint32_t width, uint32_t height, TextureUsage usage, float alpha_cutoff)
+{
+	std::vector<std::vector<uint8_t>> mips = generate_mip_chain(data, width, height, usage == TextureUsage::BaseColor || usage == TextureUsage::Emissive, usage == TextureUsage::BaseColor ? alpha_cutoff : 0.f);
+
+	CookedTexture texture;
+	texture.width      = width;
+	texture.height     = height;
+	texture.mip_levels = static_cast<uint32_t>(mips.size());
+	texture.first_mip  = 0;
+
+	// Source channels packed into the BC4/BC5 channels
+	std::array<uint32_t, 2> channels = {0, 1};
+
+	if (usage == TextureUsage::BaseColor || usage == TextureUsage::Emissive)
+	{
+		texture.format = VK_FORMAT_BC7_UNORM_BLOCK;
+	}
+	else if (usage == TextureUsage::Normal)
+	{
+		// Z is reconstructed in the shaders
+		texture.format  = VK_FORMAT_BC5_UNORM_BLOCK;
+		texture.swizzle = {VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_ZERO, VK_COMPONENT_SWIZZLE_ONE};
+	}
+	else
+	{
+		// glTF stores roughness in G and metallic in B, a channel that is uniformly 0 or 1 folds into the swizzle
+		auto uniform_channel = [&](uint32_t channel) -> VkComponentSwizzle {
+			const auto &level = mips.front();
+			for (size_t i = channel; i < level.size(); i += 4)
+			{
+				if (level[i] != level[channel])
+				{
+					return VK_COMPONENT_SWIZZLE_IDENTITY;
+				}
+			}
+			return level[channel] == 0 ? VK_COMPONENT_SWIZZLE_ZERO : (level[channel] == 255 ? VK_COMPONENT_SWIZZLE_ONE : VK_COMPONENT_SWIZZLE_IDENTITY);
+		};
+
+		VkComponentSwizzle roughness = uniform_channel(1);
+		VkComponentSwizzle metallic  = uniform_channel(2);
+		if (metallic != VK_COMPONENT_SWIZZLE_IDENTITY)
+		{
+			texture.format  = VK_FORMAT_BC4_UNORM_BLOCK;
+			texture.swizzle = {VK_COMPONENT_SWIZZLE_ZERO, VK_COMPONENT_SWIZZLE_R, metallic, VK_COMPONENT_SWIZZLE_ONE};
+			channels        = {1, 1};
+		}
+		else if (roughness != VK_COMPONENT_SWIZZLE_IDENTITY)
+		{
+			texture.format  = VK_FORMAT_BC4_UNORM_BLOCK;
+			texture.swizzle = {VK_COMPONENT_SWIZZLE_ZERO, roughness, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_ONE};
+			channels        = {2, 2};
+		}
+		else
+		{
+			texture.format  = VK_FORMAT_BC5_UNORM_BLOCK;
+			texture.swizzle = {VK_COMPONENT_SWIZZLE_ZERO, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_ONE};
+			channels        = {1, 2};
+		}
+	}
+
+	for (uint32_t mip = 0; mip < texture.mip_levels; mip++)
+	{
+		uint32_t mip_width  = std::max(width >> mip, 1u);
+		uint32_t mip_height = std::max(height >> mip, 1u);
+		switch (texture.format)
+		{
+			case VK_FORMAT_BC7_UNORM_BLOCK:
+				texture.levels.emplace_back(compress_level(mips[mip].data(), mip_width, mip_height, 16, [](const uint8_t *block, uint8_t *out) { encode_bc7_block(block, out); }));
+				break;
+			case VK_FORMAT_BC5_UNORM_BLOCK:
+				texture.levels.emplace_back(compress_level(mips[mip].data(), mip_width, mip_height, 16, [&channels](const uint8_t *block, uint8_t *out) {
+					std::array<uint8_t, 16> x, y;
+					for (uint32_t i = 0; i < 16; i++)
+					{
+						x[i] = block[i * 4 + channels[0]];
+						y[i] = block[i * 4 + channels[1]];
+					}
+					encode_bc4_block(x.data(), out);
+					encode_bc4_block(y.data(), out + 8);
+				}));
+				break;
+			default:
+				texture.levels.emplace_back(compress_level(mips[mip].data(), mip_width, mip_height, 8, [&channels](const uint8_t *block, uint8_t *out) {
+					std::array<uint8_t, 16> x;
+					for (uint32_t i = 0; i < 16; i++)
+					{
+						x[i] = block[i * 4 + channels[0]];
+					}
+					encode_bc4_block(x.data(), out);
+				}));
+				break;
+		}
+	}
+
+	return texture;
+}
+
+size_t texture_level_size(VkFormat format, uint32_t width, uint32_t height)
+{
+	if (format == VK_FORMAT_R8G8B8A8_UNORM)
+	{
+		return static_cast<size_t>(width) * height * 4;
+	}
+	return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * block_size(format);
+}
+
+bool decode_texture_level(const CookedTexture &texture, uint32_t level, std::vector<uint8_t> &texels)
+{
+	const uint32_t width  = std::max(texture.width >> (texture.first_mip + level), 1u);
+	const uint32_t height = std::max(texture.height >> (texture.first_mip + level), 1u);
+	const auto    &data   = texture.levels[level];
+
+	if (texture.format == VK_FORMAT_R8G8B8A8_UNORM)
+	{
+		texels = data;
+		return true;
+	}
+	if (texture.format != VK_FORMAT_BC7_UNORM_BLOCK || data.size() != texture_level_size(texture.format, width, height))
+	{
+		return false;
+	}
+
+	texels.resize(static_cast<size_t>(width) * height * 4);
+	for (uint32_t block_y = 0; block_y < (height + 3) / 4; block_y++)
+	{
+		for (uint32_t block_x = 0; block_x < (width + 3) / 4; block_x++)
+		{
+			const uint8_t *block  = data.data() + (static_cast<size_t>(block_y) * ((width + 3) / 4) + block_x) * 16;
+			uint32_t       offset = 0;
+
+			// The cooker only writes mode 6
+			if (read_bits(block, offset, 7) != 1u << 6)
+			{
+				return false;
+			}
+
+			std::array<std::array<uint32_t, 4>, 2> endpoints = {};
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				endpoints[0][c] = read_bits(block, offset, 7) << 1;
+				endpoints[1][c] = read_bits(block, offset, 7) << 1;
+			}
+			for (auto &endpoint : endpoints)
+			{
+				uint32_t p = read_bits(block, offset, 1);
+				for (auto &value : endpoint)
+				{
+					value |= p;
+				}
+			}
+
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				uint32_t weight = BC7_WEIGHTS[read_bits(block, offset, i == 0 ? 3 : 4)];
+				uint32_t x      = block_x * 4 + i % 4;
+				uint32_t y      = block_y * 4 + i / 4;
+				if (x < width && y < height)
+				{
+					for (uint32_t c = 0; c < 4; c++)
+					{
+						texels[(static_cast<size_t>(y) * width + x) * 4 + c] = static_cast<uint8_t>(((64 - weight) * endpoints[0][c] + weight * endpoints[1][c] + 32) >> 6);
+					}
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+uint64_t hash_cache_key(const void *data, size_t size)
+{
+	const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+	}
+	return hash;
+}
+
+bool write_ktx2(const std::string &filename, const CookedTexture &texture)
+{
+	if (texture.first_mip != 0 || texture.levels.size() != texture.mip_levels)
+	{
+		return false;
+	}
+
+	const uint32_t level_count = texture.mip_levels;
+	const uint32_t alignment   = block_size(texture.format);
+
+	// Data format descriptor with one basic block, BC5 describes its red and green halves as separate samples
+	std::vector<uint32_t> dfd;
+	{
+		uint32_t sample_count = texture.format == VK_FORMAT_BC5_UNORM_BLOCK ? 2 : 1;
+		uint32_t color_model  = texture.format == VK_FORMAT_BC7_UNORM_BLOCK ? 134 : (texture.format == VK_FORMAT_BC5_UNORM_BLOCK ? 132 : 131);
+		uint32_t block_length = 24 + 16 * sample_count;
+
+		dfd.push_back(4 + block_length);
+		dfd.push_back(0);                                         // Vendor id, descriptor type
+		dfd.push_back(2 | (block_length << 16));                  // Version 1.3, block size
+		dfd.push_back(color_model | (1 << 8) | (1 << 16));        // BT.709 primaries, linear transfer, straight alpha
+		dfd.push_back(3 | (3 << 8));                              // 4x4 texel blocks
+		dfd.push_back(alignment);                                 // Bytes per plane
+		dfd.push_back(0);
+		for (uint32_t sample = 0; sample < sample_count; sample++)
+		{
+			uint32_t bit_length = alignment / sample_count * 8;
+			dfd.push_back((sample * bit_length) | ((bit_length - 1) << 16) | (sample << 24));
+			dfd.push_back(0);
+			dfd.push_back(0);
+			dfd.push_back(~0u);
+		}
+	}
+
+	std::vector<uint8_t> kvd;
+
+	auto add_key_value = [&kvd](const std::string &key, const std::string &value) {
+		append_u32(kvd, static_cast<uint32_t>(key.size() + value.size() + 2));
+		kvd.insert(kvd.end(), key.begin(), key.end());
+		kvd.push_back(0);
+		kvd.insert(kvd.end(), value.begin(), value.end());
+		kvd.push_back(0);
+		kvd.resize((kvd.size() + 3) & ~static_cast<size_t>(3), 0);
+	};
+	add_key_value("KTXswizzle", swizzle_to_string(texture.swizzle));
+	add_key_value("KTXwriter", TEXTURE_CACHE_WRITER);
+
+	const size_t dfd_offset = KTX2_HEADER_SIZE + KTX2_LEVEL_INDEX_SIZE * level_count;
+	const size_t kvd_offset = dfd_offset + dfd.size() * sizeof(uint32_t);
+
+	// Levels are stored from the smallest up, each aligned to the block size
+	std::vector<uint64_t> level_offsets(level_count);
+	size_t                offset = kvd_offset + kvd.size();
+	for (uint32_t level = level_count; level-- > 0;)
+	{
+		offset               = (offset + alignment - 1) / alignment * alignment;
+		level_offsets[level] = offset;
+		offset += texture.levels[level].size();
+	}
+
+	std::vector<uint8_t> header;
+	header.insert(header.end(), KTX2_IDENTIFIER, KTX2_IDENTIFIER + sizeof(KTX2_IDENTIFIER));
+	append_u32(header, static_cast<uint32_t>(texture.format));
+	append_u32(header, 1);        // Type size
+	append_u32(header, texture.width);
+	append_u32(header, texture.height);
+	append_u32(header, 0);        // Depth
+	append_u32(header, 0);        // Layers
+	append_u32(header, 1);        // Faces
+	append_u32(header, level_count);
+	append_u32(header, 0);        // No supercompression
+	append_u32(header, static_cast<uint32_t>(dfd_offset));
+	append_u32(header, static_cast<uint32_t>(dfd.size() * sizeof(uint32_t)));
+	append_u32(header, static_cast<uint32_t>(kvd_offset));
+	append_u32(header, static_cast<uint32_t>(kvd.size()));
+	append_u64(header, 0);
+	append_u64(header, 0);
+	for (uint32_t level = 0; level < level_count; level++)
+	{
+		append_u64(header, level_offsets[level]);
+		append_u64(header, texture.levels[level].size());
+		append_u64(header, texture.levels[level].size());
+	}
+	header.insert(header.end(), reinterpret_cast<const uint8_t *>(dfd.data()), reinterpret_cast<const uint8_t *>(dfd.data() + dfd.size()));
+	header.insert(header.end(), kvd.begin(), kvd.end());
+
+	std::ofstream file(filename, std::ios::binary);
+	if (!file)
+	{
+		return false;
+	}
+	file.write(reinterpret_cast<const char *>(header.data()), header.size());
+	for (uint32_t level = level_count; level-- > 0;)
+	{
+		std::vector<char> padding(level_offsets[level] - static_cast<uint64_t>(file.tellp()), 0);
+		file.write(padding.data(), padding.size());
+		file.write(reinterpret_cast<const char *>(texture.levels[level].data()), texture.levels[level].size());
+	}
+	return static_cast<bool>(file);
+}
+
+bool read_ktx2_header(const std::string &filename, CookedTexture &texture)
+{
+	std::ifstream file(filename, std::ios::binary);
+	return file && read_header(file, texture);
+}
+
+bool read_ktx2(const std::string &filename, CookedTexture &texture, uint32_t first_mip)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file || !read_header(file, texture) || first_mip >= texture.mip_levels)
+	{
+		return false;
+	}
+
+	std::vector<uint8_t> level_index(static_cast<size_t>(KTX2_LEVEL_INDEX_SIZE) * texture.mip_levels);
+	file.seekg(KTX2_HEADER_SIZE);
+	if (!file.read(reinterpret_cast<char *>(level_index.data()), level_index.size()))
+	{
+		return false;
+	}
+
+	texture.levels.resize(texture.mip_levels - first_mip);
+	for (uint32_t level = first_mip; level < texture.mip_levels; level++)
+	{
+		uint64_t offset = load_u64(level_index.data() + level * KTX2_LEVEL_INDEX_SIZE);
+		uint64_t size   = load_u64(level_index.data() + level * KTX2_LEVEL_INDEX_SIZE + 8);
+		if (size != texture_level_size(texture.format, std::max(texture.width >> level, 1u), std::max(texture.height >> level, 1u)))
+		{
+			return false;
+		}
+
+		auto &data = texture.levels[level - first_mip];
+		data.resize(size);
+		file.seekg(offset);
+		if (!file.read(reinterpret_cast<char *>(data.data()), size))
+		{
+			return false;
+		}
+	}
+	texture.first_mip = first_mip;
+
+	return true;
+}
+
+inline std::vector<uint8_t> envmap_cache_header(const EnvmapCacheHeader &header)
+{
+	std::vector<uint8_t> data(ENVMAP_CACHE_IDENTIFIER, ENVMAP_CACHE_IDENTIFIER + sizeof(ENVMAP_CACHE_IDENTIFIER));
+	append_u32(data, ENVMAP_CACHE_VERSION);
+	append_u32(data, 0);
+	append_u64(data, header.hash);
+	append_u32(data, header.cubemap_size);
+	append_u32(data, header.cubemap_mip_levels);
+	append_u32(data, header.prefilter_size);
+	append_u32(data, header.prefilter_mip_levels);
+	append_u64(data, header.data_size);
+	return data;
+}
+
+bool write_envmap_cache(const std::string &filename, const EnvmapCacheHeader &header, const void *data)
+{
+	std::vector<uint8_t> header_data = envmap_cache_header(header);
+
+	std::ofstream file(filename, std::ios::binary);
+	if (!file)
+	{
+		return false;
+	}
+	file.write(reinterpret_cast<const char *>(header_data.data()), header_data.size());
+	file.write(static_cast<const char *>(data), header.data_size);
+	return static_cast<bool>(file);
+}
+
+bool read_envmap_cache(const std::string &filename, const EnvmapCacheHeader &header, void *data)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+	{
+		return false;
+	}
+
+	// Any mismatch, including the bake settings, means the cache is stale
+	std::vector<uint8_t> expected = envmap_cache_header(header);
+	std::vector<uint8_t> header_data(expected.size());
+	if (!file.read(reinterpret_cast<char *>(header_data.data()), header_data.size()) || header_data != expected)
+	{
+		return false;
+	}
+
+	return static_cast<bool>(file.read(static_cast<char *>(data), header.data_size));
+}
+
+// R8G8B8E8 to E5B9G9R9, both store mantissas over a shared exponent so in range texels convert exactly
+// Texels below the E5B9G9R9 range are flushed to zero, texels above it are clamped per channel
+inline uint32_t rgbe_to_e5b9g9r9(uint32_t rgbe)
+{
+	uint32_t exponent = rgbe >> 24;
+	if (exponent < RGBE_MIN_EXPONENT)
+	{
+		return 0;
+	}
+
+	uint32_t r = rgbe & 0xff;
+	uint32_t g = (rgbe >> 8) & 0xff;
+	uint32_t b = (rgbe >> 16) & 0xff;
+	if (exponent <= RGBE_MAX_EXPONENT)
+	{
+		return ((exponent - RGBE_MIN_EXPONENT) << 27) | (b << 19) | (g << 10) | (r << 1);
+	}
+
+	auto clamp_mantissa = [exponent](uint32_t mantissa) -> uint32_t {
+		uint32_t shift = exponent - RGBE_MAX_EXPONENT + 1;
+		return mantissa == 0 ? 0 : (shift >= 9 ? 511 : std::min(mantissa << shift, 511u));
+	};
+	return (31u << 27) | (clamp_mantissa(b) << 18) | (clamp_mantissa(g) << 9) | clamp_mantissa(r);
+}
+
+// Decodes one new style run length encoded scanline, channels are stored one after another
+inline bool decode_rgbe_scanline(const uint8_t *&data, const uint8_t *end, uint32_t width, uint8_t *texels)
+{
+	for (uint32_t channel = 0; channel < 4; channel++)
+	{
+		for (uint32_t x = 0; x < width;)
+		{
+			if (data >= end)
+			{
+				return false;
+			}
+			uint32_t count = *data++;
+			if (count > 128)
+			{
+				count -= 128;
+				if (x + count > width || data >= end)
+				{
+					return false;
+				}
+				for (uint32_t i = 0; i < count; i++)
+				{
+					texels[(x + i) * 4 + channel] = *data;
+				}
+				data++;
+			}
+			else
+			{
+				if (count == 0 || x + count > width || data + count > end)
+				{
+					return false;
+				}
+				for (uint32_t i = 0; i < count; i++)
+				{
+					texels[(x + i) * 4 + channel] = *data++;
+				}
+			}
+			x += count;
+		}
+	}
+	return true;
+}
+
+bool decode_rgbe(const uint8_t *data, size_t size, uint32_t &width, uint32_t &height, std::vector<uint32_t> &texels)
+{
+	const uint8_t *end = data + size;
+
+	auto read_line = [&]() {
+		const uint8_t *line_end = std::find(data, end, '\n');
+		std::string    line(data, line_end);
+		data = line_end == end ? end : line_end + 1;
+		return line;
+	};
+
+	// Header lines end with an empty line, followed by the resolution
+	if (read_line().rfind("#?", 0) != 0)
+	{
+		return false;
+	}
+	for (std::string line = read_line(); !line.empty(); line = read_line())
+	{
+		if (data == end || (line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe"))
+		{
+			return false;
+		}
+	}
+
+	int32_t rows = 0, columns = 0;
+	if (std::sscanf(read_line().c_str(), "-Y %d +X %d", &rows, &columns) != 2 || rows <= 0 || columns <= 0)
+	{
+		return false;
+	}
+	width  = static_cast<uint32_t>(columns);
+	height = static_cast<uint32_t>(rows);
+	texels.resize(static_cast<size_t>(width) * height);
+
+	for (uint32_t y = 0; y < height; y++)
+	{
+		uint8_t *row = reinterpret_cast<uint8_t *>(texels.data() + static_cast<size_t>(y) * width);
+		if (width >= 8 && width < 32768 && end - data >= 4 && data[0] == 2 && data[1] == 2 && (data[2] & 0x80) == 0)
+		{
+			if (((static_cast<uint32_t>(data[2]) << 8) | data[3]) != width)
+			{
+				return false;
+			}
+			data += 4;
+			if (!decode_rgbe_scanline(data, end, width, row))
+			{
+				return false;
+			}
+		}
+		else
+		{
+			// Flat scanline, old style run lengths are left to stb
+			if (static_cast<size_t>(end - data) < static_cast<size_t>(width) * 4 ||
+			    (data[0] == 1 && data[1] == 1 && data[2] == 1))
+			{
+				return false;
+			}
+			std::memcpy(row, data, static_cast<size_t>(width) * 4);
+			data += static_cast<size_t>(width) * 4;
+		}
+	}
+
+	size_t i = 0;
+#ifdef TEXTURE_CACHE_SSE2
+	const __m128i byte_mask     = _mm_set1_epi32(0xff);
+	const __m128i exponent_bias = _mm_set1_epi32(RGBE_MIN_EXPONENT);
+	const __m128i min_exponent  = _mm_set1_epi32(RGBE_MIN_EXPONENT - 1);
+	const __m128i max_exponent  = _mm_set1_epi32(RGBE_MAX_EXPONENT);
+	for (; i + 4 <= texels.size(); i += 4)
+	{
+		__m128i rgbe     = _mm_loadu_si128(reinterpret_cast<const __m128i *>(texels.data() + i));
+		__m128i exponent = _mm_srli_epi32(rgbe, 24);
+
+		// Texels above the range are rare and handled one by one
+		if (_mm_movemask_epi8(_mm_cmpgt_epi32(exponent, max_exponent)) != 0)
+		{
+			for (size_t j = i; j < i + 4; j++)
+			{
+				texels[j] = rgbe_to_e5b9g9r9(texels[j]);
+			}
+			continue;
+		}
+
+		__m128i r      = _mm_and_si128(rgbe, byte_mask);
+		__m128i g      = _mm_and_si128(_mm_srli_epi32(rgbe, 8), byte_mask);
+		__m128i b      = _mm_and_si128(_mm_srli_epi32(rgbe, 16), byte_mask);
+		__m128i packed = _mm_or_si128(
+		    _mm_or_si128(_mm_slli_epi32(_mm_sub_epi32(exponent, exponent_bias), 27), _mm_slli_epi32(b, 19)),
+		    _mm_or_si128(_mm_slli_epi32(g, 10), _mm_slli_epi32(r, 1)));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(texels.data() + i), _mm_and_si128(packed, _mm_cmpgt_epi32(exponent, min_exponent)));
+	}
+#endif
+	for (; i < texels.size(); i++)
+	{
+		texels[i] = rgbe_to_e5b9g9r9(texels[i]);
+	}
+
+	return true;
+}
@@ -0,0 +1,203 @@
+#include "work_stealing.hpp"
+
+#include <algorithm>
+
+inline uint64_t pack_range(uint32_t begin, uint32_t end)
+{
+	return (static_cast<uint64_t>(end) << 32) | begin;
+}
+
+inline uint32_t range_begin(uint64_t range)
+{
+	return static_cast<uint32_t>(range);
+}
+
+inline uint32_t range_end(uint64_t range)
+{
+	return static_cast<uint32_t>(range >> 32);
+}
+
+// The owner takes indices from the front of its share
+inline bool pop_front(WorkStealingShare &share, uint32_t &index)
+{
+	uint64_t range = share.range.load(std::memory_order_relaxed);
+	while (range_begin(range) < range_end(range))
+	{
+		if (share.range.compare_exchange_weak(range, pack_range(range_begin(range) + 1, range_end(range)), std::memory_order_acq_rel, std::memory_order_relaxed))
+		{
+			index = range_begin(range);
+			return true;
+		}
+	}
+	return false;
+}
+
+// Thieves take the back half of the largest share, returns false once every share ran dry
+inline bool steal(std::vector<WorkStealingShare> &shares, uint32_t worker_count, uint32_t thief, uint32_t &begin, uint32_t &end)
+{
+	while (true)
+	{
+		uint32_t victim       = ~0u;
+		uint64_t victim_range = 0;
+		uint32_t largest      = 0;
+		for (uint32_t i = 0; i < worker_count; i++)
+		{
+			uint64_t range = shares[i].range.load(std::memory_order_relaxed);
+			if (i != thief && range_end(range) - range_begin(range) > largest)
+			{
+				victim       = i;
+				victim_range = range;
+				largest      = range_end(range) - range_begin(range);
+			}
+		}
+
+		if (victim == ~0u)
+		{
+			return false;
+		}
+
+		// A single index moves to the thief as a whole
+		uint32_t middle = range_begin(victim_range) + largest / 2;
+		if (shares[victim].range.compare_exchange_strong(victim_range, pack_range(range_begin(victim_range), middle), std::memory_order_acq_rel, std::memory_order_relaxed))
+		{
+			begin = middle;
+			end   = range_end(victim_range);
+			return true;
+		}
+	}
+}
+
+// Set on threads running a dispatch, tasks that dispatch again run the nested range on their own thread
+inline thread_local bool is_work_stealing_worker = false;
+
+WorkStealingPool::~WorkStealingPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_start.notify_all();
+	for (auto &thread : m_threads)
+	{
+		thread.join();
+	}
+}
+
+void WorkStealingPool::run(uint32_t worker)
+{
+	uint32_t worker_count = m_workers + 1;
+	while (true)
+	{
+		uint32_t index = 0;
+		while (pop_front(m_shares[worker], index))
+		{
+			m_task(m_context, index, worker);
+		}
+
+		// The own share is empty, thieves reading it skip it until the stolen range is published
+		uint32_t begin = 0, end = 0;
+		if (!steal(m_shares, worker_count, worker, begin, end))
+		{
+			return;
+		}
+		m_shares[worker].range.store(pack_range(begin, end), std::memory_order_release);
+	}
+}
+
+void WorkStealingPool::work_thread(uint32_t worker)
+{
+	is_work_stealing_worker = true;
+
+	uint64_t generation = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_start.wait(lock, [&]() { return m_stop || m_generation != generation; });
+			if (m_stop)
+			{
+				return;
+			}
+			generation = m_generation;
+			if (worker > m_workers)
+			{
+				continue;
+			}
+		}
+
+		run(worker);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (--m_running == 0)
+		{
+			m_finish.notify_one();
+		}
+	}
+}
+
+void WorkStealingPool::parallel_for(uint32_t count, WorkStealingTask task, void *context)
+{
+	uint32_t worker_count = is_work_stealing_worker ? std::min(1u, count) : std::min(work_stealing_worker_count(), count);
+	if (worker_count <= 1)
+	{
+		for (uint32_t index = 0; index < count; index++)
+		{
+			task(context, index, 0);
+		}
+		return;
+	}
+
+	std::lock_guard<std::mutex> dispatch_lock(m_dispatch_mutex);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_shares.empty())
+		{
+			m_shares = std::vector<WorkStealingShare>(work_stealing_worker_count());
+			for (uint32_t i = 1; i < work_stealing_worker_count(); i++)
+			{
+				m_threads.emplace_back(&WorkStealingPool::work_thread, this, i);
+			}
+		}
+		for (uint32_t i = 0; i < worker_count; i++)
+		{
+			m_shares[i].range = pack_range(static_cast<uint32_t>(static_cast<uint64_t>(count) * i / worker_count), static_cast<uint32_t>(static_cast<uint64_t>(count) * (i + 1) / worker_count));
+		}
+		m_task    = task;
+		m_context = context;
+		m_workers = worker_count - 1;
+		m_running = worker_count - 1;
+		m_generation++;
+	}
+	m_start.notify_all();
+
+	is_work_stealing_worker = true;
+	run(0);
+	is_work_stealing_worker = false;
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_finish.wait(lock, [&]() { return m_running == 0; });
+	m_task    = nullptr;
+	m_context = nullptr;
+}
+
+inline WorkStealingPool &get_work_stealing_pool()
+{
+	static WorkStealingPool pool;
+	return pool;
+}
+
+WorkStealingPool &get_frame_work_stealing_pool()
+{
+	static WorkStealingPool pool;
+	return pool;
+}
+
+uint32_t work_stealing_worker_count()
+{
+	return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+void parallel_for_work_stealing(uint32_t count, const std::function<void(uint32_t, uint32_t)> &task)
+{
+	get_work_stealing_pool().parallel_for(count, task);
+}
@@ -0,0 +1,60 @@
+#include "alias_table.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#define ALIAS_TABLE_BENCHMARK_SIZE 10000000
+#define ALIAS_TABLE_BENCHMARK_RUNS 7
+
+// Median build time in ms, scratch is either reused across runs or allocated by every build
+inline float time_build(const std::vector<float> &weights, std::vector<AliasTable> &table, bool reuse_scratch)
+{
+	AliasTableScratch  scratch;
+	std::vector<float> times;
+	for (uint32_t run = 0; run < ALIAS_TABLE_BENCHMARK_RUNS; run++)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		if (reuse_scratch)
+		{
+			build_alias_table(weights.data(), static_cast<uint32_t>(weights.size()), table.data(), scratch);
+		}
+		else
+		{
+			build_alias_table(weights.data(), static_cast<uint32_t>(weights.size()), table.data());
+		}
+		times.push_back(std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+	}
+
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+int main()
+{
+	std::mt19937                          rng(0x9e3779b9u);
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+
+	// Uniform weights pair evenly, emitter powers spread over orders of magnitude and chain many small columns onto few large ones
+	std::vector<float> uniform_weights(ALIAS_TABLE_BENCHMARK_SIZE);
+	std::vector<float> skewed_weights(ALIAS_TABLE_BENCHMARK_SIZE);
+	for (uint32_t i = 0; i < ALIAS_TABLE_BENCHMARK_SIZE; i++)
+	{
+		uniform_weights[i] = uniform(rng);
+		skewed_weights[i]  = std::pow(10.f, uniform(rng) * 12.f - 6.f);
+	}
+
+	std::vector<AliasTable> table(ALIAS_TABLE_BENCHMARK_SIZE);
+	for (auto &[name, weights] : {std::pair{"uniform", &uniform_weights}, std::pair{"skewed", &skewed_weights}})
+	{
+		float fresh  = time_build(*weights, table, false);
+		float reused = time_build(*weights, table, true);
+		std::printf("%s weights, %u entries: %.1f ms, %.1f ms with reused scratch, %.1f M entries/s\n",
+		            name, ALIAS_TABLE_BENCHMARK_SIZE, fresh, reused, ALIAS_TABLE_BENCHMARK_SIZE / (reused * 1e3f));
+	}
+
+	return 0;
+}
@@ -0,0 +1,228 @@
+#include "alias_table.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#define ALIAS_TABLE_TEST_SAMPLES 4000000
+#define ALIAS_TABLE_TEST_SEED 0x9e3779b9u
+
+// Normal quantile of the chi-square threshold, a correct table fails one case in about a million
+#define CHI_SQUARE_Z 4.75
+#define CHI_SQUARE_MIN_COUNT 5.0
+
+struct AliasTableTestCase
+{
+	std::string        name;
+	std::vector<float> weights;
+};
+
+// Probability the table assigns to every event, its own column plus the remainders of columns aliasing it
+inline std::vector<double> table_distribution(const std::vector<AliasTable> &table)
+{
+	std::vector<double> distribution(table.size(), 0.0);
+	for (size_t i = 0; i < table.size(); i++)
+	{
+		distribution[i] += table[i].prob / static_cast<double>(table.size());
+		distribution[table[i].alias] += (1.0 - table[i].prob) / static_cast<double>(table.size());
+	}
+	return distribution;
+}
+
+// Wilson-Hilferty approximation of the chi-square quantile
+inline double chi_square_threshold(double dof)
+{
+	double h = 2.0 / (9.0 * dof);
+	return dof * std::pow(1.0 - h + CHI_SQUARE_Z * std::sqrt(h), 3.0);
+}
+
+// Samples like sample_emitter_alias_table() in scene.slangh, with float random numbers
+inline bool check_samples(const std::vector<AliasTable> &table, const std::vector<double> &expected, std::string &error)
+{
+	std::mt19937                          rng(ALIAS_TABLE_TEST_SEED);
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+
+	uint32_t              count = static_cast<uint32_t>(table.size());
+	std::vector<uint64_t> histogram(count, 0);
+	for (uint32_t sample = 0; sample < ALIAS_TABLE_TEST_SAMPLES; sample++)
+	{
+		float rnd_x = uniform(rng);
+		float rnd_y = uniform(rng);
+
+		uint32_t column = std::min(static_cast<uint32_t>(static_cast<float>(count) * rnd_x), count - 1);
+		uint32_t index  = table[column].prob > rnd_y ? column : static_cast<uint32_t>(table[column].alias);
+		float    pdf    = table[column].prob > rnd_y ? table[column].ori_prob : table[column].alias_ori_prob;
+
+		if (pdf != table[index].ori_prob)
+		{
+			error = "sampled pdf " + std::to_string(pdf) + " differs from ori_prob " + std::to_string(table[index].ori_prob) + " of event " + std::to_string(index);
+			return false;
+		}
+		histogram[index]++;
+	}
+
+	// Zero weight events must never be drawn, the others are compared with a chi-square test
+	// Events expected less than CHI_SQUARE_MIN_COUNT times are pooled into one bin to keep the test valid
+	double   chi_square      = 0.0;
+	uint32_t dof             = 0;
+	double   pooled_count    = 0.0;
+	double   pooled_expected = 0.0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		double expected_count = expected[i] * ALIAS_TABLE_TEST_SAMPLES;
+		if (expected[i] == 0.0)
+		{
+			if (histogram[i] > 0)
+			{
+				error = "zero weight event " + std::to_string(i) + " drawn " + std::to_string(histogram[i]) + " times";
+				return false;
+			}
+			continue;
+		}
+
+		if (expected_count < CHI_SQUARE_MIN_COUNT)
+		{
+			pooled_count += static_cast<double>(histogram[i]);
+			pooled_expected += expected_count;
+			continue;
+		}
+
+		chi_square += (histogram[i] - expected_count) * (histogram[i] - expected_count) / expected_count;
+		dof++;
+	}
+	if (pooled_expected > 0.0)
+	{
+		chi_square += (pooled_count - pooled_expected) * (pooled_count - pooled_expected) / pooled_expected;
+		dof++;
+	}
+
+	if (dof > 1 && chi_square > chi_square_threshold(dof - 1))
+	{
+		error = "chi-square " + std::to_string(chi_square) + " over " + std::to_string(dof - 1) + " dof exceeds " + std::to_string(chi_square_threshold(dof - 1));
+		return false;
+	}
+
+	std::printf("    chi-square %.1f over %u dof, threshold %.1f\n", chi_square, dof > 0 ? dof - 1 : 0, dof > 1 ? chi_square_threshold(dof - 1) : 0.0);
+	return true;
+}
+
+inline bool check_table(const std::vector<float> &weights, std::string &error)
+{
+	std::vector<AliasTable> table = build_alias_table(weights);
+
+	double total_weight = 0.0;
+	for (float weight : weights)
+	{
+		total_weight += std::max(weight, 0.f);
+	}
+
+	std::vector<double> expected(weights.size());
+	for (size_t i = 0; i < weights.size(); i++)
+	{
+		expected[i] = total_weight > 0.0 ? std::max(weights[i], 0.f) / total_weight : 1.0 / weights.size();
+	}
+
+	// Every column has to be initialized, the old builder left leftover small columns unset
+	for (size_t i = 0; i < table.size(); i++)
+	{
+		if (!(table[i].prob >= 0.f && table[i].prob <= 1.f) || table[i].alias < 0 || table[i].alias >= static_cast<int>(table.size()))
+		{
+			error = "column " + std::to_string(i) + " has prob " + std::to_string(table[i].prob) + " and alias " + std::to_string(table[i].alias);
+			return false;
+		}
+		if (std::abs(table[i].ori_prob - expected[i]) > 1e-6 * std::max(expected[i], 1e-3))
+		{
+			error = "ori_prob " + std::to_string(table[i].ori_prob) + " of event " + std::to_string(i) + " differs from " + std::to_string(expected[i]);
+			return false;
+		}
+	}
+
+	// The distribution the columns encode, checked exactly before sampling adds noise
+	std::vector<double> distribution = table_distribution(table);
+	for (size_t i = 0; i < table.size(); i++)
+	{
+		if (std::abs(distribution[i] - expected[i]) > 1e-6 * std::max(expected[i], 1.0 / table.size()))
+		{
+			error = "table gives event " + std::to_string(i) + " probability " + std::to_string(distribution[i]) + " instead of " + std::to_string(expected[i]);
+			return false;
+		}
+	}
+
+	return check_samples(table, expected, error);
+}
+
+inline std::vector<AliasTableTestCase> make_test_cases()
+{
+	std::mt19937                          rng(ALIAS_TABLE_TEST_SEED);
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+
+	std::vector<AliasTableTestCase> cases;
+
+	cases.push_back({"single event", {3.f}});
+	cases.push_back({"uniform", std::vector<float>(1000, 1.f)});
+	cases.push_back({"all zero", std::vector<float>(17, 0.f)});
+
+	AliasTableTestCase random_case = {"random", std::vector<float>(4096)};
+	for (float &weight : random_case.weights)
+	{
+		weight = uniform(rng);
+	}
+	cases.push_back(random_case);
+
+	AliasTableTestCase power_law = {"power law", std::vector<float>(10000)};
+	for (size_t i = 0; i < power_law.weights.size(); i++)
+	{
+		power_law.weights[i] = 1.f / static_cast<float>((i + 1) * (i + 1));
+	}
+	cases.push_back(power_law);
+
+	AliasTableTestCase sparse = {"half zero", std::vector<float>(1000)};
+	for (size_t i = 0; i < sparse.weights.size(); i++)
+	{
+		sparse.weights[i] = i % 2 ? 0.f : uniform(rng) + 0.1f;
+	}
+	cases.push_back(sparse);
+
+	AliasTableTestCase single = {"one non-zero", std::vector<float>(100, 0.f)};
+	single.weights[37] = 5.f;
+	cases.push_back(single);
+
+	AliasTableTestCase negative = {"negative clamped", std::vector<float>(64)};
+	for (size_t i = 0; i < negative.weights.size(); i++)
+	{
+		negative.weights[i] = i % 3 ? uniform(rng) : -uniform(rng);
+	}
+	cases.push_back(negative);
+
+	// Emitter powers span many orders of magnitude, small columns only ever take leftovers from large ones
+	AliasTableTestCase dynamic_range = {"dynamic range", std::vector<float>(2048)};
+	for (size_t i = 0; i < dynamic_range.weights.size(); i++)
+	{
+		dynamic_range.weights[i] = std::pow(10.f, uniform(rng) * 12.f - 6.f);
+	}
+	cases.push_back(dynamic_range);
+
+	return cases;
+}
+
+int main()
+{
+	uint32_t failed = 0;
+	for (const AliasTableTestCase &test_case : make_test_cases())
+	{
+		std::printf("%s, %zu events\n", test_case.name.c_str(), test_case.weights.size());
+
+		std::string error;
+		if (!check_table(test_case.weights, error))
+		{
+			std::printf("    FAILED: %s\n", error.c_str());
+			failed++;
+		}
+	}
+
+	std::printf("%u failed\n", failed);
+	return failed == 0 ? 0 : 1;
+}
@@ -1,7 +1,7 @@
 set_project("raytracer")
 set_version("0.0.1")
 
-set_xmakever("2.7.4")
+set_xmakever("2.8.5")
 
 set_warnings("all")
 set_languages("c++20")
@@ -12,6 +12,27 @@ set_runtimes("MD")
 add_defines("NOMINMAX")
 set_warnings("all")
 
+option("benchmark")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Count heap allocations per frame")
+    add_defines("BENCHMARK")
+option_end()
+
+option("bvh_benchmark")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Measure CPU BVH builds and BVH8 traversal after every scene load")
+    add_defines("BVH_BENCHMARK")
+option_end()
+
+option("avx2")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Trace CPU rays with AVX2, SSE2 otherwise")
+    add_vectorexts("avx", "avx2")
+option_end()
+
 add_requires("glfw", "vulkan-headers", "vulkan-memory-allocator", "spdlog", "stb", "glm", "cgltf", "nativefiledialog", "slang")
 add_requires("volk", {configs = {header_only = true}})
 add_requires("imgui", {configs = {glfw = true}})
@@ -53,6 +74,8 @@ target("raytracer")
         add_defines("DEBUG")
     end
 
+    add_options("benchmark", "bvh_benchmark", "avx2")
+
     add_defines("VK_NO_PROTOTYPES")
     add_defines("SHADER_DIR=R\"($(projectdir)/src/shaders/)\"")
     add_defines("PROJECT_DIR=R\"($(projectdir)/)\"")
@@ -73,3 +96,26 @@ target("raytracer")
 
     add_packages("glfw", "vulkan-headers", "vulkan-memory-allocator", "spdlog", "stb", "glm", "volk", "imgui", "glslang", "cgltf", "nativefiledialog", "slang")
 target_end()
+
+-- xmake test
+target("alias_table_test")
+    set_kind("binary")
+    set_default(false)
+    set_group("tests")
+    add_tests("default")
+
+    add_files("tests/alias_table_test.cpp", "src/raytracer/alias_table.cpp")
+    add_includedirs("include")
+target_end()
+
+-- xmake f --benchmark=y && xmake run alias_table_benchmark
+if has_config("benchmark") then
+    target("alias_table_benchmark")
+        set_kind("binary")
+        set_default(false)
+        set_group("benchmarks")
+
+        add_files("tests/alias_table_benchmark.cpp", "src/raytracer/alias_table.cpp")
+        add_includedirs("include")
+    target_end()
+end